@@ -26,50 +26,233 @@
 
 #include <string.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_AES_NI 1
+#include <immintrin.h>
+#define AES_NI_TARGET __attribute__ ((target ("aes,sse2")))
+#endif
+
 #include "gstaesctr.h"
 
+/* number of blocks that are kept in flight by the AES-NI kernel */
+#define AES_CTR_MAX_LANES 8
+
+/* size of the key stream generated at a time when transcrypting, small
+   enough to stay in the L1 cache */
+#define AES_CTR_TRANSCRYPT_CHUNK 1024
+
+#define AES_BLOCK 16
+
 struct _AesCtrState {
   volatile gint refcount;
   AES_KEY key; 
   unsigned char ivec[16];   
   unsigned int num; 
   unsigned char ecount[16]; 
+  /* expanded key in the byte order used by AES-NI */
+  unsigned char rk[11 * 16];
+  gboolean aesni;
 }; 
 
+struct _AesCbcState {
+  volatile gint refcount;
+  AES_KEY key;
+  /* the previous cipher text block, or the IV at the start of a chain */
+  unsigned char ivec[16];
+  /* decryption key schedule in the order used by AES-NI */
+  unsigned char rk[11 * 16];
+  gboolean aesni;
+};
+
+static gint aes_ctr_backend = GST_AES_CTR_BACKEND_AUTO;
+
+#ifdef HAVE_AES_NI
+static gboolean
+aes_ctr_have_aesni (void)
+{
+  static gsize init = 0;
+  static gboolean have_aesni = FALSE;
+
+  if (g_once_init_enter (&init)) {
+    __builtin_cpu_init ();
+    have_aesni = __builtin_cpu_supports ("aes")
+      && __builtin_cpu_supports ("sse2");
+    g_once_init_leave (&init, 1);
+  }
+  return have_aesni;
+}
+
+static AES_NI_TARGET inline __m128i
+aes_ni_expand_step (__m128i key, __m128i assist)
+{
+  assist = _mm_shuffle_epi32 (assist, _MM_SHUFFLE (3, 3, 3, 3));
+  key = _mm_xor_si128 (key, _mm_slli_si128 (key, 4));
+  key = _mm_xor_si128 (key, _mm_slli_si128 (key, 4));
+  key = _mm_xor_si128 (key, _mm_slli_si128 (key, 4));
+  return _mm_xor_si128 (key, assist);
+}
+
+#define AES_NI_EXPAND(rk, i, rcon)                                       \
+  rk[i] = aes_ni_expand_step (rk[i - 1],                                 \
+      _mm_aeskeygenassist_si128 (rk[i - 1], rcon))
+
+static AES_NI_TARGET void
+aes_ni_set_encrypt_key (const unsigned char *key, unsigned char *out)
+{
+  __m128i rk[11];
+  int i;
+
+  rk[0] = _mm_loadu_si128 ((const __m128i *) key);
+  AES_NI_EXPAND (rk, 1, 0x01);
+  AES_NI_EXPAND (rk, 2, 0x02);
+  AES_NI_EXPAND (rk, 3, 0x04);
+  AES_NI_EXPAND (rk, 4, 0x08);
+  AES_NI_EXPAND (rk, 5, 0x10);
+  AES_NI_EXPAND (rk, 6, 0x20);
+  AES_NI_EXPAND (rk, 7, 0x40);
+  AES_NI_EXPAND (rk, 8, 0x80);
+  AES_NI_EXPAND (rk, 9, 0x1b);
+  AES_NI_EXPAND (rk, 10, 0x36);
+  for (i = 0; i < 11; ++i) {
+    _mm_storeu_si128 ((__m128i *) (out + 16 * i), rk[i]);
+  }
+}
+
+/* encrypt n blocks, each with its own key schedule, interleaving the rounds
+   so that the AES units are kept busy */
+static AES_NI_TARGET inline void
+aes_ni_encrypt_blocks (const unsigned char **rk, __m128i *blocks, guint n)
+{
+  guint i, r;
+
+  for (i = 0; i < n; ++i) {
+    blocks[i] = _mm_xor_si128 (blocks[i],
+        _mm_loadu_si128 ((const __m128i *) rk[i]));
+  }
+  for (r = 1; r < 10; ++r) {
+    for (i = 0; i < n; ++i) {
+      blocks[i] = _mm_aesenc_si128 (blocks[i],
+          _mm_loadu_si128 ((const __m128i *) (rk[i] + 16 * r)));
+    }
+  }
+  for (i = 0; i < n; ++i) {
+    blocks[i] = _mm_aesenclast_si128 (blocks[i],
+        _mm_loadu_si128 ((const __m128i *) (rk[i] + 160)));
+  }
+}
+
+/* the equivalent inverse cipher uses the encryption round keys in reverse,
+   with InvMixColumns applied to all but the first and last */
+static AES_NI_TARGET void
+aes_ni_set_decrypt_key (const unsigned char *key, unsigned char *out)
+{
+  unsigned char ek[11 * 16];
+  int i;
+
+  aes_ni_set_encrypt_key (key, ek);
+  memcpy (out, ek + 160, 16);
+  for (i = 1; i < 10; ++i) {
+    _mm_storeu_si128 ((__m128i *) (out + 16 * i),
+        _mm_aesimc_si128 (_mm_loadu_si128 ((const __m128i *)
+                (ek + 16 * (10 - i)))));
+  }
+  memcpy (out + 160, ek, 16);
+}
+
+/* decrypt n blocks with the same key schedule */
+static AES_NI_TARGET inline void
+aes_ni_decrypt_blocks (const unsigned char *rk, __m128i *blocks, guint n)
+{
+  __m128i k;
+  guint i, r;
+
+  k = _mm_loadu_si128 ((const __m128i *) rk);
+  for (i = 0; i < n; ++i) {
+    blocks[i] = _mm_xor_si128 (blocks[i], k);
+  }
+  for (r = 1; r < 10; ++r) {
+    k = _mm_loadu_si128 ((const __m128i *) (rk + 16 * r));
+    for (i = 0; i < n; ++i) {
+      blocks[i] = _mm_aesdec_si128 (blocks[i], k);
+    }
+  }
+  k = _mm_loadu_si128 ((const __m128i *) (rk + 160));
+  for (i = 0; i < n; ++i) {
+    blocks[i] = _mm_aesdeclast_si128 (blocks[i], k);
+  }
+}
+#endif
+
+/* increment the 128 bit big-endian counter, as CRYPTO_ctr128_encrypt does */
+static inline void
+aes_ctr_increment (unsigned char *counter)
+{
+  int n = 16;
+
+  do {
+    --n;
+    if (++counter[n] != 0)
+      return;
+  } while (n);
+}
+
 AesCtrState *
 gst_aes_ctr_decrypt_new(GBytes *key, GBytes *iv)
 {
-  unsigned char *buf;
-  GstMapInfo map;
-  gsize iv_length;
   AesCtrState *state;
 
   g_return_val_if_fail(key!=NULL,NULL);
   g_return_val_if_fail(iv!=NULL,NULL);
+  g_return_val_if_fail (g_bytes_get_size (key) == 16, NULL);
 
   state = g_slice_new(AesCtrState);
   if(!state){
     GST_ERROR ("Failed to allocate AesCtrState");
     return NULL;
   }
-  g_return_val_if_fail (g_bytes_get_size (key) == 16, NULL);
+  state->refcount = 1;
+  state->aesni = FALSE;
+#ifdef HAVE_AES_NI
+  if (aes_ctr_have_aesni () &&
+      g_atomic_int_get (&aes_ctr_backend) != GST_AES_CTR_BACKEND_OPENSSL) {
+    aes_ni_set_encrypt_key (g_bytes_get_data (key, NULL), state->rk);
+    state->aesni = TRUE;
+  }
+  else
+#endif
   AES_set_encrypt_key ((const unsigned char*) g_bytes_get_data (key, NULL),
       8 * g_bytes_get_size (key), &state->key);
 
-  buf = (unsigned char*)g_bytes_get_data(iv, &iv_length);
-  g_return_val_if_fail(buf!=NULL, NULL);
-  g_return_val_if_fail(iv_length==8 || iv_length==16, NULL);
+  if(!gst_aes_ctr_decrypt_set_iv(state, g_bytes_get_data (iv, NULL),
+				 g_bytes_get_size (iv))){
+    g_slice_free (AesCtrState, state);
+    return NULL;
+  }
+  return state;
+} 
+
+/* Restart the counter with a new IV, keeping the expanded key. This allows
+   one AesCtrState to be re-used for consecutive samples that share a key. */
+gboolean
+gst_aes_ctr_decrypt_set_iv(AesCtrState *state,
+			   const unsigned char *iv,
+			   gsize iv_length)
+{
+  g_return_val_if_fail(state!=NULL, FALSE);
+  g_return_val_if_fail(iv!=NULL, FALSE);
+  g_return_val_if_fail(iv_length==8 || iv_length==16, FALSE);
+
   state->num = 0; 
   memset(state->ecount, 0, 16);      
   if(iv_length==8){
     memset(state->ivec + 8, 0, 8);  
-    memcpy(state->ivec, buf, 8); 
+    memcpy(state->ivec, iv, 8); 
   }
   else{
-    memcpy(state->ivec, buf, 16); 
+    memcpy(state->ivec, iv, 16); 
   }
-  return state;
-} 
+  return TRUE;
+}
 
 AesCtrState*
 gst_aes_ctr_decrypt_ref(AesCtrState *state)
@@ -91,12 +274,170 @@ gst_aes_ctr_decrypt_unref(AesCtrState *state)
   }
 }
 
+/* Expand a key into the AES-128 encryption schedule, in the byte order of
+   FIPS-197, which is also the order used by AES-NI. A caller that keeps
+   the schedule can re-key a state with gst_aes_ctr_decrypt_set_key()
+   without expanding the key again. */
+void
+gst_aes_ctr_expand_key(const unsigned char *key, unsigned char *schedule)
+{
+  AES_KEY aes_key;
+  int i;
+
+  g_return_if_fail(key!=NULL);
+  g_return_if_fail(schedule!=NULL);
+
+#ifdef HAVE_AES_NI
+  if (aes_ctr_have_aesni ()) {
+    aes_ni_set_encrypt_key (key, schedule);
+    return;
+  }
+#endif
+  AES_set_encrypt_key (key, 128, &aes_key);
+  for (i = 0; i < GST_AES_KEY_SCHEDULE_SIZE / 4; ++i) {
+    GST_WRITE_UINT32_BE (schedule + 4 * i, aes_key.rd_key[i]);
+  }
+}
+
+/* Replace the key of a state with one expanded by gst_aes_ctr_expand_key().
+   The counter is left alone, so the IV must be set afterwards. */
+void
+gst_aes_ctr_decrypt_set_key(AesCtrState *state, const unsigned char *schedule)
+{
+  int i;
+
+  g_return_if_fail(state!=NULL);
+  g_return_if_fail(schedule!=NULL);
+
+  if (state->aesni) {
+    memcpy (state->rk, schedule, sizeof (state->rk));
+    return;
+  }
+  state->key.rounds = 10;
+  for (i = 0; i < GST_AES_KEY_SCHEDULE_SIZE / 4; ++i) {
+    state->key.rd_key[i] = GST_READ_UINT32_BE (schedule + 4 * i);
+  }
+}
+
+AesCtrState *
+gst_aes_ctr_decrypt_new_from_schedule(const unsigned char *schedule,
+				      const unsigned char *iv,
+				      gsize iv_length)
+{
+  AesCtrState *state;
+
+  g_return_val_if_fail(schedule!=NULL,NULL);
+  g_return_val_if_fail(iv!=NULL,NULL);
+
+  state = g_slice_new(AesCtrState);
+  state->refcount = 1;
+  state->aesni = FALSE;
+#ifdef HAVE_AES_NI
+  state->aesni = aes_ctr_have_aesni () &&
+      g_atomic_int_get (&aes_ctr_backend) != GST_AES_CTR_BACKEND_OPENSSL;
+#endif
+  gst_aes_ctr_decrypt_set_key (state, schedule);
+  if(!gst_aes_ctr_decrypt_set_iv(state, iv, iv_length)){
+    g_slice_free (AesCtrState, state);
+    return NULL;
+  }
+  return state;
+}
+
+
+#ifdef HAVE_AES_NI
+/* CTR mode for up to AES_CTR_MAX_LANES jobs, each with its own state */
+static AES_NI_TARGET void
+aes_ni_ctr_ip_multi (AesCtrJob *jobs, guint n_jobs)
+{
+  unsigned char *data[AES_CTR_MAX_LANES];
+  gsize blocks[AES_CTR_MAX_LANES];
+  const unsigned char *rk[AES_CTR_MAX_LANES];
+  unsigned char *out[AES_CTR_MAX_LANES];
+  __m128i ks[AES_CTR_MAX_LANES];
+  guint i, j;
+
+  g_assert (n_jobs <= AES_CTR_MAX_LANES);
+
+  /* use up the key stream left over from the previous call, so that every
+     job continues on a block boundary */
+  for (i = 0; i < n_jobs; ++i) {
+    AesCtrState *state = jobs[i].state;
+    gsize length = jobs[i].length;
+
+    data[i] = jobs[i].data;
+    while (state->num && length) {
+      *data[i]++ ^= state->ecount[state->num];
+      state->num = (state->num + 1) & 15;
+      --length;
+    }
+    blocks[i] = length / 16;
+  }
+
+  for (;;) {
+    guint active = 0, per_job, n = 0;
+
+    for (i = 0; i < n_jobs; ++i) {
+      if (blocks[i])
+        ++active;
+    }
+    if (!active)
+      break;
+    /* a lone large job gets all of the lanes to itself */
+    per_job = MAX (1, AES_CTR_MAX_LANES / active);
+    for (i = 0; i < n_jobs && n < AES_CTR_MAX_LANES; ++i) {
+      AesCtrState *state = jobs[i].state;
+
+      for (j = 0; j < per_job && blocks[i] && n < AES_CTR_MAX_LANES; ++j) {
+        rk[n] = state->rk;
+        out[n] = data[i];
+        ks[n] = _mm_loadu_si128 ((const __m128i *) state->ivec);
+        aes_ctr_increment (state->ivec);
+        data[i] += 16;
+        --blocks[i];
+        ++n;
+      }
+    }
+    aes_ni_encrypt_blocks (rk, ks, n);
+    for (i = 0; i < n; ++i) {
+      __m128i *p = (__m128i *) out[i];
+      _mm_storeu_si128 (p, _mm_xor_si128 (_mm_loadu_si128 (p), ks[i]));
+    }
+  }
+
+  /* a partial final block leaves key stream for the next call */
+  for (i = 0; i < n_jobs; ++i) {
+    AesCtrState *state = jobs[i].state;
+    gsize tail = jobs[i].length - (data[i] - jobs[i].data);
+
+    if (!tail)
+      continue;
+    rk[0] = state->rk;
+    ks[0] = _mm_loadu_si128 ((const __m128i *) state->ivec);
+    aes_ni_encrypt_blocks (rk, ks, 1);
+    _mm_storeu_si128 ((__m128i *) state->ecount, ks[0]);
+    aes_ctr_increment (state->ivec);
+    for (j = 0; j < tail; ++j) {
+      data[i][j] ^= state->ecount[j];
+    }
+    state->num = tail;
+  }
+}
+#endif
 
 void
 gst_aes_ctr_decrypt_ip(AesCtrState *state, 
 		       unsigned char *data,
 		       int length)
 {
+#ifdef HAVE_AES_NI
+  if (state->aesni) {
+    AesCtrJob job = { state, data, length };
+
+    aes_ni_ctr_ip_multi (&job, 1);
+    return;
+  }
+#endif
 #if OPENSSL_VERSION_NUMBER > 0x010100000
   CRYPTO_ctr128_encrypt(data, data, length, &state->key, state->ivec,
                         state->ecount, &state->num, (block128_f)AES_encrypt);
@@ -106,6 +447,281 @@ gst_aes_ctr_decrypt_ip(AesCtrState *state,
 #endif
 }
 
+/* Decrypt several independent jobs in one pass. Generating the key stream
+   of up to AES_CTR_MAX_LANES blocks together hides the latency of the AES
+   rounds, which matters when each job is only a few blocks long. A state
+   must not appear more than once in the same call. */
+void
+gst_aes_ctr_decrypt_ip_multi(AesCtrJob *jobs, guint n_jobs)
+{
+  guint i;
+
+#ifdef HAVE_AES_NI
+  gboolean aesni = TRUE;
+
+  for (i = 0; i < n_jobs && aesni; ++i) {
+    aesni = jobs[i].state->aesni;
+  }
+  if (aesni) {
+    for (i = 0; i < n_jobs; i += AES_CTR_MAX_LANES) {
+      aes_ni_ctr_ip_multi (&jobs[i], MIN (n_jobs - i, AES_CTR_MAX_LANES));
+    }
+    return;
+  }
+#endif
+  for (i = 0; i < n_jobs; ++i) {
+    gst_aes_ctr_decrypt_ip (jobs[i].state, jobs[i].data, jobs[i].length);
+  }
+}
+
+/* Re-encrypt data that was encrypted with from so that it is encrypted with
+   to instead, without the clear data ever being written back to memory.
+   The key streams of both states are combined in a small buffer, and the
+   data is then read and written only once. */
+void
+gst_aes_ctr_transcrypt_ip(AesCtrState *from, AesCtrState *to,
+			  unsigned char *data, gsize length)
+{
+  guint64 ks[AES_CTR_TRANSCRYPT_CHUNK / sizeof (guint64)];
+
+  g_return_if_fail (from != NULL && to != NULL && from != to);
+
+  while (length) {
+    gsize n = MIN (length, sizeof (ks));
+    /* both jobs update the same buffer one block at a time, which leaves
+       the XOR of the two key streams in it */
+    AesCtrJob jobs[2] = {
+      { from, (unsigned char *) ks, n },
+      { to, (unsigned char *) ks, n }
+    };
+    gsize i;
+
+    memset (ks, 0, n);
+    gst_aes_ctr_decrypt_ip_multi (jobs, 2);
+    for (i = 0; i + sizeof (guint64) <= n; i += sizeof (guint64)) {
+      guint64 word;
+
+      memcpy (&word, data + i, sizeof (word));
+      word ^= ks[i / sizeof (guint64)];
+      memcpy (data + i, &word, sizeof (word));
+    }
+    for (; i < n; ++i) {
+      data[i] ^= ((unsigned char *) ks)[i];
+    }
+    data += n;
+    length -= n;
+  }
+}
+
+AesCbcState *
+gst_aes_cbc_decrypt_new(GBytes *key, GBytes *iv)
+{
+  AesCbcState *state;
+
+  g_return_val_if_fail(key!=NULL,NULL);
+  g_return_val_if_fail(iv!=NULL,NULL);
+  g_return_val_if_fail (g_bytes_get_size (key) == 16, NULL);
+
+  state = g_slice_new(AesCbcState);
+  state->refcount = 1;
+  state->aesni = FALSE;
+#ifdef HAVE_AES_NI
+  if (aes_ctr_have_aesni () &&
+      g_atomic_int_get (&aes_ctr_backend) != GST_AES_CTR_BACKEND_OPENSSL) {
+    aes_ni_set_decrypt_key (g_bytes_get_data (key, NULL), state->rk);
+    state->aesni = TRUE;
+  }
+  else
+#endif
+  AES_set_decrypt_key ((const unsigned char*) g_bytes_get_data (key, NULL),
+      8 * g_bytes_get_size (key), &state->key);
+
+  if(!gst_aes_cbc_decrypt_set_iv(state, g_bytes_get_data (iv, NULL),
+				 g_bytes_get_size (iv))){
+    g_slice_free (AesCbcState, state);
+    return NULL;
+  }
+  return state;
+}
+
+/* Start a new chain, keeping the expanded key */
+gboolean
+gst_aes_cbc_decrypt_set_iv(AesCbcState *state,
+			   const unsigned char *iv,
+			   gsize iv_length)
+{
+  g_return_val_if_fail(state!=NULL, FALSE);
+  g_return_val_if_fail(iv!=NULL, FALSE);
+  g_return_val_if_fail(iv_length==16, FALSE);
+
+  memcpy(state->ivec, iv, 16);
+  return TRUE;
+}
+
+AesCbcState*
+gst_aes_cbc_decrypt_ref(AesCbcState *state)
+{
+  g_return_val_if_fail (state != NULL, NULL);
+
+  g_atomic_int_inc (&state->refcount);
+
+  return state;
+}
+
+void
+gst_aes_cbc_decrypt_unref(AesCbcState *state)
+{
+  g_return_if_fail (state != NULL);
+
+  if (g_atomic_int_dec_and_test (&state->refcount)) {
+    g_slice_free (AesCbcState, state);
+  }
+}
+
+#ifdef HAVE_AES_NI
+/* Unlike encryption, CBC decryption of each block only depends on cipher
+   text, so the blocks of a chain are decrypted AES_CTR_MAX_LANES at a time.
+   The cipher text is loaded before any of the batch is overwritten, as it
+   is the chaining value of the following block. */
+static AES_NI_TARGET void
+aes_ni_cbc_ip_pattern (AesCbcState *state, unsigned char *data,
+    gsize blocks, guint crypt, guint skip)
+{
+  unsigned char *out[AES_CTR_MAX_LANES];
+  __m128i ct[AES_CTR_MAX_LANES];
+  __m128i pt[AES_CTR_MAX_LANES];
+  __m128i chain = _mm_loadu_si128 ((const __m128i *) state->ivec);
+  guint in_run = 0;
+
+  while (blocks) {
+    guint i, n = 0;
+
+    while (blocks && n < AES_CTR_MAX_LANES) {
+      if (in_run == crypt) {
+        gsize clear = MIN (skip, blocks);
+
+        data += AES_BLOCK * clear;
+        blocks -= clear;
+        in_run = 0;
+        continue;
+      }
+      out[n] = data;
+      ct[n] = pt[n] = _mm_loadu_si128 ((const __m128i *) data);
+      ++n;
+      ++in_run;
+      data += AES_BLOCK;
+      --blocks;
+    }
+    if (!n)
+      break;
+    aes_ni_decrypt_blocks (state->rk, pt, n);
+    for (i = 0; i < n; ++i) {
+      _mm_storeu_si128 ((__m128i *) out[i], _mm_xor_si128 (pt[i], chain));
+      chain = ct[i];
+    }
+  }
+  _mm_storeu_si128 ((__m128i *) state->ivec, chain);
+}
+#endif
+
+/* Decrypt a pattern of crypt encrypted blocks followed by skip clear blocks,
+   repeated over length bytes, as used by SAMPLE-AES and the cbcs scheme.
+   The clear blocks are not part of the CBC chain, and neither is a partial
+   block at the end. A skip of zero gives plain CBC. The last cipher text
+   block becomes the IV of the next call, so a chain can be continued
+   across several calls. */
+void
+gst_aes_cbc_decrypt_ip_pattern(AesCbcState *state,
+			       unsigned char *data,
+			       gsize length,
+			       guint crypt,
+			       guint skip)
+{
+  gsize blocks = length / AES_BLOCK;
+  guint in_run = 0;
+
+  g_return_if_fail (state != NULL);
+  g_return_if_fail (crypt > 0);
+
+  if (skip == 0)
+    crypt = G_MAXUINT;
+#ifdef HAVE_AES_NI
+  if (state->aesni) {
+    aes_ni_cbc_ip_pattern (state, data, blocks, crypt, skip);
+    return;
+  }
+#endif
+  while (blocks) {
+    unsigned char ct[AES_BLOCK];
+    int i;
+
+    if (in_run == crypt) {
+      gsize clear = MIN (skip, blocks);
+
+      data += AES_BLOCK * clear;
+      blocks -= clear;
+      in_run = 0;
+      continue;
+    }
+    memcpy (ct, data, AES_BLOCK);
+    AES_decrypt (ct, data, &state->key);
+    for (i = 0; i < AES_BLOCK; ++i) {
+      data[i] ^= state->ivec[i];
+    }
+    memcpy (state->ivec, ct, AES_BLOCK);
+    ++in_run;
+    data += AES_BLOCK;
+    --blocks;
+  }
+}
+
+/* Decrypt length bytes, which must be a whole number of blocks */
+void
+gst_aes_cbc_decrypt_ip(AesCbcState *state,
+		       unsigned char *data,
+		       gsize length)
+{
+  g_return_if_fail (length % AES_BLOCK == 0);
+
+  gst_aes_cbc_decrypt_ip_pattern (state, data, length, 1, 0);
+}
+
+/* Select the implementation used by AesCtrState and AesCbcState objects
+   created after this call, which is mainly of use for testing and benchmarking. Returns FALSE
+   if the backend is not supported on this CPU. */
+gboolean
+gst_aes_ctr_set_backend(GstAesCtrBackend backend)
+{
+  if (backend == GST_AES_CTR_BACKEND_AESNI) {
+#ifdef HAVE_AES_NI
+    if (!aes_ctr_have_aesni ())
+      return FALSE;
+#else
+    return FALSE;
+#endif
+  }
+  g_atomic_int_set (&aes_ctr_backend, backend);
+  return TRUE;
+}
+
+const gchar *
+gst_aes_ctr_backend_name(GstAesCtrBackend backend)
+{
+  switch (backend) {
+    case GST_AES_CTR_BACKEND_AUTO:
+      return "auto";
+    case GST_AES_CTR_BACKEND_OPENSSL:
+      return "openssl";
+    case GST_AES_CTR_BACKEND_AESNI:
+      return "aesni";
+  }
+  return "unknown";
+}
+
 G_DEFINE_BOXED_TYPE (AesCtrState, gst_aes_ctr,
 		     (GBoxedCopyFunc) gst_aes_ctr_decrypt_ref,
 		     (GBoxedFreeFunc) gst_aes_ctr_decrypt_unref);
+
+G_DEFINE_BOXED_TYPE (AesCbcState, gst_aes_cbc,
+		     (GBoxedCopyFunc) gst_aes_cbc_decrypt_ref,
+		     (GBoxedFreeFunc) gst_aes_cbc_decrypt_unref);
@@ -27,14 +27,63 @@
 G_BEGIN_DECLS
 
 typedef struct _AesCtrState AesCtrState;
+typedef struct _AesCbcState AesCbcState;
+
+/* size of an expanded AES-128 key, 11 round keys of 16 bytes */
+#define GST_AES_KEY_SCHEDULE_SIZE (11 * 16)
+
+/* implementation used for new AesCtrState objects */
+typedef enum {
+  GST_AES_CTR_BACKEND_AUTO,     /* fastest one available */
+  GST_AES_CTR_BACKEND_OPENSSL,
+  GST_AES_CTR_BACKEND_AESNI
+} GstAesCtrBackend;
+
+/* one contiguous range to decrypt with the given state */
+typedef struct _AesCtrJob {
+  AesCtrState *state;
+  unsigned char *data;
+  gsize length;
+} AesCtrJob;
 
 AesCtrState * gst_aes_ctr_decrypt_new(GBytes *key, GBytes *iv);
 AesCtrState * gst_aes_ctr_decrypt_ref(AesCtrState *state);
 void gst_aes_ctr_decrypt_unref(AesCtrState *state);
+AesCtrState * gst_aes_ctr_decrypt_new_from_schedule(const unsigned char *schedule,
+						    const unsigned char *iv,
+						    gsize iv_length);
+void gst_aes_ctr_decrypt_set_key(AesCtrState *state,
+				 const unsigned char *schedule);
+void gst_aes_ctr_expand_key(const unsigned char *key,
+			    unsigned char *schedule);
+gboolean gst_aes_ctr_decrypt_set_iv(AesCtrState *state,
+				    const unsigned char *iv,
+				    gsize iv_length);
 
 void gst_aes_ctr_decrypt_ip(AesCtrState *state, 
 			    unsigned char *data,
 			    int length);
+void gst_aes_ctr_decrypt_ip_multi(AesCtrJob *jobs, guint n_jobs);
+void gst_aes_ctr_transcrypt_ip(AesCtrState *from, AesCtrState *to,
+			       unsigned char *data, gsize length);
+
+AesCbcState * gst_aes_cbc_decrypt_new(GBytes *key, GBytes *iv);
+AesCbcState * gst_aes_cbc_decrypt_ref(AesCbcState *state);
+void gst_aes_cbc_decrypt_unref(AesCbcState *state);
+gboolean gst_aes_cbc_decrypt_set_iv(AesCbcState *state,
+				    const unsigned char *iv,
+				    gsize iv_length);
+void gst_aes_cbc_decrypt_ip(AesCbcState *state,
+			    unsigned char *data,
+			    gsize length);
+void gst_aes_cbc_decrypt_ip_pattern(AesCbcState *state,
+				    unsigned char *data,
+				    gsize length,
+				    guint crypt,
+				    guint skip);
+
+gboolean gst_aes_ctr_set_backend(GstAesCtrBackend backend);
+const gchar * gst_aes_ctr_backend_name(GstAesCtrBackend backend);
 
 G_END_DECLS
 #endif
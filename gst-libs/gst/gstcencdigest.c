@@ -0,0 +1,292 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define HAVE_SSE42_CRC32 1
+#include <nmmintrin.h>
+#define SSE42_TARGET __attribute__ ((target ("sse4.2")))
+#endif
+
+#include "gstcencdigest.h"
+
+struct _GstCencDigest {
+  GstCencDigestType type;
+  guint32 crc;
+  GChecksum *sha256;
+};
+
+GType
+gst_cenc_digest_type_get_type(void)
+{
+  static gsize type = 0;
+  static const GEnumValue values[] = {
+    { GST_CENC_DIGEST_NONE, "No digest", "none" },
+    { GST_CENC_DIGEST_CRC32C, "CRC32C (Castagnoli)", "crc32c" },
+    { GST_CENC_DIGEST_SHA256, "SHA-256", "sha256" },
+    { 0, NULL, NULL }
+  };
+
+  if(g_once_init_enter(&type)){
+    GType t = g_enum_register_static("GstCencDigestType", values);
+
+    g_once_init_leave(&type, t);
+  }
+  return type;
+}
+
+/* table for the reflected Castagnoli polynomial, used when the CPU does
+   not have the SSE 4.2 crc32 instruction */
+static guint32 crc32c_table[256];
+
+static void
+crc32c_init_table(void)
+{
+  static gsize init = 0;
+
+  if(g_once_init_enter(&init)){
+    guint32 i, j;
+
+    for(i=0; i<256; ++i){
+      guint32 crc = i;
+
+      for(j=0; j<8; ++j)
+	crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+      crc32c_table[i] = crc;
+    }
+    g_once_init_leave(&init, 1);
+  }
+}
+
+#ifdef HAVE_SSE42_CRC32
+static gboolean
+crc32c_have_sse42(void)
+{
+  static gsize init = 0;
+  static gboolean have_sse42 = FALSE;
+
+  if(g_once_init_enter(&init)){
+    __builtin_cpu_init();
+    have_sse42 = __builtin_cpu_supports("sse4.2");
+    g_once_init_leave(&init, 1);
+  }
+  return have_sse42;
+}
+
+static SSE42_TARGET guint32
+crc32c_sse42(guint32 crc, const guint8 *data, gsize length)
+{
+#ifdef __x86_64__
+  guint64 crc64 = crc;
+
+  for(; length>=8; data+=8, length-=8){
+    guint64 word;
+
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+  }
+  crc = (guint32) crc64;
+#endif
+  for(; length>=4; data+=4, length-=4){
+    guint32 word;
+
+    memcpy(&word, data, sizeof(word));
+    crc = _mm_crc32_u32(crc, word);
+  }
+  for(; length; ++data, --length)
+    crc = _mm_crc32_u8(crc, *data);
+  return crc;
+}
+#endif
+
+/* Continue a CRC32C over more data. Start with a crc of 0. */
+guint32
+gst_cenc_crc32c(guint32 crc, const guint8 *data, gsize length)
+{
+  crc = ~crc;
+#ifdef HAVE_SSE42_CRC32
+  if(crc32c_have_sse42())
+    return ~crc32c_sse42(crc, data, length);
+#endif
+  crc32c_init_table();
+  for(; length; ++data, --length)
+    crc = (crc >> 8) ^ crc32c_table[(crc ^ *data) & 0xff];
+  return ~crc;
+}
+
+GstCencDigest *
+gst_cenc_digest_new(GstCencDigestType type)
+{
+  GstCencDigest *digest;
+
+  g_return_val_if_fail(type!=GST_CENC_DIGEST_NONE, NULL);
+
+  digest = g_slice_new0(GstCencDigest);
+  digest->type = type;
+  if(type==GST_CENC_DIGEST_SHA256)
+    digest->sha256 = g_checksum_new(G_CHECKSUM_SHA256);
+  return digest;
+}
+
+void
+gst_cenc_digest_free(GstCencDigest *digest)
+{
+  g_return_if_fail(digest!=NULL);
+
+  if(digest->sha256)
+    g_checksum_free(digest->sha256);
+  g_slice_free(GstCencDigest, digest);
+}
+
+void
+gst_cenc_digest_update(GstCencDigest *digest, const guint8 *data,
+		       gsize length)
+{
+  if(!length)
+    return;
+  if(digest->type==GST_CENC_DIGEST_CRC32C){
+    digest->crc = gst_cenc_crc32c(digest->crc, data, length);
+  }
+  else{
+    /* g_checksum_update() takes a gssize */
+    while(length){
+      gsize n = MIN(length, G_MAXSSIZE);
+
+      g_checksum_update(digest->sha256, data, n);
+      data += n;
+      length -= n;
+    }
+  }
+}
+
+/* Write the digest to out, which must hold GST_CENC_DIGEST_MAX_LENGTH
+   bytes, and start a new one. Returns the length of the digest. */
+gsize
+gst_cenc_digest_finish(GstCencDigest *digest, guint8 *out)
+{
+  gsize length = GST_CENC_DIGEST_MAX_LENGTH;
+
+  if(digest->type==GST_CENC_DIGEST_CRC32C){
+    GST_WRITE_UINT32_BE(out, digest->crc);
+    digest->crc = 0;
+    return 4;
+  }
+  g_checksum_get_digest(digest->sha256, out, &length);
+  g_checksum_reset(digest->sha256);
+  return length;
+}
+
+GstCencDigestType
+gst_cenc_digest_get_digest_type(const GstCencDigest *digest)
+{
+  g_return_val_if_fail(digest!=NULL, GST_CENC_DIGEST_NONE);
+
+  return digest->type;
+}
+
+GType
+gst_cenc_digest_meta_api_get_type(void)
+{
+  static gsize type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if(g_once_init_enter(&type)){
+    GType t = gst_meta_api_type_register("GstCencDigestMetaAPI", tags);
+
+    g_once_init_leave(&type, t);
+  }
+  return type;
+}
+
+static gboolean
+gst_cenc_digest_meta_init(GstMeta *meta, gpointer params, GstBuffer *buffer)
+{
+  GstCencDigestMeta *digest_meta = (GstCencDigestMeta *) meta;
+
+  digest_meta->type = GST_CENC_DIGEST_NONE;
+  digest_meta->length = 0;
+  return TRUE;
+}
+
+/* the digest only stays valid while the data is copied as a whole */
+static gboolean
+gst_cenc_digest_meta_transform(GstBuffer *dest, GstMeta *meta,
+			       GstBuffer *buffer, GQuark type, gpointer data)
+{
+  GstCencDigestMeta *digest_meta = (GstCencDigestMeta *) meta;
+
+  if(GST_META_TRANSFORM_IS_COPY(type)){
+    GstMetaTransformCopy *copy = data;
+
+    if(!copy->region)
+      gst_buffer_add_cenc_digest_meta(dest, digest_meta->type,
+				      digest_meta->digest, digest_meta->length);
+  }
+  return TRUE;
+}
+
+const GstMetaInfo *
+gst_cenc_digest_meta_get_info(void)
+{
+  static const GstMetaInfo *meta_info = NULL;
+
+  if(g_once_init_enter(&meta_info)){
+    const GstMetaInfo *mi = gst_meta_register(GST_CENC_DIGEST_META_API_TYPE,
+					      "GstCencDigestMeta",
+					      sizeof(GstCencDigestMeta),
+					      gst_cenc_digest_meta_init,
+					      NULL,
+					      gst_cenc_digest_meta_transform);
+
+    g_once_init_leave(&meta_info, mi);
+  }
+  return meta_info;
+}
+
+GstCencDigestMeta *
+gst_buffer_add_cenc_digest_meta(GstBuffer *buffer, GstCencDigestType type,
+				const guint8 *digest, gsize length)
+{
+  GstCencDigestMeta *meta;
+
+  g_return_val_if_fail(GST_IS_BUFFER(buffer), NULL);
+  g_return_val_if_fail(length<=GST_CENC_DIGEST_MAX_LENGTH, NULL);
+
+  meta = (GstCencDigestMeta *) gst_buffer_add_meta(buffer,
+						   GST_CENC_DIGEST_META_INFO,
+						   NULL);
+  meta->type = type;
+  memcpy(meta->digest, digest, length);
+  meta->length = length;
+  return meta;
+}
+
+/* Returns the digest as a newly allocated hex string */
+gchar *
+gst_cenc_digest_meta_to_string(const GstCencDigestMeta *meta)
+{
+  GString *string = g_string_sized_new(2 * meta->length);
+  gsize i;
+
+  for(i=0; i<meta->length; ++i)
+    g_string_append_printf(string, "%02x", meta->digest[i]);
+  return g_string_free(string, FALSE);
+}
@@ -0,0 +1,78 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_DIGEST_H_
+#define _GST_CENC_DIGEST_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* algorithms for the digest of decrypted samples */
+typedef enum {
+  GST_CENC_DIGEST_NONE,
+  GST_CENC_DIGEST_CRC32C,
+  GST_CENC_DIGEST_SHA256
+} GstCencDigestType;
+
+#define GST_TYPE_CENC_DIGEST_TYPE (gst_cenc_digest_type_get_type())
+GType gst_cenc_digest_type_get_type(void);
+
+/* size of the largest digest, SHA-256 */
+#define GST_CENC_DIGEST_MAX_LENGTH 32
+
+/* running digest of a sample, which is fed the data in order as it is
+   decrypted */
+typedef struct _GstCencDigest GstCencDigest;
+
+GstCencDigest * gst_cenc_digest_new(GstCencDigestType type);
+void gst_cenc_digest_free(GstCencDigest *digest);
+void gst_cenc_digest_update(GstCencDigest *digest, const guint8 *data,
+			    gsize length);
+gsize gst_cenc_digest_finish(GstCencDigest *digest, guint8 *out);
+GstCencDigestType gst_cenc_digest_get_digest_type(const GstCencDigest *digest);
+
+guint32 gst_cenc_crc32c(guint32 crc, const guint8 *data, gsize length);
+
+/* digest of the contents of a buffer, added by cencdec when its digest
+   property is set. The CRC32C is stored big-endian. */
+typedef struct _GstCencDigestMeta {
+  GstMeta meta;
+
+  GstCencDigestType type;
+  guint8 digest[GST_CENC_DIGEST_MAX_LENGTH];
+  gsize length;
+} GstCencDigestMeta;
+
+#define GST_CENC_DIGEST_META_API_TYPE (gst_cenc_digest_meta_api_get_type())
+#define GST_CENC_DIGEST_META_INFO (gst_cenc_digest_meta_get_info())
+#define gst_buffer_get_cenc_digest_meta(b) \
+  ((GstCencDigestMeta *) gst_buffer_get_meta((b), GST_CENC_DIGEST_META_API_TYPE))
+
+GType gst_cenc_digest_meta_api_get_type(void);
+const GstMetaInfo * gst_cenc_digest_meta_get_info(void);
+GstCencDigestMeta * gst_buffer_add_cenc_digest_meta(GstBuffer *buffer,
+						    GstCencDigestType type,
+						    const guint8 *digest,
+						    gsize length);
+gchar * gst_cenc_digest_meta_to_string(const GstCencDigestMeta *meta);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,226 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#ifdef __SSE2__
+#define HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "gstaesctr.h"
+#include "gstcenckeyarena.h"
+
+#define KEY_ARENA_ALIGN 64
+#define KEY_ARENA_KID_SIZE 16
+/* each schedule starts on a cache line */
+#define KEY_ARENA_SCHEDULE_STRIDE \
+  ((GST_AES_KEY_SCHEDULE_SIZE + KEY_ARENA_ALIGN - 1) & ~(KEY_ARENA_ALIGN - 1))
+#define KEY_ARENA_MIN_SLOTS 16
+
+struct _GstCencKeyArena {
+  /* one allocation holding the KIDs then the schedules */
+  gpointer block;
+  guint8 *kids;
+  guint8 *schedules;
+  /* changed every time a slot is given a key, 0 when the slot is free */
+  guint32 *generations;
+  /* next slot of the free list of each free slot */
+  gint *next_free;
+  guint n_slots; /* slots that have been used */
+  guint capacity;
+  guint size; /* keys in the arena */
+  gint free_list;
+  guint32 generation;
+};
+
+static void
+key_arena_grow(GstCencKeyArena *arena)
+{
+  guint capacity = MAX(KEY_ARENA_MIN_SLOTS, 2 * arena->capacity);
+  gsize kids_size = capacity * KEY_ARENA_KID_SIZE;
+  gpointer block;
+  guint8 *kids;
+
+  /* the KID array is a whole number of cache lines, as capacity is a
+     multiple of four */
+  block = g_malloc(kids_size + capacity * KEY_ARENA_SCHEDULE_STRIDE +
+		   KEY_ARENA_ALIGN - 1);
+  kids = (guint8 *) (((guintptr) block + KEY_ARENA_ALIGN - 1) &
+		     ~(guintptr) (KEY_ARENA_ALIGN - 1));
+  if(arena->block){
+    memcpy(kids, arena->kids, arena->n_slots * KEY_ARENA_KID_SIZE);
+    memcpy(kids + kids_size, arena->schedules,
+	   arena->n_slots * KEY_ARENA_SCHEDULE_STRIDE);
+    g_free(arena->block);
+  }
+  arena->block = block;
+  arena->kids = kids;
+  arena->schedules = kids + kids_size;
+  arena->generations = g_renew(guint32, arena->generations, capacity);
+  arena->next_free = g_renew(gint, arena->next_free, capacity);
+  arena->capacity = capacity;
+}
+
+GstCencKeyArena *
+gst_cenc_key_arena_new(void)
+{
+  GstCencKeyArena *arena = g_new0(GstCencKeyArena, 1);
+
+  arena->free_list = GST_CENC_KEY_ARENA_NO_SLOT;
+  key_arena_grow(arena);
+  return arena;
+}
+
+void
+gst_cenc_key_arena_free(GstCencKeyArena *arena)
+{
+  if(!arena)
+    return;
+  /* do not leave expanded keys lying around in freed memory */
+  memset(arena->kids, 0, arena->capacity *
+	 (KEY_ARENA_KID_SIZE + KEY_ARENA_SCHEDULE_STRIDE));
+  g_free(arena->block);
+  g_free(arena->generations);
+  g_free(arena->next_free);
+  g_free(arena);
+}
+
+/* Add a key, or replace the key of a KID that is already in the arena.
+   Returns the slot of the key. */
+gint
+gst_cenc_key_arena_add(GstCencKeyArena *arena, const guint8 *kid,
+		       const guint8 *key)
+{
+  gint slot;
+
+  g_return_val_if_fail(arena!=NULL, GST_CENC_KEY_ARENA_NO_SLOT);
+  g_return_val_if_fail(kid!=NULL && key!=NULL, GST_CENC_KEY_ARENA_NO_SLOT);
+
+  slot = gst_cenc_key_arena_lookup(arena, kid);
+  if(slot==GST_CENC_KEY_ARENA_NO_SLOT){
+    if(arena->free_list!=GST_CENC_KEY_ARENA_NO_SLOT){
+      slot = arena->free_list;
+      arena->free_list = arena->next_free[slot];
+    }
+    else{
+      if(arena->n_slots==arena->capacity)
+	key_arena_grow(arena);
+      slot = arena->n_slots++;
+    }
+    memcpy(arena->kids + slot * KEY_ARENA_KID_SIZE, kid, KEY_ARENA_KID_SIZE);
+    arena->size++;
+  }
+  gst_aes_ctr_expand_key(key,
+			 arena->schedules + slot * KEY_ARENA_SCHEDULE_STRIDE);
+  if(++arena->generation==0)
+    ++arena->generation;
+  arena->generations[slot] = arena->generation;
+  return slot;
+}
+
+/* Remove a key, leaving its slot to be reused by the next key added */
+void
+gst_cenc_key_arena_remove(GstCencKeyArena *arena, gint slot)
+{
+  g_return_if_fail(arena!=NULL);
+  g_return_if_fail(slot>=0 && (guint) slot<arena->n_slots);
+  g_return_if_fail(arena->generations[slot]!=0);
+
+  memset(arena->kids + slot * KEY_ARENA_KID_SIZE, 0, KEY_ARENA_KID_SIZE);
+  memset(arena->schedules + slot * KEY_ARENA_SCHEDULE_STRIDE, 0,
+	 GST_AES_KEY_SCHEDULE_SIZE);
+  arena->generations[slot] = 0;
+  arena->next_free[slot] = arena->free_list;
+  arena->free_list = slot;
+  arena->size--;
+}
+
+/* Returns the slot of a KID, or GST_CENC_KEY_ARENA_NO_SLOT */
+gint
+gst_cenc_key_arena_lookup(const GstCencKeyArena *arena, const guint8 *kid)
+{
+  guint i;
+
+  g_return_val_if_fail(arena!=NULL, GST_CENC_KEY_ARENA_NO_SLOT);
+  g_return_val_if_fail(kid!=NULL, GST_CENC_KEY_ARENA_NO_SLOT);
+
+#ifdef HAVE_SSE2
+  {
+    const __m128i needle = _mm_loadu_si128((const __m128i *) kid);
+    const __m128i *kids = (const __m128i *) arena->kids;
+
+    for(i=0; i<arena->n_slots; ++i){
+      __m128i eq = _mm_cmpeq_epi8(_mm_load_si128(&kids[i]), needle);
+
+      /* free slots are zeroed, so only a match needs checking */
+      if(_mm_movemask_epi8(eq)==0xffff && arena->generations[i])
+	return i;
+    }
+  }
+#else
+  for(i=0; i<arena->n_slots; ++i){
+    if(memcmp(arena->kids + i * KEY_ARENA_KID_SIZE, kid,
+	      KEY_ARENA_KID_SIZE)==0 && arena->generations[i])
+      return i;
+  }
+#endif
+  return GST_CENC_KEY_ARENA_NO_SLOT;
+}
+
+const guint8 *
+gst_cenc_key_arena_get_kid(const GstCencKeyArena *arena, gint slot)
+{
+  g_return_val_if_fail(arena!=NULL, NULL);
+  g_return_val_if_fail(slot>=0 && (guint) slot<arena->n_slots, NULL);
+
+  return arena->kids + slot * KEY_ARENA_KID_SIZE;
+}
+
+/* the schedule of a slot, in the form used by gst_aes_ctr_decrypt_set_key() */
+const guint8 *
+gst_cenc_key_arena_get_schedule(const GstCencKeyArena *arena, gint slot)
+{
+  g_return_val_if_fail(arena!=NULL, NULL);
+  g_return_val_if_fail(slot>=0 && (guint) slot<arena->n_slots, NULL);
+
+  return arena->schedules + slot * KEY_ARENA_SCHEDULE_STRIDE;
+}
+
+/* A number that changes whenever the key in a slot changes, so that a
+   cipher can tell whether it needs to be re-keyed. It is never 0 for a
+   slot that holds a key. */
+guint32
+gst_cenc_key_arena_get_generation(const GstCencKeyArena *arena, gint slot)
+{
+  g_return_val_if_fail(arena!=NULL, 0);
+  g_return_val_if_fail(slot>=0 && (guint) slot<arena->n_slots, 0);
+
+  return arena->generations[slot];
+}
+
+/* number of keys in the arena */
+guint
+gst_cenc_key_arena_get_size(const GstCencKeyArena *arena)
+{
+  g_return_val_if_fail(arena!=NULL, 0);
+
+  return arena->size;
+}
@@ -0,0 +1,53 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_KEY_ARENA_H_
+#define _GST_CENC_KEY_ARENA_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GST_CENC_KEY_ARENA_NO_SLOT (-1)
+
+/* Keys by KID, with their expanded AES schedules. The KIDs are kept in one
+   array of 16 byte entries and the schedules in another, both aligned to
+   cache lines, so that a lookup scans the KIDs four to a cache line and
+   setting up a cipher copies one schedule. Slots of removed keys are
+   reused. Pointers into the arena are only valid until the next add. */
+typedef struct _GstCencKeyArena GstCencKeyArena;
+
+GstCencKeyArena * gst_cenc_key_arena_new(void);
+void gst_cenc_key_arena_free(GstCencKeyArena *arena);
+gint gst_cenc_key_arena_add(GstCencKeyArena *arena, const guint8 *kid,
+			    const guint8 *key);
+void gst_cenc_key_arena_remove(GstCencKeyArena *arena, gint slot);
+gint gst_cenc_key_arena_lookup(const GstCencKeyArena *arena,
+			       const guint8 *kid);
+const guint8 * gst_cenc_key_arena_get_kid(const GstCencKeyArena *arena,
+					  gint slot);
+const guint8 * gst_cenc_key_arena_get_schedule(const GstCencKeyArena *arena,
+					       gint slot);
+guint32 gst_cenc_key_arena_get_generation(const GstCencKeyArena *arena,
+					  gint slot);
+guint gst_cenc_key_arena_get_size(const GstCencKeyArena *arena);
+
+G_END_DECLS
+#endif
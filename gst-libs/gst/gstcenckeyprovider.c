@@ -0,0 +1,254 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include "gstcenckeyprovider.h"
+
+G_DEFINE_INTERFACE(GstCencKeyProvider, gst_cenc_key_provider, G_TYPE_OBJECT);
+
+static void
+gst_cenc_key_provider_default_init(GstCencKeyProviderInterface *iface)
+{
+}
+
+GBytes *
+gst_cenc_key_provider_get_key(GstCencKeyProvider *provider, const guint8 *kid)
+{
+  GstCencKeyProviderInterface *iface;
+
+  g_return_val_if_fail(GST_IS_CENC_KEY_PROVIDER(provider), NULL);
+  g_return_val_if_fail(kid!=NULL, NULL);
+
+  iface = GST_CENC_KEY_PROVIDER_GET_INTERFACE(provider);
+  if(!iface->get_key)
+    return NULL;
+  return iface->get_key(provider, kid);
+}
+
+GstContext *
+gst_cenc_key_provider_context_new(GstCencKeyProvider *provider)
+{
+  GstContext *context;
+
+  g_return_val_if_fail(GST_IS_CENC_KEY_PROVIDER(provider), NULL);
+
+  context = gst_context_new(GST_CENC_KEY_PROVIDER_CONTEXT_TYPE, TRUE);
+  gst_structure_set(gst_context_writable_structure(context),
+		    "provider", GST_TYPE_CENC_KEY_PROVIDER, provider, NULL);
+  return context;
+}
+
+/* Returns a new reference to the provider of a context, or NULL if the
+   context is not a key provider context */
+GstCencKeyProvider *
+gst_cenc_key_provider_from_context(GstContext *context)
+{
+  GstCencKeyProvider *provider = NULL;
+
+  g_return_val_if_fail(GST_IS_CONTEXT(context), NULL);
+
+  if(!gst_context_has_context_type(context, GST_CENC_KEY_PROVIDER_CONTEXT_TYPE))
+    return NULL;
+  gst_structure_get(gst_context_get_structure(context), "provider",
+		    GST_TYPE_CENC_KEY_PROVIDER, &provider, NULL);
+  return provider;
+}
+
+struct _GstCencMemoryKeyProvider {
+  GObject parent;
+  GMutex lock;
+  GHashTable *keys;		/* GBytes KID -> GBytes key */
+};
+
+static void gst_cenc_memory_key_provider_iface_init(GstCencKeyProviderInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GstCencMemoryKeyProvider, gst_cenc_memory_key_provider,
+			G_TYPE_OBJECT,
+			G_IMPLEMENT_INTERFACE(GST_TYPE_CENC_KEY_PROVIDER,
+					      gst_cenc_memory_key_provider_iface_init));
+
+static void
+gst_cenc_memory_key_provider_finalize(GObject *object)
+{
+  GstCencMemoryKeyProvider *self = GST_CENC_MEMORY_KEY_PROVIDER(object);
+
+  g_hash_table_unref(self->keys);
+  g_mutex_clear(&self->lock);
+  G_OBJECT_CLASS(gst_cenc_memory_key_provider_parent_class)->finalize(object);
+}
+
+static void
+gst_cenc_memory_key_provider_class_init(GstCencMemoryKeyProviderClass *klass)
+{
+  G_OBJECT_CLASS(klass)->finalize = gst_cenc_memory_key_provider_finalize;
+}
+
+static void
+gst_cenc_memory_key_provider_init(GstCencMemoryKeyProvider *self)
+{
+  g_mutex_init(&self->lock);
+  self->keys = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+				     (GDestroyNotify) g_bytes_unref,
+				     (GDestroyNotify) g_bytes_unref);
+}
+
+static GBytes *
+gst_cenc_memory_key_provider_get_key(GstCencKeyProvider *provider,
+				     const guint8 *kid)
+{
+  GstCencMemoryKeyProvider *self = GST_CENC_MEMORY_KEY_PROVIDER(provider);
+  GBytes *kid_bytes = g_bytes_new_static(kid, GST_CENC_KID_LENGTH);
+  GBytes *key;
+
+  g_mutex_lock(&self->lock);
+  key = g_hash_table_lookup(self->keys, kid_bytes);
+  if(key)
+    g_bytes_ref(key);
+  g_mutex_unlock(&self->lock);
+  g_bytes_unref(kid_bytes);
+  return key;
+}
+
+static void
+gst_cenc_memory_key_provider_iface_init(GstCencKeyProviderInterface *iface)
+{
+  iface->get_key = gst_cenc_memory_key_provider_get_key;
+}
+
+GstCencMemoryKeyProvider *
+gst_cenc_memory_key_provider_new(void)
+{
+  return g_object_new(GST_TYPE_CENC_MEMORY_KEY_PROVIDER, NULL);
+}
+
+/* Adds or replaces the key of a KID. Returns FALSE if either of them is
+   not 16 bytes long. */
+gboolean
+gst_cenc_memory_key_provider_add_key(GstCencMemoryKeyProvider *provider,
+				     GBytes *kid, GBytes *key)
+{
+  g_return_val_if_fail(GST_IS_CENC_MEMORY_KEY_PROVIDER(provider), FALSE);
+  g_return_val_if_fail(kid!=NULL && key!=NULL, FALSE);
+
+  if(g_bytes_get_size(kid)!=GST_CENC_KID_LENGTH
+     || g_bytes_get_size(key)!=GST_CENC_KEY_LENGTH)
+    return FALSE;
+  g_mutex_lock(&provider->lock);
+  g_hash_table_replace(provider->keys, g_bytes_ref(kid), g_bytes_ref(key));
+  g_mutex_unlock(&provider->lock);
+  return TRUE;
+}
+
+/* Parses 2 * length hex digits, ignoring any '-' separators as used in
+   UUIDs */
+static GBytes *
+gst_cenc_memory_key_provider_parse_hex(const gchar *string, gsize length)
+{
+  guint8 *bytes = g_malloc(length);
+  gsize n = 0;
+
+  while(*string && n<length){
+    gint high, low;
+
+    if(*string=='-'){
+      ++string;
+      continue;
+    }
+    high = g_ascii_xdigit_value(string[0]);
+    low = high<0 ? -1 : g_ascii_xdigit_value(string[1]);
+    if(low<0)
+      break;
+    bytes[n++] = (high << 4) | low;
+    string += 2;
+  }
+  if(n!=length || *string){
+    g_free(bytes);
+    return NULL;
+  }
+  return g_bytes_new_take(bytes, length);
+}
+
+static GBytes *
+gst_cenc_memory_key_provider_value_to_bytes(const GValue *value)
+{
+  if(G_VALUE_HOLDS_STRING(value)){
+    const gchar *string = g_value_get_string(value);
+
+    return string ? gst_cenc_memory_key_provider_parse_hex(string, GST_CENC_KEY_LENGTH) : NULL;
+  }
+  if(GST_VALUE_HOLDS_BUFFER(value)){
+    GstBuffer *buf = gst_value_get_buffer(value);
+    guint8 bytes[GST_CENC_KEY_LENGTH];
+
+    if(!buf || gst_buffer_get_size(buf)!=sizeof(bytes))
+      return NULL;
+    gst_buffer_extract(buf, 0, bytes, sizeof(bytes));
+    return g_bytes_new(bytes, sizeof(bytes));
+  }
+  if(G_VALUE_HOLDS(value, G_TYPE_BYTES)){
+    GBytes *bytes = g_value_get_boxed(value);
+
+    return bytes ? g_bytes_ref(bytes) : NULL;
+  }
+  return NULL;
+}
+
+typedef struct {
+  GstCencMemoryKeyProvider *provider;
+  guint added;
+} GstCencAddKeysData;
+
+static gboolean
+gst_cenc_memory_key_provider_add_field(GQuark field, const GValue *value,
+				       gpointer user_data)
+{
+  GstCencAddKeysData *data = user_data;
+  GBytes *kid, *key;
+
+  kid = gst_cenc_memory_key_provider_parse_hex(g_quark_to_string(field),
+					       GST_CENC_KID_LENGTH);
+  key = gst_cenc_memory_key_provider_value_to_bytes(value);
+  if(kid && key && gst_cenc_memory_key_provider_add_key(data->provider, kid, key))
+    ++data->added;
+  else
+    GST_WARNING("Ignoring invalid key for KID %s", g_quark_to_string(field));
+  if(kid)
+    g_bytes_unref(kid);
+  if(key)
+    g_bytes_unref(key);
+  return TRUE;
+}
+
+/* Adds a set of keys in one call. Each field of the structure is named
+   after a KID in hex and holds its key as a string of hex digits, a
+   GstBuffer or a GBytes. Returns the number of keys added. */
+guint
+gst_cenc_memory_key_provider_add_keys(GstCencMemoryKeyProvider *provider,
+				      const GstStructure *keys)
+{
+  GstCencAddKeysData data = { provider, 0 };
+
+  g_return_val_if_fail(GST_IS_CENC_MEMORY_KEY_PROVIDER(provider), 0);
+  g_return_val_if_fail(keys!=NULL, 0);
+
+  gst_structure_foreach(keys, gst_cenc_memory_key_provider_add_field, &data);
+  return data.added;
+}
@@ -0,0 +1,79 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_KEY_PROVIDER_H_
+#define _GST_CENC_KEY_PROVIDER_H_
+
+#include <gst/gst.h>
+#include <gst/gstcenckeystore.h>
+
+G_BEGIN_DECLS
+
+/* A key provider returns the key of a KID, for example from memory or
+   from a license server. Elements fall back to the key store when no
+   provider has the key. */
+#define GST_TYPE_CENC_KEY_PROVIDER (gst_cenc_key_provider_get_type())
+#define GST_CENC_KEY_PROVIDER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CENC_KEY_PROVIDER,GstCencKeyProvider))
+#define GST_IS_CENC_KEY_PROVIDER(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CENC_KEY_PROVIDER))
+#define GST_CENC_KEY_PROVIDER_GET_INTERFACE(obj) (G_TYPE_INSTANCE_GET_INTERFACE((obj),GST_TYPE_CENC_KEY_PROVIDER,GstCencKeyProviderInterface))
+
+typedef struct _GstCencKeyProvider GstCencKeyProvider;
+typedef struct _GstCencKeyProviderInterface GstCencKeyProviderInterface;
+
+struct _GstCencKeyProviderInterface {
+  GTypeInterface parent;
+
+  /* returns a new reference to the key, or NULL if it is not known.
+     Called from streaming threads. */
+  GBytes * (*get_key) (GstCencKeyProvider *provider, const guint8 *kid);
+};
+
+GType gst_cenc_key_provider_get_type(void);
+GBytes * gst_cenc_key_provider_get_key(GstCencKeyProvider *provider,
+				       const guint8 *kid);
+
+/* A GstContext of this type carries a key provider in its "provider"
+   field, to share it between all the elements of a pipeline */
+#define GST_CENC_KEY_PROVIDER_CONTEXT_TYPE "gst.cenc.key-provider"
+
+GstContext * gst_cenc_key_provider_context_new(GstCencKeyProvider *provider);
+GstCencKeyProvider * gst_cenc_key_provider_from_context(GstContext *context);
+
+/* A key provider that holds keys given to it by the application */
+#define GST_TYPE_CENC_MEMORY_KEY_PROVIDER (gst_cenc_memory_key_provider_get_type())
+#define GST_CENC_MEMORY_KEY_PROVIDER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CENC_MEMORY_KEY_PROVIDER,GstCencMemoryKeyProvider))
+#define GST_IS_CENC_MEMORY_KEY_PROVIDER(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CENC_MEMORY_KEY_PROVIDER))
+
+typedef struct _GstCencMemoryKeyProvider GstCencMemoryKeyProvider;
+typedef struct _GstCencMemoryKeyProviderClass GstCencMemoryKeyProviderClass;
+
+struct _GstCencMemoryKeyProviderClass {
+  GObjectClass parent_class;
+};
+
+GType gst_cenc_memory_key_provider_get_type(void);
+GstCencMemoryKeyProvider * gst_cenc_memory_key_provider_new(void);
+gboolean gst_cenc_memory_key_provider_add_key(GstCencMemoryKeyProvider *provider,
+					      GBytes *kid, GBytes *key);
+guint gst_cenc_memory_key_provider_add_keys(GstCencMemoryKeyProvider *provider,
+					    const GstStructure *keys);
+
+G_END_DECLS
+#endif
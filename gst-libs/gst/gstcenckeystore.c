@@ -0,0 +1,190 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include <openssl/sha.h>
+
+#include "gstcenckeyprovider.h"
+#include "gstcenckeystore.h"
+
+static gchar *
+gst_cenc_key_store_hex(const guint8 *data, gsize length)
+{
+  gchar *string = g_malloc0(2 * length + 1);
+  gsize i;
+
+  for(i=0; i<length; ++i){
+    g_snprintf(string + (2 * i), 3, "%02x", data[i]);
+  }
+  return string;
+}
+
+gchar *
+gst_cenc_key_store_get_path(const gchar *directory,
+			    const guint8 *kid,
+			    GstCencKeyNaming naming)
+{
+  gchar *name;
+  gchar *filename;
+  gchar *path;
+
+  g_return_val_if_fail(kid!=NULL, NULL);
+
+  name = gst_cenc_key_store_hex(kid, GST_CENC_KID_LENGTH);
+  if(naming==GST_CENC_KEY_NAMING_MARLIN){
+    guint8 hash[SHA_DIGEST_LENGTH];
+    gchar *content_id = g_strconcat("urn:marlin:kid:", name, NULL);
+
+    SHA1((const unsigned char *) content_id, strlen(content_id), hash);
+    g_free(content_id);
+    g_free(name);
+    name = gst_cenc_key_store_hex(hash, SHA_DIGEST_LENGTH);
+  }
+  filename = g_strconcat(name, ".key", NULL);
+  g_free(name);
+  path = g_build_filename(directory ? directory : "", filename, NULL);
+  g_free(filename);
+
+  return path;
+}
+
+GBytes *
+gst_cenc_key_store_load(const gchar *directory,
+			const guint8 *kid,
+			GstCencKeyNaming naming,
+			GError **error)
+{
+  gchar *path;
+  gchar *contents = NULL;
+  gsize length = 0;
+
+  path = gst_cenc_key_store_get_path(directory, kid, naming);
+  if(!path)
+    return NULL;
+  if(!g_file_get_contents(path, &contents, &length, error)){
+    g_free(path);
+    return NULL;
+  }
+  if(length < GST_CENC_KEY_LENGTH){
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		"Failed to read key from file %s", path);
+    g_free(contents);
+    g_free(path);
+    return NULL;
+  }
+  g_free(path);
+
+  return g_bytes_new_take(contents, GST_CENC_KEY_LENGTH);
+}
+
+void
+gst_cenc_key_store_kid_from_uri(const gchar *uri, guint8 *kid)
+{
+  guint8 hash[SHA_DIGEST_LENGTH];
+
+  g_return_if_fail(uri!=NULL);
+  g_return_if_fail(kid!=NULL);
+
+  SHA1((const unsigned char *) uri, strlen(uri), hash);
+  memcpy(kid, hash, GST_CENC_KID_LENGTH);
+}
+
+gboolean
+gst_cenc_key_store_parse_hex(const gchar *string, guint8 *bytes,
+			     gsize length)
+{
+  gsize i;
+
+  if(string && (g_str_has_prefix(string, "0x")
+		|| g_str_has_prefix(string, "0X")))
+    string += 2;
+  if(!string || strlen(string)!=2 * length)
+    return FALSE;
+  for(i=0; i<length; ++i){
+    gint hi = g_ascii_xdigit_value(string[2 * i]);
+    gint lo = g_ascii_xdigit_value(string[2 * i + 1]);
+
+    if(hi<0 || lo<0)
+      return FALSE;
+    bytes[i] = (hi << 4) | lo;
+  }
+  return TRUE;
+}
+
+GBytes *
+gst_cenc_key_store_load_uri(const gchar *directory,
+			    const gchar *uri,
+			    const gchar *key_hex,
+			    GstCencKeyProvider *provider,
+			    GError **error)
+{
+  guint8 kid[GST_CENC_KID_LENGTH];
+  guint8 key[GST_CENC_KEY_LENGTH];
+  GBytes *bytes = NULL;
+
+  if(key_hex){
+    if(!gst_cenc_key_store_parse_hex(key_hex, key, sizeof(key))){
+      g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		  "key is not 32 hex digits");
+      return NULL;
+    }
+    return g_bytes_new(key, sizeof(key));
+  }
+  if(!uri){
+    g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+		"neither key-uri nor key is set");
+    return NULL;
+  }
+  gst_cenc_key_store_kid_from_uri(uri, kid);
+  if(provider)
+    bytes = gst_cenc_key_provider_get_key(provider, kid);
+  if(!bytes)
+    bytes = gst_cenc_key_store_load(directory, kid,
+				    GST_CENC_KEY_NAMING_CLEARKEY, error);
+  return bytes;
+}
+
+/* Store a key under both of the names that it can be looked up by */
+gboolean
+gst_cenc_key_store_save(const gchar *directory,
+			const guint8 *kid,
+			GBytes *key,
+			GError **error)
+{
+  gboolean ret = TRUE;
+  gsize length;
+  gconstpointer data;
+  gint naming;
+
+  g_return_val_if_fail(key!=NULL, FALSE);
+
+  data = g_bytes_get_data(key, &length);
+  g_return_val_if_fail(length==GST_CENC_KEY_LENGTH, FALSE);
+
+  for(naming=GST_CENC_KEY_NAMING_CLEARKEY;
+      ret && naming<=GST_CENC_KEY_NAMING_MARLIN; ++naming){
+    gchar *path = gst_cenc_key_store_get_path(directory, kid, naming);
+
+    ret = g_file_set_contents(path, data, length, error);
+    g_free(path);
+  }
+  return ret;
+}
@@ -0,0 +1,68 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_KEY_STORE_H_
+#define _GST_CENC_KEY_STORE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define GST_CENC_KID_LENGTH 16
+#define GST_CENC_KEY_LENGTH 16
+
+/* The key store is a directory of files that each contain the 16 bytes
+   of one key, as written by store-key.py. */
+typedef enum {
+  GST_CENC_KEY_NAMING_CLEARKEY, /* <hex KID>.key */
+  GST_CENC_KEY_NAMING_MARLIN    /* <hex SHA-1 of urn:marlin:kid:<hex KID>>.key */
+} GstCencKeyNaming;
+
+gchar * gst_cenc_key_store_get_path(const gchar *directory,
+				    const guint8 *kid,
+				    GstCencKeyNaming naming);
+GBytes * gst_cenc_key_store_load(const gchar *directory,
+				 const guint8 *kid,
+				 GstCencKeyNaming naming,
+				 GError **error);
+/* HLS identifies a key by the URI of its EXT-X-KEY tag rather than by a
+   KID. Such keys are stored under the first 16 bytes of the SHA-1 hash of
+   the URI, which is also the KID that key providers are asked for. */
+void gst_cenc_key_store_kid_from_uri(const gchar *uri, guint8 *kid);
+/* Parse exactly 2 * length hex digits, after an optional 0x as in the
+   hexadecimal-sequences of an HLS playlist */
+gboolean gst_cenc_key_store_parse_hex(const gchar *string, guint8 *bytes,
+				      gsize length);
+/* Find the key of an HLS key URI. key_hex is the key itself, in hex, when
+   it is set. Otherwise the key provider, which may be NULL, is asked
+   first and then the key store in directory. */
+struct _GstCencKeyProvider;
+GBytes * gst_cenc_key_store_load_uri(const gchar *directory,
+				     const gchar *uri,
+				     const gchar *key_hex,
+				     struct _GstCencKeyProvider *provider,
+				     GError **error);
+gboolean gst_cenc_key_store_save(const gchar *directory,
+				 const guint8 *kid,
+				 GBytes *key,
+				 GError **error);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,581 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "gstcenclicense.h"
+
+/* a license holds a few keys, so a larger response is not a license */
+#define LICENSE_MAX_RESPONSE_SIZE (1024 * 1024)
+
+struct _GstCencLicenseClient {
+  GObject parent;
+  gchar *url;
+  GMutex lock;
+  GCond cond;			/* signalled when a request finishes */
+  GHashTable *keys;		/* GBytes KID -> GBytes key */
+  GHashTable *pending;		/* GBytes KIDs queued or being requested */
+  GPtrArray *queue;		/* GBytes KIDs not yet sent */
+  gboolean busy;		/* the worker is sending requests */
+  GThreadPool *pool;
+};
+
+static void gst_cenc_license_client_iface_init(GstCencKeyProviderInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GstCencLicenseClient, gst_cenc_license_client,
+			G_TYPE_OBJECT,
+			G_IMPLEMENT_INTERFACE(GST_TYPE_CENC_KEY_PROVIDER,
+					      gst_cenc_license_client_iface_init));
+
+/* one client per license server URL, shared by all elements and kept
+   until the process exits, so that every key is only requested once */
+static GMutex clients_lock;
+static GHashTable *clients;
+
+static void gst_cenc_license_client_run(gpointer data, gpointer user_data);
+
+static void
+gst_cenc_license_client_class_init(GstCencLicenseClientClass *klass)
+{
+}
+
+static void
+gst_cenc_license_client_init(GstCencLicenseClient *self)
+{
+  g_mutex_init(&self->lock);
+  g_cond_init(&self->cond);
+  self->keys = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+				     (GDestroyNotify) g_bytes_unref,
+				     (GDestroyNotify) g_bytes_unref);
+  self->pending = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+					(GDestroyNotify) g_bytes_unref, NULL);
+  self->queue = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+  self->pool = g_thread_pool_new(gst_cenc_license_client_run, self, 1, FALSE,
+				 NULL);
+}
+
+GstCencLicenseClient *
+gst_cenc_license_client_get(const gchar *url)
+{
+  GstCencLicenseClient *client;
+
+  g_return_val_if_fail(url!=NULL, NULL);
+
+  g_mutex_lock(&clients_lock);
+  if(!clients)
+    clients = g_hash_table_new_full(g_str_hash, g_str_equal, NULL,
+				    g_object_unref);
+  client = g_hash_table_lookup(clients, url);
+  if(!client){
+    client = g_object_new(GST_TYPE_CENC_LICENSE_CLIENT, NULL);
+    client->url = g_strdup(url);
+    g_hash_table_insert(clients, client->url, client);
+  }
+  g_object_ref(client);
+  g_mutex_unlock(&clients_lock);
+  return client;
+}
+
+const gchar *
+gst_cenc_license_client_get_url(GstCencLicenseClient *client)
+{
+  g_return_val_if_fail(GST_IS_CENC_LICENSE_CLIENT(client), NULL);
+  return client->url;
+}
+
+/* base64url without padding, as used by the ClearKey JSON formats */
+static gchar *
+gst_cenc_license_encode(GBytes *bytes)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data(bytes, &size);
+  gchar *string = g_base64_encode(data, size);
+  gchar *end;
+
+  g_strdelimit(string, "+", '-');
+  g_strdelimit(string, "/", '_');
+  end = strchr(string, '=');
+  if(end)
+    *end = '\0';
+  return string;
+}
+
+static GBytes *
+gst_cenc_license_decode(const gchar *string, gsize expected_size)
+{
+  GString *padded = g_string_new(string);
+  guchar *data;
+  gsize size;
+
+  g_strdelimit(padded->str, "-", '+');
+  g_strdelimit(padded->str, "_", '/');
+  while(padded->len % 4)
+    g_string_append_c(padded, '=');
+  data = g_base64_decode(padded->str, &size);
+  g_string_free(padded, TRUE);
+  if(size!=expected_size){
+    g_free(data);
+    return NULL;
+  }
+  return g_bytes_new_take(data, size);
+}
+
+/* A small reader for the JSON license response, which only needs to pick
+   the "kid" and "k" members out of the objects of the "keys" array */
+typedef struct {
+  const gchar *pos;
+  const gchar *end;
+} GstCencJson;
+
+static gboolean
+gst_cenc_json_next(GstCencJson *json, gchar c)
+{
+  while(json->pos<json->end && g_ascii_isspace(*json->pos))
+    ++json->pos;
+  if(json->pos<json->end && *json->pos==c){
+    ++json->pos;
+    return TRUE;
+  }
+  return FALSE;
+}
+
+static gchar *
+gst_cenc_json_string(GstCencJson *json)
+{
+  GString *string;
+
+  if(!gst_cenc_json_next(json, '"'))
+    return NULL;
+  string = g_string_new(NULL);
+  while(json->pos<json->end && *json->pos!='"'){
+    if(*json->pos=='\\' && json->pos+1<json->end){
+      ++json->pos;
+      switch(*json->pos){
+      case 'n': g_string_append_c(string, '\n'); break;
+      case 't': g_string_append_c(string, '\t'); break;
+      case 'r': g_string_append_c(string, '\r'); break;
+      case 'b': g_string_append_c(string, '\b'); break;
+      case 'f': g_string_append_c(string, '\f'); break;
+      case 'u':
+	/* not needed for base64 values */
+	json->pos = MIN(json->pos + 4, json->end - 1);
+	g_string_append_c(string, '?');
+	break;
+      default: g_string_append_c(string, *json->pos); break;
+      }
+    }
+    else{
+      g_string_append_c(string, *json->pos);
+    }
+    ++json->pos;
+  }
+  if(!gst_cenc_json_next(json, '"')){
+    g_string_free(string, TRUE);
+    return NULL;
+  }
+  return g_string_free(string, FALSE);
+}
+
+static gboolean
+gst_cenc_json_skip(GstCencJson *json)
+{
+  gchar *string;
+
+  if(gst_cenc_json_next(json, '{')){
+    if(gst_cenc_json_next(json, '}'))
+      return TRUE;
+    do{
+      string = gst_cenc_json_string(json);
+      g_free(string);
+      if(!string || !gst_cenc_json_next(json, ':') || !gst_cenc_json_skip(json))
+	return FALSE;
+    } while(gst_cenc_json_next(json, ','));
+    return gst_cenc_json_next(json, '}');
+  }
+  if(gst_cenc_json_next(json, '[')){
+    if(gst_cenc_json_next(json, ']'))
+      return TRUE;
+    do{
+      if(!gst_cenc_json_skip(json))
+	return FALSE;
+    } while(gst_cenc_json_next(json, ','));
+    return gst_cenc_json_next(json, ']');
+  }
+  if(json->pos<json->end && *json->pos=='"'){
+    string = gst_cenc_json_string(json);
+    g_free(string);
+    return string!=NULL;
+  }
+  /* number, true, false or null */
+  if(json->pos>=json->end || !(g_ascii_isalnum(*json->pos) || *json->pos=='-'))
+    return FALSE;
+  while(json->pos<json->end && (g_ascii_isalnum(*json->pos)
+				|| strchr("+-.", *json->pos)))
+    ++json->pos;
+  return TRUE;
+}
+
+/* one {"kty":"oct","kid":...,"k":...} object */
+static gboolean
+gst_cenc_json_key(GstCencJson *json, GHashTable *keys)
+{
+  gchar *kid = NULL, *k = NULL;
+  gboolean ret = TRUE;
+
+  if(!gst_cenc_json_next(json, '{'))
+    return FALSE;
+  if(!gst_cenc_json_next(json, '}')){
+    do{
+      gchar *name = gst_cenc_json_string(json);
+
+      ret = name && gst_cenc_json_next(json, ':');
+      if(ret && (g_str_equal(name, "kid") || g_str_equal(name, "k"))){
+	gchar **value = g_str_equal(name, "kid") ? &kid : &k;
+
+	g_free(*value);
+	*value = gst_cenc_json_string(json);
+	ret = *value!=NULL;
+      }
+      else if(ret){
+	ret = gst_cenc_json_skip(json);
+      }
+      g_free(name);
+    } while(ret && gst_cenc_json_next(json, ','));
+    ret = ret && gst_cenc_json_next(json, '}');
+  }
+  if(ret && kid && k){
+    GBytes *kid_bytes = gst_cenc_license_decode(kid, GST_CENC_KID_LENGTH);
+    GBytes *key_bytes = gst_cenc_license_decode(k, GST_CENC_KEY_LENGTH);
+
+    if(kid_bytes && key_bytes)
+      g_hash_table_replace(keys, g_bytes_ref(kid_bytes), g_bytes_ref(key_bytes));
+    if(kid_bytes)
+      g_bytes_unref(kid_bytes);
+    if(key_bytes)
+      g_bytes_unref(key_bytes);
+  }
+  g_free(kid);
+  g_free(k);
+  return ret;
+}
+
+static GHashTable *
+gst_cenc_license_parse(const gchar *data, gsize size, GError **error)
+{
+  GstCencJson json = { data, data + size };
+  GHashTable *keys;
+  gboolean ret = TRUE;
+
+  keys = g_hash_table_new_full(g_bytes_hash, g_bytes_equal,
+			       (GDestroyNotify) g_bytes_unref,
+			       (GDestroyNotify) g_bytes_unref);
+  if(!gst_cenc_json_next(&json, '{'))
+    ret = FALSE;
+  else if(!gst_cenc_json_next(&json, '}')){
+    do{
+      gchar *name = gst_cenc_json_string(&json);
+
+      ret = name && gst_cenc_json_next(&json, ':');
+      if(ret && g_str_equal(name, "keys")){
+	ret = gst_cenc_json_next(&json, '[');
+	if(ret && !gst_cenc_json_next(&json, ']')){
+	  do{
+	    ret = gst_cenc_json_key(&json, keys);
+	  } while(ret && gst_cenc_json_next(&json, ','));
+	  ret = ret && gst_cenc_json_next(&json, ']');
+	}
+      }
+      else if(ret){
+	ret = gst_cenc_json_skip(&json);
+      }
+      g_free(name);
+    } while(ret && gst_cenc_json_next(&json, ','));
+    ret = ret && gst_cenc_json_next(&json, '}');
+  }
+  if(!ret){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+		"Invalid license response");
+    g_hash_table_unref(keys);
+    return NULL;
+  }
+  return keys;
+}
+
+/* Sends an HTTP POST and returns the body of a 200 response. HTTP/1.0 is
+   used so that the response is never chunked. */
+static gchar *
+gst_cenc_license_post(const gchar *url, const gchar *body, gsize *size,
+		      GError **error)
+{
+  const gchar *host, *path;
+  GSocketClient *client;
+  GSocketConnection *connection;
+  GDataInputStream *input = NULL;
+  gchar *request, *host_port, *line;
+  gchar *response = NULL;
+  guint status = 0;
+  gssize content_length = -1;
+  gboolean https;
+
+  https = g_str_has_prefix(url, "https://");
+  if(!https && !g_str_has_prefix(url, "http://")){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+		"Unsupported license server URL %s", url);
+    return NULL;
+  }
+  host = strstr(url, "://") + 3;
+  path = strchr(host, '/');
+  host_port = path ? g_strndup(host, path - host) : g_strdup(host);
+  if(!path)
+    path = "/";
+
+  client = g_socket_client_new();
+  g_socket_client_set_timeout(client, 10);
+  g_socket_client_set_tls(client, https);
+  connection = g_socket_client_connect_to_uri(client, url, https ? 443 : 80,
+					      NULL, error);
+  g_object_unref(client);
+  if(!connection){
+    g_free(host_port);
+    return NULL;
+  }
+
+  request = g_strdup_printf("POST %s HTTP/1.0\r\n"
+			    "Host: %s\r\n"
+			    "Content-Type: application/json\r\n"
+			    "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+			    "\r\n%s", path, host_port, strlen(body), body);
+  g_free(host_port);
+  if(!g_output_stream_write_all(g_io_stream_get_output_stream(G_IO_STREAM(connection)),
+				request, strlen(request), NULL, NULL, error))
+    goto done;
+
+  input = g_data_input_stream_new(g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+  g_data_input_stream_set_newline_type(input, G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  line = g_data_input_stream_read_line(input, NULL, NULL, error);
+  if(!line)
+    goto done;
+  if(sscanf(line, "HTTP/%*u.%*u %u", &status)!=1)
+    status = 0;
+  g_free(line);
+  /* headers */
+  while((line = g_data_input_stream_read_line(input, NULL, NULL, error)) && *line){
+    if(g_ascii_strncasecmp(line, "Content-Length:", 15)==0)
+      content_length = g_ascii_strtoll(line + 15, NULL, 10);
+    g_free(line);
+  }
+  if(!line)
+    goto done;
+  g_free(line);
+  if(status!=200){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+		"License server returned status %u", status);
+    goto done;
+  }
+  if(content_length>LICENSE_MAX_RESPONSE_SIZE){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+		"License response of %" G_GSSIZE_FORMAT " bytes is too large",
+		content_length);
+    goto done;
+  }
+  if(content_length>=0){
+    gsize length = content_length, read;
+
+    response = g_malloc(length + 1);
+    if(!g_input_stream_read_all(G_INPUT_STREAM(input), response, length,
+				&read, NULL, error) || read!=length){
+      if(error && !*error)
+	g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+		    "License response truncated");
+      g_clear_pointer(&response, g_free);
+      goto done;
+    }
+    response[length] = '\0';
+    *size = length;
+  }
+  else{
+    GByteArray *array = g_byte_array_new();
+    guint8 chunk[4096];
+    gssize n;
+
+    while((n = g_input_stream_read(G_INPUT_STREAM(input), chunk, sizeof(chunk),
+				   NULL, error))>0){
+      if(array->len + n > LICENSE_MAX_RESPONSE_SIZE){
+	g_set_error(error, G_IO_ERROR, G_IO_ERROR_MESSAGE_TOO_LARGE,
+		    "License response is larger than %u bytes",
+		    LICENSE_MAX_RESPONSE_SIZE);
+	n = -1;
+	break;
+      }
+      g_byte_array_append(array, chunk, n);
+    }
+    if(n<0){
+      g_byte_array_unref(array);
+      goto done;
+    }
+    *size = array->len;
+    g_byte_array_append(array, (const guint8 *) "", 1);
+    response = (gchar *) g_byte_array_free(array, FALSE);
+  }
+
+done:
+  if(input)
+    g_object_unref(input);
+  g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+  g_object_unref(connection);
+  g_free(request);
+  return response;
+}
+
+/* Requests the keys of a batch of KIDs, retrying with exponential backoff.
+   Returns a table of the keys in the response, or NULL. */
+static GHashTable *
+gst_cenc_license_client_fetch(GstCencLicenseClient *self, GPtrArray *kids)
+{
+  GHashTable *keys = NULL;
+  GString *body;
+  guint i, attempt;
+
+  body = g_string_new("{\"kids\":[");
+  for(i=0; i<kids->len; ++i){
+    gchar *kid = gst_cenc_license_encode(g_ptr_array_index(kids, i));
+
+    g_string_append_printf(body, "%s\"%s\"", i ? "," : "", kid);
+    g_free(kid);
+  }
+  g_string_append(body, "],\"type\":\"temporary\"}");
+
+  for(attempt=0; !keys; ++attempt){
+    GError *err = NULL;
+    gchar *response;
+    gsize size;
+
+    GST_DEBUG("Requesting %u keys from %s", kids->len, self->url);
+    response = gst_cenc_license_post(self->url, body->str, &size, &err);
+    if(response)
+      keys = gst_cenc_license_parse(response, size, &err);
+    g_free(response);
+    if(keys)
+      break;
+    GST_WARNING("License request to %s failed: %s", self->url, err->message);
+    g_clear_error(&err);
+    if(attempt==GST_CENC_LICENSE_MAX_RETRIES)
+      break;
+    g_usleep(GST_CENC_LICENSE_RETRY_DELAY << attempt);
+  }
+  g_string_free(body, TRUE);
+  return keys;
+}
+
+/* worker thread, which sends everything that is queued */
+static void
+gst_cenc_license_client_run(gpointer data, gpointer user_data)
+{
+  GstCencLicenseClient *self = user_data;
+
+  g_mutex_lock(&self->lock);
+  while(self->queue->len){
+    GPtrArray *batch = self->queue;
+    GHashTable *keys;
+    guint i;
+
+    self->queue = g_ptr_array_new_with_free_func((GDestroyNotify) g_bytes_unref);
+    g_mutex_unlock(&self->lock);
+    keys = gst_cenc_license_client_fetch(self, batch);
+    g_mutex_lock(&self->lock);
+    if(keys){
+      GHashTableIter iter;
+      gpointer kid, key;
+
+      g_hash_table_iter_init(&iter, keys);
+      while(g_hash_table_iter_next(&iter, &kid, &key))
+	g_hash_table_replace(self->keys, g_bytes_ref(kid), g_bytes_ref(key));
+      g_hash_table_unref(keys);
+    }
+    /* KIDs that the server did not return fail, and can be requested
+       again later */
+    for(i=0; i<batch->len; ++i)
+      g_hash_table_remove(self->pending, g_ptr_array_index(batch, i));
+    g_ptr_array_unref(batch);
+    g_cond_broadcast(&self->cond);
+  }
+  self->busy = FALSE;
+  g_mutex_unlock(&self->lock);
+}
+
+/* called with the lock held */
+static void
+gst_cenc_license_client_queue(GstCencLicenseClient *self, GBytes *kid)
+{
+  if(g_bytes_get_size(kid)!=GST_CENC_KID_LENGTH
+     || g_hash_table_contains(self->keys, kid)
+     || g_hash_table_contains(self->pending, kid))
+    return;
+  g_hash_table_add(self->pending, g_bytes_ref(kid));
+  g_ptr_array_add(self->queue, g_bytes_ref(kid));
+  if(!self->busy){
+    self->busy = TRUE;
+    g_thread_pool_push(self->pool, GINT_TO_POINTER(1), NULL);
+  }
+}
+
+/* Requests the keys of a set of KIDs without waiting for them, for
+   example when they are found in a PSSH box or an MPD */
+void
+gst_cenc_license_client_request(GstCencLicenseClient *client, GBytes **kids,
+				guint n_kids)
+{
+  guint i;
+
+  g_return_if_fail(GST_IS_CENC_LICENSE_CLIENT(client));
+
+  g_mutex_lock(&client->lock);
+  for(i=0; i<n_kids; ++i)
+    gst_cenc_license_client_queue(client, kids[i]);
+  g_mutex_unlock(&client->lock);
+}
+
+static GBytes *
+gst_cenc_license_client_get_key(GstCencKeyProvider *provider, const guint8 *kid)
+{
+  GstCencLicenseClient *self = GST_CENC_LICENSE_CLIENT(provider);
+  GBytes *kid_bytes = g_bytes_new(kid, GST_CENC_KID_LENGTH);
+  gint64 deadline = g_get_monotonic_time() + GST_CENC_LICENSE_TIMEOUT;
+  GBytes *key;
+
+  g_mutex_lock(&self->lock);
+  gst_cenc_license_client_queue(self, kid_bytes);
+  while(!(key = g_hash_table_lookup(self->keys, kid_bytes))
+	&& g_hash_table_contains(self->pending, kid_bytes)
+	&& g_cond_wait_until(&self->cond, &self->lock, deadline));
+  if(key)
+    g_bytes_ref(key);
+  g_mutex_unlock(&self->lock);
+  g_bytes_unref(kid_bytes);
+  return key;
+}
+
+static void
+gst_cenc_license_client_iface_init(GstCencKeyProviderInterface *iface)
+{
+  iface->get_key = gst_cenc_license_client_get_key;
+}
@@ -0,0 +1,60 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_LICENSE_H_
+#define _GST_CENC_LICENSE_H_
+
+#include <gst/gst.h>
+#include <gst/gstcenckeyprovider.h>
+
+G_BEGIN_DECLS
+
+/* A key provider that fetches ClearKey keys from a license server, using
+   the JSON license request format of the W3C Encrypted Media Extensions.
+   Requests are made from a worker thread. All the KIDs that are waiting
+   when the worker sends a request go in that request, and a KID that is
+   already waiting is not requested again. Failed requests are retried
+   with exponential backoff. */
+#define GST_TYPE_CENC_LICENSE_CLIENT (gst_cenc_license_client_get_type())
+#define GST_CENC_LICENSE_CLIENT(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CENC_LICENSE_CLIENT,GstCencLicenseClient))
+#define GST_IS_CENC_LICENSE_CLIENT(obj) (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CENC_LICENSE_CLIENT))
+
+typedef struct _GstCencLicenseClient GstCencLicenseClient;
+typedef struct _GstCencLicenseClientClass GstCencLicenseClientClass;
+
+struct _GstCencLicenseClientClass {
+  GObjectClass parent_class;
+};
+
+/* number of times a failed request is retried */
+#define GST_CENC_LICENSE_MAX_RETRIES 4
+/* delay before the first retry, doubled for each further retry */
+#define GST_CENC_LICENSE_RETRY_DELAY (100 * G_TIME_SPAN_MILLISECOND)
+/* longest time that looking up a key waits for the license server */
+#define GST_CENC_LICENSE_TIMEOUT (10 * G_TIME_SPAN_SECOND)
+
+GType gst_cenc_license_client_get_type(void);
+GstCencLicenseClient * gst_cenc_license_client_get(const gchar *url);
+const gchar * gst_cenc_license_client_get_url(GstCencLicenseClient *client);
+void gst_cenc_license_client_request(GstCencLicenseClient *client,
+				     GBytes **kids, guint n_kids);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,853 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/*
+  Parser for the Common Encryption boxes of fragmented MP4 files. It finds
+  the encrypted samples of each moof box, so that they can be decrypted in
+  place without demuxing the file.
+
+  All offsets are relative to the start of the data that is passed to
+  gst_cenc_mp4_fragment_parse(). Base data offsets given in a tfhd box are
+  taken to be relative to the same position, which is only right when the
+  data is the whole file, so the fragment records that it had one.
+*/
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbytereader.h>
+
+#include "gstcencmp4.h"
+
+#define FOURCC GST_CENC_MP4_FOURCC
+
+/* tfhd flags */
+#define TFHD_BASE_DATA_OFFSET 0x000001
+#define TFHD_SAMPLE_DESCRIPTION_INDEX 0x000002
+#define TFHD_DEFAULT_SAMPLE_DURATION 0x000008
+#define TFHD_DEFAULT_SAMPLE_SIZE 0x000010
+#define TFHD_DEFAULT_SAMPLE_FLAGS 0x000020
+#define TFHD_DEFAULT_BASE_IS_MOOF 0x020000
+
+/* trun flags */
+#define TRUN_DATA_OFFSET 0x000001
+#define TRUN_FIRST_SAMPLE_FLAGS 0x000004
+#define TRUN_SAMPLE_DURATION 0x000100
+#define TRUN_SAMPLE_SIZE 0x000200
+#define TRUN_SAMPLE_FLAGS 0x000400
+#define TRUN_SAMPLE_CTO 0x000800
+
+/* senc flags */
+#define SENC_USE_SUBSAMPLES 0x000002
+
+/* uuid of the PIFF sample encryption box, which is laid out like senc */
+static const guint8 piff_senc_uuid[16] = {
+  0xa2, 0x39, 0x4f, 0x52, 0x5a, 0x9b, 0x4f, 0x14,
+  0xa2, 0x44, 0x6c, 0x42, 0x7c, 0x64, 0x8d, 0xf4
+};
+
+/* Read the header of the box at offset. Returns FALSE if there is no
+   complete box at offset. */
+gboolean
+gst_cenc_mp4_next_box(const guint8 *data, gsize size, gsize offset,
+		      guint32 *type, gsize *header_size, gsize *box_size)
+{
+  guint64 length;
+
+  if(offset > size || size - offset < 8)
+    return FALSE;
+  length = GST_READ_UINT32_BE(data + offset);
+  *type = GST_READ_UINT32_BE(data + offset + 4);
+  *header_size = 8;
+  if(length == 1){
+    if(size - offset < 16)
+      return FALSE;
+    length = GST_READ_UINT64_BE(data + offset + 8);
+    *header_size = 16;
+  }
+  else if(length == 0){
+    length = size - offset;
+  }
+  if(length < *header_size || length > size - offset)
+    return FALSE;
+  *box_size = length;
+  return TRUE;
+}
+
+/* Find the first child box of the given type. Sets child to its payload. */
+static gboolean
+gst_cenc_mp4_find_child(const guint8 *data, gsize size, guint32 type,
+			const guint8 **child, gsize *child_size)
+{
+  gsize offset = 0, header_size, box_size;
+  guint32 box_type;
+
+  while(gst_cenc_mp4_next_box(data, size, offset, &box_type, &header_size,
+			      &box_size)){
+    if(box_type == type){
+      *child = data + offset + header_size;
+      *child_size = box_size - header_size;
+      return TRUE;
+    }
+    offset += box_size;
+  }
+  return FALSE;
+}
+
+void
+gst_cenc_mp4_movie_init(GstCencMp4Movie *movie)
+{
+  movie->tracks = g_array_new(FALSE, TRUE, sizeof(GstCencMp4Track));
+  movie->has_protected_entries = FALSE;
+}
+
+void
+gst_cenc_mp4_movie_clear(GstCencMp4Movie *movie)
+{
+  if(movie->tracks){
+    g_array_free(movie->tracks, TRUE);
+    movie->tracks = NULL;
+  }
+}
+
+const GstCencMp4Track *
+gst_cenc_mp4_movie_get_track(const GstCencMp4Movie *movie, guint32 track_id)
+{
+  guint i;
+
+  for(i=0; i<movie->tracks->len; ++i){
+    const GstCencMp4Track *track = &g_array_index(movie->tracks,
+						  GstCencMp4Track, i);
+    if(track->track_id == track_id)
+      return track;
+  }
+  return NULL;
+}
+
+/* size of the fields of a sample entry that come before its child boxes */
+static gsize
+gst_cenc_mp4_sample_entry_size(guint32 type)
+{
+  switch(type){
+  case FOURCC('e','n','c','v'):
+    return 78;                  /* VisualSampleEntry */
+  case FOURCC('e','n','c','a'):
+    return 28;                  /* AudioSampleEntry */
+  default:
+    return 0;
+  }
+}
+
+static gboolean
+gst_cenc_mp4_parse_sinf(GstCencMp4Track *track, const guint8 *data,
+			gsize size)
+{
+  const guint8 *box, *tenc;
+  gsize box_size, tenc_size;
+
+  if(gst_cenc_mp4_find_child(data, size, FOURCC('f','r','m','a'), &box,
+			     &box_size) && box_size >= 4){
+    track->original_format = GST_READ_UINT32_BE(box);
+  }
+  track->scheme_type = FOURCC('c','e','n','c');
+  if(gst_cenc_mp4_find_child(data, size, FOURCC('s','c','h','m'), &box,
+			     &box_size) && box_size >= 8){
+    track->scheme_type = GST_READ_UINT32_BE(box + 4);
+  }
+  if(!gst_cenc_mp4_find_child(data, size, FOURCC('s','c','h','i'), &box,
+			      &box_size)
+     || !gst_cenc_mp4_find_child(box, box_size, FOURCC('t','e','n','c'),
+				 &tenc, &tenc_size)
+     || tenc_size < 24){
+    GST_WARNING("Missing tenc box");
+    return FALSE;
+  }
+  track->is_protected = tenc[6] != 0;
+  track->iv_size = tenc[7];
+  memcpy(track->kid, tenc + 8, GST_CENC_KID_LENGTH);
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_mp4_parse_stsd(GstCencMp4Movie *movie, GstCencMp4Track *track,
+			const guint8 *data, gsize size)
+{
+  gsize offset = 8, header_size, box_size;
+  guint32 type;
+
+  while(gst_cenc_mp4_next_box(data, size, offset, &type, &header_size,
+			      &box_size)){
+    gsize fields = gst_cenc_mp4_sample_entry_size(type);
+    const guint8 *sinf;
+    gsize sinf_size;
+
+    if(fields)
+      movie->has_protected_entries = TRUE;
+    if(fields && box_size - header_size >= fields
+       && gst_cenc_mp4_find_child(data + offset + header_size + fields,
+				  box_size - header_size - fields,
+				  FOURCC('s','i','n','f'), &sinf, &sinf_size)){
+      return gst_cenc_mp4_parse_sinf(track, sinf, sinf_size);
+    }
+    offset += box_size;
+  }
+  return FALSE;
+}
+
+static void
+gst_cenc_mp4_parse_trak(GstCencMp4Movie *movie, const guint8 *data,
+			gsize size)
+{
+  static const guint32 path[] = {
+    FOURCC('m','d','i','a'), FOURCC('m','i','n','f'),
+    FOURCC('s','t','b','l'), FOURCC('s','t','s','d')
+  };
+  GstCencMp4Track track;
+  const guint8 *box;
+  gsize box_size;
+  guint i;
+
+  memset(&track, 0, sizeof(track));
+  if(!gst_cenc_mp4_find_child(data, size, FOURCC('t','k','h','d'), &box,
+			      &box_size) || box_size < 24)
+    return;
+  track.track_id = GST_READ_UINT32_BE(box + (box[0] == 1 ? 20 : 12));
+
+  box = data;
+  box_size = size;
+  for(i=0; i<G_N_ELEMENTS(path); ++i){
+    if(!gst_cenc_mp4_find_child(box, box_size, path[i], &box, &box_size))
+      return;
+  }
+  if(gst_cenc_mp4_parse_stsd(movie, &track, box, box_size)){
+    g_array_append_val(movie->tracks, track);
+  }
+}
+
+/* Find the protected tracks of a moov box, given its payload */
+gboolean
+gst_cenc_mp4_movie_parse(GstCencMp4Movie *movie, const guint8 *moov,
+			 gsize size)
+{
+  gsize offset = 0, header_size, box_size;
+  const guint8 *mvex;
+  gsize mvex_size;
+  guint32 type;
+  guint i;
+
+  g_array_set_size(movie->tracks, 0);
+  movie->has_protected_entries = FALSE;
+  while(gst_cenc_mp4_next_box(moov, size, offset, &type, &header_size,
+			      &box_size)){
+    if(type == FOURCC('t','r','a','k')){
+      gst_cenc_mp4_parse_trak(movie, moov + offset + header_size,
+			      box_size - header_size);
+    }
+    offset += box_size;
+  }
+
+  if(gst_cenc_mp4_find_child(moov, size, FOURCC('m','v','e','x'), &mvex,
+			     &mvex_size)){
+    offset = 0;
+    while(gst_cenc_mp4_next_box(mvex, mvex_size, offset, &type,
+				&header_size, &box_size)){
+      const guint8 *trex = mvex + offset + header_size;
+
+      if(type == FOURCC('t','r','e','x') && box_size - header_size >= 24){
+	guint32 track_id = GST_READ_UINT32_BE(trex + 4);
+
+	for(i=0; i<movie->tracks->len; ++i){
+	  GstCencMp4Track *track = &g_array_index(movie->tracks,
+						  GstCencMp4Track, i);
+	  if(track->track_id == track_id)
+	    track->default_sample_size = GST_READ_UINT32_BE(trex + 16);
+	}
+      }
+      offset += box_size;
+    }
+  }
+
+  for(i=0; i<movie->tracks->len; ++i){
+    const GstCencMp4Track *track = &g_array_index(movie->tracks,
+						  GstCencMp4Track, i);
+    if(track->scheme_type != FOURCC('c','e','n','c')){
+      GST_WARNING("Track %u uses unsupported scheme %" GST_FOURCC_FORMAT,
+		  track->track_id,
+		  GST_FOURCC_ARGS(GUINT32_SWAP_LE_BE(track->scheme_type)));
+      return FALSE;
+    }
+  }
+  return movie->tracks->len > 0;
+}
+
+static void
+gst_cenc_mp4_rename_children(guint8 *data, gsize size,
+			     const guint32 *types, guint n_types)
+{
+  gsize offset = 0, header_size, box_size;
+  guint32 type;
+  guint i;
+
+  while(gst_cenc_mp4_next_box(data, size, offset, &type, &header_size,
+			      &box_size)){
+    gboolean is_piff = type == FOURCC('u','u','i','d')
+      && box_size - header_size >= 16
+      && memcmp(data + offset + header_size, piff_senc_uuid, 16) == 0;
+
+    for(i=0; i<n_types; ++i){
+      if(type == types[i] || (is_piff && types[i] == FOURCC('s','e','n','c')))
+	GST_WRITE_UINT32_BE(data + offset + 4, FOURCC('f','r','e','e'));
+    }
+    offset += box_size;
+  }
+}
+
+/* Turn the payload of a moov box into that of an unencrypted file, by
+   giving protected sample entries their original format and replacing
+   sinf and pssh boxes with free boxes */
+void
+gst_cenc_mp4_movie_clear_protection(guint8 *moov, gsize size)
+{
+  static const guint32 pssh[] = { FOURCC('p','s','s','h') };
+  static const guint32 path[] = {
+    FOURCC('m','d','i','a'), FOURCC('m','i','n','f'),
+    FOURCC('s','t','b','l'), FOURCC('s','t','s','d')
+  };
+  gsize offset = 0, header_size, box_size;
+  guint32 type;
+
+  gst_cenc_mp4_rename_children(moov, size, pssh, G_N_ELEMENTS(pssh));
+  while(gst_cenc_mp4_next_box(moov, size, offset, &type, &header_size,
+			      &box_size)){
+    const guint8 *box = moov + offset + header_size;
+    gsize entry_offset = 8, entry_header, entry_size;
+    gsize stsd_size = box_size - header_size;
+    guint8 *stsd;
+    guint i;
+
+    offset += box_size;
+    if(type != FOURCC('t','r','a','k'))
+      continue;
+    /* walk down from the trak to its stsd box */
+    for(i=0; i<G_N_ELEMENTS(path); ++i){
+      if(!gst_cenc_mp4_find_child(box, stsd_size, path[i], &box, &stsd_size))
+	break;
+    }
+    if(i < G_N_ELEMENTS(path))
+      continue;
+    stsd = moov + (box - moov);
+    while(gst_cenc_mp4_next_box(stsd, stsd_size, entry_offset, &type,
+				&entry_header, &entry_size)){
+      gsize fields = gst_cenc_mp4_sample_entry_size(type);
+      guint8 *children = stsd + entry_offset + entry_header + fields;
+      gsize children_size = entry_size - entry_header - fields;
+      const guint8 *sinf, *frma;
+      gsize sinf_size, frma_size;
+
+      if(fields && entry_size - entry_header >= fields
+	 && gst_cenc_mp4_find_child(children, children_size,
+				    FOURCC('s','i','n','f'), &sinf, &sinf_size)
+	 && gst_cenc_mp4_find_child(sinf, sinf_size, FOURCC('f','r','m','a'),
+				    &frma, &frma_size) && frma_size >= 4){
+	static const guint32 sinf_type[] = { FOURCC('s','i','n','f') };
+
+	GST_WRITE_UINT32_BE(stsd + entry_offset + 4, GST_READ_UINT32_BE(frma));
+	gst_cenc_mp4_rename_children(children, children_size, sinf_type, 1);
+      }
+      entry_offset += entry_size;
+    }
+  }
+}
+
+void
+gst_cenc_mp4_fragment_init(GstCencMp4Fragment *fragment)
+{
+  fragment->offset = 0;
+  fragment->size = 0;
+  fragment->has_base_data_offset = FALSE;
+  fragment->samples = g_array_new(FALSE, TRUE, sizeof(GstCencMp4Sample));
+  fragment->subsamples = g_array_new(FALSE, TRUE,
+				     sizeof(GstCencMp4Subsample));
+}
+
+void
+gst_cenc_mp4_fragment_clear(GstCencMp4Fragment *fragment)
+{
+  if(fragment->samples){
+    g_array_free(fragment->samples, TRUE);
+    fragment->samples = NULL;
+  }
+  if(fragment->subsamples){
+    g_array_free(fragment->subsamples, TRUE);
+    fragment->subsamples = NULL;
+  }
+}
+
+/* Read the IV and subsamples of one sample from a senc box or from the
+   auxiliary information that saiz and saio point to */
+static gboolean
+gst_cenc_mp4_read_aux_info(GstCencMp4Fragment *fragment,
+			   GstCencMp4Sample *sample, GstByteReader *reader,
+			   guint iv_size, gboolean use_subsamples)
+{
+  const guint8 *iv;
+  guint16 count, i;
+
+  if(!gst_byte_reader_get_data(reader, iv_size, &iv))
+    return FALSE;
+  memcpy(sample->iv, iv, iv_size);
+  sample->first_subsample = fragment->subsamples->len;
+  sample->subsample_count = 0;
+  if(!use_subsamples)
+    return TRUE;
+  if(!gst_byte_reader_get_uint16_be(reader, &count))
+    return FALSE;
+  for(i=0; i<count; ++i){
+    GstCencMp4Subsample subsample;
+
+    if(!gst_byte_reader_get_uint16_be(reader, &subsample.bytes_clear)
+       || !gst_byte_reader_get_uint32_be(reader, &subsample.bytes_encrypted))
+      return FALSE;
+    g_array_append_val(fragment->subsamples, subsample);
+  }
+  sample->subsample_count = count;
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_mp4_parse_senc(GstCencMp4Fragment *fragment, guint first,
+			const guint8 *data, gsize size, guint iv_size,
+			gboolean piff)
+{
+  GstByteReader reader;
+  guint32 flags, count, i;
+
+  gst_byte_reader_init(&reader, data, size);
+  if(piff && !gst_byte_reader_skip(&reader, 16))
+    return FALSE;
+  if(!gst_byte_reader_get_uint32_be(&reader, &flags))
+    return FALSE;
+  if(piff && (flags & 0x000001)){
+    /* AlgorithmID, IV_size and KID override the track defaults */
+    guint8 size8;
+
+    if(!gst_byte_reader_skip(&reader, 3)
+       || !gst_byte_reader_get_uint8(&reader, &size8)
+       || !gst_byte_reader_skip(&reader, GST_CENC_KID_LENGTH))
+      return FALSE;
+    iv_size = size8;
+  }
+  if(!gst_byte_reader_get_uint32_be(&reader, &count)
+     || count != fragment->samples->len - first)
+    return FALSE;
+  for(i=0; i<count; ++i){
+    GstCencMp4Sample *sample = &g_array_index(fragment->samples,
+					      GstCencMp4Sample, first + i);
+    if(!gst_cenc_mp4_read_aux_info(fragment, sample, &reader, iv_size,
+				   (flags & SENC_USE_SUBSAMPLES) != 0))
+      return FALSE;
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_mp4_parse_saiz_saio(GstCencMp4Fragment *fragment, guint first,
+			     const guint8 *data, gsize size,
+			     const guint8 *saiz, gsize saiz_size,
+			     const guint8 *saio, gsize saio_size,
+			     gsize base, guint iv_size)
+{
+  GstByteReader reader;
+  guint32 flags, count, i;
+  guint8 default_size, version;
+  const guint8 *sizes = NULL;
+  guint64 offset;
+
+  gst_byte_reader_init(&reader, saiz, saiz_size);
+  if(!gst_byte_reader_get_uint32_be(&reader, &flags)
+     || ((flags & 1) && !gst_byte_reader_skip(&reader, 8))
+     || !gst_byte_reader_get_uint8(&reader, &default_size)
+     || !gst_byte_reader_get_uint32_be(&reader, &count)
+     || count != fragment->samples->len - first
+     || (!default_size && !gst_byte_reader_get_data(&reader, count, &sizes)))
+    return FALSE;
+
+  gst_byte_reader_init(&reader, saio, saio_size);
+  if(!gst_byte_reader_get_uint8(&reader, &version)
+     || !gst_byte_reader_get_uint24_be(&reader, &flags)
+     || ((flags & 1) && !gst_byte_reader_skip(&reader, 8))
+     || !gst_byte_reader_get_uint32_be(&reader, &i)
+     || i != 1)
+    return FALSE;
+  if(version == 0){
+    guint32 offset32;
+
+    if(!gst_byte_reader_get_uint32_be(&reader, &offset32))
+      return FALSE;
+    offset = offset32;
+  }
+  else if(!gst_byte_reader_get_uint64_be(&reader, &offset)){
+    return FALSE;
+  }
+  if(base + offset > size)
+    return FALSE;
+
+  for(i=0; i<count; ++i){
+    GstCencMp4Sample *sample = &g_array_index(fragment->samples,
+					      GstCencMp4Sample, first + i);
+    guint info_size = default_size ? default_size : sizes[i];
+
+    if(base + offset + info_size > size)
+      return FALSE;
+    gst_byte_reader_init(&reader, data + base + offset, info_size);
+    if(!gst_cenc_mp4_read_aux_info(fragment, sample, &reader, iv_size,
+				   info_size > iv_size))
+      return FALSE;
+    offset += info_size;
+  }
+  return TRUE;
+}
+
+/* Add the samples of a traf box to the fragment. base is the base data
+   offset of the previous traf, which is updated to the end of the data of
+   this one. Only the first available bytes of data can be read. */
+static gboolean
+gst_cenc_mp4_parse_traf(GstCencMp4Fragment *fragment,
+			const GstCencMp4Movie *movie,
+			const guint8 *data, gsize available, gsize size,
+			gsize moof_offset, const guint8 *traf,
+			gsize traf_size, gsize *base)
+{
+  const GstCencMp4Track *track;
+  GstByteReader reader;
+  const guint8 *box, *saiz = NULL, *saio = NULL, *senc = NULL;
+  gsize box_size, saiz_size = 0, saio_size = 0, senc_size = 0;
+  gsize offset = 0, header_size, pos, traf_base;
+  guint32 flags, track_id, default_size, type;
+  gboolean piff = FALSE;
+  guint first = fragment->samples->len;
+
+  if(!gst_cenc_mp4_find_child(traf, traf_size, FOURCC('t','f','h','d'), &box,
+			      &box_size))
+    return FALSE;
+  gst_byte_reader_init(&reader, box, box_size);
+  if(!gst_byte_reader_get_uint32_be(&reader, &flags)
+     || !gst_byte_reader_get_uint32_be(&reader, &track_id))
+    return FALSE;
+  flags &= 0xffffff;
+  track = gst_cenc_mp4_movie_get_track(movie, track_id);
+  default_size = track ? track->default_sample_size : 0;
+  if(flags & TFHD_BASE_DATA_OFFSET){
+    guint64 base_data_offset;
+
+    fragment->has_base_data_offset = TRUE;
+    if(!gst_byte_reader_get_uint64_be(&reader, &base_data_offset)
+       || base_data_offset > size)
+      return FALSE;
+    *base = base_data_offset;
+  }
+  else if(flags & TFHD_DEFAULT_BASE_IS_MOOF){
+    *base = moof_offset;
+  }
+  if((flags & TFHD_SAMPLE_DESCRIPTION_INDEX)
+     && !gst_byte_reader_skip(&reader, 4))
+    return FALSE;
+  if((flags & TFHD_DEFAULT_SAMPLE_DURATION)
+     && !gst_byte_reader_skip(&reader, 4))
+    return FALSE;
+  if((flags & TFHD_DEFAULT_SAMPLE_SIZE)
+     && !gst_byte_reader_get_uint32_be(&reader, &default_size))
+    return FALSE;
+
+  pos = *base;
+  while(gst_cenc_mp4_next_box(traf, traf_size, offset, &type, &header_size,
+			      &box_size)){
+    const guint8 *payload = traf + offset + header_size;
+    gsize payload_size = box_size - header_size;
+
+    offset += box_size;
+    if(type == FOURCC('t','r','u','n')){
+      guint32 trun_flags, count, i;
+
+      gst_byte_reader_init(&reader, payload, payload_size);
+      if(!gst_byte_reader_get_uint32_be(&reader, &trun_flags)
+	 || !gst_byte_reader_get_uint32_be(&reader, &count))
+	return FALSE;
+      if(trun_flags & TRUN_DATA_OFFSET){
+	gint32 data_offset;
+
+	if(!gst_byte_reader_get_int32_be(&reader, &data_offset)
+	   || (data_offset < 0 && -(gint64) data_offset > *base))
+	  return FALSE;
+	pos = *base + data_offset;
+      }
+      if((trun_flags & TRUN_FIRST_SAMPLE_FLAGS)
+	 && !gst_byte_reader_skip(&reader, 4))
+	return FALSE;
+      for(i=0; i<count; ++i){
+	guint32 sample_size = default_size;
+
+	if(((trun_flags & TRUN_SAMPLE_DURATION)
+	    && !gst_byte_reader_skip(&reader, 4))
+	   || ((trun_flags & TRUN_SAMPLE_SIZE)
+	       && !gst_byte_reader_get_uint32_be(&reader, &sample_size))
+	   || ((trun_flags & TRUN_SAMPLE_FLAGS)
+	       && !gst_byte_reader_skip(&reader, 4))
+	   || ((trun_flags & TRUN_SAMPLE_CTO)
+	       && !gst_byte_reader_skip(&reader, 4)))
+	  return FALSE;
+	if(pos > size || sample_size > size - pos){
+	  GST_WARNING("Sample data beyond the end of the file");
+	  return FALSE;
+	}
+	if(track && track->is_protected){
+	  GstCencMp4Sample sample;
+
+	  memset(&sample, 0, sizeof(sample));
+	  sample.track = track;
+	  sample.offset = pos;
+	  sample.size = sample_size;
+	  g_array_append_val(fragment->samples, sample);
+	}
+	pos += sample_size;
+      }
+    }
+    else if(type == FOURCC('s','e','n','c')){
+      senc = payload;
+      senc_size = payload_size;
+    }
+    else if(type == FOURCC('u','u','i','d') && payload_size >= 16
+	    && memcmp(payload, piff_senc_uuid, 16) == 0){
+      senc = payload;
+      senc_size = payload_size;
+      piff = TRUE;
+    }
+    else if(type == FOURCC('s','a','i','z')){
+      saiz = payload;
+      saiz_size = payload_size;
+    }
+    else if(type == FOURCC('s','a','i','o')){
+      saio = payload;
+      saio_size = payload_size;
+    }
+  }
+  /* the data of a following traf starts where the data of this one ends */
+  traf_base = *base;
+  *base = pos;
+
+  if(fragment->samples->len == first)
+    return TRUE;
+  if(track->iv_size != 8 && track->iv_size != 16){
+    GST_WARNING("Track %u has unsupported IV size %u", track->track_id,
+		track->iv_size);
+    return FALSE;
+  }
+  if(senc)
+    return gst_cenc_mp4_parse_senc(fragment, first, senc, senc_size,
+				   track->iv_size, piff);
+  if(saiz && saio)
+    return gst_cenc_mp4_parse_saiz_saio(fragment, first, data, available,
+					saiz, saiz_size, saio, saio_size,
+					traf_base, track->iv_size);
+  GST_WARNING("No sample auxiliary information for track %u",
+	      track->track_id);
+  return FALSE;
+}
+
+/* Find the encrypted samples of the moof box at moof_offset in data */
+gboolean
+gst_cenc_mp4_fragment_parse(GstCencMp4Fragment *fragment,
+			    const GstCencMp4Movie *movie,
+			    const guint8 *data, gsize size,
+			    gsize moof_offset)
+{
+  return gst_cenc_mp4_fragment_parse_partial(fragment, movie, data, size,
+					     size, moof_offset);
+}
+
+/* As gst_cenc_mp4_fragment_parse(), when only the first available of the
+   size bytes of data have arrived, which must include the moof box. The
+   samples must lie within size, but sample auxiliary information that
+   saio points to must be within the available bytes. */
+gboolean
+gst_cenc_mp4_fragment_parse_partial(GstCencMp4Fragment *fragment,
+				    const GstCencMp4Movie *movie,
+				    const guint8 *data, gsize available,
+				    gsize size, gsize moof_offset)
+{
+  gsize offset = 0, header_size, box_size, moof_header, moof_size;
+  gsize base = moof_offset;
+  const guint8 *moof;
+  guint32 type;
+
+  g_array_set_size(fragment->samples, 0);
+  g_array_set_size(fragment->subsamples, 0);
+  fragment->has_base_data_offset = FALSE;
+  g_return_val_if_fail(available <= size, FALSE);
+
+  if(!gst_cenc_mp4_next_box(data, available, moof_offset, &type,
+			    &moof_header, &moof_size)
+     || type != FOURCC('m','o','o','f'))
+    return FALSE;
+  fragment->offset = moof_offset;
+  fragment->size = moof_size;
+
+  moof = data + moof_offset + moof_header;
+  moof_size -= moof_header;
+  while(gst_cenc_mp4_next_box(moof, moof_size, offset, &type, &header_size,
+			      &box_size)){
+    if(type == FOURCC('t','r','a','f')
+       && !gst_cenc_mp4_parse_traf(fragment, movie, data, available, size,
+				   moof_offset, moof + offset + header_size,
+				   box_size - header_size, &base))
+      return FALSE;
+    offset += box_size;
+  }
+  return TRUE;
+}
+
+/* Replace the sample encryption boxes of a parsed moof with free boxes */
+void
+gst_cenc_mp4_fragment_clear_protection(guint8 *data,
+				       const GstCencMp4Fragment *fragment)
+{
+  static const guint32 types[] = {
+    FOURCC('s','e','n','c'), FOURCC('s','a','i','z'),
+    FOURCC('s','a','i','o'), FOURCC('p','s','s','h')
+  };
+  guint8 *moof;
+  gsize offset = 0, header_size, box_size, moof_header, moof_size;
+  guint32 type;
+
+  if(!gst_cenc_mp4_next_box(data, fragment->offset + fragment->size,
+			    fragment->offset, &type, &moof_header, &moof_size))
+    return;
+  moof = data + fragment->offset + moof_header;
+  moof_size -= moof_header;
+  gst_cenc_mp4_rename_children(moof, moof_size, types, G_N_ELEMENTS(types));
+  while(gst_cenc_mp4_next_box(moof, moof_size, offset, &type, &header_size,
+			      &box_size)){
+    if(type == FOURCC('t','r','a','f'))
+      gst_cenc_mp4_rename_children(moof + offset + header_size,
+				   box_size - header_size, types,
+				   G_N_ELEMENTS(types));
+    offset += box_size;
+  }
+}
+
+/* Decrypt a sample in place. Returns FALSE if its subsamples do not fit
+   in the sample. */
+gboolean
+gst_cenc_mp4_sample_decrypt(AesCtrState *state, guint8 *data,
+			    const GstCencMp4Fragment *fragment,
+			    const GstCencMp4Sample *sample)
+{
+  guint8 *pos = data + sample->offset;
+  gsize todo = sample->size;
+  guint i;
+
+  if(!gst_aes_ctr_decrypt_set_iv(state, sample->iv, sample->track->iv_size))
+    return FALSE;
+  if(!sample->subsample_count){
+    gst_aes_ctr_decrypt_ip(state, pos, todo);
+    return TRUE;
+  }
+  for(i=0; i<sample->subsample_count; ++i){
+    const GstCencMp4Subsample *subsample =
+      &g_array_index(fragment->subsamples, GstCencMp4Subsample,
+		     sample->first_subsample + i);
+
+    if(subsample->bytes_clear > todo
+       || subsample->bytes_encrypted > todo - subsample->bytes_clear)
+      return FALSE;
+    pos += subsample->bytes_clear;
+    gst_aes_ctr_decrypt_ip(state, pos, subsample->bytes_encrypted);
+    pos += subsample->bytes_encrypted;
+    todo -= subsample->bytes_clear + subsample->bytes_encrypted;
+  }
+  return TRUE;
+}
+
+/* Decrypt n_samples consecutive samples in place, interleaving them
+   through gst_aes_ctr_decrypt_ip_multi(). states[i] must be keyed for
+   sample first + i, and no state may be used for two of the samples.
+   Returns FALSE if the subsamples of a sample do not fit in it. */
+gboolean
+gst_cenc_mp4_samples_decrypt(AesCtrState **states, guint8 *data,
+			     const GstCencMp4Fragment *fragment,
+			     guint first, guint n_samples)
+{
+  const GstCencMp4Sample *samples[GST_CENC_MP4_MAX_LANES];
+  gsize pos[GST_CENC_MP4_MAX_LANES];
+  guint next[GST_CENC_MP4_MAX_LANES];
+  AesCtrJob jobs[GST_CENC_MP4_MAX_LANES];
+  guint i, n_jobs, n_pending;
+
+  g_return_val_if_fail(n_samples <= GST_CENC_MP4_MAX_LANES, FALSE);
+
+  for(i=0; i<n_samples; ++i){
+    samples[i] = &g_array_index(fragment->samples, GstCencMp4Sample,
+				first + i);
+    if(!gst_aes_ctr_decrypt_set_iv(states[i], samples[i]->iv,
+				   samples[i]->track->iv_size))
+      return FALSE;
+    pos[i] = 0;
+    next[i] = 0;
+  }
+  do{
+    /* the next encrypted range of every sample that has one left */
+    n_jobs = n_pending = 0;
+    for(i=0; i<n_samples; ++i){
+      const GstCencMp4Sample *sample = samples[i];
+      gsize clear, encrypted;
+
+      if(!sample->subsample_count){
+	if(next[i]++)
+	  continue;
+	clear = 0;
+	encrypted = sample->size;
+      }
+      else{
+	const GstCencMp4Subsample *subsample;
+
+	if(next[i] == sample->subsample_count)
+	  continue;
+	subsample = &g_array_index(fragment->subsamples, GstCencMp4Subsample,
+				   sample->first_subsample + next[i]++);
+	clear = subsample->bytes_clear;
+	encrypted = subsample->bytes_encrypted;
+      }
+      if(clear > sample->size - pos[i]
+	 || encrypted > sample->size - pos[i] - clear)
+	return FALSE;
+      pos[i] += clear;
+      if(encrypted){
+	jobs[n_jobs].state = states[i];
+	jobs[n_jobs].data = data + sample->offset + pos[i];
+	jobs[n_jobs].length = encrypted;
+	++n_jobs;
+      }
+      pos[i] += encrypted;
+      ++n_pending;
+    }
+    gst_aes_ctr_decrypt_ip_multi(jobs, n_jobs);
+  } while(n_pending);
+  return TRUE;
+}
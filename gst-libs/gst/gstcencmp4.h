@@ -0,0 +1,111 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_MP4_H_
+#define _GST_CENC_MP4_H_
+
+#include <glib.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+
+G_BEGIN_DECLS
+
+#define GST_CENC_MP4_FOURCC(a,b,c,d) \
+  ((guint32)(((a)<<24) | ((b)<<16) | ((c)<<8) | (d)))
+
+/* protection parameters of a track, from its tenc and trex boxes */
+typedef struct _GstCencMp4Track {
+  guint32 track_id;
+  guint32 scheme_type;          /* 'cenc', 'cens', 'cbc1' or 'cbcs' */
+  guint32 original_format;      /* from the frma box */
+  gboolean is_protected;
+  guint iv_size;                /* 0, 8 or 16 */
+  guint8 kid[GST_CENC_KID_LENGTH];
+  guint32 default_sample_size;
+} GstCencMp4Track;
+
+/* tracks of a moov box */
+typedef struct _GstCencMp4Movie {
+  GArray *tracks;               /* of GstCencMp4Track */
+  gboolean has_protected_entries; /* an encv or enca sample entry was seen */
+} GstCencMp4Movie;
+
+typedef struct _GstCencMp4Subsample {
+  guint16 bytes_clear;
+  guint32 bytes_encrypted;
+} GstCencMp4Subsample;
+
+typedef struct _GstCencMp4Sample {
+  const GstCencMp4Track *track;
+  gsize offset;                 /* of the sample data */
+  guint32 size;
+  guint8 iv[16];
+  guint subsample_count;
+  guint first_subsample;        /* index in GstCencMp4Fragment.subsamples */
+} GstCencMp4Sample;
+
+/* encrypted samples of a moof box */
+typedef struct _GstCencMp4Fragment {
+  gsize offset;                 /* of the moof box */
+  gsize size;                   /* of the moof box */
+  gboolean has_base_data_offset; /* a tfhd box gives a base data offset */
+  GArray *samples;              /* of GstCencMp4Sample */
+  GArray *subsamples;           /* of GstCencMp4Subsample */
+} GstCencMp4Fragment;
+
+gboolean gst_cenc_mp4_next_box(const guint8 *data, gsize size,
+			       gsize offset, guint32 *type,
+			       gsize *header_size, gsize *box_size);
+
+void gst_cenc_mp4_movie_init(GstCencMp4Movie *movie);
+void gst_cenc_mp4_movie_clear(GstCencMp4Movie *movie);
+gboolean gst_cenc_mp4_movie_parse(GstCencMp4Movie *movie,
+				  const guint8 *moov, gsize size);
+const GstCencMp4Track * gst_cenc_mp4_movie_get_track(const GstCencMp4Movie *movie,
+						      guint32 track_id);
+void gst_cenc_mp4_movie_clear_protection(guint8 *moov, gsize size);
+
+void gst_cenc_mp4_fragment_init(GstCencMp4Fragment *fragment);
+void gst_cenc_mp4_fragment_clear(GstCencMp4Fragment *fragment);
+gboolean gst_cenc_mp4_fragment_parse(GstCencMp4Fragment *fragment,
+				     const GstCencMp4Movie *movie,
+				     const guint8 *data, gsize size,
+				     gsize moof_offset);
+gboolean gst_cenc_mp4_fragment_parse_partial(GstCencMp4Fragment *fragment,
+					     const GstCencMp4Movie *movie,
+					     const guint8 *data,
+					     gsize available, gsize size,
+					     gsize moof_offset);
+void gst_cenc_mp4_fragment_clear_protection(guint8 *data,
+					    const GstCencMp4Fragment *fragment);
+
+gboolean gst_cenc_mp4_sample_decrypt(AesCtrState *state, guint8 *data,
+				     const GstCencMp4Fragment *fragment,
+				     const GstCencMp4Sample *sample);
+
+/* largest number of samples that gst_cenc_mp4_samples_decrypt() takes */
+#define GST_CENC_MP4_MAX_LANES 8
+
+gboolean gst_cenc_mp4_samples_decrypt(AesCtrState **states, guint8 *data,
+				      const GstCencMp4Fragment *fragment,
+				      guint first, guint n_samples);
+
+G_END_DECLS
+#endif
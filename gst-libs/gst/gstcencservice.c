@@ -0,0 +1,758 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <gio/gio.h>
+#include <gst/gst.h>
+
+#include "gstaesctr.h"
+#include "gstcenckeyarena.h"
+#include "gstcenckeystore.h"
+#include "gstcencservice.h"
+
+#define SERVICE_MAGIC 0x43454e43	/* "CENC" */
+#define SERVICE_VERSION 1
+#define SERVICE_ALIGN 64
+#define SERVICE_MAX_SLOTS 1024
+#define SERVICE_MAX_SLOT_SIZE (64 * 1024 * 1024)
+/* longest time a client waits for a batch to be decrypted */
+#define SERVICE_TIMEOUT_MS 5000
+
+#define SERVICE_ROUND_UP(x) (((x) + SERVICE_ALIGN - 1) & ~(SERVICE_ALIGN - 1))
+
+/* sent by a client when it connects, along with the shared memory and the
+   submission and completion eventfds */
+typedef struct {
+  guint32 magic;
+  guint32 version;
+  guint32 n_slots;
+  guint32 slot_size;
+} ServiceHello;
+
+/* the start of the shared memory. The ring positions are free running
+   counts, each on a cache line of its own as they are written by
+   different processes. Each side keeps its read position to itself. */
+typedef struct {
+  gint sq_tail;			/* written by the client */
+  guint8 pad0[SERVICE_ALIGN - sizeof(gint)];
+  gint cq_tail;			/* written by the service */
+  guint8 pad1[SERVICE_ALIGN - sizeof(gint)];
+} ServiceHeader;
+
+/* the shared memory as seen by one side of a connection */
+typedef struct {
+  guint8 *base;
+  gsize size;
+  guint n_slots;
+  gsize slot_size;
+  gsize requests;		/* offsets of the parts of the region */
+  gsize sq;
+  gsize cq;
+  gsize data;
+} ServiceRegion;
+
+struct _GstCencServiceClient {
+  gint socket;
+  gint submit_fd;
+  gint complete_fd;
+  ServiceRegion region;
+  guint sq_tail;
+  guint cq_head;
+};
+
+struct _GstCencService {
+  gchar *path;
+  gchar *key_directory;
+  gint socket;
+  gint stop_fd;			/* readable once the service is stopping */
+  GThread *thread;
+  GMutex lock;
+  GCond cond;			/* signalled when a connection closes */
+  GstCencKeyArena *keys;	/* protected by lock */
+  guint n_connections;		/* protected by lock */
+};
+
+typedef struct {
+  GstCencService *service;
+  gint socket;
+  gint submit_fd;
+  gint complete_fd;
+  ServiceRegion region;
+  guint sq_head;
+  guint cq_tail;
+  AesCtrState *state;
+  guint32 generation;		/* of the key in service->keys that state has */
+} ServiceConnection;
+
+static gboolean
+service_region_init(ServiceRegion *region, guint n_slots, gsize slot_size)
+{
+  gsize offset = SERVICE_ROUND_UP(sizeof(ServiceHeader));
+
+  if(n_slots==0 || n_slots>SERVICE_MAX_SLOTS || slot_size==0
+     || slot_size>SERVICE_MAX_SLOT_SIZE || slot_size % SERVICE_ALIGN)
+    return FALSE;
+  memset(region, 0, sizeof(ServiceRegion));
+  region->n_slots = n_slots;
+  region->slot_size = slot_size;
+  region->requests = offset;
+  offset += SERVICE_ROUND_UP(n_slots * sizeof(GstCencServiceRequest));
+  region->sq = offset;
+  offset += SERVICE_ROUND_UP(n_slots * sizeof(guint32));
+  region->cq = offset;
+  offset += SERVICE_ROUND_UP(n_slots * sizeof(guint32));
+  region->data = offset;
+  region->size = offset + n_slots * slot_size;
+  return TRUE;
+}
+
+static gboolean
+service_region_map(ServiceRegion *region, gint fd)
+{
+  gpointer base = mmap(NULL, region->size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED, fd, 0);
+
+  if(base==MAP_FAILED)
+    return FALSE;
+  region->base = base;
+  return TRUE;
+}
+
+static void
+service_region_unmap(ServiceRegion *region)
+{
+  if(region->base)
+    munmap(region->base, region->size);
+  region->base = NULL;
+}
+
+#define service_region_header(r) ((ServiceHeader *) (r)->base)
+#define service_region_request(r, slot) \
+  ((GstCencServiceRequest *) ((r)->base + (r)->requests) + (slot))
+#define service_region_sq(r) ((guint32 *) ((r)->base + (r)->sq))
+#define service_region_cq(r) ((guint32 *) ((r)->base + (r)->cq))
+#define service_region_data(r, slot) \
+  ((r)->base + (r)->data + (slot) * (r)->slot_size)
+
+static void
+service_signal(gint fd)
+{
+  guint64 one = 1;
+
+  if(write(fd, &one, sizeof(one))<0 && errno!=EAGAIN)
+    GST_WARNING("Failed to signal eventfd: %s", g_strerror(errno));
+}
+
+static void
+service_clear_signal(gint fd)
+{
+  guint64 count;
+
+  while(read(fd, &count, sizeof(count))<0 && errno==EINTR)
+    ;
+}
+
+static void
+service_set_error(GError **error, const gchar *what)
+{
+  gint err = errno;
+
+  g_set_error(error, G_IO_ERROR, g_io_error_from_errno(err), "%s: %s",
+	      what, g_strerror(err));
+}
+
+static void
+service_close(gint *fd)
+{
+  if(*fd>=0)
+    close(*fd);
+  *fd = -1;
+}
+
+static gboolean
+service_make_address(const gchar *path, struct sockaddr_un *address,
+		     GError **error)
+{
+  memset(address, 0, sizeof(struct sockaddr_un));
+  address->sun_family = AF_UNIX;
+  if(strlen(path)>=sizeof(address->sun_path)){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+		"Socket path is too long: %s", path);
+    return FALSE;
+  }
+  strcpy(address->sun_path, path);
+  return TRUE;
+}
+
+/* Send the hello message and the file descriptors of the connection */
+static gboolean
+service_client_send_hello(GstCencServiceClient *client, gint memory_fd,
+			  GError **error)
+{
+  ServiceHello hello = { SERVICE_MAGIC, SERVICE_VERSION,
+			 client->region.n_slots, client->region.slot_size };
+  gint fds[3] = { memory_fd, client->submit_fd, client->complete_fd };
+  union {
+    struct cmsghdr header;
+    guint8 buf[CMSG_SPACE(sizeof(fds))];
+  } control;
+  struct iovec iov = { &hello, sizeof(hello) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  guint32 reply;
+  gssize n;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  do
+    n = sendmsg(client->socket, &msg, MSG_NOSIGNAL);
+  while(n<0 && errno==EINTR);
+  if(n!=sizeof(hello)){
+    service_set_error(error, "Failed to send to the decryption service");
+    return FALSE;
+  }
+  do
+    n = recv(client->socket, &reply, sizeof(reply), MSG_WAITALL);
+  while(n<0 && errno==EINTR);
+  if(n!=sizeof(reply) || reply!=0){
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_CONNECTION_REFUSED,
+		"The decryption service refused the connection");
+    return FALSE;
+  }
+  return TRUE;
+}
+
+/* Connect to the service listening on a local socket */
+GstCencServiceClient *
+gst_cenc_service_client_new(const gchar *path, GError **error)
+{
+  GstCencServiceClient *client;
+  struct sockaddr_un address;
+  gint memory_fd;
+  gboolean ok;
+
+  g_return_val_if_fail(path!=NULL, NULL);
+
+  if(!service_make_address(path, &address, error))
+    return NULL;
+  client = g_new0(GstCencServiceClient, 1);
+  client->submit_fd = client->complete_fd = -1;
+  service_region_init(&client->region, GST_CENC_SERVICE_SLOTS,
+		      GST_CENC_SERVICE_SLOT_SIZE);
+  client->socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(client->socket<0
+     || connect(client->socket, (struct sockaddr *) &address,
+		sizeof(address))<0){
+    service_set_error(error, "Failed to connect to the decryption service");
+    gst_cenc_service_client_free(client);
+    return NULL;
+  }
+  /* the region is sparse, so only the pages of slots in use are backed.
+     It is sealed against shrinking, as the service would be killed by
+     SIGBUS if it touched a page that had been truncated away. */
+  memory_fd = memfd_create("gst-cenc-service",
+			   MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  ok = memory_fd>=0 && ftruncate(memory_fd, client->region.size)==0
+    && fcntl(memory_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL)==0
+    && service_region_map(&client->region, memory_fd);
+  if(!ok)
+    service_set_error(error, "Failed to create shared memory");
+  if(ok){
+    client->submit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    client->complete_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ok = client->submit_fd>=0 && client->complete_fd>=0;
+    if(!ok)
+      service_set_error(error, "Failed to create eventfd");
+  }
+  if(ok)
+    ok = service_client_send_hello(client, memory_fd, error);
+  service_close(&memory_fd);
+  if(!ok){
+    gst_cenc_service_client_free(client);
+    return NULL;
+  }
+  return client;
+}
+
+void
+gst_cenc_service_client_free(GstCencServiceClient *client)
+{
+  if(!client)
+    return;
+  service_region_unmap(&client->region);
+  service_close(&client->socket);
+  service_close(&client->submit_fd);
+  service_close(&client->complete_fd);
+  g_free(client);
+}
+
+guint
+gst_cenc_service_client_get_n_slots(const GstCencServiceClient *client)
+{
+  g_return_val_if_fail(client!=NULL, 0);
+
+  return client->region.n_slots;
+}
+
+gsize
+gst_cenc_service_client_get_slot_size(const GstCencServiceClient *client)
+{
+  g_return_val_if_fail(client!=NULL, 0);
+
+  return client->region.slot_size;
+}
+
+GstCencServiceRequest *
+gst_cenc_service_client_get_request(GstCencServiceClient *client, guint slot)
+{
+  g_return_val_if_fail(client!=NULL, NULL);
+  g_return_val_if_fail(slot<client->region.n_slots, NULL);
+
+  return service_region_request(&client->region, slot);
+}
+
+guint8 *
+gst_cenc_service_client_get_data(GstCencServiceClient *client, guint slot)
+{
+  g_return_val_if_fail(client!=NULL, NULL);
+  g_return_val_if_fail(slot<client->region.n_slots, NULL);
+
+  return service_region_data(&client->region, slot);
+}
+
+/* Submit the requests in the first n_requests slots as one batch and wait
+   until the service has completed all of them. The status of each request
+   says whether its data has been decrypted. */
+gboolean
+gst_cenc_service_client_run(GstCencServiceClient *client, guint n_requests,
+			    GError **error)
+{
+  ServiceRegion *region;
+  ServiceHeader *header;
+  guint32 *sq;
+  guint i, done = 0;
+
+  g_return_val_if_fail(client!=NULL, FALSE);
+  g_return_val_if_fail(n_requests<=client->region.n_slots, FALSE);
+
+  region = &client->region;
+  header = service_region_header(region);
+  sq = service_region_sq(region);
+  if(n_requests==0)
+    return TRUE;
+  for(i=0; i<n_requests; ++i){
+    service_region_request(region, i)->status = GST_CENC_SERVICE_PENDING;
+    sq[(client->sq_tail + i) % region->n_slots] = i;
+  }
+  client->sq_tail += n_requests;
+  /* the atomic store is a full barrier, so the requests are visible to the
+     service before the new tail */
+  g_atomic_int_set(&header->sq_tail, client->sq_tail);
+  service_signal(client->submit_fd);
+
+  while(TRUE){
+    guint tail = g_atomic_int_get(&header->cq_tail);
+    struct pollfd fds[2] = {
+      { client->complete_fd, POLLIN, 0 },
+      { client->socket, POLLIN, 0 }
+    };
+    gint n;
+
+    while(client->cq_head!=tail && done<n_requests){
+      client->cq_head++;
+      done++;
+    }
+    if(done==n_requests)
+      return TRUE;
+    n = poll(fds, G_N_ELEMENTS(fds), SERVICE_TIMEOUT_MS);
+    if(n<0 && errno==EINTR)
+      continue;
+    if(n<0){
+      service_set_error(error, "Failed to wait for the decryption service");
+      return FALSE;
+    }
+    if(n==0){
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT,
+		  "The decryption service did not reply");
+      return FALSE;
+    }
+    /* the service never writes to the socket after the hello */
+    if(fds[1].revents){
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+		  "The decryption service closed the connection");
+      return FALSE;
+    }
+    service_clear_signal(client->complete_fd);
+  }
+}
+
+/* Only memory that the client can no longer shrink is safe to map, and
+   the seal has to be in place before its size is checked */
+static gboolean
+service_is_sealed(gint fd)
+{
+  gint seals = fcntl(fd, F_GET_SEALS);
+
+  return seals>=0 && (seals & F_SEAL_SHRINK);
+}
+
+/* Only clients that run as the user or the group of the service may use
+   its keys, as the socket permissions say */
+static gboolean
+service_peer_is_allowed(gint fd)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)<0
+     || len!=sizeof(cred))
+    return FALSE;
+  return cred.uid==geteuid() || cred.gid==getegid();
+}
+
+/* Receive the hello message and file descriptors of a new client and map
+   its shared memory */
+static gboolean
+service_connection_accept(ServiceConnection *conn)
+{
+  ServiceHello hello;
+  union {
+    struct cmsghdr header;
+    guint8 buf[CMSG_SPACE(3 * sizeof(gint))];
+  } control;
+  struct iovec iov = { &hello, sizeof(hello) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  struct stat st;
+  gint fds[3] = { -1, -1, -1 };
+  guint32 reply = 1;
+  gboolean ok = FALSE;
+  gssize n;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+  do
+    n = recvmsg(conn->socket, &msg, MSG_CMSG_CLOEXEC);
+  while(n<0 && errno==EINTR);
+  for(cmsg=CMSG_FIRSTHDR(&msg); n>0 && cmsg; cmsg=CMSG_NXTHDR(&msg, cmsg)){
+    if(cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_RIGHTS
+       && cmsg->cmsg_len==CMSG_LEN(sizeof(fds)))
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+  }
+  if(n==sizeof(hello) && !(msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+     && service_peer_is_allowed(conn->socket)
+     && fds[0]>=0 && hello.magic==SERVICE_MAGIC
+     && hello.version==SERVICE_VERSION
+     && service_region_init(&conn->region, hello.n_slots, hello.slot_size)
+     && service_is_sealed(fds[0])
+     && fstat(fds[0], &st)==0 && st.st_size>=(off_t) conn->region.size)
+    ok = service_region_map(&conn->region, fds[0]);
+  service_close(&fds[0]);
+  if(ok){
+    conn->submit_fd = fds[1];
+    conn->complete_fd = fds[2];
+    /* a client that reads its own eventfd must not block the service */
+    ok = fcntl(conn->submit_fd, F_SETFL, O_NONBLOCK)==0
+      && fcntl(conn->complete_fd, F_SETFL, O_NONBLOCK)==0;
+  }
+  else{
+    service_close(&fds[1]);
+    service_close(&fds[2]);
+  }
+  if(ok)
+    reply = 0;
+  else
+    GST_WARNING("Refused a client of the decryption service");
+  if(send(conn->socket, &reply, sizeof(reply), MSG_NOSIGNAL)!=sizeof(reply))
+    ok = FALSE;
+  return ok;
+}
+
+/* Set up the cipher of a connection for a request. The key is loaded from
+   the key store the first time that its KID is seen. */
+static gboolean
+service_connection_set_key(ServiceConnection *conn,
+			   const GstCencServiceRequest *request)
+{
+  GstCencService *service = conn->service;
+  GstCencKeyNaming naming = (request->flags & GST_CENC_SERVICE_FLAG_MARLIN) ?
+    GST_CENC_KEY_NAMING_MARLIN : GST_CENC_KEY_NAMING_CLEARKEY;
+  const guint8 *schedule;
+  guint32 generation;
+  gboolean ok = TRUE;
+  gint slot;
+
+  g_mutex_lock(&service->lock);
+  slot = gst_cenc_key_arena_lookup(service->keys, request->kid);
+  if(slot==GST_CENC_KEY_ARENA_NO_SLOT){
+    GBytes *key = gst_cenc_key_store_load(service->key_directory,
+					  request->kid, naming, NULL);
+
+    if(key && g_bytes_get_size(key)==GST_CENC_KEY_LENGTH)
+      slot = gst_cenc_key_arena_add(service->keys, request->kid,
+				    g_bytes_get_data(key, NULL));
+    if(key)
+      g_bytes_unref(key);
+  }
+  if(slot==GST_CENC_KEY_ARENA_NO_SLOT){
+    g_mutex_unlock(&service->lock);
+    return FALSE;
+  }
+  /* the schedule is copied into the state, as the arena can move */
+  schedule = gst_cenc_key_arena_get_schedule(service->keys, slot);
+  generation = gst_cenc_key_arena_get_generation(service->keys, slot);
+  if(!conn->state){
+    conn->state = gst_aes_ctr_decrypt_new_from_schedule(schedule,
+							request->iv,
+							request->iv_size);
+    ok = conn->state!=NULL;
+  }
+  else{
+    if(generation!=conn->generation)
+      gst_aes_ctr_decrypt_set_key(conn->state, schedule);
+    ok = gst_aes_ctr_decrypt_set_iv(conn->state, request->iv,
+				    request->iv_size);
+  }
+  conn->generation = generation;
+  g_mutex_unlock(&service->lock);
+  return ok;
+}
+
+static GstCencServiceStatus
+service_connection_decrypt(ServiceConnection *conn, guint slot)
+{
+  GstCencServiceRequest request;
+
+  /* the client can change the shared descriptor at any time */
+  memcpy(&request, service_region_request(&conn->region, slot),
+	 sizeof(request));
+  if(request.size>conn->region.slot_size
+     || request.iv_size>sizeof(request.iv))
+    return GST_CENC_SERVICE_INVALID;
+  if(!service_connection_set_key(conn, &request))
+    return GST_CENC_SERVICE_NO_KEY;
+  gst_aes_ctr_decrypt_ip(conn->state,
+			 service_region_data(&conn->region, slot),
+			 request.size);
+  return GST_CENC_SERVICE_OK;
+}
+
+/* Decrypt everything on the submission ring, then signal the client */
+static void
+service_connection_process(ServiceConnection *conn)
+{
+  ServiceRegion *region = &conn->region;
+  ServiceHeader *header = service_region_header(region);
+  guint32 *sq = service_region_sq(region);
+  guint32 *cq = service_region_cq(region);
+  guint tail = g_atomic_int_get(&header->sq_tail);
+
+  if(tail - conn->sq_head > region->n_slots)
+    conn->sq_head = tail - region->n_slots;
+  while(conn->sq_head!=tail){
+    guint slot = sq[conn->sq_head++ % region->n_slots];
+
+    if(slot>=region->n_slots)
+      continue;
+    g_atomic_int_set(&service_region_request(region, slot)->status,
+		     service_connection_decrypt(conn, slot));
+    cq[conn->cq_tail++ % region->n_slots] = slot;
+  }
+  g_atomic_int_set(&header->cq_tail, conn->cq_tail);
+  service_signal(conn->complete_fd);
+}
+
+static gboolean
+service_connection_wait(ServiceConnection *conn, gint fd)
+{
+  struct pollfd fds[3] = {
+    { fd, POLLIN, 0 },
+    { conn->socket, POLLIN, 0 },
+    { conn->service->stop_fd, POLLIN, 0 }
+  };
+
+  while(poll(fds, fd>=0 ? 3 : 2, -1)<0){
+    if(errno!=EINTR)
+      return FALSE;
+  }
+  if(fds[2].revents)
+    return FALSE;
+  return fd<0 ? TRUE : !fds[1].revents;
+}
+
+static gpointer
+service_connection_run(gpointer data)
+{
+  ServiceConnection *conn = data;
+  GstCencService *service = conn->service;
+
+  /* wait for the hello without holding up gst_cenc_service_free() */
+  if(service_connection_wait(conn, -1) && service_connection_accept(conn)){
+    GST_DEBUG("Client connected with %u slots", conn->region.n_slots);
+    while(service_connection_wait(conn, conn->submit_fd)){
+      service_clear_signal(conn->submit_fd);
+      service_connection_process(conn);
+    }
+  }
+  if(conn->state)
+    gst_aes_ctr_decrypt_unref(conn->state);
+  service_region_unmap(&conn->region);
+  service_close(&conn->socket);
+  service_close(&conn->submit_fd);
+  service_close(&conn->complete_fd);
+  g_free(conn);
+
+  g_mutex_lock(&service->lock);
+  service->n_connections--;
+  g_cond_broadcast(&service->cond);
+  g_mutex_unlock(&service->lock);
+  return NULL;
+}
+
+static gpointer
+service_run(gpointer data)
+{
+  GstCencService *service = data;
+  struct pollfd fds[2] = {
+    { service->socket, POLLIN, 0 },
+    { service->stop_fd, POLLIN, 0 }
+  };
+
+  while(poll(fds, G_N_ELEMENTS(fds), -1)>=0 || errno==EINTR){
+    ServiceConnection *conn;
+    GThread *thread;
+    gint fd;
+
+    if(fds[1].revents)
+      break;
+    if(!fds[0].revents)
+      continue;
+    fd = accept4(service->socket, NULL, NULL, SOCK_CLOEXEC);
+    if(fd<0)
+      continue;
+    conn = g_new0(ServiceConnection, 1);
+    conn->service = service;
+    conn->socket = fd;
+    conn->submit_fd = conn->complete_fd = -1;
+    g_mutex_lock(&service->lock);
+    service->n_connections++;
+    g_mutex_unlock(&service->lock);
+    thread = g_thread_try_new("cenc-service", service_connection_run, conn,
+			      NULL);
+    if(thread)
+      g_thread_unref(thread);
+    else
+      service_connection_run(conn);
+  }
+  return NULL;
+}
+
+/* Start a service that listens on the local socket path and reads keys
+   from key_directory. A stale socket left at path is replaced. The socket
+   can only be used by the user and the group of the service. */
+GstCencService *
+gst_cenc_service_new(const gchar *path, const gchar *key_directory,
+		     GError **error)
+{
+  GstCencService *service;
+  struct sockaddr_un address;
+  struct stat st;
+
+  g_return_val_if_fail(path!=NULL, NULL);
+  g_return_val_if_fail(key_directory!=NULL, NULL);
+
+  if(!service_make_address(path, &address, error))
+    return NULL;
+  if(lstat(path, &st)==0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+  service = g_new0(GstCencService, 1);
+  service->path = g_strdup(path);
+  service->key_directory = g_strdup(key_directory);
+  service->keys = gst_cenc_key_arena_new();
+  g_mutex_init(&service->lock);
+  g_cond_init(&service->cond);
+  service->stop_fd = eventfd(0, EFD_CLOEXEC);
+  service->socket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(service->stop_fd<0 || service->socket<0
+     || bind(service->socket, (struct sockaddr *) &address,
+	     sizeof(address))<0
+     || chmod(path, 0660)<0
+     || listen(service->socket, SOMAXCONN)<0){
+    service_set_error(error, "Failed to listen on the service socket");
+    gst_cenc_service_free(service);
+    return NULL;
+  }
+  service->thread = g_thread_try_new("cenc-service-listen", service_run,
+				     service, error);
+  if(!service->thread){
+    gst_cenc_service_free(service);
+    return NULL;
+  }
+  return service;
+}
+
+/* Stop the service, closing the connection of every client */
+void
+gst_cenc_service_free(GstCencService *service)
+{
+  if(!service)
+    return;
+  if(service->thread){
+    service_signal(service->stop_fd);
+    g_thread_join(service->thread);
+    unlink(service->path);
+  }
+  g_mutex_lock(&service->lock);
+  while(service->n_connections)
+    g_cond_wait(&service->cond, &service->lock);
+  g_mutex_unlock(&service->lock);
+  service_close(&service->socket);
+  service_close(&service->stop_fd);
+  gst_cenc_key_arena_free(service->keys);
+  g_mutex_clear(&service->lock);
+  g_cond_clear(&service->cond);
+  g_free(service->path);
+  g_free(service->key_directory);
+  g_free(service);
+}
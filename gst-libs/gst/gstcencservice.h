@@ -0,0 +1,89 @@
+
+/* GStreamer ISO MPEG-DASH common encryption decryption
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_SERVICE_H_
+#define _GST_CENC_SERVICE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Decryption in a separate process, so that keys and cipher state are
+   held by one service per host rather than by every pipeline.
+
+   A client creates a shared memory region with a request descriptor and a
+   data slot for each of n_slots samples, followed by a submission and a
+   completion ring of slot numbers. It passes the region, sealed so that
+   it cannot shrink, and two eventfds to the service over a local socket.
+   To decrypt a batch, the client copies the encrypted bytes of each
+   sample into a slot, puts the slots on the submission ring and signals
+   the first eventfd once. The service decrypts the data of each slot in
+   place, puts the slot on the completion ring and signals the second
+   eventfd once the submission ring is empty. The data of a slot is one
+   contiguous AES-CTR stream, so the clear ranges of a sample never leave
+   the client. */
+
+#define GST_CENC_SERVICE_SLOTS 16
+#define GST_CENC_SERVICE_SLOT_SIZE (4 * 1024 * 1024)
+
+typedef enum {
+  GST_CENC_SERVICE_OK,
+  GST_CENC_SERVICE_PENDING,
+  GST_CENC_SERVICE_NO_KEY,     /* the service has no key for the KID */
+  GST_CENC_SERVICE_INVALID     /* the request does not fit its slot */
+} GstCencServiceStatus;
+
+/* the key is stored under its Marlin file name */
+#define GST_CENC_SERVICE_FLAG_MARLIN (1 << 0)
+
+typedef struct _GstCencServiceRequest {
+  guint8 kid[16];
+  guint8 iv[16];
+  guint32 iv_size;
+  guint32 flags;
+  guint32 size;                 /* bytes of the slot to decrypt */
+  gint status;                  /* a GstCencServiceStatus */
+} GstCencServiceRequest;
+
+typedef struct _GstCencServiceClient GstCencServiceClient;
+
+GstCencServiceClient * gst_cenc_service_client_new(const gchar *path,
+						   GError **error);
+void gst_cenc_service_client_free(GstCencServiceClient *client);
+guint gst_cenc_service_client_get_n_slots(const GstCencServiceClient *client);
+gsize gst_cenc_service_client_get_slot_size(const GstCencServiceClient *client);
+GstCencServiceRequest * gst_cenc_service_client_get_request(GstCencServiceClient *client,
+							    guint slot);
+guint8 * gst_cenc_service_client_get_data(GstCencServiceClient *client,
+					  guint slot);
+gboolean gst_cenc_service_client_run(GstCencServiceClient *client,
+				     guint n_requests, GError **error);
+
+/* the service side, which decrypts the requests of each client in a
+   thread of its own */
+typedef struct _GstCencService GstCencService;
+
+GstCencService * gst_cenc_service_new(const gchar *path,
+				      const gchar *key_directory,
+				      GError **error);
+void gst_cenc_service_free(GstCencService *service);
+
+G_END_DECLS
+#endif
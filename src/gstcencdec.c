@@ -23,6 +23,30 @@
  * Decrypts media that has been encrypted using the ISOBMFF Common Encryption
  * standard.
  *
+ * When transcrypt-kid and transcrypt-key are set, the element re-encrypts
+ * the samples under that key instead of decrypting them. The old and new
+ * key streams are applied together, so the clear data is never written
+ * to memory, and each sample leaves with a GstProtectionMeta that gives
+ * the new KID and an 8 byte IV.
+ *
+ * When digest is set, a CRC32C or SHA-256 of each output sample is
+ * computed while the decrypted data is still in the cache, and attached to
+ * the buffer as a GstCencDigestMeta.
+ *
+ * When validate is set, the start of each decrypted sample is checked
+ * against the bitstream format of the caps (NAL unit headers and lengths,
+ * or the ADTS, MPEG audio or AC-3 sync word). A sample that fails the
+ * check was almost certainly decrypted with the wrong key, so the key is
+ * reloaded, an error is posted and the sample is not pushed downstream.
+ *
+ * When sample-cache-size is set, the clear data of recently decrypted
+ * samples is kept, up to that many bytes, and looked up by the KID, IV,
+ * subsample table and a CRC32C of the encrypted sample. An advert or slate
+ * that is repeated in a stream is then only decrypted once, and later
+ * copies share the memory of the cached sample. CENC never uses a KID and
+ * IV pair for more than one sample, so the CRC32C is only a guard against
+ * packagers that get this wrong. The cache is not used in transcrypt mode.
+ *
  */
 
 #ifdef HAVE_CONFIG_H
@@ -38,14 +62,23 @@
 #include <gst/base/gstbytereader.h>
 #include <gst/gstprotection.h>
 #include <gst/gstaesctr.h>
+#include <gst/gstcenckeyprovider.h>
+#include <gst/gstcencdigest.h>
+#include <gst/gstcenckeyarena.h>
+#include <gst/gstcenckeystore.h>
+#include <gst/gstcenclicense.h>
+#include <gst/gstcencservice.h>
 
 #include <glib.h>
 
-#include <openssl/sha.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
 #include "gstcencdec.h"
+#include "gstcencstats.h"
+#include "gstcencrecorder.h"
+#include "gstcencsamplecache.h"
+#include "gstcencvalidate.h"
 
 GST_DEBUG_CATEGORY_STATIC (gst_cenc_decrypt_debug_category);
 #define GST_CAT_DEFAULT gst_cenc_decrypt_debug_category
@@ -60,28 +93,195 @@ typedef enum
   GST_DRM_UNKNOWN = -1
 } GstCencDrmType;
 
+/* The KID and expanded key are kept in the key arena, in the slot given by
+   index */
 typedef struct _GstCencKeyPair 
 {
-  GBytes *key_id;
   gchar *content_id;
-  GBytes *key;
+  guint index; /* position in the key table and the key arena */
+  gboolean stale; /* failed validation, to be reloaded before it is used */
 } GstCencKeyPair;
 
+/* maximum number of samples of a buffer list decrypted together */
+#define GST_CENC_DECRYPT_MAX_BATCH 16
+
+typedef struct _GstCencCipher
+{
+  const GstCencKeyPair *keypair;
+  guint32 generation; /* of the key in the arena that state was set up with */
+  AesCtrState *state;
+} GstCencCipher;
+
+/* decryption progress through one sample */
+typedef struct _GstCencSample
+{
+  GstBuffer *buf;
+  const GstProtectionMeta *prot_meta;
+  AesCtrState *state;
+  GstMapInfo map;
+  GstBuffer *subsamples_buf;
+  GstMapInfo subsamples_map;
+  GstByteReader reader;
+  guint subsample_count;
+  guint sample_index;
+  gsize pos;
+  gsize digest_pos; /* end of the data added to the digest */
+  /* for the flight recorder */
+  guint kid_index;
+  guint8 iv[16];
+  gsize iv_size;
+  gsize bytes_encrypted;
+  GstClockTime decrypt_time;
+  GstClockTime timestamp; /* when decryption finished */
+  /* mapped for decryption, by state or by the decryption service */
+  gboolean encrypted;
+  guint8 kid[KID_LENGTH]; /* for the decryption service */
+  /* the sample missed the cache, and is added to it once decrypted */
+  gboolean cache_insert;
+  GstCencSampleCacheKey cache_key;
+  /* result of the sample alone, when it is decrypted in a batch */
+  GstFlowReturn ret;
+} GstCencSample;
+
+/* an encrypted range of a sample, gathered into a slot of the decryption
+   service */
+typedef struct _GstCencServiceRange
+{
+  guint slot;
+  guint8 *data;
+  gsize length;
+} GstCencServiceRange;
+
 struct _GstCencDecrypt
 {
   GstBaseTransform parent;
   GPtrArray *keys; /* array of GstCencKeyPair objects */
+  GstCencKeyArena *key_arena;
   GstCencDrmType drm_type;
+  /* key of the most recently decrypted sample */
+  const GstCencKeyPair *last_keypair;
+  GstCencCipher cipher;
+  /* one cipher per sample of a batch from a buffer list */
+  GstCencCipher lanes[GST_CENC_DECRYPT_MAX_BATCH];
+  GstPadChainFunction base_chain;
+  /* QoS values from downstream, protected by the object lock */
+  GstClockTime earliest_time;
+  gdouble proportion;
+  /* QoS statistics, streaming thread only */
+  guint64 processed;
+  guint64 dropped;
+  gboolean skip_to_keyframe;
+  gboolean discont;
+  /* TRUE if the decrypted stream is audio */
+  gboolean is_audio;
+  GstCencStats stats;
+  guint stats_interval; /* milliseconds */
+  GstClockTime last_stats_post;
+  GstCencRecorder *recorder;
+  gchar *flight_recorder_file;
+  gchar *key_directory;
+  /* keys given to the element with the add-key and add-keys signals */
+  GstCencMemoryKeyProvider *memory_keys;
+  /* set by the key-provider property or a GstContext, protected by the
+     object lock */
+  GstCencKeyProvider *key_provider;
+  guint key_timeout; /* milliseconds */
+  gchar *license_url; /* protected by the object lock */
+  /* ClearKey license server, from license-url or the MPD */
+  GstCencLicenseClient *license;
+  /* transcrypt-kid and transcrypt-key, protected by the object lock */
+  gchar *transcrypt_kid_string;
+  gchar *transcrypt_key_string;
+  /* transcrypt mode: the new key, and the KID and IV given to the next
+     sample, or NULL when decrypting */
+  AesCtrState *transcrypt;
+  guint8 transcrypt_kid[KID_LENGTH];
+  guint8 transcrypt_iv[8];
+  GstCencDigestType digest_type; /* protected by the object lock */
+  /* digest of the sample being decrypted, or NULL when disabled */
+  GstCencDigest *digest;
+  gboolean validate; /* protected by the object lock */
+  /* checks for the output caps, streaming thread only */
+  GstCencValidator validator;
+  guint sample_cache_size; /* bytes, protected by the object lock */
+  /* decrypted samples, or NULL when disabled */
+  GstCencSampleCache *sample_cache;
+  gchar *decrypt_service; /* protected by the object lock */
+  /* connection to the decryption service, or NULL to decrypt here */
+  GstCencServiceClient *service;
+  GArray *service_ranges; /* GstCencServiceRange of the current batch */
+  /* signalled when keys are added, or to stop waiting for them */
+  GMutex key_lock;
+  GCond key_cond;
+  gboolean key_flushing;
 };
 
 struct _GstCencDecryptClass
 {
   GstBaseTransformClass parent_class;
+
+  void (*dump_flight_recorder) (GstCencDecrypt * self);
+  gboolean (*add_key) (GstCencDecrypt * self, GBytes * kid, GBytes * key);
+  guint (*add_keys) (GstCencDecrypt * self, const GstStructure * keys);
+};
+
+enum
+{
+  PROP_0,
+  PROP_STATS,
+  PROP_STATS_INTERVAL,
+  PROP_FLIGHT_RECORDER_FILE,
+  PROP_KEY_DIRECTORY,
+  PROP_KEY_PROVIDER,
+  PROP_KEY_TIMEOUT,
+  PROP_LICENSE_URL,
+  PROP_TRANSCRYPT_KID,
+  PROP_TRANSCRYPT_KEY,
+  PROP_DIGEST,
+  PROP_VALIDATE,
+  PROP_SAMPLE_CACHE_SIZE,
+  PROP_DECRYPT_SERVICE
 };
 
+enum
+{
+  SIGNAL_DUMP_FLIGHT_RECORDER,
+  SIGNAL_ADD_KEY,
+  SIGNAL_ADD_KEYS,
+  SIGNAL_NEED_KEY,
+  LAST_SIGNAL
+};
+
+#define DEFAULT_STATS_INTERVAL 0
+#define DEFAULT_FLIGHT_RECORDER_FILE NULL
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_KEY_TIMEOUT 0
+#define DEFAULT_LICENSE_URL NULL
+#define DEFAULT_TRANSCRYPT_KID NULL
+#define DEFAULT_TRANSCRYPT_KEY NULL
+#define DEFAULT_DIGEST GST_CENC_DIGEST_NONE
+#define DEFAULT_VALIDATE FALSE
+#define DEFAULT_SAMPLE_CACHE_SIZE 0
+#define DEFAULT_DECRYPT_SERVICE NULL
+
+static guint gst_cenc_decrypt_signals[LAST_SIGNAL] = { 0 };
+
 /* prototypes */
+static void gst_cenc_decrypt_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_cenc_decrypt_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
 static void gst_cenc_decrypt_dispose (GObject * object);
 static void gst_cenc_decrypt_finalize (GObject * object);
+static void gst_cenc_decrypt_dump_flight_recorder (GstCencDecrypt * self);
+static gboolean gst_cenc_decrypt_add_key (GstCencDecrypt * self, GBytes * kid,
+    GBytes * key);
+static guint gst_cenc_decrypt_add_keys (GstCencDecrypt * self,
+    const GstStructure * keys);
+static GstStateChangeReturn gst_cenc_decrypt_change_state (GstElement *
+    element, GstStateChange transition);
+static void gst_cenc_decrypt_set_context (GstElement * element,
+    GstContext * context);
 
 static gboolean gst_cenc_decrypt_start (GstBaseTransform * trans);
 static gboolean gst_cenc_decrypt_stop (GstBaseTransform * trans);
@@ -91,16 +291,34 @@ static GstCaps *gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
 
 static GstFlowReturn gst_cenc_decrypt_transform_ip (GstBaseTransform * trans,
     GstBuffer * buf);
+static GstFlowReturn gst_cenc_decrypt_chain_list (GstPad * pad,
+    GstObject * parent, GstBufferList * list);
 static const GstCencKeyPair* gst_cenc_decrypt_lookup_key (GstCencDecrypt * self,
     GstBuffer * kid);
 static GstCencKeyPair* gst_cenc_decrypt_get_key (GstCencDecrypt * self, GstBuffer * kid);
 static gboolean gst_cenc_decrypt_sink_event_handler (GstBaseTransform * trans,
     GstEvent * event);
+static gboolean gst_cenc_decrypt_src_event_handler (GstBaseTransform * trans,
+    GstEvent * event);
+static gboolean gst_cenc_decrypt_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static GstFlowReturn gst_cenc_decrypt_submit_input_buffer (
+    GstBaseTransform * trans, gboolean is_discont, GstBuffer * input);
 static gchar* gst_cenc_create_uuid_string (gconstpointer uuid_bytes);
 
 #define M_MPD_PROTECTION_ID "5e629af5-38da-4063-8977-97ffbd9902d4"
 #define M_PSSH_PROTECTION_ID "69f908af-4816-46ea-910c-cd5dcccb0a3a"
 #define CLEARKEY_PROTECTION_ID "e2719d58-a985-b3c9-781a-b030af78d30e"
+/* system ID of the W3C common PSSH box, used for ClearKey in MP4 files */
+#define COMMON_PSSH_PROTECTION_ID "1077efec-c0b2-4d02-ace3-3c1e52e2fb4b"
+
+/* field names of the GstProtectionMeta info structure */
+static GQuark quark_iv_size;
+static GQuark quark_encrypted;
+static GQuark quark_subsample_count;
+static GQuark quark_subsamples;
+static GQuark quark_kid;
+static GQuark quark_iv;
 
 /* pad templates */
 
@@ -136,6 +354,8 @@ static const gchar* gst_cenc_decrypt_protection_ids[] = {
 G_DEFINE_TYPE (GstCencDecrypt, gst_cenc_decrypt, GST_TYPE_BASE_TRANSFORM);
 
 static void gst_cenc_keypair_destroy (gpointer data);
+static void gst_cenc_decrypt_clear_ciphers (GstCencDecrypt * self);
+static void gst_cenc_decrypt_reset_qos (GstCencDecrypt * self);
 
 static void
 gst_cenc_decrypt_class_init (GstCencDecryptClass * klass)
@@ -159,8 +379,156 @@ gst_cenc_decrypt_class_init (GstCencDecryptClass * klass)
   GST_DEBUG_CATEGORY_INIT (gst_cenc_decrypt_debug_category,
       "cencdec", 0, "CENC decryptor");
 
+  quark_iv_size = g_quark_from_static_string ("iv_size");
+  quark_encrypted = g_quark_from_static_string ("encrypted");
+  quark_subsample_count = g_quark_from_static_string ("subsample_count");
+  quark_subsamples = g_quark_from_static_string ("subsamples");
+  quark_kid = g_quark_from_static_string ("kid");
+  quark_iv = g_quark_from_static_string ("iv");
+
+  gobject_class->set_property = gst_cenc_decrypt_set_property;
+  gobject_class->get_property = gst_cenc_decrypt_get_property;
   gobject_class->dispose = gst_cenc_decrypt_dispose;
   gobject_class->finalize = gst_cenc_decrypt_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_STATS,
+      g_param_spec_boxed ("stats", "Statistics",
+          "Decryption statistics: bytes-decrypted, bytes-clear, "
+          "samples-decrypted, samples-clear, samples-dropped, "
+          "samples-invalid, key-cache-hits, key-cache-misses, sample-cache-hits, "
+          "sample-cache-misses, key-load-time, map-time, "
+          "decrypt-time-p50 and decrypt-time-p99 (all times in ns)",
+          GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_STATS_INTERVAL,
+      g_param_spec_uint ("stats-interval", "Statistics interval",
+          "Interval in milliseconds between element messages that carry "
+          "the statistics (0 = disabled)", 0, G_MAXUINT,
+          DEFAULT_STATS_INTERVAL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_FLIGHT_RECORDER_FILE,
+      g_param_spec_string ("flight-recorder-file", "Flight recorder file",
+          "File that the records of the most recent samples are appended "
+          "to when decryption fails, or NULL to write them to the debug log",
+          DEFAULT_FLIGHT_RECORDER_FILE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory that contains the <content-id>.key files",
+          DEFAULT_KEY_DIRECTORY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_PROVIDER,
+      g_param_spec_object ("key-provider", "Key provider",
+          "Provider asked for keys that have not been added with add-key, "
+          "before the key-directory is searched",
+          GST_TYPE_CENC_KEY_PROVIDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_TIMEOUT,
+      g_param_spec_uint ("key-timeout", "Key timeout",
+          "Time in milliseconds to wait for a key to be added after "
+          "emitting need-key (0 = do not wait)", 0, G_MAXUINT,
+          DEFAULT_KEY_TIMEOUT, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LICENSE_URL,
+      g_param_spec_string ("license-url", "License URL",
+          "URL of a ClearKey license server to fetch keys from, overriding "
+          "the Laurl of the MPD", DEFAULT_LICENSE_URL,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TRANSCRYPT_KID,
+      g_param_spec_string ("transcrypt-kid", "Transcrypt KID",
+          "KID as a string of 32 hex digits to re-encrypt the samples "
+          "under, or NULL to decrypt them (applied when the element starts)",
+          DEFAULT_TRANSCRYPT_KID, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_TRANSCRYPT_KEY,
+      g_param_spec_string ("transcrypt-key", "Transcrypt key",
+          "Key of transcrypt-kid as a string of 32 hex digits, which cannot "
+          "be read back (applied when the element starts)",
+          DEFAULT_TRANSCRYPT_KEY, G_PARAM_WRITABLE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_DIGEST,
+      g_param_spec_enum ("digest", "Digest",
+          "Digest of each output sample to attach as a GstCencDigestMeta "
+          "(applied when the element starts)", GST_TYPE_CENC_DIGEST_TYPE,
+          DEFAULT_DIGEST, G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_VALIDATE,
+      g_param_spec_boolean ("validate", "Validate",
+          "Check the start of each decrypted sample, to detect a wrong key",
+          DEFAULT_VALIDATE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_SAMPLE_CACHE_SIZE,
+      g_param_spec_uint ("sample-cache-size", "Sample cache size",
+          "Bytes of decrypted samples to keep for reuse by repeated content "
+          "(0 = disabled, applied when the element starts)", 0, G_MAXUINT,
+          DEFAULT_SAMPLE_CACHE_SIZE, G_PARAM_READWRITE |
+          GST_PARAM_MUTABLE_READY | G_PARAM_STATIC_STRINGS));
+#ifdef HAVE_CENC_SERVICE
+  g_object_class_install_property (gobject_class, PROP_DECRYPT_SERVICE,
+      g_param_spec_string ("decrypt-service", "Decryption service",
+          "Socket of a cenc-decryptd service that holds the keys and "
+          "decrypts the samples, or NULL to decrypt in this process "
+          "(applied when the element starts)", DEFAULT_DECRYPT_SERVICE,
+          G_PARAM_READWRITE | GST_PARAM_MUTABLE_READY |
+          G_PARAM_STATIC_STRINGS));
+#endif
+
+  /**
+   * GstCencDecrypt::dump-flight-recorder:
+   *
+   * Write the records of the most recent samples to the flight-recorder-file,
+   * or the debug log.
+   */
+  gst_cenc_decrypt_signals[SIGNAL_DUMP_FLIGHT_RECORDER] =
+      g_signal_new ("dump-flight-recorder", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstCencDecryptClass, dump_flight_recorder), NULL, NULL,
+      NULL, G_TYPE_NONE, 0);
+  klass->dump_flight_recorder = gst_cenc_decrypt_dump_flight_recorder;
+
+  /**
+   * GstCencDecrypt::add-key:
+   * @kid: the 16 byte key ID
+   * @key: the 16 byte key
+   *
+   * Give the element the key of a KID, so that it does not need to be
+   * read from the key-directory. Keys that are already in use are not
+   * replaced. Returns FALSE if the KID or key has the wrong length.
+   */
+  gst_cenc_decrypt_signals[SIGNAL_ADD_KEY] =
+      g_signal_new ("add-key", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstCencDecryptClass, add_key), NULL, NULL,
+      NULL, G_TYPE_BOOLEAN, 2, G_TYPE_BYTES, G_TYPE_BYTES);
+  klass->add_key = gst_cenc_decrypt_add_key;
+
+  /**
+   * GstCencDecrypt::add-keys:
+   * @keys: a #GstStructure with one field per KID
+   *
+   * Give the element a set of keys in one call. Each field is named after
+   * a KID in hex and holds its key as a hex string, a #GstBuffer or a
+   * #GBytes. Returns the number of keys added.
+   */
+  gst_cenc_decrypt_signals[SIGNAL_ADD_KEYS] =
+      g_signal_new ("add-keys", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST | G_SIGNAL_ACTION,
+      G_STRUCT_OFFSET (GstCencDecryptClass, add_keys), NULL, NULL,
+      NULL, G_TYPE_UINT, 1, GST_TYPE_STRUCTURE);
+  klass->add_keys = gst_cenc_decrypt_add_keys;
+
+  /**
+   * GstCencDecrypt::need-key:
+   * @kid: the 16 byte key ID
+   *
+   * Emitted when the key of a KID is not known. The handler can answer
+   * with add-key, either before it returns or later from another thread,
+   * in which case the element waits for up to key-timeout milliseconds.
+   */
+  gst_cenc_decrypt_signals[SIGNAL_NEED_KEY] =
+      g_signal_new ("need-key", G_TYPE_FROM_CLASS (klass),
+      G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL, G_TYPE_NONE, 1, G_TYPE_BYTES);
+
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_change_state);
+  element_class->set_context =
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_set_context);
   base_transform_class->start = GST_DEBUG_FUNCPTR (gst_cenc_decrypt_start);
   base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_cenc_decrypt_stop);
   base_transform_class->transform_ip =
@@ -169,6 +537,12 @@ gst_cenc_decrypt_class_init (GstCencDecryptClass * klass)
       GST_DEBUG_FUNCPTR (gst_cenc_decrypt_transform_caps);
   base_transform_class->sink_event =
       GST_DEBUG_FUNCPTR (gst_cenc_decrypt_sink_event_handler);
+  base_transform_class->src_event =
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_src_event_handler);
+  base_transform_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_set_caps);
+  base_transform_class->submit_input_buffer =
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_submit_input_buffer);
   base_transform_class->transform_ip_on_passthrough = FALSE;
 }
 
@@ -176,14 +550,192 @@ static void
 gst_cenc_decrypt_init (GstCencDecrypt * self)
 {
   GstBaseTransform *base = GST_BASE_TRANSFORM (self);
+  GstPad *sinkpad = GST_BASE_TRANSFORM_SINK_PAD (self);
   
-  GST_PAD_SET_ACCEPT_TEMPLATE (GST_BASE_TRANSFORM_SINK_PAD (self));
+  GST_PAD_SET_ACCEPT_TEMPLATE (sinkpad);
+  self->base_chain = GST_PAD_CHAINFUNC (sinkpad);
+  gst_pad_set_chain_list_function (sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_decrypt_chain_list));
 
   gst_base_transform_set_in_place (base, TRUE);
   gst_base_transform_set_passthrough (base, FALSE);
   gst_base_transform_set_gap_aware (GST_BASE_TRANSFORM (self), FALSE);
   self->keys = g_ptr_array_new_with_free_func (gst_cenc_keypair_destroy);
+  self->key_arena = gst_cenc_key_arena_new ();
   self->drm_type = GST_DRM_UNKNOWN;
+  self->last_keypair = NULL;
+  gst_cenc_decrypt_reset_qos (self);
+  gst_cenc_stats_reset (&self->stats);
+  self->stats_interval = DEFAULT_STATS_INTERVAL;
+  self->recorder = gst_cenc_recorder_new ();
+  self->flight_recorder_file = g_strdup (DEFAULT_FLIGHT_RECORDER_FILE);
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->memory_keys = gst_cenc_memory_key_provider_new ();
+  self->key_provider = NULL;
+  self->key_timeout = DEFAULT_KEY_TIMEOUT;
+  self->license_url = g_strdup (DEFAULT_LICENSE_URL);
+  self->transcrypt_kid_string = g_strdup (DEFAULT_TRANSCRYPT_KID);
+  self->transcrypt_key_string = g_strdup (DEFAULT_TRANSCRYPT_KEY);
+  self->digest_type = DEFAULT_DIGEST;
+  self->validate = DEFAULT_VALIDATE;
+  self->sample_cache_size = DEFAULT_SAMPLE_CACHE_SIZE;
+  self->decrypt_service = g_strdup (DEFAULT_DECRYPT_SERVICE);
+  self->service_ranges = g_array_new (FALSE, FALSE,
+      sizeof (GstCencServiceRange));
+  g_mutex_init (&self->key_lock);
+  g_cond_init (&self->key_cond);
+}
+
+static void
+gst_cenc_decrypt_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (object);
+
+  switch (prop_id) {
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      self->stats_interval = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_FLIGHT_RECORDER_FILE:
+      GST_OBJECT_LOCK (self);
+      g_free (self->flight_recorder_file);
+      self->flight_recorder_file = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_PROVIDER:
+      GST_OBJECT_LOCK (self);
+      if (self->key_provider)
+        g_object_unref (self->key_provider);
+      self->key_provider = g_value_dup_object (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_TIMEOUT:
+      GST_OBJECT_LOCK (self);
+      self->key_timeout = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LICENSE_URL:
+      GST_OBJECT_LOCK (self);
+      g_free (self->license_url);
+      self->license_url = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TRANSCRYPT_KID:
+      GST_OBJECT_LOCK (self);
+      g_free (self->transcrypt_kid_string);
+      self->transcrypt_kid_string = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TRANSCRYPT_KEY:
+      GST_OBJECT_LOCK (self);
+      g_free (self->transcrypt_key_string);
+      self->transcrypt_key_string = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DIGEST:
+      GST_OBJECT_LOCK (self);
+      self->digest_type = g_value_get_enum (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VALIDATE:
+      GST_OBJECT_LOCK (self);
+      self->validate = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SAMPLE_CACHE_SIZE:
+      GST_OBJECT_LOCK (self);
+      self->sample_cache_size = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DECRYPT_SERVICE:
+      GST_OBJECT_LOCK (self);
+      g_free (self->decrypt_service);
+      self->decrypt_service = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_cenc_decrypt_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (object);
+
+  switch (prop_id) {
+    case PROP_STATS:
+      g_value_take_boxed (value, gst_cenc_stats_to_structure (&self->stats));
+      break;
+    case PROP_STATS_INTERVAL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->stats_interval);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_FLIGHT_RECORDER_FILE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->flight_recorder_file);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->key_directory);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_PROVIDER:
+      GST_OBJECT_LOCK (self);
+      g_value_set_object (value, self->key_provider);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_TIMEOUT:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->key_timeout);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LICENSE_URL:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->license_url);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_TRANSCRYPT_KID:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->transcrypt_kid_string);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DIGEST:
+      GST_OBJECT_LOCK (self);
+      g_value_set_enum (value, self->digest_type);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_VALIDATE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->validate);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_SAMPLE_CACHE_SIZE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->sample_cache_size);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_DECRYPT_SERVICE:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->decrypt_service);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
 }
 
 void
@@ -191,10 +743,18 @@ gst_cenc_decrypt_dispose (GObject * object)
 {
   GstCencDecrypt *self = GST_CENC_DECRYPT (object);
 
+  gst_cenc_decrypt_clear_ciphers (self);
   if (self->keys) {
     g_ptr_array_unref (self->keys);
     self->keys = NULL;
   }
+  if (self->key_arena) {
+    gst_cenc_key_arena_free (self->key_arena);
+    self->key_arena = NULL;
+  }
+  g_clear_object (&self->memory_keys);
+  g_clear_object (&self->key_provider);
+  g_clear_object (&self->license);
 
   G_OBJECT_CLASS (parent_class)->dispose (object);
 }
@@ -202,19 +762,159 @@ gst_cenc_decrypt_dispose (GObject * object)
 void
 gst_cenc_decrypt_finalize (GObject * object)
 {
-  /* GstCencDecrypt *self = GST_CENC_DECRYPT (object); */
+  GstCencDecrypt *self = GST_CENC_DECRYPT (object);
 
-  /* clean up object here */
+  gst_cenc_recorder_free (self->recorder);
+  g_free (self->flight_recorder_file);
+  g_free (self->key_directory);
+  g_free (self->license_url);
+  g_free (self->transcrypt_kid_string);
+  g_free (self->transcrypt_key_string);
+  g_free (self->decrypt_service);
+  g_array_free (self->service_ranges, TRUE);
+  g_mutex_clear (&self->key_lock);
+  g_cond_clear (&self->key_cond);
 
   G_OBJECT_CLASS (parent_class)->finalize (object);
 }
 
+/* Parse a hex string, ignoring any '-' characters as found in UUIDs */
+static gboolean
+gst_cenc_decrypt_parse_hex (const gchar * string, guint8 * bytes,
+    gsize length)
+{
+  gsize i = 0;
+
+  while (string && *string) {
+    gint hi, lo;
+
+    if (*string == '-') {
+      ++string;
+      continue;
+    }
+    hi = g_ascii_xdigit_value (string[0]);
+    lo = hi < 0 ? -1 : g_ascii_xdigit_value (string[1]);
+    if (lo < 0 || i == length)
+      return FALSE;
+    bytes[i++] = (hi << 4) | lo;
+    string += 2;
+  }
+  return i == length;
+}
+
+/* Connect to the decryption service at path. The new key of transcrypt
+   mode would have to be held here, so the two cannot be combined. Without
+   the service, which needs Linux, decrypt-service is never set. */
+static gboolean
+gst_cenc_decrypt_service_connect (GstCencDecrypt * self, const gchar * path,
+    gboolean transcrypt)
+{
+#ifdef HAVE_CENC_SERVICE
+  GError *err = NULL;
+
+  if (transcrypt) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("transcrypt-kid cannot be used with decrypt-service"), (NULL));
+    return FALSE;
+  }
+  self->service = gst_cenc_service_client_new (path, &err);
+  if (!self->service) {
+    GST_ELEMENT_ERROR (self, RESOURCE, OPEN_READ_WRITE,
+        ("Failed to connect to the decryption service"),
+        ("%s", err->message));
+    g_clear_error (&err);
+    return FALSE;
+  }
+  GST_DEBUG_OBJECT (self, "decrypting with the service at %s", path);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Set up the new key when transcrypt-kid is set */
+static gboolean
+gst_cenc_decrypt_transcrypt_setup (GstCencDecrypt * self)
+{
+  guint8 key[KEY_LENGTH];
+  GBytes *key_bytes, *iv_bytes;
+  gboolean enabled, valid;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  enabled = self->transcrypt_kid_string != NULL;
+  valid = gst_cenc_decrypt_parse_hex (self->transcrypt_kid_string,
+      self->transcrypt_kid, KID_LENGTH) &&
+      gst_cenc_decrypt_parse_hex (self->transcrypt_key_string, key,
+      KEY_LENGTH);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!enabled)
+    return TRUE;
+  if (!valid) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("Invalid transcrypt-kid or transcrypt-key"), (NULL));
+    return FALSE;
+  }
+  for (i = 0; i < sizeof (self->transcrypt_iv); ++i) {
+    self->transcrypt_iv[i] = g_random_int_range (0, 256);
+  }
+  key_bytes = g_bytes_new (key, KEY_LENGTH);
+  iv_bytes = g_bytes_new (self->transcrypt_iv, sizeof (self->transcrypt_iv));
+  self->transcrypt = gst_aes_ctr_decrypt_new (key_bytes, iv_bytes);
+  g_bytes_unref (key_bytes);
+  g_bytes_unref (iv_bytes);
+  if (!self->transcrypt) {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT,
+        ("Failed to init AES cipher"), (NULL));
+    return FALSE;
+  }
+  return TRUE;
+}
+
 static gboolean
 gst_cenc_decrypt_start (GstBaseTransform * trans)
 {
   GstCencDecrypt *self = GST_CENC_DECRYPT (trans);
+  GstCencDigestType digest_type;
+  guint sample_cache_size;
+  gboolean have_provider, transcrypt;
+  gchar *decrypt_service;
+
   GST_DEBUG_OBJECT (self, "start");
-  return TRUE;
+  gst_cenc_decrypt_reset_qos (self);
+  self->processed = 0;
+  self->dropped = 0;
+  self->last_stats_post = gst_util_get_timestamp ();
+
+  /* let the application share one key provider between elements */
+  GST_OBJECT_LOCK (self);
+  have_provider = self->key_provider != NULL;
+  digest_type = self->digest_type;
+  sample_cache_size = self->sample_cache_size;
+  transcrypt = self->transcrypt_kid_string != NULL;
+  decrypt_service = g_strdup (self->decrypt_service);
+  GST_OBJECT_UNLOCK (self);
+  if (decrypt_service && !gst_cenc_decrypt_service_connect (self,
+          decrypt_service, transcrypt)) {
+    g_free (decrypt_service);
+    return FALSE;
+  }
+  g_free (decrypt_service);
+  if (digest_type != GST_CENC_DIGEST_NONE) {
+    self->digest = gst_cenc_digest_new (digest_type);
+  }
+  /* transcrypted samples are still encrypted, so there is nothing to
+     share between copies */
+  if (sample_cache_size > 0 && !transcrypt) {
+    self->sample_cache = gst_cenc_sample_cache_new (sample_cache_size);
+  }
+  if (!have_provider) {
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_need_context (GST_OBJECT (self),
+            GST_CENC_KEY_PROVIDER_CONTEXT_TYPE));
+  }
+  return gst_cenc_decrypt_transcrypt_setup (self);
 }
 
 static gboolean
@@ -222,6 +922,23 @@ gst_cenc_decrypt_stop (GstBaseTransform * trans)
 {
   GstCencDecrypt *self = GST_CENC_DECRYPT (trans);
   GST_DEBUG_OBJECT (self, "stop");
+  gst_cenc_decrypt_clear_ciphers (self);
+  if (self->transcrypt) {
+    gst_aes_ctr_decrypt_unref (self->transcrypt);
+    self->transcrypt = NULL;
+  }
+  if (self->digest) {
+    gst_cenc_digest_free (self->digest);
+    self->digest = NULL;
+  }
+  if (self->sample_cache) {
+    gst_cenc_sample_cache_free (self->sample_cache);
+    self->sample_cache = NULL;
+  }
+#ifdef HAVE_CENC_SERVICE
+  gst_cenc_service_client_free (self->service);
+  self->service = NULL;
+#endif
   return TRUE;
 }
 
@@ -286,11 +1003,19 @@ static GstCaps *
 gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
     GstPadDirection direction, GstCaps * caps, GstCaps * filter)
 {
+  GstCencDecrypt *self = GST_CENC_DECRYPT (base);
   GstCaps *res = NULL;
+  gboolean transcrypt;
   gint i, j;
 
   g_return_val_if_fail (direction != GST_PAD_UNKNOWN, NULL);
 
+  /* when transcrypting, the output is still encrypted, but with a
+     ClearKey key */
+  GST_OBJECT_LOCK (self);
+  transcrypt = self->transcrypt_kid_string != NULL;
+  GST_OBJECT_UNLOCK (self);
+
   GST_DEBUG_OBJECT (base, "direction: %s   caps: %" GST_PTR_FORMAT "   filter:"
       " %" GST_PTR_FORMAT, (direction == GST_PAD_SRC) ? "Src" : "Sink",
       caps, filter);
@@ -313,6 +1038,12 @@ gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
         continue;
 
       out = gst_structure_copy (in);
+      if (transcrypt) {
+        gst_structure_set (out, "protection-system", G_TYPE_STRING,
+            CLEARKEY_PROTECTION_ID, NULL);
+        gst_cenc_decrypt_append_if_not_duplicate(res, out);
+        continue;
+      }
       n_fields = gst_structure_n_fields (in);
 
       gst_structure_set_name (out,
@@ -334,6 +1065,9 @@ gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
       gint n_fields;
       GstStructure *tmp = NULL;
       guint p;
+
+      if (transcrypt && !gst_structure_has_name (in, "application/x-cenc"))
+        continue;
       tmp = gst_structure_copy (in);
       gst_cenc_remove_codec_fields (tmp);
       for(p=0; gst_cenc_decrypt_protection_ids[p]; ++p){
@@ -344,9 +1078,13 @@ gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
         out = gst_structure_copy (tmp);
         gst_structure_set (out,
                            "protection-system", G_TYPE_STRING, gst_cenc_decrypt_protection_ids[p],
-                           "original-media-type", G_TYPE_STRING, gst_structure_get_name (in),
                            NULL);
-        gst_structure_set_name (out, "application/x-cenc");
+        if (!transcrypt) {
+          gst_structure_set (out,
+                             "original-media-type", G_TYPE_STRING, gst_structure_get_name (in),
+                             NULL);
+          gst_structure_set_name (out, "application/x-cenc");
+        }
         gst_cenc_decrypt_append_if_not_duplicate(res, out);
       }
       gst_structure_free (tmp);
@@ -371,18 +1109,30 @@ gst_cenc_decrypt_transform_caps (GstBaseTransform * base,
   return res;
 }
 
-static gchar *
-gst_cenc_bytes_to_hexstring (gconstpointer bytes, guint length)
+static gboolean
+gst_cenc_decrypt_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
 {
-  const guint8 *data = (const guint8 *) bytes;
-  gchar *string = g_malloc0 ((2 * length) + 1);
-  guint i;
-
-  for (i = 0; i < length; ++i) {
-    g_snprintf (string + (2 * i), 3, "%02x", data[i]);
+  GstCencDecrypt *self = GST_CENC_DECRYPT (trans);
+  const GstStructure *s = gst_caps_get_structure (outcaps, 0);
+  const gchar *media_type;
+  gboolean validate;
+
+  media_type = gst_structure_get_string (s, "original-media-type");
+  if (!media_type)
+    media_type = gst_structure_get_name (s);
+  self->is_audio = g_str_has_prefix (media_type, "audio/");
+  /* there is nothing to check when the output is still encrypted */
+  GST_OBJECT_LOCK (self);
+  validate = self->validate;
+  GST_OBJECT_UNLOCK (self);
+  if (!validate || gst_structure_has_field (s, "original-media-type")) {
+    self->validator.type = GST_CENC_VALIDATOR_NONE;
+  } else {
+    gst_cenc_validator_init (&self->validator, s);
   }
-
-  return string;
+  GST_DEBUG_OBJECT (self, "output caps %" GST_PTR_FORMAT, outcaps);
+  return TRUE;
 }
 
 static gchar *
@@ -437,66 +1187,247 @@ gst_cenc_decrypt_key_id_from_content_id(GstCencDecrypt * self, const gchar *cont
   return kid;
 }
 
+/* The license server client, which the license-url property selects in
+   preference to the Laurl of the MPD */
+static GstCencLicenseClient *
+gst_cenc_decrypt_get_license (GstCencDecrypt * self)
+{
+  gchar *url;
+
+  GST_OBJECT_LOCK (self);
+  url = g_strdup (self->license_url);
+  GST_OBJECT_UNLOCK (self);
+  if (url && *url && (!self->license || g_strcmp0 (url,
+              gst_cenc_license_client_get_url (self->license)) != 0)) {
+    if (self->license)
+      g_object_unref (self->license);
+    self->license = gst_cenc_license_client_get (url);
+  }
+  g_free (url);
+  return self->license;
+}
+
+/* Request the keys of all the KIDs of a PSSH box or MPD from the license
+   server in one go, without waiting for them */
+static void
+gst_cenc_decrypt_prefetch_keys (GstCencDecrypt * self, GPtrArray * kids)
+{
+  GstCencLicenseClient *license;
+
+  /* the keys are the business of the decryption service */
+  if (self->service)
+    return;
+  license = gst_cenc_decrypt_get_license (self);
+  if (license && kids->len) {
+    GST_DEBUG_OBJECT (self, "requesting %u keys from %s", kids->len,
+        gst_cenc_license_client_get_url (license));
+    gst_cenc_license_client_request (license, (GBytes **) kids->pdata,
+        kids->len);
+  }
+}
+
+/* Look for a key in the keys added to the element, then the key provider,
+   then the license server, then the key directory */
+static GBytes *
+gst_cenc_decrypt_find_key (GstCencDecrypt * self, const guint8 * kid,
+    GError ** err)
+{
+  GstCencKeyProvider *provider;
+  GstCencKeyNaming naming;
+  gchar *key_directory;
+  GBytes *key;
+
+  key = gst_cenc_key_provider_get_key (GST_CENC_KEY_PROVIDER
+      (self->memory_keys), kid);
+  if (key)
+    return key;
+
+  GST_OBJECT_LOCK (self);
+  provider = self->key_provider ? g_object_ref (self->key_provider) : NULL;
+  key_directory = g_strdup (self->key_directory);
+  GST_OBJECT_UNLOCK (self);
+
+  if (provider) {
+    key = gst_cenc_key_provider_get_key (provider, kid);
+    g_object_unref (provider);
+  }
+  if (!key && gst_cenc_decrypt_get_license (self)) {
+    key = gst_cenc_key_provider_get_key (GST_CENC_KEY_PROVIDER
+        (self->license), kid);
+  }
+  if (!key) {
+    /* Marlin key files are named after the sha1 hash of the content id,
+       others after the hex representation of the KID */
+    naming = (self->drm_type == GST_DRM_MARLIN) ?
+        GST_CENC_KEY_NAMING_MARLIN : GST_CENC_KEY_NAMING_CLEARKEY;
+    key = gst_cenc_key_store_load (key_directory, kid, naming, err);
+  }
+  g_free (key_directory);
+  return key;
+}
+
+/* Ask the application for a key with the need-key signal, and wait for up
+   to key-timeout for it to be added */
+static GBytes *
+gst_cenc_decrypt_request_key (GstCencDecrypt * self, GBytes * kid)
+{
+  const guint8 *kid_data = g_bytes_get_data (kid, NULL);
+  GstCencKeyProvider *memory_keys = GST_CENC_KEY_PROVIDER (self->memory_keys);
+  GBytes *key;
+  gint64 deadline;
+  guint timeout;
+
+  GST_OBJECT_LOCK (self);
+  timeout = self->key_timeout;
+  GST_OBJECT_UNLOCK (self);
+
+  g_signal_emit (self, gst_cenc_decrypt_signals[SIGNAL_NEED_KEY], 0, kid);
+
+  deadline = g_get_monotonic_time () + timeout * G_TIME_SPAN_MILLISECOND;
+  g_mutex_lock (&self->key_lock);
+  while (!(key = gst_cenc_key_provider_get_key (memory_keys, kid_data))
+      && !self->key_flushing
+      && g_cond_wait_until (&self->key_cond, &self->key_lock, deadline));
+  g_mutex_unlock (&self->key_lock);
+  if (!key)
+    key = gst_cenc_decrypt_find_key (self, kid_data, NULL);
+  return key;
+}
+
 static GstCencKeyPair *
 gst_cenc_decrypt_get_key (GstCencDecrypt * self, GstBuffer * key_id)
 {
-  guint8 key[KEY_LENGTH] = { 0 };
-  guint8 hash[SHA_DIGEST_LENGTH] = { 0 };
-  gchar *hash_string;
-  gchar *path;
-  size_t bytes_read = 0;
-  FILE *key_file = NULL;
-  GstMapInfo info;
+  GError *err = NULL;
+  guint8 kid[KID_LENGTH];
   GstCencKeyPair *kp;
+  GBytes *key;
+  gint slot;
 
-  if(!gst_buffer_map(key_id, &info, GST_MAP_READ))
+  if (gst_buffer_extract (key_id, 0, kid, KID_LENGTH) != KID_LENGTH)
     return NULL;
-  kp = g_new0 (GstCencKeyPair, 1);
-  kp->key_id = g_bytes_new (info.data, KID_LENGTH);
-  kp->content_id = gst_cenc_create_content_id (self, info.data);
-  gst_buffer_unmap(key_id, &info);
 
-  GST_DEBUG_OBJECT (self, "Content ID: %s", kp->content_id);
+  key = gst_cenc_decrypt_find_key (self, kid, &err);
+  if (!key) {
+    GBytes *kid_bytes = g_bytes_new (kid, KID_LENGTH);
 
-  if (self->drm_type == GST_DRM_MARLIN) {
-    /* Perform sha1 hash of content id. */
-    SHA1 ((const unsigned char *) kp->content_id, 47, hash);
-    hash_string = gst_cenc_bytes_to_hexstring (hash, SHA_DIGEST_LENGTH);
+    GST_DEBUG_OBJECT (self, "Requesting key: %s", err->message);
+    key = gst_cenc_decrypt_request_key (self, kid_bytes);
+    g_bytes_unref (kid_bytes);
   }
-  else {
-    /* content_id is a hex representation of the KID */
-    hash_string = g_strdup (kp->content_id);
-  }
-  GST_DEBUG_OBJECT (self, "Hash: %s", hash_string);
 
-  /* Read contents of file with the hash as its name. */
-  path = g_strconcat ("/tmp/", hash_string, ".key", NULL);
-  g_free (hash_string);
-  GST_DEBUG_OBJECT (self, "Opening file: %s", path);
-  key_file = fopen (path, "rb");
-
-  if (!key_file) {
-    GST_ERROR_OBJECT (self, "Failed to open keyfile: %s", path);
-    goto error;
+  if (!key || g_bytes_get_size (key) != KEY_LENGTH) {
+    GST_ERROR_OBJECT (self, "Failed to load key: %s",
+        err ? err->message : "wrong length");
+    g_clear_error (&err);
+    if (key)
+      g_bytes_unref (key);
+    return NULL;
   }
+  g_clear_error (&err);
 
-  bytes_read = fread (key, 1, KEY_LENGTH, key_file);
-  fclose (key_file);
-
-  if (bytes_read != KEY_LENGTH) {
-    GST_ERROR_OBJECT (self, "Failed to read key from file %s", path);
-    goto error;
+  slot = gst_cenc_key_arena_add (self->key_arena, kid,
+      g_bytes_get_data (key, NULL));
+  g_bytes_unref (key);
+  if (slot == GST_CENC_KEY_ARENA_NO_SLOT) {
+    GST_ERROR_OBJECT (self, "Failed to add the key to the key arena");
+    return NULL;
+  }
+  if ((guint) slot < self->keys->len) {
+    /* the KID was already known, so only its key has been replaced */
+    kp = g_ptr_array_index (self->keys, slot);
+    kp->stale = FALSE;
+    return kp;
   }
-  g_free (path);
 
-  kp->key = g_bytes_new (key, KEY_LENGTH);
+  kp = g_new0 (GstCencKeyPair, 1);
+  kp->content_id = gst_cenc_create_content_id (self, kid);
+  GST_DEBUG_OBJECT (self, "Content ID: %s", kp->content_id);
+  /* keys are never removed from the arena, so its slots are handed out in
+     the order of the key table */
+  kp->index = slot;
+  g_assert (kp->index == self->keys->len);
   g_ptr_array_add (self->keys, kp);
 
   return kp;
-error:
-  g_free (path);
-  gst_cenc_keypair_destroy (kp);
-  return NULL;
+}
+
+static void
+gst_cenc_decrypt_keys_added (GstCencDecrypt * self)
+{
+  g_mutex_lock (&self->key_lock);
+  g_cond_broadcast (&self->key_cond);
+  g_mutex_unlock (&self->key_lock);
+}
+
+static gboolean
+gst_cenc_decrypt_add_key (GstCencDecrypt * self, GBytes * kid, GBytes * key)
+{
+  if (!kid || !key)
+    return FALSE;
+  if (!gst_cenc_memory_key_provider_add_key (self->memory_keys, kid, key))
+    return FALSE;
+  gst_cenc_decrypt_keys_added (self);
+  return TRUE;
+}
+
+static guint
+gst_cenc_decrypt_add_keys (GstCencDecrypt * self, const GstStructure * keys)
+{
+  guint added;
+
+  if (!keys)
+    return 0;
+  added = gst_cenc_memory_key_provider_add_keys (self->memory_keys, keys);
+  GST_DEBUG_OBJECT (self, "added %u keys", added);
+  if (added)
+    gst_cenc_decrypt_keys_added (self);
+  return added;
+}
+
+static void
+gst_cenc_decrypt_set_key_flushing (GstCencDecrypt * self, gboolean flushing)
+{
+  g_mutex_lock (&self->key_lock);
+  self->key_flushing = flushing;
+  g_cond_broadcast (&self->key_cond);
+  g_mutex_unlock (&self->key_lock);
+}
+
+static GstStateChangeReturn
+gst_cenc_decrypt_change_state (GstElement * element, GstStateChange transition)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (element);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      gst_cenc_decrypt_set_key_flushing (self, FALSE);
+      break;
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* stop waiting for keys so that the streaming thread can finish */
+      gst_cenc_decrypt_set_key_flushing (self, TRUE);
+      break;
+    default:
+      break;
+  }
+  return GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+}
+
+static void
+gst_cenc_decrypt_set_context (GstElement * element, GstContext * context)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (element);
+  GstCencKeyProvider *provider;
+
+  provider = gst_cenc_key_provider_from_context (context);
+  if (provider) {
+    GST_DEBUG_OBJECT (self, "using key provider %" GST_PTR_FORMAT, provider);
+    GST_OBJECT_LOCK (self);
+    if (self->key_provider)
+      g_object_unref (self->key_provider);
+    self->key_provider = provider;
+    GST_OBJECT_UNLOCK (self);
+  }
+  GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
 }
 
 static gchar *
@@ -517,13 +1448,43 @@ gst_cenc_create_uuid_string (gconstpointer uuid_bytes)
   return uuid_string;
 }
 
+/* Load the key of a key pair that failed validation again, in case it has
+   been replaced since it was loaded */
+static const GstCencKeyPair*
+gst_cenc_decrypt_reload_key (GstCencDecrypt * self, GstCencKeyPair * kp)
+{
+  guint8 kid[KID_LENGTH];
+  GBytes *key;
+
+  GST_DEBUG_OBJECT (self, "Reloading key: %s", kp->content_id);
+  memcpy (kid, gst_cenc_key_arena_get_kid (self->key_arena, kp->index),
+      KID_LENGTH);
+  key = gst_cenc_decrypt_find_key (self, kid, NULL);
+  if (!key) {
+    GBytes *kid_bytes = g_bytes_new (kid, KID_LENGTH);
+
+    key = gst_cenc_decrypt_request_key (self, kid_bytes);
+    g_bytes_unref (kid_bytes);
+  }
+  if (!key)
+    return NULL;
+  if (g_bytes_get_size (key) != KEY_LENGTH) {
+    g_bytes_unref (key);
+    return NULL;
+  }
+  /* the ciphers notice that the generation of the slot has changed */
+  gst_cenc_key_arena_add (self->key_arena, kid, g_bytes_get_data (key, NULL));
+  g_bytes_unref (key);
+  kp->stale = FALSE;
+  return kp;
+}
+
 static const GstCencKeyPair*
 gst_cenc_decrypt_lookup_key (GstCencDecrypt * self, GstBuffer * kid)
 {
-  GstMapInfo info;
   const GstCencKeyPair *kp=NULL;
-  int i;
-  gsize sz;
+  guint8 kid_bytes[KID_LENGTH];
+  gint slot;
 
   /*
     GstMapInfo info;
@@ -534,198 +1495,1015 @@ gst_cenc_decrypt_lookup_key (GstCencDecrypt * self, GstBuffer * kid)
     g_free (id_string);
     gst_buffer_unmap (kid, &info);
   */
-  for (i = 0; kp==NULL && i < self->keys->len; ++i) {
-    const GstCencKeyPair *k;
-    k = g_ptr_array_index (self->keys, i);
-    if(gst_buffer_memcmp (kid, 0, g_bytes_get_data (k->key_id, NULL), KEY_LENGTH)==0){
-      kp=k;
-    }
+  if (gst_buffer_extract (kid, 0, kid_bytes, KID_LENGTH) != KID_LENGTH)
+    return NULL;
+  if (self->last_keypair && !self->last_keypair->stale &&
+      memcmp (kid_bytes, gst_cenc_key_arena_get_kid (self->key_arena,
+              self->last_keypair->index), KID_LENGTH) == 0) {
+    gst_cenc_stats_add (self->stats.key_cache_hits, 1);
+    return self->last_keypair;
+  }
+  slot = gst_cenc_key_arena_lookup (self->key_arena, kid_bytes);
+  if (slot != GST_CENC_KEY_ARENA_NO_SLOT) {
+    kp = g_ptr_array_index (self->keys, slot);
   }
-  if (!kp) {
+  if (kp && kp->stale) {
+    kp = gst_cenc_decrypt_reload_key (self, (GstCencKeyPair *) kp);
+  }
+  else if (kp) {
+    gst_cenc_stats_add (self->stats.key_cache_hits, 1);
+  }
+  else {
+    GstClockTime start = gst_util_get_timestamp ();
+
     kp = gst_cenc_decrypt_get_key (self, kid);
+    gst_cenc_stats_add (self->stats.key_cache_misses, 1);
+    gst_cenc_stats_add (self->stats.key_load_time,
+        gst_util_get_timestamp () - start);
   }
+  self->last_keypair = kp;
 
   return kp;
 }
 
+static void
+gst_cenc_decrypt_cipher_clear (GstCencCipher * cipher)
+{
+  cipher->keypair = NULL;
+  cipher->generation = 0;
+  if (cipher->state) {
+    gst_aes_ctr_decrypt_unref (cipher->state);
+    cipher->state = NULL;
+  }
+}
+
+/* Select the cipher for a sample. A cipher keeps its AES state for the
+   life of the element, and is re-keyed from the schedule in the key arena
+   only when the key changes, so that most samples only reset the counter. */
+static AesCtrState *
+gst_cenc_decrypt_cipher_setup (GstCencCipher * cipher,
+    const GstCencKeyArena * arena, const GstCencKeyPair * keypair,
+    const guint8 * iv, gsize iv_length)
+{
+  const guint8 *schedule = gst_cenc_key_arena_get_schedule (arena,
+      keypair->index);
+  guint32 generation = gst_cenc_key_arena_get_generation (arena,
+      keypair->index);
+
+  if (!cipher->state) {
+    cipher->state = gst_aes_ctr_decrypt_new_from_schedule (schedule, iv,
+        iv_length);
+    if (!cipher->state)
+      return NULL;
+  } else {
+    /* generations are unique within the arena, so this also catches a
+       change of KID */
+    if (generation != cipher->generation)
+      gst_aes_ctr_decrypt_set_key (cipher->state, schedule);
+    if (!gst_aes_ctr_decrypt_set_iv (cipher->state, iv, iv_length))
+      return NULL;
+  }
+  cipher->keypair = keypair;
+  cipher->generation = generation;
+  return cipher->state;
+}
+
+/* Look for the clear data of a mapped sample in the sample cache. On a hit
+   the memory of the sample is replaced with the cached data and TRUE is
+   returned, otherwise the sample is marked to be added to the cache once it
+   has been decrypted. */
+static gboolean
+gst_cenc_decrypt_sample_cache_lookup (GstCencDecrypt * self,
+    GstCencSample * sample, GstBuffer * key_id)
+{
+  GstCencSampleCacheKey *key = &sample->cache_key;
+  GstMemory *memory;
+
+  /* the key is hashed and compared as raw bytes */
+  memset (key, 0, sizeof (GstCencSampleCacheKey));
+  gst_buffer_extract (key_id, 0, key->kid, sizeof (key->kid));
+  memcpy (key->iv, sample->iv, sample->iv_size);
+  key->size = sample->map.size;
+  key->subsample_count = sample->subsample_count;
+  if (sample->subsamples_buf) {
+    key->layout = gst_cenc_crc32c (0, sample->subsamples_map.data,
+        sample->subsamples_map.size);
+  }
+  key->digest = gst_cenc_crc32c (0, sample->map.data, sample->map.size);
+
+  memory = gst_cenc_sample_cache_lookup (self->sample_cache, key);
+  if (!memory) {
+    gst_cenc_stats_add (self->stats.sample_cache_misses, 1);
+    sample->cache_insert = TRUE;
+    return FALSE;
+  }
+  GST_TRACE_OBJECT (self, "sample %d found in cache", (gint) sample->map.size);
+  gst_cenc_stats_add (self->stats.sample_cache_hits, 1);
+  gst_buffer_unmap (sample->buf, &sample->map);
+  gst_buffer_replace_all_memory (sample->buf, memory);
+  return TRUE;
+}
+
+/* Parse the protection meta of a sample, set up its cipher and map it for
+   decryption. Clear samples are left unmapped with sample->encrypted FALSE.
+   With the decryption service there is no cipher, and sample->state is
+   NULL. */
 static GstFlowReturn
-gst_cenc_decrypt_transform_ip (GstBaseTransform * base, GstBuffer * buf)
+gst_cenc_decrypt_sample_begin (GstCencDecrypt * self, GstBuffer * buf,
+    GstCencSample * sample, GstCencCipher * cipher)
 {
-  GstCencDecrypt *self = GST_CENC_DECRYPT (base);
   GstFlowReturn ret = GST_FLOW_OK;
-  GstMapInfo map, iv_map;
   const GstCencKeyPair *keypair;
-  const GstProtectionMeta *prot_meta = NULL;
-  guint pos = 0;
-  gint sample_index = 0;
-  guint subsample_count;
-  AesCtrState *state = NULL;
   guint iv_size;
   gboolean encrypted;
   const GValue *value;
   GstBuffer *key_id = NULL;
   GstBuffer *iv_buf = NULL;
-  GBytes *iv_bytes = NULL;
-  GstBuffer *subsamples_buf = NULL;
-  GstMapInfo subsamples_map;
-  GstByteReader *reader=NULL;
-
-  GST_TRACE_OBJECT (self, "decrypt in-place");
-  prot_meta = (GstProtectionMeta*) gst_buffer_get_protection_meta (buf);
-  if (!prot_meta || !buf) {
-    if (!prot_meta) {
-      GST_ERROR_OBJECT (self, "Failed to get GstProtection metadata from buffer");
-    }
-    if (!buf) {
-      GST_ERROR_OBJECT (self, "Failed to get writable buffer");
-    }
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto out;
+  guint8 iv[16];
+  gsize iv_length;
+  GstClockTime start;
+
+  memset (sample, 0, sizeof (GstCencSample));
+  sample->buf = buf;
+  sample->kid_index = GST_CENC_RECORDER_NO_KID;
+  sample->prot_meta = (GstProtectionMeta*) gst_buffer_get_protection_meta (buf);
+  if (!sample->prot_meta) {
+    GST_ERROR_OBJECT (self, "Failed to get GstProtection metadata from buffer");
+    return GST_FLOW_NOT_SUPPORTED;
   }
 
-  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
-    GST_ERROR_OBJECT (self, "Failed to map buffer");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
-  }
-
-  GST_TRACE_OBJECT (self, "decrypt sample %d", (gint)map.size);
-  if(!gst_structure_get_uint(prot_meta->info,"iv_size",&iv_size)){
-    GST_ERROR_OBJECT (self, "failed to get iv_size");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
-  }
-  if(!gst_structure_get_boolean(prot_meta->info,"encrypted",&encrypted)){
-    GST_ERROR_OBJECT (self, "failed to get encrypted flag");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+  if(!gst_structure_id_get (sample->prot_meta->info,
+                            quark_iv_size, G_TYPE_UINT, &iv_size,
+                            quark_encrypted, G_TYPE_BOOLEAN, &encrypted,
+                            NULL)){
+    GST_ERROR_OBJECT (self, "failed to get iv_size or encrypted flag");
+    return GST_FLOW_NOT_SUPPORTED;
   }
   if (iv_size == 0 || !encrypted) {
     /* sample is not encrypted */
-    goto beach;
+    gst_cenc_stats_add (self->stats.samples_clear, 1);
+    gst_cenc_stats_add (self->stats.bytes_clear, gst_buffer_get_size (buf));
+    return GST_FLOW_OK;
   }
-  GST_DEBUG_OBJECT (base, "protection meta: %" GST_PTR_FORMAT, prot_meta->info);
-  if(!gst_structure_get_uint(prot_meta->info,"subsample_count",&subsample_count)){
+  GST_LOG_OBJECT (self, "protection meta: %" GST_PTR_FORMAT,
+      sample->prot_meta->info);
+  value = gst_structure_id_get_value (sample->prot_meta->info,
+      quark_subsample_count);
+  if(!value){
     GST_ERROR_OBJECT (self, "failed to get subsample_count");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+    return GST_FLOW_NOT_SUPPORTED;
   }
-  value = gst_structure_get_value (prot_meta->info, "kid");
+  sample->subsample_count = g_value_get_uint (value);
+  value = gst_structure_id_get_value (sample->prot_meta->info, quark_kid);
   if(!value){
     GST_ERROR_OBJECT (self, "Failed to get KID for sample");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+    return GST_FLOW_NOT_SUPPORTED;
   }
   key_id = gst_value_get_buffer (value);
 
-  value = gst_structure_get_value (prot_meta->info, "iv");
+  value = gst_structure_id_get_value (sample->prot_meta->info, quark_iv);
   if(!value){
     GST_ERROR_OBJECT (self, "Failed to get IV for sample");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+    return GST_FLOW_NOT_SUPPORTED;
   }
   iv_buf = gst_value_get_buffer (value);
-  if(!gst_buffer_map (iv_buf, &iv_map, GST_MAP_READ)){
-    GST_ERROR_OBJECT (self, "Failed to map IV");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
-  }
-  iv_bytes = g_bytes_new (iv_map.data, iv_map.size);
-  gst_buffer_unmap (iv_buf, &iv_map);
-  if(subsample_count){
-    value = gst_structure_get_value (prot_meta->info, "subsamples");
+  iv_length = gst_buffer_extract (iv_buf, 0, iv, sizeof (iv));
+  memcpy (sample->iv, iv, iv_length);
+  sample->iv_size = iv_length;
+
+  if (self->service) {
+    /* the service looks up the key */
+    if (gst_buffer_extract (key_id, 0, sample->kid, KID_LENGTH) !=
+        KID_LENGTH) {
+      GST_ERROR_OBJECT (self, "Invalid KID");
+      return GST_FLOW_NOT_SUPPORTED;
+    }
+  } else {
+    keypair = gst_cenc_decrypt_lookup_key (self,key_id);
+
+    if (!keypair) {
+      GST_ERROR_OBJECT (self, "Failed to lookup key");
+      return GST_FLOW_NOT_SUPPORTED;
+    }
+    sample->kid_index = keypair->index;
+
+    if (!gst_cenc_decrypt_cipher_setup (cipher, self->key_arena, keypair, iv,
+            iv_length)) {
+      GST_ERROR_OBJECT (self, "Failed to init AES cipher");
+      return GST_FLOW_NOT_SUPPORTED;
+    }
+  }
+
+  if(sample->subsample_count){
+    value = gst_structure_id_get_value (sample->prot_meta->info,
+        quark_subsamples);
     if(!value){
       GST_ERROR_OBJECT (self, "Failed to get subsamples");
-      ret = GST_FLOW_NOT_SUPPORTED;
-      goto release;
+      return GST_FLOW_NOT_SUPPORTED;
     }
-    subsamples_buf = gst_value_get_buffer (value);
-    if(!gst_buffer_map (subsamples_buf, &subsamples_map, GST_MAP_READ)){
+    sample->subsamples_buf = gst_value_get_buffer (value);
+    if(!gst_buffer_map (sample->subsamples_buf, &sample->subsamples_map,
+                        GST_MAP_READ)){
       GST_ERROR_OBJECT (self, "Failed to map subsample buffer");
-      ret = GST_FLOW_NOT_SUPPORTED;
-      goto release;
+      sample->subsamples_buf = NULL;
+      return GST_FLOW_NOT_SUPPORTED;
     }
+    gst_byte_reader_init (&sample->reader, sample->subsamples_map.data,
+        sample->subsamples_map.size);
   }
 
-  keypair = gst_cenc_decrypt_lookup_key (self,key_id);
-
-  if (!keypair) {
-    gsize sz;
-    GST_ERROR_OBJECT (self, "Failed to lookup key");
-    GST_MEMDUMP_OBJECT (self, "Key ID:", 
-                        g_bytes_get_data (keypair->key_id, &sz),
-                        sz);
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+  start = gst_util_get_timestamp ();
+  if (!gst_buffer_map (buf, &sample->map, GST_MAP_READWRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map buffer");
+    return GST_FLOW_NOT_SUPPORTED;
   }
-
-  state = gst_aes_ctr_decrypt_new (keypair->key, iv_bytes);
-
-  if (!state) {
-    GST_ERROR_OBJECT (self, "Failed to init AES cipher");
-    ret = GST_FLOW_NOT_SUPPORTED;
-    goto release;
+  gst_cenc_stats_add (self->stats.map_time, gst_util_get_timestamp () - start);
+  if (self->sample_cache
+      && gst_cenc_decrypt_sample_cache_lookup (self, sample, key_id)) {
+    return ret;
   }
+  GST_TRACE_OBJECT (self, "decrypt sample %d", (gint)sample->map.size);
+  sample->state = cipher->state;
+  sample->encrypted = TRUE;
 
-  if (subsample_count) {
-    reader = gst_byte_reader_new (subsamples_map.data, subsamples_map.size);
-    if(!reader){
-      GST_ERROR_OBJECT (self, "Failed to allocate subsample reader");
-      ret = GST_FLOW_NOT_SUPPORTED;
-      goto release;
-    }
-  }
+  return ret;
+}
 
-  while (pos < map.size) {
+/* Find the next encrypted range of a sample. Returns FALSE when the end of
+   the sample has been reached or the subsample table is invalid, in which
+   case ret is set to an error. */
+static gboolean
+gst_cenc_decrypt_sample_next_range (GstCencDecrypt * self,
+    GstCencSample * sample, AesCtrJob * job, GstFlowReturn * ret)
+{
+  while (sample->encrypted && sample->pos < sample->map.size) {
     guint16 n_bytes_clear = 0;
     guint32 n_bytes_encrypted = 0;
-
-    if (sample_index < subsample_count) {
-      if (!gst_byte_reader_get_uint16_be (reader, &n_bytes_clear)
-            || !gst_byte_reader_get_uint32_be (reader, &n_bytes_encrypted)) {
-          ret = GST_FLOW_NOT_SUPPORTED;
-          goto release;
+    gsize todo = sample->map.size - sample->pos;
+
+    if (sample->sample_index < sample->subsample_count) {
+      if (!gst_byte_reader_get_uint16_be (&sample->reader, &n_bytes_clear)
+            || !gst_byte_reader_get_uint32_be (&sample->reader,
+                &n_bytes_encrypted)) {
+          *ret = GST_FLOW_NOT_SUPPORTED;
+          return FALSE;
       }
-      sample_index++;
+      sample->sample_index++;
     } else {
       n_bytes_clear = 0;
-      n_bytes_encrypted = map.size - pos;
+      n_bytes_encrypted = todo;
+    }
+    if (n_bytes_clear > todo || n_bytes_encrypted > todo - n_bytes_clear) {
+      GST_ERROR_OBJECT (self, "Subsample %u exceeds sample size",
+          sample->sample_index);
+      *ret = GST_FLOW_NOT_SUPPORTED;
+      return FALSE;
     }
     GST_TRACE_OBJECT (self, "%u bytes clear (todo=%d)", n_bytes_clear,
-                      (gint)map.size - pos);
-    pos += n_bytes_clear;
+                      (gint)todo);
+    sample->pos += n_bytes_clear;
+    gst_cenc_stats_add (self->stats.bytes_clear, n_bytes_clear);
     if (n_bytes_encrypted) {
+      gst_cenc_stats_add (self->stats.bytes_decrypted, n_bytes_encrypted);
       GST_TRACE_OBJECT (self, "%u bytes encrypted (todo=%d)",
-                        n_bytes_encrypted, (gint)map.size - pos);
-      gst_aes_ctr_decrypt_ip (state, map.data + pos, n_bytes_encrypted);
-      pos += n_bytes_encrypted;
+                        n_bytes_encrypted, (gint)(todo - n_bytes_clear));
+      job->state = sample->state;
+      job->data = sample->map.data + sample->pos;
+      job->length = n_bytes_encrypted;
+      sample->pos += n_bytes_encrypted;
+      sample->bytes_encrypted += n_bytes_encrypted;
+      return TRUE;
     }
   }
+  return FALSE;
+}
 
-beach:
-  gst_buffer_unmap (buf, &map);
-  if (state) {
-    gst_aes_ctr_decrypt_unref (state);
+/* Replace the protection meta of a transcrypted sample with one that
+   gives the new KID and IV, and move on to the IV of the next sample */
+static void
+gst_cenc_decrypt_transcrypt_meta (GstCencDecrypt * self,
+    GstCencSample * sample)
+{
+  GstStructure *info;
+  GstBuffer *kid_buf, *iv_buf;
+  gint i;
+
+  info = gst_structure_copy (sample->prot_meta->info);
+  kid_buf = gst_buffer_new_allocate (NULL, KID_LENGTH, NULL);
+  gst_buffer_fill (kid_buf, 0, self->transcrypt_kid, KID_LENGTH);
+  iv_buf = gst_buffer_new_allocate (NULL, sizeof (self->transcrypt_iv), NULL);
+  gst_buffer_fill (iv_buf, 0, self->transcrypt_iv,
+      sizeof (self->transcrypt_iv));
+  gst_structure_id_set (info,
+      quark_iv_size, G_TYPE_UINT, (guint) sizeof (self->transcrypt_iv),
+      quark_kid, GST_TYPE_BUFFER, kid_buf,
+      quark_iv, GST_TYPE_BUFFER, iv_buf, NULL);
+  gst_buffer_unref (kid_buf);
+  gst_buffer_unref (iv_buf);
+  gst_buffer_remove_meta (sample->buf, (GstMeta *) sample->prot_meta);
+  gst_buffer_add_protection_meta (sample->buf, info);
+
+  /* an 8 byte IV is the upper half of the counter, so it only needs to
+     change by one for no counter value to be used twice */
+  for (i = sizeof (self->transcrypt_iv) - 1; i >= 0; --i) {
+    if (++self->transcrypt_iv[i] != 0)
+      break;
+  }
+}
+
+/* Add the output of a sample up to offset end to the digest */
+static void
+gst_cenc_decrypt_sample_digest (GstCencDecrypt * self, GstCencSample * sample,
+    gsize end)
+{
+  gst_cenc_digest_update (self->digest, sample->map.data + sample->digest_pos,
+      end - sample->digest_pos);
+  sample->digest_pos = end;
+}
+
+/* Add whatever is left of a sample to the digest and attach the result */
+static void
+gst_cenc_decrypt_sample_digest_finish (GstCencDecrypt * self,
+    GstCencSample * sample)
+{
+  guint8 digest[GST_CENC_DIGEST_MAX_LENGTH];
+  gsize length;
+
+  if (sample->encrypted) {
+    gst_cenc_decrypt_sample_digest (self, sample, sample->map.size);
+  } else if (gst_buffer_map (sample->buf, &sample->map, GST_MAP_READ)) {
+    /* clear samples are not mapped for decryption */
+    gst_cenc_decrypt_sample_digest (self, sample, sample->map.size);
+    gst_buffer_unmap (sample->buf, &sample->map);
+  }
+  length = gst_cenc_digest_finish (self->digest, digest);
+  gst_buffer_add_cenc_digest_meta (sample->buf,
+      gst_cenc_digest_get_digest_type (self->digest), digest, length);
+}
+
+/* Called when a decrypted sample fails validation. The key is marked to be
+   loaded again before it is next used, so that the stream can be restarted
+   once the right key is available. */
+static GstFlowReturn
+gst_cenc_decrypt_reject_key (GstCencDecrypt * self, GstCencSample * sample)
+{
+  GstCencKeyPair *keypair;
+  gchar *kid;
+
+  gst_cenc_stats_add (self->stats.samples_invalid, 1);
+  /* samples decrypted by the service have no key here to reload */
+  if (sample->kid_index == GST_CENC_RECORDER_NO_KID) {
+    kid = gst_cenc_create_uuid_string (sample->kid);
+  } else {
+    keypair = g_ptr_array_index (self->keys, sample->kid_index);
+    keypair->stale = TRUE;
+    kid = g_strdup (keypair->content_id);
+  }
+  GST_ELEMENT_ERROR (self, STREAM, DECRYPT_NOKEY,
+      ("Decrypted sample is not valid, the key is probably wrong"),
+      ("KID %s", kid));
+  g_free (kid);
+  return GST_FLOW_NOT_SUPPORTED;
+}
+
+/* Release a sample and add it to the statistics and flight recorder.
+   Returns ret, or an error if the sample fails validation. */
+static GstFlowReturn
+gst_cenc_decrypt_sample_end (GstCencDecrypt * self, GstCencSample * sample,
+    GstFlowReturn ret)
+{
+  GstCencRecord *record;
+  gboolean encrypted = sample->encrypted;
+
+  if (encrypted && ret == GST_FLOW_OK
+      && self->validator.type != GST_CENC_VALIDATOR_NONE
+      && !gst_cenc_validator_check (&self->validator, sample->map.data,
+          sample->map.size)) {
+    GST_WARNING_OBJECT (self, "sample %" GST_TIME_FORMAT " failed validation",
+        GST_TIME_ARGS (GST_BUFFER_PTS (sample->buf)));
+    ret = gst_cenc_decrypt_reject_key (self, sample);
+  }
+
+  record = gst_cenc_recorder_claim (self->recorder);
+  record->timestamp = sample->timestamp;
+  record->pts = GST_BUFFER_PTS (sample->buf);
+  record->size = gst_buffer_get_size (sample->buf);
+  record->bytes_encrypted = sample->bytes_encrypted;
+  record->decrypt_time = MIN (sample->decrypt_time, G_MAXUINT32);
+  record->result = ret;
+  record->kid_index = MIN (sample->kid_index, GST_CENC_RECORDER_NO_KID);
+  record->subsample_count = MIN (sample->subsample_count, G_MAXUINT16);
+  record->iv_size = sample->iv_size;
+  memcpy (record->iv, sample->iv, sizeof (record->iv));
+
+  if (self->digest && ret == GST_FLOW_OK) {
+    gst_cenc_decrypt_sample_digest_finish (self, sample);
+  }
+  if (sample->cache_insert && encrypted && ret == GST_FLOW_OK) {
+    gst_cenc_sample_cache_insert (self->sample_cache, &sample->cache_key,
+        sample->map.data, sample->map.size);
+  }
+  if (sample->encrypted) {
+    GstClockTime start;
+
+    gst_cenc_stats_add_decrypt_time (&self->stats, sample->decrypt_time);
+    start = gst_util_get_timestamp ();
+    gst_buffer_unmap (sample->buf, &sample->map);
+    gst_cenc_stats_add (self->stats.map_time,
+        gst_util_get_timestamp () - start);
+    gst_cenc_stats_add (self->stats.samples_decrypted, 1);
+    sample->state = NULL;
+    sample->encrypted = FALSE;
+  }
+  if(sample->subsamples_buf){
+    gst_buffer_unmap (sample->subsamples_buf, &sample->subsamples_map);
+    sample->subsamples_buf = NULL;
+  }
+  if (sample->prot_meta) {
+    /* transcrypted samples keep a protection meta, even when clear */
+    if (!self->transcrypt) {
+      gst_buffer_remove_meta (sample->buf, (GstMeta *) sample->prot_meta);
+    } else if (encrypted && ret == GST_FLOW_OK) {
+      gst_cenc_decrypt_transcrypt_meta (self, sample);
+    }
+    sample->prot_meta = NULL;
+  }
+  return ret;
+}
+
+#ifdef HAVE_CENC_SERVICE
+/* Decrypt a batch of samples with the decryption service. The encrypted
+   ranges of each sample are gathered into a slot of the shared memory as
+   one CTR stream, the slots are submitted together, and the decrypted
+   ranges are scattered back into the samples. A sample that cannot be
+   decrypted is left out and given its own error. */
+static GstFlowReturn
+gst_cenc_decrypt_samples_remote (GstCencDecrypt * self,
+    GstCencSample * samples, guint n_samples)
+{
+  GstCencServiceClient *client = self->service;
+  gsize slot_size = gst_cenc_service_client_get_slot_size (client);
+  GArray *ranges = self->service_ranges;
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstClockTime start, end, duration;
+  GError *err = NULL;
+  /* the sample that each slot holds */
+  guint slot_samples[GST_CENC_DECRYPT_MAX_BATCH];
+  guint i, slot, n_slots = 0;
+  gsize offset;
+  AesCtrJob job;
+
+  g_return_val_if_fail (n_samples <= gst_cenc_service_client_get_n_slots
+      (client), GST_FLOW_ERROR);
+
+  start = gst_util_get_timestamp ();
+  g_array_set_size (ranges, 0);
+  for (i = 0; i < n_samples; ++i) {
+    GstCencSample *sample = &samples[i];
+    GstCencServiceRequest *request;
+    guint8 *data;
+    gsize length = 0;
+    guint first_range = ranges->len;
+
+    if (!sample->encrypted)
+      continue;
+    request = gst_cenc_service_client_get_request (client, n_slots);
+    data = gst_cenc_service_client_get_data (client, n_slots);
+    memcpy (request->kid, sample->kid, KID_LENGTH);
+    memcpy (request->iv, sample->iv, sizeof (request->iv));
+    request->iv_size = sample->iv_size;
+    request->flags = self->drm_type == GST_DRM_MARLIN ?
+        GST_CENC_SERVICE_FLAG_MARLIN : 0;
+    while (gst_cenc_decrypt_sample_next_range (self, sample, &job,
+            &sample->ret)) {
+      GstCencServiceRange range = { n_slots, job.data, job.length };
+
+      if (job.length > slot_size - length) {
+        GST_ERROR_OBJECT (self, "Sample of %" G_GSIZE_FORMAT " bytes is too "
+            "large for the decryption service", sample->map.size);
+        sample->ret = GST_FLOW_NOT_SUPPORTED;
+        break;
+      }
+      memcpy (data + length, job.data, job.length);
+      length += job.length;
+      g_array_append_val (ranges, range);
+    }
+    if (sample->ret != GST_FLOW_OK) {
+      /* the slot is reused by the next sample */
+      g_array_set_size (ranges, first_range);
+      continue;
+    }
+    request->size = length;
+    slot_samples[n_slots++] = i;
+  }
+  if (n_slots && !gst_cenc_service_client_run (client, n_slots, &err)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, READ,
+        ("Failed to decrypt with the decryption service"),
+        ("%s", err->message));
+    g_clear_error (&err);
+    for (slot = 0; slot < n_slots; ++slot)
+      samples[slot_samples[slot]].ret = GST_FLOW_ERROR;
+  }
+  for (slot = 0; slot < n_slots; ++slot) {
+    GstCencSample *sample = &samples[slot_samples[slot]];
+    gint status = gst_cenc_service_client_get_request (client, slot)->status;
+
+    if (sample->ret != GST_FLOW_OK)
+      continue;
+    if (status == GST_CENC_SERVICE_NO_KEY) {
+      GST_ERROR_OBJECT (self, "The decryption service has no key");
+      sample->ret = GST_FLOW_NOT_SUPPORTED;
+    } else if (status != GST_CENC_SERVICE_OK) {
+      GST_ERROR_OBJECT (self, "The decryption service rejected a sample");
+      sample->ret = GST_FLOW_NOT_SUPPORTED;
+    }
+  }
+  offset = 0;
+  for (i = 0; i < ranges->len; ++i) {
+    GstCencServiceRange *range =
+        &g_array_index (ranges, GstCencServiceRange, i);
+
+    if (i > 0 && range->slot != range[-1].slot)
+      offset = 0;
+    if (samples[slot_samples[range->slot]].ret == GST_FLOW_OK) {
+      memcpy (range->data,
+          gst_cenc_service_client_get_data (client, range->slot) + offset,
+          range->length);
+    }
+    offset += range->length;
+  }
+
+  end = gst_util_get_timestamp ();
+  duration = n_slots ? (end - start) / n_slots : 0;
+  for (i = 0; i < n_samples; ++i) {
+    samples[i].decrypt_time = duration;
+    samples[i].timestamp = end;
+    if (ret == GST_FLOW_OK)
+      ret = samples[i].ret;
+  }
+  return ret;
+}
+#endif
+
+/* Decrypt a batch of samples that have been through
+   gst_cenc_decrypt_sample_begin(). Each sample must have its own cipher.
+   The n-th encrypted range of every sample is handed to the multi-buffer
+   AES-CTR kernel in one call, so that small samples are decrypted together
+   rather than one after the other. The result of each sample is kept in
+   its ret, and the first error is returned. */
+static GstFlowReturn
+gst_cenc_decrypt_samples (GstCencDecrypt * self, GstCencSample * samples,
+    guint n_samples)
+{
+  AesCtrJob jobs[GST_CENC_DECRYPT_MAX_BATCH];
+  GstFlowReturn ret = GST_FLOW_OK;
+  guint i, n_jobs, n_encrypted = 0;
+  GstClockTime start, end, duration;
+
+  g_return_val_if_fail (n_samples <= GST_CENC_DECRYPT_MAX_BATCH,
+      GST_FLOW_ERROR);
+
+#ifdef HAVE_CENC_SERVICE
+  if (self->service)
+    return gst_cenc_decrypt_samples_remote (self, samples, n_samples);
+#endif
+
+  start = gst_util_get_timestamp ();
+  do {
+    n_jobs = 0;
+    for (i = 0; i < n_samples; ++i) {
+      GstCencSample *sample = &samples[i];
+
+      if (sample->ret == GST_FLOW_OK
+          && gst_cenc_decrypt_sample_next_range (self, sample, &jobs[n_jobs],
+              &sample->ret)) {
+        ++n_jobs;
+      }
+    }
+    gst_aes_ctr_decrypt_ip_multi (jobs, n_jobs);
+  } while (n_jobs);
+
+  /* the samples were decrypted together, so each is charged an equal
+     share of the time */
+  for (i = 0; i < n_samples; ++i) {
+    if (samples[i].encrypted)
+      ++n_encrypted;
+  }
+  end = gst_util_get_timestamp ();
+  duration = n_encrypted ? (end - start) / n_encrypted : 0;
+  for (i = 0; i < n_samples; ++i) {
+    samples[i].decrypt_time = duration;
+    samples[i].timestamp = end;
+    if (ret == GST_FLOW_OK)
+      ret = samples[i].ret;
+  }
+
+  return ret;
+}
+
+/* Decrypt one sample in-place and remove its protection meta, or
+   re-encrypt it under the new key in transcrypt mode */
+static GstFlowReturn
+gst_cenc_decrypt_sample (GstCencDecrypt * self, GstBuffer * buf)
+{
+  GstCencSample sample;
+  AesCtrJob job;
+  GstFlowReturn ret;
+  GstClockTime start;
+
+  ret = gst_cenc_decrypt_sample_begin (self, buf, &sample, &self->cipher);
+  if (self->service) {
+    if (ret == GST_FLOW_OK)
+      ret = gst_cenc_decrypt_samples (self, &sample, 1);
+    return gst_cenc_decrypt_sample_end (self, &sample, ret);
+  }
+  if (self->transcrypt) {
+    gst_aes_ctr_decrypt_set_iv (self->transcrypt, self->transcrypt_iv,
+        sizeof (self->transcrypt_iv));
+  }
+  start = gst_util_get_timestamp ();
+  while (ret == GST_FLOW_OK &&
+         gst_cenc_decrypt_sample_next_range (self, &sample, &job, &ret)) {
+    if (self->transcrypt) {
+      gst_aes_ctr_transcrypt_ip (job.state, self->transcrypt, job.data,
+          job.length);
+    } else {
+      gst_aes_ctr_decrypt_ip (job.state, job.data, job.length);
+    }
+    /* digest the range while it is still in the cache */
+    if (self->digest) {
+      gst_cenc_decrypt_sample_digest (self, &sample,
+          job.data + job.length - sample.map.data);
+    }
+  }
+  sample.timestamp = gst_util_get_timestamp ();
+  sample.decrypt_time = sample.timestamp - start;
+  ret = gst_cenc_decrypt_sample_end (self, &sample, ret);
+
+  return ret;
+}
+
+static void
+gst_cenc_decrypt_reset_qos (GstCencDecrypt * self)
+{
+  GST_OBJECT_LOCK (self);
+  self->earliest_time = GST_CLOCK_TIME_NONE;
+  self->proportion = 1.0;
+  GST_OBJECT_UNLOCK (self);
+  self->skip_to_keyframe = FALSE;
+  self->discont = FALSE;
+}
+
+/*
+  Decide whether a sample can be dropped before it is decrypted, because it
+  is too late to be displayed. Key frames are never dropped. A late
+  non-reference frame is dropped on its own, whereas dropping a late
+  reference frame means the rest of its GOP is dropped as well, because it
+  can no longer be decoded.
+*/
+static gboolean
+gst_cenc_decrypt_check_qos (GstCencDecrypt * self, GstBuffer * buf)
+{
+  GstBaseTransform *base = GST_BASE_TRANSFORM (self);
+  GstClockTime timestamp, running_time, earliest_time;
+  GstClockTime stream_time;
+  gdouble proportion;
+  GstMessage *msg;
+
+  if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    self->skip_to_keyframe = FALSE;
+    return FALSE;
+  }
+
+  timestamp = GST_BUFFER_PTS (buf);
+  if (!GST_CLOCK_TIME_IS_VALID (timestamp)) {
+    timestamp = GST_BUFFER_DTS (buf);
+  }
+  if (!GST_CLOCK_TIME_IS_VALID (timestamp) ||
+      base->segment.format != GST_FORMAT_TIME) {
+    return self->skip_to_keyframe;
+  }
+  running_time = gst_segment_to_running_time (&base->segment, GST_FORMAT_TIME,
+      timestamp);
+
+  if (!self->skip_to_keyframe) {
+    GST_OBJECT_LOCK (self);
+    earliest_time = self->earliest_time;
+    proportion = self->proportion;
+    GST_OBJECT_UNLOCK (self);
+
+    if (!GST_CLOCK_TIME_IS_VALID (running_time) ||
+        !GST_CLOCK_TIME_IS_VALID (earliest_time) ||
+        running_time > earliest_time) {
+      return FALSE;
+    }
+    if (!GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DROPPABLE)) {
+      GST_DEBUG_OBJECT (self, "dropped late reference frame, skipping to "
+          "next key frame");
+      self->skip_to_keyframe = TRUE;
+    }
+
+    self->dropped++;
+    GST_DEBUG_OBJECT (self, "dropping late sample %" GST_TIME_FORMAT
+        " (earliest %" GST_TIME_FORMAT ")", GST_TIME_ARGS (running_time),
+        GST_TIME_ARGS (earliest_time));
+    stream_time = gst_segment_to_stream_time (&base->segment, GST_FORMAT_TIME,
+        timestamp);
+    msg = gst_message_new_qos (GST_OBJECT_CAST (self), FALSE, running_time,
+        stream_time, timestamp, GST_BUFFER_DURATION (buf));
+    gst_message_set_qos_values (msg,
+        GST_CLOCK_DIFF (earliest_time, running_time), proportion, 1000000);
+    gst_message_set_qos_stats (msg, GST_FORMAT_BUFFERS, self->processed,
+        self->dropped);
+    gst_element_post_message (GST_ELEMENT_CAST (self), msg);
+    return TRUE;
+  }
+
+  self->dropped++;
+  GST_LOG_OBJECT (self, "dropping sample %" GST_TIME_FORMAT
+      " until next key frame", GST_TIME_ARGS (running_time));
+  return TRUE;
+}
+
+/*
+  In trick mode playback downstream only wants key frames, or no audio at
+  all, so the other samples are discarded without touching their payload.
+*/
+static gboolean
+gst_cenc_decrypt_check_trickmode (GstCencDecrypt * self, GstBuffer * buf)
+{
+  GstSegmentFlags flags = GST_BASE_TRANSFORM (self)->segment.flags;
+
+  if ((flags & GST_SEGMENT_FLAG_TRICKMODE_NO_AUDIO) && self->is_audio) {
+    GST_LOG_OBJECT (self, "dropping audio sample in trick mode");
+    return TRUE;
+  }
+  if ((flags & GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS) &&
+      GST_BUFFER_FLAG_IS_SET (buf, GST_BUFFER_FLAG_DELTA_UNIT)) {
+    GST_LOG_OBJECT (self, "dropping delta unit in key unit trick mode");
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* returns TRUE if buf should be dropped instead of decrypted */
+static gboolean
+gst_cenc_decrypt_check_drop (GstCencDecrypt * self, GstBuffer * buf)
+{
+  if (gst_cenc_decrypt_check_trickmode (self, buf)
+      || gst_cenc_decrypt_check_qos (self, buf)) {
+    gst_cenc_stats_add (self->stats.samples_dropped, 1);
+    return TRUE;
+  }
+  return FALSE;
+}
+
+/* post the statistics on the bus if the stats-interval has elapsed */
+static void
+gst_cenc_decrypt_post_stats (GstCencDecrypt * self)
+{
+  GstClockTime now, interval;
+
+  GST_OBJECT_LOCK (self);
+  interval = self->stats_interval * GST_MSECOND;
+  GST_OBJECT_UNLOCK (self);
+  if (!interval)
+    return;
+
+  now = gst_util_get_timestamp ();
+  if (now - self->last_stats_post < interval)
+    return;
+  self->last_stats_post = now;
+  gst_element_post_message (GST_ELEMENT_CAST (self),
+      gst_message_new_element (GST_OBJECT_CAST (self),
+          gst_cenc_stats_to_structure (&self->stats)));
+}
+
+static GstFlowReturn
+gst_cenc_decrypt_submit_input_buffer (GstBaseTransform * trans,
+    gboolean is_discont, GstBuffer * input)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (trans);
+
+  /* the next buffer that is output is marked DISCONT, as in the list
+     path */
+  if (gst_cenc_decrypt_check_drop (self, input)) {
+    gst_buffer_unref (input);
+    self->discont = TRUE;
+    return GST_BASE_TRANSFORM_FLOW_DROPPED;
+  }
+  self->processed++;
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->submit_input_buffer (trans,
+      is_discont, input);
+}
+
+static gboolean
+gst_cenc_decrypt_src_event_handler (GstBaseTransform * trans, GstEvent * event)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (trans);
+
+  if (GST_EVENT_TYPE (event) == GST_EVENT_QOS) {
+    GstQOSType type;
+    gdouble proportion;
+    GstClockTimeDiff diff;
+    GstClockTime timestamp;
+
+    gst_event_parse_qos (event, &type, &proportion, &diff, &timestamp);
+    GST_OBJECT_LOCK (self);
+    self->proportion = proportion;
+    if (GST_CLOCK_TIME_IS_VALID (timestamp)) {
+      if (diff < 0 && (GstClockTime) -diff > timestamp) {
+        self->earliest_time = 0;
+      } else {
+        self->earliest_time = timestamp + diff;
+      }
+    } else {
+      self->earliest_time = GST_CLOCK_TIME_NONE;
+    }
+    GST_OBJECT_UNLOCK (self);
   }
-release:
-  if (reader){
-    gst_byte_reader_free (reader);
+
+  return GST_BASE_TRANSFORM_CLASS (parent_class)->src_event (trans, event);
+}
+
+static void
+gst_cenc_decrypt_clear_ciphers (GstCencDecrypt * self)
+{
+  guint i;
+
+  self->last_keypair = NULL;
+  gst_cenc_decrypt_cipher_clear (&self->cipher);
+  for (i = 0; i < GST_CENC_DECRYPT_MAX_BATCH; ++i) {
+    gst_cenc_decrypt_cipher_clear (&self->lanes[i]);
   }
-  if(subsamples_buf){
-    gst_buffer_unmap (subsamples_buf, &subsamples_map);
+}
+
+static void
+gst_cenc_decrypt_dump_flight_recorder (GstCencDecrypt * self)
+{
+  gchar *records = gst_cenc_recorder_format (self->recorder);
+  gchar *filename;
+  FILE *file = NULL;
+
+  GST_OBJECT_LOCK (self);
+  filename = g_strdup (self->flight_recorder_file);
+  GST_OBJECT_UNLOCK (self);
+
+  if (filename) {
+    file = fopen (filename, "a");
+    if (!file) {
+      GST_ERROR_OBJECT (self, "Failed to open flight recorder file: %s",
+          filename);
+    }
   }
-  if (prot_meta) {
-    gst_buffer_remove_meta (buf, (GstMeta *) prot_meta);
+  if (file) {
+    fprintf (file, "# %s\n%s", GST_OBJECT_NAME (self), records);
+    fclose (file);
+    GST_INFO_OBJECT (self, "flight recorder written to %s", filename);
   }
-  if (iv_bytes) {
-    g_bytes_unref (iv_bytes);
+  else {
+    GST_WARNING_OBJECT (self, "flight recorder:\n%s", records);
+  }
+  g_free (filename);
+  g_free (records);
+}
+
+static GstFlowReturn
+gst_cenc_decrypt_transform_ip (GstBaseTransform * base, GstBuffer * buf)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (base);
+  GstFlowReturn ret;
+
+  GST_TRACE_OBJECT (self, "decrypt in-place");
+  if (self->discont) {
+    GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    self->discont = FALSE;
+  }
+  ret = gst_cenc_decrypt_sample (self, buf);
+  gst_cenc_decrypt_post_stats (self);
+  if (ret == GST_FLOW_NOT_SUPPORTED) {
+    gst_cenc_decrypt_dump_flight_recorder (self);
   }
-out:
   return ret;
 }
 
+typedef struct
+{
+  GstCencDecrypt *self;
+  GstFlowReturn ret;
+  GstCencSample samples[GST_CENC_DECRYPT_MAX_BATCH];
+  guint n_samples;
+} GstCencDecryptListData;
+
+/* Decrypt and release the samples of the batch, each with its own result,
+   and keep the first error */
+static void
+gst_cenc_decrypt_list_flush (GstCencDecryptListData * data)
+{
+  guint i, n_begun = data->n_samples;
+
+  /* a sample that failed to begin is the last of its batch */
+  if (data->ret != GST_FLOW_OK && n_begun > 0) {
+    data->samples[--n_begun].ret = data->ret;
+  }
+  if (n_begun > 0) {
+    gst_cenc_decrypt_samples (data->self, data->samples, n_begun);
+  }
+  for (i = 0; i < data->n_samples; ++i) {
+    GstCencSample *sample = &data->samples[i];
+    GstFlowReturn ret;
+
+    ret = gst_cenc_decrypt_sample_end (data->self, sample, sample->ret);
+    if (data->ret == GST_FLOW_OK)
+      data->ret = ret;
+  }
+  data->n_samples = 0;
+}
+
+static gboolean
+gst_cenc_decrypt_list_decrypt_func (GstBuffer ** buf, guint idx,
+    gpointer user_data)
+{
+  GstCencDecryptListData *data = (GstCencDecryptListData *) user_data;
+  GstCencDecrypt *self = data->self;
+  GstCencSample *sample = &data->samples[data->n_samples];
+
+  if (gst_cenc_decrypt_check_drop (self, *buf)) {
+    gst_buffer_unref (*buf);
+    *buf = NULL;
+    self->discont = TRUE;
+    return TRUE;
+  }
+  self->processed++;
+  *buf = gst_buffer_make_writable (*buf);
+  if (self->discont) {
+    GST_BUFFER_FLAG_SET (*buf, GST_BUFFER_FLAG_DISCONT);
+    self->discont = FALSE;
+  }
+  data->ret = gst_cenc_decrypt_sample_begin (self, *buf, sample,
+      &self->lanes[data->n_samples]);
+  data->n_samples++;
+  if (data->ret != GST_FLOW_OK ||
+      data->n_samples == GST_CENC_DECRYPT_MAX_BATCH) {
+    gst_cenc_decrypt_list_flush (data);
+  }
+  return data->ret == GST_FLOW_OK;
+}
+
+/*
+  Decrypt every sample of a buffer list in one sweep and push the result
+  downstream as a list, bypassing the per-buffer work of GstBaseTransform.
+*/
+static GstFlowReturn
+gst_cenc_decrypt_chain_list (GstPad * pad, GstObject * parent,
+    GstBufferList * list)
+{
+  GstCencDecrypt *self = GST_CENC_DECRYPT (parent);
+  GstBaseTransform *base = GST_BASE_TRANSFORM (parent);
+  GstCencDecryptListData data;
+
+  /* caps negotiation is done by GstBaseTransform when it handles a
+     buffer, so hand it one buffer at a time until the source pad has
+     been configured. Transcrypted samples share the one new key, so they
+     are also handled one at a time. */
+  if (!gst_pad_has_current_caps (base->srcpad)
+      || gst_pad_needs_reconfigure (base->srcpad) || self->transcrypt) {
+    guint i, len = gst_buffer_list_length (list);
+    GstFlowReturn ret = GST_FLOW_OK;
+
+    GST_DEBUG_OBJECT (self, "decrypting list per buffer");
+    for (i = 0; ret == GST_FLOW_OK && i < len; ++i) {
+      ret = self->base_chain (pad, parent,
+          gst_buffer_ref (gst_buffer_list_get (list, i)));
+    }
+    gst_buffer_list_unref (list);
+    return ret;
+  }
+
+  GST_TRACE_OBJECT (self, "decrypt list of %u buffers",
+      gst_buffer_list_length (list));
+  data.self = self;
+  data.ret = GST_FLOW_OK;
+  data.n_samples = 0;
+  list = gst_buffer_list_make_writable (list);
+  gst_buffer_list_foreach (list, gst_cenc_decrypt_list_decrypt_func, &data);
+  gst_cenc_decrypt_list_flush (&data);
+  gst_cenc_decrypt_post_stats (self);
+  if (data.ret == GST_FLOW_NOT_SUPPORTED) {
+    gst_cenc_decrypt_dump_flight_recorder (self);
+  }
+  if (data.ret != GST_FLOW_OK || gst_buffer_list_length (list) == 0) {
+    gst_buffer_list_unref (list);
+    return data.ret;
+  }
+
+  return gst_pad_push_list (base->srcpad, list);
+}
+
 static void
-gst_cenc_decrypt_parse_pssh_box (GstCencDecrypt * self, GstBuffer * pssh)
+gst_cenc_decrypt_parse_pssh_box (GstCencDecrypt * self, GstBuffer * pssh,
+    GPtrArray * kids)
 {
   GstMapInfo info;
   GstByteReader br;
@@ -754,6 +2532,8 @@ gst_cenc_decrypt_parse_pssh_box (GstCencDecrypt * self, GstBuffer * pssh)
       gchar *key_id_string = gst_cenc_create_uuid_string (key_id_data);
       GST_DEBUG_OBJECT (self, "key_id: %s", key_id_string);
       g_free (key_id_string);
+      if (kids)
+        g_ptr_array_add (kids, g_bytes_new (key_id_data, key_id_size));
       key_id_data += key_id_size;
       --key_id_count;
     }
@@ -845,6 +2625,83 @@ beach:
   return (ret);
 }
 
+/* Parse a ClearKey ContentProtection element for its default KID and the
+   URL of its license server */
+static void
+gst_cenc_decrypt_parse_clearkey_element (GstCencDecrypt * self,
+    GstBuffer * pssi, GPtrArray * kids)
+{
+  GstMapInfo info;
+  xmlDocPtr doc;
+  xmlNode *root_element, *cur_node;
+  xmlChar *value;
+  gboolean have_url;
+
+  if (!gst_buffer_map (pssi, &info, GST_MAP_READ))
+    return;
+  LIBXML_TEST_VERSION
+  doc = xmlReadMemory ((const char *) info.data, info.size,
+      "ContentProtection.xml", NULL, XML_PARSE_NONET);
+  gst_buffer_unmap (pssi, &info);
+  if (!doc) {
+    GST_ERROR_OBJECT (self, "Failed to parse XML from pssi event");
+    return;
+  }
+  root_element = xmlDocGetRootElement (doc);
+  if (!root_element || root_element->type != XML_ELEMENT_NODE) {
+    xmlFreeDoc (doc);
+    return;
+  }
+
+  /* cenc:default_KID is a UUID string */
+  value = xmlGetProp (root_element, (const xmlChar *) "default_KID");
+  if (value) {
+    guint8 kid[KID_LENGTH];
+    guint i, n = 0;
+
+    for (i = 0; value[i] && n < 2 * KID_LENGTH; ++i) {
+      gint digit = g_ascii_xdigit_value (value[i]);
+
+      if (digit < 0)
+        continue;
+      if (n % 2)
+        kid[n / 2] |= digit;
+      else
+        kid[n / 2] = digit << 4;
+      ++n;
+    }
+    GST_DEBUG_OBJECT (self, "default_KID: %s", value);
+    if (n == 2 * KID_LENGTH)
+      g_ptr_array_add (kids, g_bytes_new (kid, KID_LENGTH));
+    xmlFree (value);
+  }
+
+  GST_OBJECT_LOCK (self);
+  have_url = self->license_url && *self->license_url;
+  GST_OBJECT_UNLOCK (self);
+  for (cur_node = root_element->children; cur_node && !have_url;
+      cur_node = cur_node->next) {
+    if (cur_node->type != XML_ELEMENT_NODE ||
+        !g_str_has_suffix ((const gchar *) cur_node->name, "Laurl"))
+      continue;
+    value = xmlNodeGetContent (cur_node);
+    if (value) {
+      gchar *url = g_strstrip (g_strdup ((const gchar *) value));
+
+      GST_DEBUG_OBJECT (self, "License URL: %s", url);
+      if (*url) {
+        if (self->license)
+          g_object_unref (self->license);
+        self->license = gst_cenc_license_client_get (url);
+        have_url = TRUE;
+      }
+      g_free (url);
+      xmlFree (value);
+    }
+  }
+  xmlFreeDoc (doc);
+}
+
 static gboolean
 gst_cenc_decrypt_sink_event_handler (GstBaseTransform * trans, GstEvent * event)
 {
@@ -864,19 +2721,43 @@ gst_cenc_decrypt_sink_event_handler (GstBaseTransform * trans, GstEvent * event)
             self->drm_type = GST_DRM_MARLIN;
             gst_cenc_decrypt_parse_content_protection_element (self, pssi);
         }
-        else if(g_ascii_strcasecmp(loc, "dash/mpd")==0 && g_ascii_strcasecmp(system_id, M_MPD_PROTECTION_ID)==0){
+        else if(g_ascii_strcasecmp(loc, "dash/mpd")==0 && g_ascii_strcasecmp(system_id, CLEARKEY_PROTECTION_ID)==0){
+          GPtrArray *kids = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+
           GST_DEBUG_OBJECT (self, "event carries MPD clearkey data");
           self->drm_type = GST_DRM_CLEARKEY;
-          /* TODO: parse clearkey:Laurl element */
+          gst_cenc_decrypt_parse_clearkey_element (self, pssi, kids);
+          gst_cenc_decrypt_prefetch_keys (self, kids);
+          g_ptr_array_unref (kids);
         }
         else if(g_str_has_prefix (loc, "isobmff/") && g_ascii_strcasecmp(system_id, M_PSSH_PROTECTION_ID)==0){
           GST_DEBUG_OBJECT (self, "event carries pssh data from qtdemux");
           self->drm_type = GST_DRM_MARLIN;
-          gst_cenc_decrypt_parse_pssh_box (self, pssi);
+          gst_cenc_decrypt_parse_pssh_box (self, pssi, NULL);
+        }
+        else if(g_str_has_prefix (loc, "isobmff/") && (g_ascii_strcasecmp(system_id, COMMON_PSSH_PROTECTION_ID)==0 || g_ascii_strcasecmp(system_id, CLEARKEY_PROTECTION_ID)==0)){
+          GPtrArray *kids = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+
+          GST_DEBUG_OBJECT (self, "event carries clearkey pssh data from qtdemux");
+          self->drm_type = GST_DRM_CLEARKEY;
+          gst_cenc_decrypt_parse_pssh_box (self, pssi, kids);
+          gst_cenc_decrypt_prefetch_keys (self, kids);
+          g_ptr_array_unref (kids);
         }
         gst_event_unref (event);
       break;
 
+    case GST_EVENT_FLUSH_START:
+      gst_cenc_decrypt_set_key_flushing (self, TRUE);
+      ret = GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
+      break;
+
+    case GST_EVENT_FLUSH_STOP:
+      gst_cenc_decrypt_set_key_flushing (self, FALSE);
+      gst_cenc_decrypt_reset_qos (self);
+      ret = GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
+      break;
+
     default:
       ret = GST_BASE_TRANSFORM_CLASS (parent_class)->sink_event (trans, event);
       break;
@@ -888,9 +2769,7 @@ gst_cenc_decrypt_sink_event_handler (GstBaseTransform * trans, GstEvent * event)
 static void gst_cenc_keypair_destroy (gpointer data)
 {
   GstCencKeyPair *key_pair = (GstCencKeyPair*)data;
-  g_bytes_unref (key_pair->key_id);
   g_free (key_pair->content_id);
-  g_bytes_unref (key_pair->key);
   g_free (key_pair);
 }
 
@@ -23,12 +23,27 @@
 #endif
 
 #include "gstcencdec.h"
+#include "gstcencenc.h"
+#include "gstcencfragdec.h"
+#include "gstcenchlsdec.h"
+#include "gstcencmultidec.h"
+#include "gstcencsampleaesdec.h"
 
 static gboolean
 plugin_init (GstPlugin * plugin)
 {
   return gst_element_register (plugin, "cencdec", GST_RANK_PRIMARY,
-      GST_TYPE_CENC_DECRYPT);
+      GST_TYPE_CENC_DECRYPT)
+      && gst_element_register (plugin, "cencenc", GST_RANK_NONE,
+      GST_TYPE_CENC_ENCRYPT)
+      && gst_element_register (plugin, "cencfragdec", GST_RANK_NONE,
+      GST_TYPE_CENC_FRAG_DECRYPT)
+      && gst_element_register (plugin, "hlsaesdec", GST_RANK_NONE,
+      GST_TYPE_CENC_HLS_DECRYPT)
+      && gst_element_register (plugin, "cencmultidec", GST_RANK_NONE,
+      GST_TYPE_CENC_MULTI_DECRYPT)
+      && gst_element_register (plugin, "hlssampleaesdec", GST_RANK_NONE,
+      GST_TYPE_CENC_SAMPLE_AES_DECRYPT);
 }
 
 GST_PLUGIN_DEFINE (GST_VERSION_MAJOR,
@@ -0,0 +1,727 @@
+/* GStreamer ISO MPEG DASH common encryption encryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/**
+ * SECTION:element-gstcencencrypt
+ *
+ * Encrypts elementary stream samples using the 'cenc' scheme of the ISOBMFF
+ * Common Encryption standard, producing the same buffers and
+ * GstProtectionMeta as qtdemux outputs for encrypted content. It is
+ * intended for generating local test and load content for cencdec.
+ *
+ * Video samples are split into subsamples so that the NAL unit headers and
+ * all non-VCL NAL units stay in the clear, with the protected part of each
+ * VCL NAL unit a multiple of 16 bytes. Audio samples are encrypted whole.
+ *
+ * When key-directory is set, the key is stored in it using the same file
+ * names as store-key.py, so that cencdec can find it.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 filesrc location=in.mp4 ! qtdemux ! h264parse ! \
+ *     video/x-h264,stream-format=avc,alignment=au ! \
+ *     cencenc kid=0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc ! cencdec ! \
+ *     avdec_h264 ! autovideosink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/base/gstbytereader.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gstprotection.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+
+#include <glib.h>
+
+#include "gstcencenc.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_cenc_encrypt_debug_category);
+#define GST_CAT_DEFAULT gst_cenc_encrypt_debug_category
+
+#define KID_LENGTH GST_CENC_KID_LENGTH
+#define KEY_LENGTH GST_CENC_KEY_LENGTH
+
+typedef enum
+{
+  GST_CENC_CODEC_AUDIO,
+  GST_CENC_CODEC_AVC,
+  GST_CENC_CODEC_HEVC
+} GstCencCodec;
+
+struct _GstCencEncrypt
+{
+  GstBaseTransform parent;
+  /* properties, protected by the object lock */
+  gchar *kid_string;
+  gchar *key_string;
+  gchar *iv_string;
+  guint iv_size;
+  gchar *key_directory;
+  gchar *protection_system;
+  /* streaming state */
+  guint8 kid[KID_LENGTH];
+  guint8 iv[16]; /* IV of the next sample */
+  AesCtrState *state;
+  GstCencCodec codec;
+  /* size of the NAL unit length prefix, or 0 for byte-stream */
+  guint nal_length_size;
+};
+
+struct _GstCencEncryptClass
+{
+  GstBaseTransformClass parent_class;
+};
+
+enum
+{
+  PROP_0,
+  PROP_KID,
+  PROP_KEY,
+  PROP_IV,
+  PROP_IV_SIZE,
+  PROP_KEY_DIRECTORY,
+  PROP_PROTECTION_SYSTEM
+};
+
+#define CLEARKEY_PROTECTION_ID "e2719d58-a985-b3c9-781a-b030af78d30e"
+
+#define DEFAULT_KID "00000000000000000000000000000000"
+#define DEFAULT_KEY NULL
+#define DEFAULT_IV NULL
+#define DEFAULT_IV_SIZE 8
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_PROTECTION_SYSTEM CLEARKEY_PROTECTION_ID
+
+/* largest value of the BytesOfClearData field of a subsample */
+#define MAX_CLEAR_BYTES G_MAXUINT16
+
+/* prototypes */
+static void gst_cenc_encrypt_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec);
+static void gst_cenc_encrypt_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec);
+static void gst_cenc_encrypt_finalize (GObject * object);
+static gboolean gst_cenc_encrypt_start (GstBaseTransform * trans);
+static gboolean gst_cenc_encrypt_stop (GstBaseTransform * trans);
+static GstCaps *gst_cenc_encrypt_transform_caps (GstBaseTransform * base,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter);
+static gboolean gst_cenc_encrypt_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps);
+static GstFlowReturn gst_cenc_encrypt_transform_ip (GstBaseTransform * trans,
+    GstBuffer * buf);
+
+/* pad templates */
+
+static GstStaticPadTemplate gst_cenc_encrypt_sink_template =
+    GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS
+    (
+     "video/x-h264, stream-format=(string){ avc, avc3, byte-stream }, "
+     "alignment=(string)au; "
+     "video/x-h265, stream-format=(string){ hvc1, hev1, byte-stream }, "
+     "alignment=(string)au; "
+     "audio/mpeg; audio/x-ac3; audio/x-eac3")
+    );
+
+static GstStaticPadTemplate gst_cenc_encrypt_src_template =
+    GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("application/x-cenc")
+    );
+
+/* class initialization */
+
+#define gst_cenc_encrypt_parent_class parent_class
+G_DEFINE_TYPE (GstCencEncrypt, gst_cenc_encrypt, GST_TYPE_BASE_TRANSFORM);
+
+static void
+gst_cenc_encrypt_class_init (GstCencEncryptClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstBaseTransformClass *base_transform_class =
+      GST_BASE_TRANSFORM_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_encrypt_sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_encrypt_src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Encrypt content using ISOBMFF Common Encryption",
+      "Encryptor",
+      "Encrypts elementary streams using ISOBMFF Common Encryption, "
+      "for generating test content.",
+      "Alex Ashley <alex.ashley@youview.com>");
+
+  GST_DEBUG_CATEGORY_INIT (gst_cenc_encrypt_debug_category,
+      "cencenc", 0, "CENC encryptor");
+
+  gobject_class->set_property = gst_cenc_encrypt_set_property;
+  gobject_class->get_property = gst_cenc_encrypt_get_property;
+  gobject_class->finalize = gst_cenc_encrypt_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_KID,
+      g_param_spec_string ("kid", "KID",
+          "Key ID as a string of 32 hex digits", DEFAULT_KID,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY,
+      g_param_spec_string ("key", "Key",
+          "Key as a string of 32 hex digits, or NULL for a random key",
+          DEFAULT_KEY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IV,
+      g_param_spec_string ("iv", "IV",
+          "IV of the first sample as a string of 2 * iv-size hex digits, "
+          "or NULL for a random IV", DEFAULT_IV,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IV_SIZE,
+      g_param_spec_uint ("iv-size", "IV size",
+          "Size of the per-sample IV in bytes (8 or 16)", 8, 16,
+          DEFAULT_IV_SIZE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory that the key is stored in, or NULL to not store it",
+          DEFAULT_KEY_DIRECTORY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_PROTECTION_SYSTEM,
+      g_param_spec_string ("protection-system", "Protection system",
+          "UUID of the protection system put in the output caps",
+          DEFAULT_PROTECTION_SYSTEM,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  base_transform_class->start = GST_DEBUG_FUNCPTR (gst_cenc_encrypt_start);
+  base_transform_class->stop = GST_DEBUG_FUNCPTR (gst_cenc_encrypt_stop);
+  base_transform_class->transform_ip =
+      GST_DEBUG_FUNCPTR (gst_cenc_encrypt_transform_ip);
+  base_transform_class->transform_caps =
+      GST_DEBUG_FUNCPTR (gst_cenc_encrypt_transform_caps);
+  base_transform_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_cenc_encrypt_set_caps);
+  base_transform_class->transform_ip_on_passthrough = FALSE;
+}
+
+static void
+gst_cenc_encrypt_init (GstCencEncrypt * self)
+{
+  GstBaseTransform *base = GST_BASE_TRANSFORM (self);
+
+  gst_base_transform_set_in_place (base, TRUE);
+  gst_base_transform_set_passthrough (base, FALSE);
+  gst_base_transform_set_gap_aware (base, FALSE);
+  self->kid_string = g_strdup (DEFAULT_KID);
+  self->key_string = g_strdup (DEFAULT_KEY);
+  self->iv_string = g_strdup (DEFAULT_IV);
+  self->iv_size = DEFAULT_IV_SIZE;
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->protection_system = g_strdup (DEFAULT_PROTECTION_SYSTEM);
+  self->codec = GST_CENC_CODEC_AUDIO;
+}
+
+static void
+gst_cenc_encrypt_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_KID:
+      g_free (self->kid_string);
+      self->kid_string = g_value_dup_string (value);
+      break;
+    case PROP_KEY:
+      g_free (self->key_string);
+      self->key_string = g_value_dup_string (value);
+      break;
+    case PROP_IV:
+      g_free (self->iv_string);
+      self->iv_string = g_value_dup_string (value);
+      break;
+    case PROP_IV_SIZE:
+      self->iv_size = g_value_get_uint (value);
+      break;
+    case PROP_KEY_DIRECTORY:
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      break;
+    case PROP_PROTECTION_SYSTEM:
+      g_free (self->protection_system);
+      self->protection_system = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_encrypt_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (object);
+
+  GST_OBJECT_LOCK (self);
+  switch (prop_id) {
+    case PROP_KID:
+      g_value_set_string (value, self->kid_string);
+      break;
+    case PROP_KEY:
+      g_value_set_string (value, self->key_string);
+      break;
+    case PROP_IV:
+      g_value_set_string (value, self->iv_string);
+      break;
+    case PROP_IV_SIZE:
+      g_value_set_uint (value, self->iv_size);
+      break;
+    case PROP_KEY_DIRECTORY:
+      g_value_set_string (value, self->key_directory);
+      break;
+    case PROP_PROTECTION_SYSTEM:
+      g_value_set_string (value, self->protection_system);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_encrypt_finalize (GObject * object)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (object);
+
+  g_free (self->kid_string);
+  g_free (self->key_string);
+  g_free (self->iv_string);
+  g_free (self->key_directory);
+  g_free (self->protection_system);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* Parse a hex string, ignoring any '-' characters as found in UUIDs */
+static gboolean
+gst_cenc_encrypt_parse_hex (const gchar * string, guint8 * bytes,
+    gsize length)
+{
+  gsize i = 0;
+
+  while (string && *string) {
+    gint hi, lo;
+
+    if (*string == '-') {
+      ++string;
+      continue;
+    }
+    hi = g_ascii_xdigit_value (string[0]);
+    lo = hi < 0 ? -1 : g_ascii_xdigit_value (string[1]);
+    if (lo < 0 || i == length)
+      return FALSE;
+    bytes[i++] = (hi << 4) | lo;
+    string += 2;
+  }
+  return i == length;
+}
+
+static gboolean
+gst_cenc_encrypt_start (GstBaseTransform * trans)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (trans);
+  guint8 key[KEY_LENGTH];
+  gchar *key_directory;
+  GBytes *key_bytes, *iv_bytes;
+  gboolean ret = TRUE;
+  guint i;
+
+  GST_DEBUG_OBJECT (self, "start");
+  GST_OBJECT_LOCK (self);
+  if (self->iv_size != 8 && self->iv_size != 16) {
+    GST_OBJECT_UNLOCK (self);
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("iv-size must be 8 or 16"), (NULL));
+    return FALSE;
+  }
+  if (!gst_cenc_encrypt_parse_hex (self->kid_string, self->kid, KID_LENGTH)) {
+    GST_OBJECT_UNLOCK (self);
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("Invalid kid"), (NULL));
+    return FALSE;
+  }
+  if (self->key_string) {
+    ret = gst_cenc_encrypt_parse_hex (self->key_string, key, KEY_LENGTH);
+  } else {
+    for (i = 0; i < KEY_LENGTH; ++i) {
+      key[i] = g_random_int_range (0, 256);
+    }
+  }
+  memset (self->iv, 0, sizeof (self->iv));
+  if (self->iv_string) {
+    ret = ret && gst_cenc_encrypt_parse_hex (self->iv_string, self->iv,
+        self->iv_size);
+  } else {
+    for (i = 0; i < self->iv_size; ++i) {
+      self->iv[i] = g_random_int_range (0, 256);
+    }
+  }
+  key_directory = g_strdup (self->key_directory);
+  GST_OBJECT_UNLOCK (self);
+
+  if (!ret) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("Invalid key or iv"), (NULL));
+    g_free (key_directory);
+    return FALSE;
+  }
+  key_bytes = g_bytes_new (key, KEY_LENGTH);
+  if (key_directory && *key_directory) {
+    GError *err = NULL;
+
+    /* use the same file names as store-key.py */
+    ret = gst_cenc_key_store_save (key_directory, self->kid, key_bytes, &err);
+    if (!ret) {
+      GST_ELEMENT_ERROR (self, RESOURCE, WRITE,
+          ("Failed to store key in %s", key_directory), ("%s", err->message));
+      g_clear_error (&err);
+    }
+  }
+  g_free (key_directory);
+
+  iv_bytes = g_bytes_new (self->iv, 16);
+  self->state = gst_aes_ctr_decrypt_new (key_bytes, iv_bytes);
+  g_bytes_unref (key_bytes);
+  g_bytes_unref (iv_bytes);
+  if (!self->state) {
+    GST_ELEMENT_ERROR (self, LIBRARY, INIT,
+        ("Failed to init AES cipher"), (NULL));
+    return FALSE;
+  }
+  return ret;
+}
+
+static gboolean
+gst_cenc_encrypt_stop (GstBaseTransform * trans)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (trans);
+
+  GST_DEBUG_OBJECT (self, "stop");
+  if (self->state) {
+    gst_aes_ctr_decrypt_unref (self->state);
+    self->state = NULL;
+  }
+  return TRUE;
+}
+
+/*
+  Given the pad in this direction and the given caps, what caps are allowed on
+  the other pad in this element ?
+*/
+static GstCaps *
+gst_cenc_encrypt_transform_caps (GstBaseTransform * base,
+    GstPadDirection direction, GstCaps * caps, GstCaps * filter)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (base);
+  GstCaps *res;
+  gchar *protection_system;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  protection_system = g_strdup (self->protection_system);
+  GST_OBJECT_UNLOCK (self);
+
+  res = gst_caps_new_empty ();
+  for (i = 0; i < gst_caps_get_size (caps); ++i) {
+    GstStructure *in = gst_caps_get_structure (caps, i);
+    GstStructure *out;
+
+    if (direction == GST_PAD_SINK) {
+      out = gst_structure_copy (in);
+      gst_structure_set (out,
+          "original-media-type", G_TYPE_STRING, gst_structure_get_name (in),
+          "protection-system", G_TYPE_STRING, protection_system, NULL);
+      gst_structure_set_name (out, "application/x-cenc");
+    } else {
+      const gchar *media_type;
+
+      media_type = gst_structure_get_string (in, "original-media-type");
+      if (!media_type)
+        continue;
+      out = gst_structure_copy (in);
+      gst_structure_set_name (out, media_type);
+      gst_structure_remove_fields (out, "original-media-type",
+          "protection-system", NULL);
+    }
+    gst_caps_append_structure (res, out);
+  }
+  g_free (protection_system);
+
+  if (direction == GST_PAD_SRC && gst_caps_is_empty (res)) {
+    gst_caps_unref (res);
+    res = gst_pad_get_pad_template_caps (GST_BASE_TRANSFORM_SINK_PAD (base));
+  }
+  if (filter) {
+    GstCaps *intersection;
+
+    intersection =
+        gst_caps_intersect_full (res, filter, GST_CAPS_INTERSECT_FIRST);
+    gst_caps_unref (res);
+    res = intersection;
+  }
+  GST_DEBUG_OBJECT (base, "transformed %" GST_PTR_FORMAT " to %"
+      GST_PTR_FORMAT, caps, res);
+
+  return res;
+}
+
+static gboolean
+gst_cenc_encrypt_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (trans);
+  const GstStructure *s = gst_caps_get_structure (incaps, 0);
+  const gchar *stream_format;
+  const GValue *value;
+  GstMapInfo map;
+
+  GST_DEBUG_OBJECT (self, "input caps %" GST_PTR_FORMAT, incaps);
+  if (gst_structure_has_name (s, "video/x-h264")) {
+    self->codec = GST_CENC_CODEC_AVC;
+  } else if (gst_structure_has_name (s, "video/x-h265")) {
+    self->codec = GST_CENC_CODEC_HEVC;
+  } else {
+    self->codec = GST_CENC_CODEC_AUDIO;
+    return TRUE;
+  }
+
+  stream_format = gst_structure_get_string (s, "stream-format");
+  if (g_strcmp0 (stream_format, "byte-stream") == 0) {
+    self->nal_length_size = 0;
+    return TRUE;
+  }
+  /* the NAL unit length size is found in the AVCDecoderConfigurationRecord
+     or HEVCDecoderConfigurationRecord */
+  self->nal_length_size = 4;
+  value = gst_structure_get_value (s, "codec_data");
+  if (value && gst_buffer_map (gst_value_get_buffer (value), &map,
+          GST_MAP_READ)) {
+    if (self->codec == GST_CENC_CODEC_AVC && map.size > 4) {
+      self->nal_length_size = (map.data[4] & 0x03) + 1;
+    } else if (self->codec == GST_CENC_CODEC_HEVC && map.size > 21) {
+      self->nal_length_size = (map.data[21] & 0x03) + 1;
+    }
+    gst_buffer_unmap (gst_value_get_buffer (value), &map);
+  }
+  GST_DEBUG_OBJECT (self, "NAL length size %u", self->nal_length_size);
+  return TRUE;
+}
+
+/* Find the NAL unit that starts at pos. prefix is set to the size of its
+   length field or start code, and size to the size of the NAL unit without
+   the prefix. Returns FALSE if no NAL unit starts at pos. */
+static gboolean
+gst_cenc_encrypt_next_nal (GstCencEncrypt * self, const guint8 * data,
+    gsize length, gsize pos, gsize * prefix, gsize * size)
+{
+  if (self->nal_length_size) {
+    guint32 nal_size = 0;
+    guint i;
+
+    if (length - pos < self->nal_length_size)
+      return FALSE;
+    for (i = 0; i < self->nal_length_size; ++i) {
+      nal_size = (nal_size << 8) | data[pos + i];
+    }
+    if (nal_size > length - pos - self->nal_length_size)
+      return FALSE;
+    *prefix = self->nal_length_size;
+    *size = nal_size;
+  } else {
+    GstByteReader reader;
+    gint offset;
+
+    if (length - pos < 3 || data[pos] || data[pos + 1])
+      return FALSE;
+    if (data[pos + 2] == 1) {
+      *prefix = 3;
+    } else if (length - pos >= 4 && !data[pos + 2] && data[pos + 3] == 1) {
+      *prefix = 4;
+    } else {
+      return FALSE;
+    }
+    gst_byte_reader_init (&reader, data + pos + *prefix,
+        length - pos - *prefix);
+    offset = gst_byte_reader_masked_scan_uint32 (&reader, 0xffffff00,
+        0x00000100, 0, gst_byte_reader_get_remaining (&reader));
+    *size = offset < 0 ? length - pos - *prefix : offset;
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_encrypt_nal_is_vcl (GstCencEncrypt * self, const guint8 * nal,
+    gsize size, guint * header_size)
+{
+  if (self->codec == GST_CENC_CODEC_AVC) {
+    guint type = nal[0] & 0x1f;
+
+    *header_size = 1;
+    return size > 1 && type >= 1 && type <= 5;
+  }
+  *header_size = 2;
+  return size > 2 && ((nal[0] >> 1) & 0x3f) <= 31;
+}
+
+static void
+gst_cenc_encrypt_add_subsample (GstByteWriter * writer, gsize n_bytes_clear,
+    guint32 n_bytes_encrypted)
+{
+  while (n_bytes_clear > MAX_CLEAR_BYTES) {
+    gst_byte_writer_put_uint16_be (writer, MAX_CLEAR_BYTES);
+    gst_byte_writer_put_uint32_be (writer, 0);
+    n_bytes_clear -= MAX_CLEAR_BYTES;
+  }
+  gst_byte_writer_put_uint16_be (writer, n_bytes_clear);
+  gst_byte_writer_put_uint32_be (writer, n_bytes_encrypted);
+}
+
+/* Build the subsample table of a video sample, encrypting the protected
+   range of every subsample. Returns the number of subsamples. */
+static guint
+gst_cenc_encrypt_video (GstCencEncrypt * self, guint8 * data, gsize length,
+    GstByteWriter * writer, gsize * bytes_encrypted)
+{
+  gsize pos = 0, clear = 0, prefix, size;
+
+  *bytes_encrypted = 0;
+  while (pos < length) {
+    guint header_size;
+    gsize encrypted = 0;
+
+    if (!gst_cenc_encrypt_next_nal (self, data, length, pos, &prefix, &size)) {
+      GST_WARNING_OBJECT (self, "Invalid NAL unit at offset %"
+          G_GSIZE_FORMAT ", leaving the rest of the sample clear", pos);
+      clear += length - pos;
+      break;
+    }
+    if (gst_cenc_encrypt_nal_is_vcl (self, data + pos + prefix, size,
+            &header_size)) {
+      /* the protected part must be a multiple of the AES block size */
+      encrypted = (size - header_size) & ~(gsize) 15;
+    }
+    clear += prefix + size - encrypted;
+    if (encrypted) {
+      gst_aes_ctr_decrypt_ip (self->state, data + pos + prefix + size -
+          encrypted, encrypted);
+      gst_cenc_encrypt_add_subsample (writer, clear, encrypted);
+      *bytes_encrypted += encrypted;
+      clear = 0;
+    }
+    pos += prefix + size;
+  }
+  if (clear || !gst_byte_writer_get_pos (writer))
+    gst_cenc_encrypt_add_subsample (writer, clear, 0);
+
+  return gst_byte_writer_get_pos (writer) / 6;
+}
+
+/* Add the number of AES blocks used by the previous sample to the IV, so
+   that no counter value is used twice with the same key. An 8 byte IV is
+   the upper half of the counter, so it only needs to change by one. */
+static void
+gst_cenc_encrypt_advance_iv (GstCencEncrypt * self, gsize bytes_encrypted)
+{
+  guint64 carry;
+  gint i;
+
+  carry = self->iv_size == 8 ? 1 : (bytes_encrypted + 15) / 16;
+  for (i = self->iv_size - 1; i >= 0 && carry; --i) {
+    carry += self->iv[i];
+    self->iv[i] = carry & 0xff;
+    carry >>= 8;
+  }
+}
+
+static GstFlowReturn
+gst_cenc_encrypt_transform_ip (GstBaseTransform * base, GstBuffer * buf)
+{
+  GstCencEncrypt *self = GST_CENC_ENCRYPT (base);
+  GstStructure *info;
+  GstBuffer *kid_buf, *iv_buf;
+  GstMapInfo map;
+  gsize bytes_encrypted;
+  guint subsample_count = 0;
+  GstByteWriter writer;
+
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ERROR_OBJECT (self, "Failed to map buffer");
+    return GST_FLOW_ERROR;
+  }
+  gst_aes_ctr_decrypt_set_iv (self->state, self->iv, self->iv_size);
+  /* AES-CTR encryption and decryption are the same operation */
+  if (self->codec == GST_CENC_CODEC_AUDIO) {
+    gst_aes_ctr_decrypt_ip (self->state, map.data, map.size);
+    bytes_encrypted = map.size;
+  } else {
+    gst_byte_writer_init (&writer);
+    subsample_count = gst_cenc_encrypt_video (self, map.data, map.size,
+        &writer, &bytes_encrypted);
+  }
+  gst_buffer_unmap (buf, &map);
+  GST_TRACE_OBJECT (self, "encrypted %" G_GSIZE_FORMAT " of %" G_GSIZE_FORMAT
+      " bytes in %u subsamples", bytes_encrypted, gst_buffer_get_size (buf),
+      subsample_count);
+
+  kid_buf = gst_buffer_new_allocate (NULL, KID_LENGTH, NULL);
+  gst_buffer_fill (kid_buf, 0, self->kid, KID_LENGTH);
+  iv_buf = gst_buffer_new_allocate (NULL, self->iv_size, NULL);
+  gst_buffer_fill (iv_buf, 0, self->iv, self->iv_size);
+  /* same fields as qtdemux puts in the protection meta */
+  info = gst_structure_new ("application/x-cenc",
+      "iv_size", G_TYPE_UINT, self->iv_size,
+      "encrypted", G_TYPE_BOOLEAN, TRUE,
+      "kid", GST_TYPE_BUFFER, kid_buf,
+      "iv", GST_TYPE_BUFFER, iv_buf,
+      "subsample_count", G_TYPE_UINT, subsample_count, NULL);
+  gst_buffer_unref (kid_buf);
+  gst_buffer_unref (iv_buf);
+  if (self->codec != GST_CENC_CODEC_AUDIO) {
+    GstBuffer *subsamples = gst_byte_writer_reset_and_get_buffer (&writer);
+
+    gst_structure_set (info, "subsamples", GST_TYPE_BUFFER, subsamples, NULL);
+    gst_buffer_unref (subsamples);
+  }
+  gst_buffer_add_protection_meta (buf, info);
+  gst_cenc_encrypt_advance_iv (self, bytes_encrypted);
+
+  return GST_FLOW_OK;
+}
@@ -0,0 +1,38 @@
+/* GStreamer ISO MPEG-DASH common encryption encryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_ENCRYPT_H_
+#define _GST_CENC_ENCRYPT_H_
+
+#include <gst/base/gstbasetransform.h>
+
+G_BEGIN_DECLS
+#define GST_TYPE_CENC_ENCRYPT   (gst_cenc_encrypt_get_type())
+#define GST_CENC_ENCRYPT(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CENC_ENCRYPT,GstCencEncrypt))
+#define GST_CENC_ENCRYPT_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_CENC_ENCRYPT,GstCencEncryptClass))
+#define GST_IS_CENC_ENCRYPT(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CENC_ENCRYPT))
+#define GST_IS_CENC_ENCRYPT_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_CENC_ENCRYPT))
+typedef struct _GstCencEncrypt GstCencEncrypt;
+typedef struct _GstCencEncryptClass GstCencEncryptClass;
+
+
+GType gst_cenc_encrypt_get_type (void);
+
+G_END_DECLS
+#endif
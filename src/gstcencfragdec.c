@@ -0,0 +1,1017 @@
+/* GStreamer ISO MPEG DASH common encryption fragment decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/**
+ * SECTION:element-gstcencfragdecrypt
+ *
+ * Decrypts a fragmented MP4 byte stream that uses the 'cenc' scheme of the
+ * ISOBMFF Common Encryption standard, before it reaches qtdemux.
+ *
+ * Each moof box is held back together with the mdat box that follows it,
+ * and all of the samples of the fragment are then decrypted in one pass
+ * using the sample encryption information of the moof, interleaving
+ * several samples per AES call and, for large fragments, spreading them
+ * over a pool of threads. The protection boxes are renamed to 'free' and
+ * the encrypted sample entries are given back their original format, so
+ * the output is a clear fMP4 stream of exactly the same size, and qtdemux
+ * never sees any protection information.
+ *
+ * With low-latency set, as for chunked CMAF in low-latency DASH, a moof box
+ * is pushed as soon as it and the header of its mdat box have arrived, and
+ * the sample data is then decrypted and pushed piece by piece as it
+ * arrives, keeping the position in the current sample and its counter
+ * between buffers. Sample auxiliary information has to be in the moof box
+ * (in a senc box, or pointed to by saio) for this to work.
+ *
+ * A stream whose moov box has no protected tracks is passed through
+ * unchanged. Fragments that give an explicit base-data-offset in their tfhd
+ * box are not supported, as that is a position in the whole file.
+ *
+ * Keys are loaded from key-directory, using either the ClearKey or the
+ * Marlin file names written by store-key.py.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 filesrc location=encrypted.mp4 ! cencfragdec ! qtdemux ! \
+ *     h264parse ! avdec_h264 ! autovideosink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstadapter.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+#include <gst/gstcencmp4.h>
+
+#include <glib.h>
+
+#include "gstcencfragdec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_cenc_frag_decrypt_debug_category);
+#define GST_CAT_DEFAULT gst_cenc_frag_decrypt_debug_category
+
+#define LANES GST_CENC_MP4_MAX_LANES
+
+/* progress through the mdat payload of a fragment in low-latency mode */
+typedef struct _GstCencFragProgress
+{
+  GstCencMp4Fragment fragment;  /* samples sorted by offset */
+  guint64 remaining;            /* bytes of the mdat payload still to come */
+  gsize offset;                 /* of the next byte, from the moof box */
+  guint sample;                 /* next sample of fragment */
+  gboolean in_sample;
+  guint subsample;              /* next subsample of the current sample */
+  gsize sample_left;            /* bytes of the current sample to come */
+  gsize clear;                  /* bytes of the current range to come */
+  gsize encrypted;
+  const GstCencMp4Track *track; /* that state is keyed for */
+  AesCtrState *state;
+} GstCencFragProgress;
+
+struct _GstCencFragDecrypt
+{
+  GstElement parent;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  /* properties, protected by the object lock */
+  gchar *key_directory;
+  guint n_threads;
+  gboolean low_latency;
+  /* streaming state */
+  GstAdapter *adapter;
+  guint64 passthrough;          /* bytes of the current box still to forward */
+  GstCencMp4Movie movie;
+  gboolean have_movie;
+  GPtrArray *track_keys;        /* GBytes key of each track of movie */
+  GstCencFragProgress ll;
+  /* worker threads, created in the READY state */
+  GThreadPool *pool;
+  guint pool_size;
+  GMutex task_lock;
+  GCond task_cond;
+  guint tasks_pending;
+};
+
+struct _GstCencFragDecryptClass
+{
+  GstElementClass parent_class;
+};
+
+/* a run of samples of one fragment, decrypted by one thread */
+typedef struct _GstCencFragTask
+{
+  GstCencFragDecrypt *self;
+  const GstCencMp4Fragment *fragment;
+  guint8 *data;
+  guint first;
+  guint last;
+  gboolean ok;
+} GstCencFragTask;
+
+enum
+{
+  PROP_0,
+  PROP_KEY_DIRECTORY,
+  PROP_N_THREADS,
+  PROP_LOW_LATENCY
+};
+
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_N_THREADS 0
+#define DEFAULT_LOW_LATENCY FALSE
+
+/* smallest amount of sample data worth handing to another thread */
+#define MIN_TASK_BYTES (256 * 1024)
+
+#define FOURCC_moov GST_CENC_MP4_FOURCC('m','o','o','v')
+#define FOURCC_moof GST_CENC_MP4_FOURCC('m','o','o','f')
+#define FOURCC_mdat GST_CENC_MP4_FOURCC('m','d','a','t')
+
+/* prototypes */
+static void gst_cenc_frag_decrypt_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_cenc_frag_decrypt_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_cenc_frag_decrypt_finalize (GObject * object);
+static GstStateChangeReturn gst_cenc_frag_decrypt_change_state (GstElement *
+    element, GstStateChange transition);
+static gboolean gst_cenc_frag_decrypt_sink_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static GstFlowReturn gst_cenc_frag_decrypt_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buf);
+static void gst_cenc_frag_decrypt_task_run (gpointer data,
+    gpointer user_data);
+
+/* pad templates */
+
+#define GST_CENC_FRAG_DECRYPT_CAPS \
+  "video/quicktime; audio/x-m4a; application/x-3gp"
+
+static GstStaticPadTemplate gst_cenc_frag_decrypt_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_CENC_FRAG_DECRYPT_CAPS)
+    );
+
+static GstStaticPadTemplate gst_cenc_frag_decrypt_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_CENC_FRAG_DECRYPT_CAPS)
+    );
+
+/* class initialization */
+
+#define gst_cenc_frag_decrypt_parent_class parent_class
+G_DEFINE_TYPE (GstCencFragDecrypt, gst_cenc_frag_decrypt, GST_TYPE_ELEMENT);
+
+static void
+gst_cenc_frag_decrypt_class_init (GstCencFragDecryptClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_frag_decrypt_sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_frag_decrypt_src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Decrypt fragmented MP4 using ISOBMFF Common Encryption",
+      "Decryptor",
+      "Decrypts a fragmented MP4 byte stream before demuxing, producing "
+      "an unencrypted fragmented MP4 stream.",
+      "Alex Ashley <alex.ashley@youview.com>");
+
+  GST_DEBUG_CATEGORY_INIT (gst_cenc_frag_decrypt_debug_category,
+      "cencfragdec", 0, "CENC fragmented MP4 decryptor");
+
+  gobject_class->set_property = gst_cenc_frag_decrypt_set_property;
+  gobject_class->get_property = gst_cenc_frag_decrypt_get_property;
+  gobject_class->finalize = gst_cenc_frag_decrypt_finalize;
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_cenc_frag_decrypt_change_state);
+
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory containing the key files", DEFAULT_KEY_DIRECTORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Largest number of threads used to decrypt one fragment, "
+          "or 0 for one per processor (applied when going to READY)",
+          0, G_MAXINT, DEFAULT_N_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_LOW_LATENCY,
+      g_param_spec_boolean ("low-latency", "Low latency",
+          "Decrypt and push the sample data of a fragment as it arrives, "
+          "instead of waiting for the whole mdat box",
+          DEFAULT_LOW_LATENCY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_cenc_frag_decrypt_init (GstCencFragDecrypt * self)
+{
+  self->sinkpad =
+      gst_pad_new_from_static_template (&gst_cenc_frag_decrypt_sink_template,
+      "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_frag_decrypt_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_frag_decrypt_sink_event));
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad =
+      gst_pad_new_from_static_template (&gst_cenc_frag_decrypt_src_template,
+      "src");
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->n_threads = DEFAULT_N_THREADS;
+  self->low_latency = DEFAULT_LOW_LATENCY;
+  self->adapter = gst_adapter_new ();
+  gst_cenc_mp4_fragment_init (&self->ll.fragment);
+  gst_cenc_mp4_movie_init (&self->movie);
+  self->track_keys =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+  g_mutex_init (&self->task_lock);
+  g_cond_init (&self->task_cond);
+}
+
+static void
+gst_cenc_frag_decrypt_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "set_property");
+
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (self);
+      self->n_threads = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LOW_LATENCY:
+      GST_OBJECT_LOCK (self);
+      self->low_latency = g_value_get_boolean (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_cenc_frag_decrypt_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "get_property");
+
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->key_directory);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->n_threads);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_LOW_LATENCY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_boolean (value, self->low_latency);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_cenc_frag_decrypt_finalize (GObject * object)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  g_free (self->key_directory);
+  g_object_unref (self->adapter);
+  gst_cenc_mp4_movie_clear (&self->movie);
+  g_ptr_array_unref (self->track_keys);
+  gst_cenc_mp4_fragment_clear (&self->ll.fragment);
+  if (self->ll.state)
+    gst_aes_ctr_decrypt_unref (self->ll.state);
+  g_mutex_clear (&self->task_lock);
+  g_cond_clear (&self->task_cond);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_cenc_frag_decrypt_ll_reset (GstCencFragDecrypt * self)
+{
+  GstCencFragProgress *ll = &self->ll;
+
+  g_array_set_size (ll->fragment.samples, 0);
+  g_array_set_size (ll->fragment.subsamples, 0);
+  ll->remaining = 0;
+  ll->sample = 0;
+  ll->in_sample = FALSE;
+  ll->track = NULL;
+  if (ll->state) {
+    gst_aes_ctr_decrypt_unref (ll->state);
+    ll->state = NULL;
+  }
+}
+
+static void
+gst_cenc_frag_decrypt_reset (GstCencFragDecrypt * self)
+{
+  gst_adapter_clear (self->adapter);
+  self->passthrough = 0;
+  gst_cenc_frag_decrypt_ll_reset (self);
+}
+
+static GstStateChangeReturn
+gst_cenc_frag_decrypt_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (element);
+  GstStateChangeReturn ret;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      GST_OBJECT_LOCK (self);
+      self->pool_size = self->n_threads;
+      GST_OBJECT_UNLOCK (self);
+      if (self->pool_size == 0)
+        self->pool_size = g_get_num_processors ();
+      /* the streaming thread decrypts one share of each fragment itself */
+      if (self->pool_size > 1) {
+        self->pool = g_thread_pool_new (gst_cenc_frag_decrypt_task_run, self,
+            self->pool_size - 1, FALSE, NULL);
+        if (!self->pool)
+          self->pool_size = 1;
+      }
+      GST_DEBUG_OBJECT (self, "using %u threads", self->pool_size);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_cenc_frag_decrypt_reset (self);
+      gst_cenc_mp4_movie_clear (&self->movie);
+      gst_cenc_mp4_movie_init (&self->movie);
+      self->have_movie = FALSE;
+      g_ptr_array_set_size (self->track_keys, 0);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      if (self->pool)
+        g_thread_pool_free (self->pool, FALSE, TRUE);
+      self->pool = NULL;
+      break;
+    default:
+      break;
+  }
+  return ret;
+}
+
+static gboolean
+gst_cenc_frag_decrypt_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (parent);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_STOP:
+      gst_cenc_frag_decrypt_reset (self);
+      break;
+    case GST_EVENT_EOS:
+      if (self->ll.remaining) {
+        GST_WARNING_OBJECT (self, "%" G_GUINT64_FORMAT " bytes of an mdat "
+            "box missing at EOS", self->ll.remaining);
+        gst_cenc_frag_decrypt_reset (self);
+      } else if (gst_adapter_available (self->adapter)) {
+        GST_WARNING_OBJECT (self, "Discarding %" G_GSIZE_FORMAT
+            " bytes of an incomplete box at EOS",
+            gst_adapter_available (self->adapter));
+        gst_cenc_frag_decrypt_reset (self);
+      }
+      break;
+    default:
+      break;
+  }
+  return gst_pad_event_default (pad, parent, event);
+}
+
+/* Reads the header of the box that starts offset bytes into the adapter.
+   Returns FALSE if the adapter does not yet hold all of the header. A box
+   that extends to the end of the stream has a size of G_MAXUINT64. */
+static gboolean
+gst_cenc_frag_decrypt_peek_box (GstCencFragDecrypt * self, gsize offset,
+    guint32 * type, guint64 * header_size, guint64 * box_size)
+{
+  gsize avail = gst_adapter_available (self->adapter);
+  guint8 header[16];
+
+  if (avail < offset + 8)
+    return FALSE;
+  gst_adapter_copy (self->adapter, header, offset, 8);
+  *box_size = GST_READ_UINT32_BE (header);
+  *type = GST_READ_UINT32_BE (header + 4);
+  *header_size = 8;
+  if (*box_size == 1) {
+    if (avail < offset + 16)
+      return FALSE;
+    gst_adapter_copy (self->adapter, header + 8, offset + 8, 8);
+    *box_size = GST_READ_UINT64_BE (header + 8);
+    *header_size = 16;
+  } else if (*box_size == 0) {
+    *box_size = G_MAXUINT64;
+  }
+  return TRUE;
+}
+
+/* Loads the key of every track that has samples in the fragment and
+   that has not yet been used, so that the worker threads only need to
+   read track_keys. */
+static gboolean
+gst_cenc_frag_decrypt_load_keys (GstCencFragDecrypt * self,
+    const GstCencMp4Fragment * fragment)
+{
+  const GstCencMp4Track *tracks =
+      (const GstCencMp4Track *) self->movie.tracks->data;
+  gchar *key_directory;
+  gboolean ret = TRUE;
+  guint i;
+
+  GST_OBJECT_LOCK (self);
+  key_directory = g_strdup (self->key_directory);
+  GST_OBJECT_UNLOCK (self);
+
+  for (i = 0; ret && i < fragment->samples->len; ++i) {
+    const GstCencMp4Sample *sample =
+        &g_array_index (fragment->samples, GstCencMp4Sample, i);
+    guint index = sample->track - tracks;
+    GError *err = NULL;
+    GBytes *key;
+
+    if (g_ptr_array_index (self->track_keys, index))
+      continue;
+    key = gst_cenc_key_store_load (key_directory, sample->track->kid,
+        GST_CENC_KEY_NAMING_CLEARKEY, NULL);
+    if (!key)
+      key = gst_cenc_key_store_load (key_directory, sample->track->kid,
+          GST_CENC_KEY_NAMING_MARLIN, &err);
+    if (!key) {
+      GST_ELEMENT_ERROR (self, RESOURCE, NOT_FOUND,
+          ("Failed to load the key of track %u from %s",
+              sample->track->track_id, key_directory), ("%s", err->message));
+      g_error_free (err);
+      ret = FALSE;
+      break;
+    }
+    g_ptr_array_index (self->track_keys, index) = key;
+  }
+  g_free (key_directory);
+  return ret;
+}
+
+/* Decrypts samples first to last - 1 of a fragment, LANES at a time. */
+static gboolean
+gst_cenc_frag_decrypt_samples (GstCencFragDecrypt * self,
+    const GstCencMp4Fragment * fragment, guint8 * data, guint first,
+    guint last)
+{
+  const GstCencMp4Track *tracks =
+      (const GstCencMp4Track *) self->movie.tracks->data;
+  const GstCencMp4Track *lane_tracks[LANES] = { NULL };
+  AesCtrState *states[LANES] = { NULL };
+  gboolean ret = TRUE;
+  guint i, j, n;
+
+  for (i = first; ret && i < last; i += n) {
+    n = MIN (LANES, last - i);
+    for (j = 0; ret && j < n; ++j) {
+      const GstCencMp4Sample *sample =
+          &g_array_index (fragment->samples, GstCencMp4Sample, i + j);
+      GBytes *iv;
+
+      /* the key only changes at the boundaries of the runs of a track */
+      if (sample->track == lane_tracks[j])
+        continue;
+      if (states[j])
+        gst_aes_ctr_decrypt_unref (states[j]);
+      lane_tracks[j] = sample->track;
+      iv = g_bytes_new (sample->iv, sample->track->iv_size);
+      states[j] = gst_aes_ctr_decrypt_new (g_ptr_array_index (self->track_keys,
+              sample->track - tracks), iv);
+      g_bytes_unref (iv);
+      ret = states[j] != NULL;
+    }
+    if (ret)
+      ret = gst_cenc_mp4_samples_decrypt (states, data, fragment, i, n);
+  }
+  for (j = 0; j < LANES; ++j) {
+    if (states[j])
+      gst_aes_ctr_decrypt_unref (states[j]);
+  }
+  return ret;
+}
+
+static void
+gst_cenc_frag_decrypt_task_run (gpointer data, gpointer user_data)
+{
+  GstCencFragTask *task = data;
+  GstCencFragDecrypt *self = task->self;
+
+  task->ok = gst_cenc_frag_decrypt_samples (self, task->fragment, task->data,
+      task->first, task->last);
+
+  g_mutex_lock (&self->task_lock);
+  if (--self->tasks_pending == 0)
+    g_cond_signal (&self->task_cond);
+  g_mutex_unlock (&self->task_lock);
+}
+
+/* Decrypts every sample of a fragment, sharing them out between the
+   streaming thread and the thread pool when there is enough data. */
+static gboolean
+gst_cenc_frag_decrypt_fragment (GstCencFragDecrypt * self,
+    const GstCencMp4Fragment * fragment, guint8 * data, gsize size)
+{
+  GstCencFragTask tasks[64];
+  guint n_samples = fragment->samples->len;
+  guint n_tasks, per_task, i;
+  gboolean ret = TRUE;
+
+  n_tasks = MIN (self->pool_size, size / MIN_TASK_BYTES);
+  n_tasks = MIN (n_tasks, G_N_ELEMENTS (tasks));
+  n_tasks = MIN (n_tasks, (n_samples + LANES - 1) / LANES);
+  if (!self->pool || n_tasks < 2)
+    return gst_cenc_frag_decrypt_samples (self, fragment, data, 0, n_samples);
+
+  /* whole groups of LANES samples per task */
+  per_task = (n_samples + n_tasks - 1) / n_tasks;
+  per_task = (per_task + LANES - 1) / LANES * LANES;
+  for (i = 0; i < n_tasks; ++i) {
+    tasks[i].self = self;
+    tasks[i].fragment = fragment;
+    tasks[i].data = data;
+    tasks[i].first = MIN (i * per_task, n_samples);
+    tasks[i].last = MIN (tasks[i].first + per_task, n_samples);
+    tasks[i].ok = TRUE;
+  }
+
+  /* only the pool tasks count down tasks_pending, the first task is run
+     directly by the streaming thread */
+  self->tasks_pending = n_tasks - 1;
+  for (i = 1; i < n_tasks; ++i)
+    g_thread_pool_push (self->pool, &tasks[i], NULL);
+  tasks[0].ok = gst_cenc_frag_decrypt_samples (self, fragment, data,
+      tasks[0].first, tasks[0].last);
+  g_mutex_lock (&self->task_lock);
+  while (self->tasks_pending)
+    g_cond_wait (&self->task_cond, &self->task_lock);
+  g_mutex_unlock (&self->task_lock);
+
+  for (i = 0; i < n_tasks; ++i)
+    ret = ret && tasks[i].ok;
+  return ret;
+}
+
+static GstFlowReturn
+gst_cenc_frag_decrypt_process_movie (GstCencFragDecrypt * self,
+    GstBuffer * buf, gsize header_size)
+{
+  GstMapInfo map;
+  gboolean ok, clear;
+
+  buf = gst_buffer_make_writable (buf);
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("Failed to map buffer"),
+        (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  gst_cenc_mp4_movie_clear (&self->movie);
+  gst_cenc_mp4_movie_init (&self->movie);
+  ok = gst_cenc_mp4_movie_parse (&self->movie, map.data + header_size,
+      map.size - header_size);
+  if (ok)
+    gst_cenc_mp4_movie_clear_protection (map.data + header_size,
+        map.size - header_size);
+  gst_buffer_unmap (buf, &map);
+  /* a movie without protected sample entries only has clear fragments, a
+     protected one that could not be parsed is an error */
+  clear = !ok && !self->movie.has_protected_entries;
+  self->have_movie = ok || clear;
+  g_ptr_array_set_size (self->track_keys, 0);
+  if (clear) {
+    GST_DEBUG_OBJECT (self, "moov has no protected tracks, passing through");
+    return gst_pad_push (self->srcpad, buf);
+  }
+  if (!ok) {
+    GST_ELEMENT_ERROR (self, STREAM, DEMUX, ("Failed to parse moov box"),
+        (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  g_ptr_array_set_size (self->track_keys, self->movie.tracks->len);
+  GST_DEBUG_OBJECT (self, "moov with %u tracks", self->movie.tracks->len);
+  return gst_pad_push (self->srcpad, buf);
+}
+
+/* buf holds a moof box and the mdat box that follows it */
+static GstFlowReturn
+gst_cenc_frag_decrypt_process_fragment (GstCencFragDecrypt * self,
+    GstBuffer * buf)
+{
+  GstCencMp4Fragment fragment;
+  GstMapInfo map;
+  gboolean ok;
+
+  if (!self->have_movie) {
+    GST_ELEMENT_ERROR (self, STREAM, DEMUX,
+        ("Received a moof box before the moov box"), (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  buf = gst_buffer_make_writable (buf);
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("Failed to map buffer"),
+        (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  gst_cenc_mp4_fragment_init (&fragment);
+  ok = gst_cenc_mp4_fragment_parse (&fragment, &self->movie, map.data,
+      map.size, 0);
+  if (fragment.has_base_data_offset) {
+    GST_ELEMENT_ERROR (self, STREAM, NOT_IMPLEMENTED,
+        ("Unsupported moof box"),
+        ("tfhd base-data-offset is a position in the file, which is unknown"));
+    ok = FALSE;
+  } else if (!ok) {
+    GST_ELEMENT_ERROR (self, STREAM, DEMUX, ("Failed to parse moof box"),
+        (NULL));
+  } else if (gst_cenc_frag_decrypt_load_keys (self, &fragment)) {
+    GST_LOG_OBJECT (self, "decrypting %u samples", fragment.samples->len);
+    ok = gst_cenc_frag_decrypt_fragment (self, &fragment, map.data, map.size);
+    if (!ok)
+      GST_ELEMENT_ERROR (self, STREAM, DECRYPT, ("Failed to decrypt fragment"),
+          ("invalid subsample information"));
+    gst_cenc_mp4_fragment_clear_protection (map.data, &fragment);
+  } else {
+    ok = FALSE;
+  }
+  gst_cenc_mp4_fragment_clear (&fragment);
+  gst_buffer_unmap (buf, &map);
+  if (!ok) {
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  return gst_pad_push (self->srcpad, buf);
+}
+
+static gint
+gst_cenc_frag_decrypt_compare_samples (gconstpointer a, gconstpointer b)
+{
+  const GstCencMp4Sample *sa = a, *sb = b;
+
+  return (sa->offset > sb->offset) - (sa->offset < sb->offset);
+}
+
+/* Low-latency mode: buf holds a moof box and the header of the mdat box
+   after it, and fragment_size is the size of both boxes. The moof box is
+   parsed and pushed at once, and the mdat payload is then decrypted as it
+   arrives by gst_cenc_frag_decrypt_ll_payload(). */
+static GstFlowReturn
+gst_cenc_frag_decrypt_ll_start (GstCencFragDecrypt * self, GstBuffer * buf,
+    guint64 fragment_size)
+{
+  GstCencFragProgress *ll = &self->ll;
+  GArray *samples = ll->fragment.samples;
+  GstMapInfo map;
+  gboolean ok;
+  guint i;
+
+  if (!self->have_movie) {
+    GST_ELEMENT_ERROR (self, STREAM, DEMUX,
+        ("Received a moof box before the moov box"), (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  buf = gst_buffer_make_writable (buf);
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("Failed to map buffer"),
+        (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  gst_cenc_frag_decrypt_ll_reset (self);
+  ok = gst_cenc_mp4_fragment_parse_partial (&ll->fragment, &self->movie,
+      map.data, map.size, fragment_size, 0);
+  if (ll->fragment.has_base_data_offset) {
+    GST_ELEMENT_ERROR (self, STREAM, NOT_IMPLEMENTED,
+        ("Unsupported moof box"),
+        ("tfhd base-data-offset is a position in the file, which is unknown"));
+    ok = FALSE;
+  } else if (!ok) {
+    GST_ELEMENT_ERROR (self, STREAM, DEMUX, ("Failed to parse moof box"),
+        ("in low-latency mode, the sample auxiliary information must be in "
+            "the moof box"));
+  } else {
+    /* the sample data is decrypted in the order that it arrives */
+    g_array_sort (samples, gst_cenc_frag_decrypt_compare_samples);
+    for (i = 0; ok && i < samples->len; ++i) {
+      const GstCencMp4Sample *sample =
+          &g_array_index (samples, GstCencMp4Sample, i);
+
+      if (sample->offset < map.size)
+        ok = FALSE;
+      else if (i > 0 && sample->offset < sample[-1].offset + sample[-1].size)
+        ok = FALSE;
+    }
+    if (!ok)
+      GST_ELEMENT_ERROR (self, STREAM, DEMUX, ("Failed to parse moof box"),
+          ("samples overlap or are outside the mdat box"));
+    else
+      ok = gst_cenc_frag_decrypt_load_keys (self, &ll->fragment);
+    if (ok)
+      gst_cenc_mp4_fragment_clear_protection (map.data, &ll->fragment);
+  }
+  ll->offset = map.size;
+  gst_buffer_unmap (buf, &map);
+  if (!ok) {
+    gst_cenc_frag_decrypt_ll_reset (self);
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  ll->remaining = fragment_size - ll->offset;
+  GST_LOG_OBJECT (self, "decrypting %u samples as they arrive", samples->len);
+  return gst_pad_push (self->srcpad, buf);
+}
+
+/* Sets up the cipher for the next sample of a low-latency fragment */
+static gboolean
+gst_cenc_frag_decrypt_ll_begin_sample (GstCencFragDecrypt * self,
+    const GstCencMp4Sample * sample)
+{
+  const GstCencMp4Track *tracks =
+      (const GstCencMp4Track *) self->movie.tracks->data;
+  GstCencFragProgress *ll = &self->ll;
+
+  if (sample->track != ll->track) {
+    GBytes *iv = g_bytes_new (sample->iv, sample->track->iv_size);
+
+    if (ll->state)
+      gst_aes_ctr_decrypt_unref (ll->state);
+    ll->state = gst_aes_ctr_decrypt_new (g_ptr_array_index (self->track_keys,
+            sample->track - tracks), iv);
+    g_bytes_unref (iv);
+    ll->track = ll->state ? sample->track : NULL;
+    if (!ll->state)
+      return FALSE;
+  } else if (!gst_aes_ctr_decrypt_set_iv (ll->state, sample->iv,
+          sample->track->iv_size)) {
+    return FALSE;
+  }
+  ll->in_sample = TRUE;
+  ll->subsample = 0;
+  ll->sample_left = sample->size;
+  ll->clear = 0;
+  ll->encrypted = 0;
+  return TRUE;
+}
+
+/* Moves on to the next clear and encrypted range of the current sample.
+   Returns FALSE if the subsample does not fit in the sample. */
+static gboolean
+gst_cenc_frag_decrypt_ll_next_range (GstCencFragDecrypt * self,
+    const GstCencMp4Sample * sample)
+{
+  GstCencFragProgress *ll = &self->ll;
+
+  if (!sample->subsample_count) {
+    ll->encrypted = ll->sample_left;
+  } else if (ll->subsample < sample->subsample_count) {
+    const GstCencMp4Subsample *subsample =
+        &g_array_index (ll->fragment.subsamples, GstCencMp4Subsample,
+        sample->first_subsample + ll->subsample);
+
+    if (subsample->bytes_clear > ll->sample_left
+        || subsample->bytes_encrypted >
+        ll->sample_left - subsample->bytes_clear)
+      return FALSE;
+    ll->clear = subsample->bytes_clear;
+    ll->encrypted = subsample->bytes_encrypted;
+    ll->subsample++;
+  } else {
+    /* data after the last subsample is left alone */
+    ll->clear = ll->sample_left;
+  }
+  return TRUE;
+}
+
+/* Decrypts the next size bytes of the mdat payload of a low-latency
+   fragment in place. The counter of a sample that is cut short carries on
+   in the next call. */
+static gboolean
+gst_cenc_frag_decrypt_ll_decrypt (GstCencFragDecrypt * self, guint8 * data,
+    gsize size)
+{
+  GstCencFragProgress *ll = &self->ll;
+  GArray *samples = ll->fragment.samples;
+  gsize done = 0;
+
+  while (done < size && ll->sample < samples->len) {
+    const GstCencMp4Sample *sample =
+        &g_array_index (samples, GstCencMp4Sample, ll->sample);
+    gsize n;
+
+    if (!ll->in_sample) {
+      /* data between samples is clear */
+      n = MIN (size - done, sample->offset - (ll->offset + done));
+      done += n;
+      if (ll->offset + done < sample->offset)
+        break;
+      if (!gst_cenc_frag_decrypt_ll_begin_sample (self, sample))
+        return FALSE;
+    }
+    if (!ll->sample_left) {
+      ll->in_sample = FALSE;
+      ll->sample++;
+      continue;
+    }
+    if (!ll->clear && !ll->encrypted
+        && !gst_cenc_frag_decrypt_ll_next_range (self, sample))
+      return FALSE;
+    n = MIN (size - done, ll->clear);
+    ll->clear -= n;
+    ll->sample_left -= n;
+    done += n;
+    n = MIN (size - done, ll->encrypted);
+    gst_aes_ctr_decrypt_ip (ll->state, data + done, n);
+    ll->encrypted -= n;
+    ll->sample_left -= n;
+    done += n;
+  }
+  ll->offset += size;
+  return TRUE;
+}
+
+/* buf is the next part of the mdat payload of a low-latency fragment */
+static GstFlowReturn
+gst_cenc_frag_decrypt_ll_payload (GstCencFragDecrypt * self, GstBuffer * buf)
+{
+  GstMapInfo map;
+  gboolean ok;
+
+  buf = gst_buffer_make_writable (buf);
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, FAILED, ("Failed to map buffer"),
+        (NULL));
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  ok = gst_cenc_frag_decrypt_ll_decrypt (self, map.data, map.size);
+  self->ll.remaining -= map.size;
+  gst_buffer_unmap (buf, &map);
+  if (!ok) {
+    GST_ELEMENT_ERROR (self, STREAM, DECRYPT, ("Failed to decrypt fragment"),
+        ("invalid subsample information"));
+    gst_cenc_frag_decrypt_ll_reset (self);
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  if (!self->ll.remaining)
+    gst_cenc_frag_decrypt_ll_reset (self);
+  return gst_pad_push (self->srcpad, buf);
+}
+
+static GstFlowReturn
+gst_cenc_frag_decrypt_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstCencFragDecrypt *self = GST_CENC_FRAG_DECRYPT (parent);
+  GstFlowReturn ret = GST_FLOW_OK;
+
+  gst_adapter_push (self->adapter, buf);
+  while (ret == GST_FLOW_OK) {
+    gsize avail = gst_adapter_available (self->adapter);
+    guint64 header_size, box_size, next_header, next_size;
+    guint32 type, next_type;
+    gboolean low_latency;
+
+    /* the mdat payload of a low-latency fragment */
+    if (self->ll.remaining) {
+      gsize n = MIN (avail, self->ll.remaining);
+
+      if (!n)
+        break;
+      ret = gst_cenc_frag_decrypt_ll_payload (self,
+          gst_adapter_take_buffer (self->adapter, n));
+      continue;
+    }
+    /* boxes that need no changes are forwarded as they arrive */
+    if (self->passthrough) {
+      gsize n = MIN (avail, self->passthrough);
+
+      if (!n)
+        break;
+      if (self->passthrough != G_MAXUINT64)
+        self->passthrough -= n;
+      ret = gst_pad_push (self->srcpad,
+          gst_adapter_take_buffer (self->adapter, n));
+      continue;
+    }
+    if (!gst_cenc_frag_decrypt_peek_box (self, 0, &type, &header_size,
+            &box_size))
+      break;
+    if (box_size < header_size) {
+      GST_ELEMENT_ERROR (self, STREAM, DEMUX, ("Invalid box size"),
+          ("box %" GST_FOURCC_FORMAT " has a size of %" G_GUINT64_FORMAT,
+              GST_FOURCC_ARGS (GUINT32_SWAP_LE_BE (type)), box_size));
+      ret = GST_FLOW_ERROR;
+    } else if (type == FOURCC_moov) {
+      if (avail < box_size)
+        break;
+      ret = gst_cenc_frag_decrypt_process_movie (self,
+          gst_adapter_take_buffer (self->adapter, box_size), header_size);
+    } else if (type == FOURCC_moof && self->have_movie
+        && self->movie.tracks->len == 0) {
+      /* the fragments of a clear movie are forwarded with their mdat boxes */
+      self->passthrough = box_size;
+    } else if (type == FOURCC_moof) {
+      /* the samples of a fragment are in the mdat box after its moof */
+      if (!gst_cenc_frag_decrypt_peek_box (self, box_size, &next_type,
+              &next_header, &next_size))
+        break;
+      if (next_type != FOURCC_mdat || next_size < next_header
+          || next_size == G_MAXUINT64) {
+        GST_ELEMENT_ERROR (self, STREAM, DEMUX,
+            ("moof box is not followed by an mdat box"), (NULL));
+        ret = GST_FLOW_ERROR;
+        break;
+      }
+      GST_OBJECT_LOCK (self);
+      low_latency = self->low_latency;
+      GST_OBJECT_UNLOCK (self);
+      if (low_latency) {
+        /* peek_box() has made sure that the mdat header is available */
+        ret = gst_cenc_frag_decrypt_ll_start (self,
+            gst_adapter_take_buffer (self->adapter, box_size + next_header),
+            box_size + next_size);
+        continue;
+      }
+      if (avail < box_size + next_size)
+        break;
+      ret = gst_cenc_frag_decrypt_process_fragment (self,
+          gst_adapter_take_buffer (self->adapter, box_size + next_size));
+    } else {
+      self->passthrough = box_size;
+    }
+  }
+  return ret;
+}
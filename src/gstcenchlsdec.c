@@ -0,0 +1,597 @@
+/* GStreamer HLS AES-128 segment decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-gstcenchlsdecrypt
+ *
+ * Decrypts HLS media segments that use the AES-128 method, in which each
+ * segment is encrypted as a whole with AES-128 in CBC mode and PKCS7
+ * padding.
+ *
+ * The data is decrypted as it arrives, one buffer at a time, carrying a
+ * partial block over to the next buffer. The last decrypted block is held
+ * back until the next data or the end of the segment, where its padding is
+ * removed. A segment ends at EOS or at a buffer with the DISCONT flag.
+ *
+ * The key is the one of key-uri, which is looked up with the key provider
+ * and then in the key-directory (see store-key.py --uri), unless it is
+ * given directly with the key property. Each segment uses the iv property,
+ * or if it is not set, the media sequence number, which is incremented at
+ * the end of every segment. Changes to the key and IV take effect at the
+ * start of the next segment.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 souphttpsrc location=http://example.com/media_7.ts ! \
+ *     hlsaesdec key-uri=https://example.com/key media-sequence=7 ! \
+ *     tsdemux ! h264parse ! avdec_h264 ! autovideosink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeyprovider.h>
+#include <gst/gstcenckeystore.h>
+
+#include <glib.h>
+
+#include "gstcenchlsdec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_cenc_hls_decrypt_debug_category);
+#define GST_CAT_DEFAULT gst_cenc_hls_decrypt_debug_category
+
+#define AES_BLOCK_SIZE 16
+
+struct _GstCencHlsDecrypt
+{
+  GstElement parent;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  /* properties, protected by the object lock */
+  gchar *key_directory;
+  GstCencKeyProvider *key_provider;
+  gchar *key_uri;
+  gchar *key_string;
+  gchar *iv_string;
+  guint64 media_sequence;
+  /* streaming state */
+  gboolean in_segment;
+  AesCbcState *state;
+  guint8 partial[AES_BLOCK_SIZE];       /* cipher text of a partial block */
+  gsize partial_size;
+  guint8 tail[AES_BLOCK_SIZE];  /* last decrypted block, maybe padding */
+  gboolean have_tail;
+};
+
+struct _GstCencHlsDecryptClass
+{
+  GstElementClass parent_class;
+};
+
+enum
+{
+  PROP_0,
+  PROP_KEY_DIRECTORY,
+  PROP_KEY_PROVIDER,
+  PROP_KEY_URI,
+  PROP_KEY,
+  PROP_IV,
+  PROP_MEDIA_SEQUENCE
+};
+
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_KEY_URI NULL
+#define DEFAULT_KEY NULL
+#define DEFAULT_IV NULL
+#define DEFAULT_MEDIA_SEQUENCE 0
+
+/* prototypes */
+static void gst_cenc_hls_decrypt_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_cenc_hls_decrypt_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_cenc_hls_decrypt_finalize (GObject * object);
+static GstStateChangeReturn gst_cenc_hls_decrypt_change_state (GstElement *
+    element, GstStateChange transition);
+static void gst_cenc_hls_decrypt_set_context (GstElement * element,
+    GstContext * context);
+static gboolean gst_cenc_hls_decrypt_sink_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static GstFlowReturn gst_cenc_hls_decrypt_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buf);
+
+/* pad templates */
+
+static GstStaticPadTemplate gst_cenc_hls_decrypt_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate gst_cenc_hls_decrypt_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS_ANY);
+
+/* class initialization */
+
+#define gst_cenc_hls_decrypt_parent_class parent_class
+G_DEFINE_TYPE (GstCencHlsDecrypt, gst_cenc_hls_decrypt, GST_TYPE_ELEMENT);
+
+static void
+gst_cenc_hls_decrypt_class_init (GstCencHlsDecryptClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_hls_decrypt_sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_hls_decrypt_src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Decrypt HLS AES-128 segments",
+      "Decryptor",
+      "Decrypts HLS media segments that are encrypted as a whole using the "
+      "AES-128 method.",
+      "Alex Ashley <alex.ashley@youview.com>");
+
+  GST_DEBUG_CATEGORY_INIT (gst_cenc_hls_decrypt_debug_category,
+      "hlsaesdec", 0, "HLS AES-128 segment decryptor");
+
+  gobject_class->set_property = gst_cenc_hls_decrypt_set_property;
+  gobject_class->get_property = gst_cenc_hls_decrypt_get_property;
+  gobject_class->finalize = gst_cenc_hls_decrypt_finalize;
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_cenc_hls_decrypt_change_state);
+  element_class->set_context =
+      GST_DEBUG_FUNCPTR (gst_cenc_hls_decrypt_set_context);
+
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory containing the key files", DEFAULT_KEY_DIRECTORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_PROVIDER,
+      g_param_spec_object ("key-provider", "Key provider",
+          "Provider asked for the key of key-uri before the key-directory "
+          "is searched", GST_TYPE_CENC_KEY_PROVIDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_URI,
+      g_param_spec_string ("key-uri", "Key URI",
+          "URI of the EXT-X-KEY tag of the playlist", DEFAULT_KEY_URI,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY,
+      g_param_spec_string ("key", "Key",
+          "Key as a string of 32 hex digits, used instead of looking up "
+          "key-uri, which cannot be read back", DEFAULT_KEY,
+          G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IV,
+      g_param_spec_string ("iv", "IV",
+          "IV as a string of 32 hex digits, from the IV attribute of the "
+          "EXT-X-KEY tag (NULL = use the media sequence number)",
+          DEFAULT_IV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_MEDIA_SEQUENCE,
+      g_param_spec_uint64 ("media-sequence", "Media sequence",
+          "Media sequence number of the next segment, which is its IV when "
+          "iv is not set", 0, G_MAXUINT64, DEFAULT_MEDIA_SEQUENCE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_cenc_hls_decrypt_init (GstCencHlsDecrypt * self)
+{
+  self->sinkpad =
+      gst_pad_new_from_static_template (&gst_cenc_hls_decrypt_sink_template,
+      "sink");
+  gst_pad_set_chain_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_hls_decrypt_chain));
+  gst_pad_set_event_function (self->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_hls_decrypt_sink_event));
+  GST_PAD_SET_PROXY_CAPS (self->sinkpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->sinkpad);
+
+  self->srcpad =
+      gst_pad_new_from_static_template (&gst_cenc_hls_decrypt_src_template,
+      "src");
+  GST_PAD_SET_PROXY_CAPS (self->srcpad);
+  gst_element_add_pad (GST_ELEMENT (self), self->srcpad);
+
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->key_provider = NULL;
+  self->key_uri = g_strdup (DEFAULT_KEY_URI);
+  self->key_string = g_strdup (DEFAULT_KEY);
+  self->iv_string = g_strdup (DEFAULT_IV);
+  self->media_sequence = DEFAULT_MEDIA_SEQUENCE;
+  self->state = NULL;
+}
+
+static void
+gst_cenc_hls_decrypt_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "set_property");
+
+  GST_OBJECT_LOCK (self);
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      break;
+    case PROP_KEY_PROVIDER:
+      if (self->key_provider)
+        g_object_unref (self->key_provider);
+      self->key_provider = g_value_dup_object (value);
+      break;
+    case PROP_KEY_URI:
+      g_free (self->key_uri);
+      self->key_uri = g_value_dup_string (value);
+      break;
+    case PROP_KEY:
+      g_free (self->key_string);
+      self->key_string = g_value_dup_string (value);
+      break;
+    case PROP_IV:
+      g_free (self->iv_string);
+      self->iv_string = g_value_dup_string (value);
+      break;
+    case PROP_MEDIA_SEQUENCE:
+      self->media_sequence = g_value_get_uint64 (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_hls_decrypt_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "get_property");
+
+  GST_OBJECT_LOCK (self);
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      g_value_set_string (value, self->key_directory);
+      break;
+    case PROP_KEY_PROVIDER:
+      g_value_set_object (value, self->key_provider);
+      break;
+    case PROP_KEY_URI:
+      g_value_set_string (value, self->key_uri);
+      break;
+    case PROP_IV:
+      g_value_set_string (value, self->iv_string);
+      break;
+    case PROP_MEDIA_SEQUENCE:
+      g_value_set_uint64 (value, self->media_sequence);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_hls_decrypt_finalize (GObject * object)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  g_free (self->key_directory);
+  g_clear_object (&self->key_provider);
+  g_free (self->key_uri);
+  g_free (self->key_string);
+  g_free (self->iv_string);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+/* Forget the current segment without pushing what is left of it */
+static void
+gst_cenc_hls_decrypt_reset (GstCencHlsDecrypt * self)
+{
+  self->in_segment = FALSE;
+  self->partial_size = 0;
+  self->have_tail = FALSE;
+  if (self->state) {
+    gst_aes_cbc_decrypt_unref (self->state);
+    self->state = NULL;
+  }
+}
+
+static GstStateChangeReturn
+gst_cenc_hls_decrypt_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (element);
+  GstStateChangeReturn ret;
+  gboolean have_provider;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_READY_TO_PAUSED:
+      /* let the application share one key provider between elements */
+      GST_OBJECT_LOCK (self);
+      have_provider = self->key_provider != NULL;
+      GST_OBJECT_UNLOCK (self);
+      if (!have_provider) {
+        gst_element_post_message (element,
+            gst_message_new_need_context (GST_OBJECT (self),
+                GST_CENC_KEY_PROVIDER_CONTEXT_TYPE));
+      }
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      gst_cenc_hls_decrypt_reset (self);
+      break;
+    default:
+      break;
+  }
+  return ret;
+}
+
+static void
+gst_cenc_hls_decrypt_set_context (GstElement * element, GstContext * context)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (element);
+  GstCencKeyProvider *provider;
+
+  provider = gst_cenc_key_provider_from_context (context);
+  if (provider) {
+    GST_DEBUG_OBJECT (self, "using key provider %" GST_PTR_FORMAT, provider);
+    GST_OBJECT_LOCK (self);
+    if (self->key_provider)
+      g_object_unref (self->key_provider);
+    self->key_provider = provider;
+    GST_OBJECT_UNLOCK (self);
+  }
+  GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
+}
+
+/* Set up the cipher for a new segment with the current key and IV */
+static gboolean
+gst_cenc_hls_decrypt_start_segment (GstCencHlsDecrypt * self)
+{
+  GstCencKeyProvider *provider;
+  gchar *key_directory, *key_uri, *key_string, *iv_string;
+  guint8 iv_data[AES_BLOCK_SIZE];
+  guint64 media_sequence;
+  GBytes *key, *iv;
+  GError *err = NULL;
+  gboolean valid = TRUE;
+
+  GST_OBJECT_LOCK (self);
+  provider = self->key_provider ? g_object_ref (self->key_provider) : NULL;
+  key_directory = g_strdup (self->key_directory);
+  key_uri = g_strdup (self->key_uri);
+  key_string = g_strdup (self->key_string);
+  iv_string = g_strdup (self->iv_string);
+  media_sequence = self->media_sequence;
+  GST_OBJECT_UNLOCK (self);
+
+  if (iv_string) {
+    valid = gst_cenc_key_store_parse_hex (iv_string, iv_data,
+        sizeof (iv_data));
+  } else {
+    /* the media sequence number as a 128 bit big-endian integer */
+    memset (iv_data, 0, 8);
+    GST_WRITE_UINT64_BE (iv_data + 8, media_sequence);
+  }
+  key = gst_cenc_key_store_load_uri (key_directory, key_uri, key_string,
+      provider, &err);
+
+  gst_cenc_hls_decrypt_reset (self);
+  if (!valid) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("Invalid iv \"%s\"", iv_string), (NULL));
+  } else if (!key) {
+    GST_ELEMENT_ERROR (self, STREAM, DECRYPT_NOKEY,
+        ("No key for %s", GST_STR_NULL (key_uri)), ("%s",
+            err ? err->message : "not found"));
+  } else {
+    iv = g_bytes_new (iv_data, sizeof (iv_data));
+    self->state = gst_aes_cbc_decrypt_new (key, iv);
+    g_bytes_unref (iv);
+    if (!self->state) {
+      GST_ELEMENT_ERROR (self, LIBRARY, INIT,
+          ("Failed to init AES cipher"), (NULL));
+    }
+  }
+  self->in_segment = self->state != NULL;
+  GST_DEBUG_OBJECT (self, "segment %" G_GUINT64_FORMAT " started: %d",
+      media_sequence, self->in_segment);
+
+  if (key)
+    g_bytes_unref (key);
+  g_clear_error (&err);
+  if (provider)
+    g_object_unref (provider);
+  g_free (key_directory);
+  g_free (key_uri);
+  g_free (key_string);
+  g_free (iv_string);
+  return self->in_segment;
+}
+
+/* Push the last block of the segment without its PKCS7 padding, and move
+   on to the next media sequence number. Invalid padding is an error, as
+   the key or IV must be wrong. */
+static GstFlowReturn
+gst_cenc_hls_decrypt_end_segment (GstCencHlsDecrypt * self)
+{
+  GstFlowReturn ret = GST_FLOW_OK;
+  gsize size = AES_BLOCK_SIZE;
+  guint padding, i;
+
+  if (!self->in_segment)
+    return GST_FLOW_OK;
+  if (self->partial_size) {
+    GST_WARNING_OBJECT (self, "Discarding %" G_GSIZE_FORMAT " bytes at the "
+        "end of a segment that is not a whole number of blocks",
+        self->partial_size);
+  }
+  if (self->have_tail) {
+    padding = self->tail[AES_BLOCK_SIZE - 1];
+    for (i = 1; padding && padding <= AES_BLOCK_SIZE && i < padding; ++i) {
+      if (self->tail[AES_BLOCK_SIZE - 1 - i] != padding)
+        break;
+    }
+    if (padding && padding <= AES_BLOCK_SIZE && i == padding) {
+      size -= padding;
+    } else {
+      GST_ELEMENT_ERROR (self, STREAM, DECRYPT,
+          ("Invalid padding at the end of a segment"),
+          ("the key or IV is probably wrong"));
+      ret = GST_FLOW_ERROR;
+    }
+    if (ret == GST_FLOW_OK && size) {
+      GstBuffer *buf = gst_buffer_new_allocate (NULL, size, NULL);
+
+      gst_buffer_fill (buf, 0, self->tail, size);
+      ret = gst_pad_push (self->srcpad, buf);
+    }
+  }
+  gst_cenc_hls_decrypt_reset (self);
+
+  GST_OBJECT_LOCK (self);
+  self->media_sequence++;
+  GST_OBJECT_UNLOCK (self);
+  return ret;
+}
+
+static gboolean
+gst_cenc_hls_decrypt_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (parent);
+  GstFlowReturn ret;
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_FLUSH_STOP:
+      gst_cenc_hls_decrypt_reset (self);
+      break;
+    case GST_EVENT_EOS:
+      /* there is no flow return to hand the end of the last segment to, so
+         a failure to push it is posted here. A decryption error has been
+         posted already, and downstream posts its own errors. */
+      ret = gst_cenc_hls_decrypt_end_segment (self);
+      if (ret == GST_FLOW_NOT_LINKED || (ret < GST_FLOW_EOS
+              && ret != GST_FLOW_ERROR)) {
+        GST_ELEMENT_ERROR (self, STREAM, FAILED,
+            ("Failed to push the end of the last segment"),
+            ("flow: %s", gst_flow_get_name (ret)));
+      }
+      break;
+    default:
+      break;
+  }
+  return gst_pad_event_default (pad, parent, event);
+}
+
+/* Decrypt the whole blocks of the partial block from the previous buffer
+   followed by buf, in one batch. The last of them is held back, as it may
+   be the padding at the end of the segment, and pushed with the next. */
+static GstFlowReturn
+gst_cenc_hls_decrypt_chain (GstPad * pad, GstObject * parent, GstBuffer * buf)
+{
+  GstCencHlsDecrypt *self = GST_CENC_HLS_DECRYPT (parent);
+  GstFlowReturn ret = GST_FLOW_OK;
+  GstMapInfo in, out;
+  GstBuffer *outbuf;
+  gsize held, blocks, used;
+
+  if (GST_BUFFER_IS_DISCONT (buf))
+    ret = gst_cenc_hls_decrypt_end_segment (self);
+  if (ret == GST_FLOW_OK && !self->in_segment
+      && !gst_cenc_hls_decrypt_start_segment (self))
+    ret = GST_FLOW_NOT_SUPPORTED;
+  if (ret != GST_FLOW_OK || !gst_buffer_map (buf, &in, GST_MAP_READ)) {
+    gst_buffer_unref (buf);
+    return ret != GST_FLOW_OK ? ret : GST_FLOW_ERROR;
+  }
+
+  blocks = (self->partial_size + in.size) / AES_BLOCK_SIZE;
+  if (!blocks) {
+    memcpy (self->partial + self->partial_size, in.data, in.size);
+    self->partial_size += in.size;
+    gst_buffer_unmap (buf, &in);
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
+  }
+
+  held = self->have_tail ? AES_BLOCK_SIZE : 0;
+  outbuf = gst_buffer_new_allocate (NULL, held + AES_BLOCK_SIZE * blocks,
+      NULL);
+  if (!gst_buffer_map (outbuf, &out, GST_MAP_WRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, WRITE, ("Failed to map buffer"),
+        (NULL));
+    gst_buffer_unref (outbuf);
+    gst_buffer_unmap (buf, &in);
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  memcpy (out.data, self->tail, held);
+  memcpy (out.data + held, self->partial, self->partial_size);
+  used = AES_BLOCK_SIZE * blocks - self->partial_size;
+  memcpy (out.data + held + self->partial_size, in.data, used);
+  self->partial_size = in.size - used;
+  memcpy (self->partial, in.data + used, self->partial_size);
+  gst_buffer_unmap (buf, &in);
+
+  gst_aes_cbc_decrypt_ip (self->state, out.data + held,
+      AES_BLOCK_SIZE * blocks);
+  memcpy (self->tail, out.data + out.size - AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+  self->have_tail = TRUE;
+  gst_buffer_unmap (outbuf, &out);
+  gst_buffer_set_size (outbuf, out.size - AES_BLOCK_SIZE);
+
+  if (gst_buffer_get_size (outbuf) == 0) {
+    gst_buffer_unref (outbuf);
+    gst_buffer_unref (buf);
+    return GST_FLOW_OK;
+  }
+  gst_buffer_copy_into (outbuf, buf,
+      GST_BUFFER_COPY_FLAGS | GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+  GST_BUFFER_OFFSET (outbuf) = GST_BUFFER_OFFSET_NONE;
+  GST_BUFFER_OFFSET_END (outbuf) = GST_BUFFER_OFFSET_NONE;
+  gst_buffer_unref (buf);
+  return gst_pad_push (self->srcpad, outbuf);
+}
@@ -0,0 +1,1024 @@
+/* GStreamer ISO MPEG DASH common encryption multi-stream decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/**
+ * SECTION:element-gstcencmultidecrypt
+ *
+ * Decrypts all of the tracks of a presentation that uses the ISOBMFF
+ * Common Encryption 'cenc' scheme in one element, with a sink_%u and a
+ * src_%u pad for each track. Requesting a sink pad also adds the src pad
+ * with the same number.
+ *
+ * The tracks share one key table. A key is loaded from key-provider or
+ * key-directory the first time any track needs it, and the KIDs of the
+ * PSSH boxes that qtdemux sends to every track are loaded as soon as the
+ * first copy of the box arrives; later copies are not parsed again.
+ *
+ * The samples of all the tracks are decrypted by one pool of n-threads
+ * threads. Each track has one sample in flight, which its streaming thread
+ * waits for, so that buffers and events keep their order. The threads
+ * decrypt a chunk of at most 64 KiB at a time, and always take the next
+ * chunk from the waiting track that has had the least data decrypted, so
+ * that the large samples of a video track cannot hold up its audio and
+ * subtitle tracks.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 filesrc location=encrypted.mp4 ! qtdemux name=d \
+ *     cencmultidec name=c \
+ *     d.video_0 ! c.sink_0  c.src_0 ! queue ! h264parse ! avdec_h264 ! \
+ *         autovideosink \
+ *     d.audio_0 ! c.sink_1  c.src_1 ! queue ! aacparse ! avdec_aac ! \
+ *         autoaudiosink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbytereader.h>
+#include <gst/gstprotection.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeyarena.h>
+#include <gst/gstcenckeyprovider.h>
+#include <gst/gstcenckeystore.h>
+
+#include <glib.h>
+
+#include "gstcencmultidec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_cenc_multi_decrypt_debug_category);
+#define GST_CAT_DEFAULT gst_cenc_multi_decrypt_debug_category
+
+/* most of a sample that a thread decrypts before it looks for the stream
+   that has had the least decrypted */
+#define CHUNK_SIZE (64 * 1024)
+
+/* a sink pad, its src pad and the sample being decrypted for them */
+typedef struct _GstCencMultiStream
+{
+  GstCencMultiDecrypt *self;
+  guint index;
+  GstPad *sinkpad;
+  GstPad *srcpad;
+  /* cipher of the current sample, set up by the streaming thread */
+  gint slot;                    /* of its key in the key arena */
+  guint32 generation;
+  AesCtrState *state;
+  /* AesCtrJob for each encrypted range of the current sample, and the
+     position in them, used by one thread at a time */
+  GArray *ranges;
+  guint next_range;
+  gsize range_pos;
+  /* protected by the work lock */
+  gboolean queued;              /* waiting for the sample to be decrypted */
+  gboolean busy;                /* a thread is decrypting a chunk of it */
+  guint64 vtime;                /* bytes decrypted, to choose between streams */
+  GCond done_cond;
+} GstCencMultiStream;
+
+struct _GstCencMultiDecrypt
+{
+  GstElement parent;
+  /* properties, protected by the object lock */
+  gchar *key_directory;
+  GstCencKeyProvider *key_provider;
+  guint n_threads;
+  /* GstCencMultiStream of the request pads, protected by the object lock */
+  GPtrArray *streams;
+  guint next_index;
+  /* keys of all the streams, and the protection events already parsed,
+     protected by the key lock */
+  GMutex key_lock;
+  GstCencKeyArena *key_arena;
+  GHashTable *protection_events;
+  /* worker threads, created in the READY state */
+  GThreadPool *pool;
+  /* streams waiting for their samples, protected by the work lock */
+  GMutex work_lock;
+  GPtrArray *queue;
+  guint64 vtime;                /* of the stream chosen most recently */
+};
+
+struct _GstCencMultiDecryptClass
+{
+  GstElementClass parent_class;
+};
+
+enum
+{
+  PROP_0,
+  PROP_KEY_DIRECTORY,
+  PROP_KEY_PROVIDER,
+  PROP_N_THREADS
+};
+
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_N_THREADS 0
+
+#define CLEARKEY_PROTECTION_ID "e2719d58-a985-b3c9-781a-b030af78d30e"
+#define M_MPD_PROTECTION_ID "5e629af5-38da-4063-8977-97ffbd9902d4"
+#define M_PSSH_PROTECTION_ID "69f908af-4816-46ea-910c-cd5dcccb0a3a"
+
+/* field names of the GstProtectionMeta info structure */
+static GQuark quark_iv_size;
+static GQuark quark_encrypted;
+static GQuark quark_subsample_count;
+static GQuark quark_subsamples;
+static GQuark quark_kid;
+static GQuark quark_iv;
+
+/* prototypes */
+static void gst_cenc_multi_decrypt_set_property (GObject * object,
+    guint prop_id, const GValue * value, GParamSpec * pspec);
+static void gst_cenc_multi_decrypt_get_property (GObject * object,
+    guint prop_id, GValue * value, GParamSpec * pspec);
+static void gst_cenc_multi_decrypt_finalize (GObject * object);
+static GstStateChangeReturn gst_cenc_multi_decrypt_change_state (GstElement *
+    element, GstStateChange transition);
+static void gst_cenc_multi_decrypt_set_context (GstElement * element,
+    GstContext * context);
+static GstPad *gst_cenc_multi_decrypt_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps);
+static void gst_cenc_multi_decrypt_release_pad (GstElement * element,
+    GstPad * pad);
+static GstIterator *gst_cenc_multi_decrypt_iterate_internal_links (GstPad *
+    pad, GstObject * parent);
+static gboolean gst_cenc_multi_decrypt_sink_event (GstPad * pad,
+    GstObject * parent, GstEvent * event);
+static GstFlowReturn gst_cenc_multi_decrypt_chain (GstPad * pad,
+    GstObject * parent, GstBuffer * buf);
+static void gst_cenc_multi_decrypt_worker (gpointer data, gpointer user_data);
+
+/* pad templates */
+
+static GstStaticPadTemplate gst_cenc_multi_decrypt_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink_%u",
+    GST_PAD_SINK,
+    GST_PAD_REQUEST,
+    GST_STATIC_CAPS
+    ("application/x-cenc, protection-system=(string)" CLEARKEY_PROTECTION_ID
+        "; "
+        "application/x-cenc, protection-system=(string)" M_MPD_PROTECTION_ID
+        "; "
+        "application/x-cenc, protection-system=(string)" M_PSSH_PROTECTION_ID)
+    );
+
+static GstStaticPadTemplate gst_cenc_multi_decrypt_src_template =
+GST_STATIC_PAD_TEMPLATE ("src_%u",
+    GST_PAD_SRC,
+    GST_PAD_SOMETIMES,
+    GST_STATIC_CAPS_ANY);
+
+/* class initialization */
+
+#define gst_cenc_multi_decrypt_parent_class parent_class
+G_DEFINE_TYPE (GstCencMultiDecrypt, gst_cenc_multi_decrypt,
+    GST_TYPE_ELEMENT);
+
+static void
+gst_cenc_multi_decrypt_class_init (GstCencMultiDecryptClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_multi_decrypt_sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_multi_decrypt_src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Decrypt all the tracks of a presentation using ISOBMFF Common "
+      "Encryption", "Decryptor",
+      "Decrypts media that has been encrypted using ISOBMFF Common "
+      "Encryption, with one pair of pads per track, sharing one key table "
+      "and one pool of threads between the tracks.",
+      "Alex Ashley <alex.ashley@youview.com>");
+
+  GST_DEBUG_CATEGORY_INIT (gst_cenc_multi_decrypt_debug_category,
+      "cencmultidec", 0, "CENC multi-stream decryptor");
+
+  gobject_class->set_property = gst_cenc_multi_decrypt_set_property;
+  gobject_class->get_property = gst_cenc_multi_decrypt_get_property;
+  gobject_class->finalize = gst_cenc_multi_decrypt_finalize;
+  element_class->change_state =
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_change_state);
+  element_class->set_context =
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_set_context);
+  element_class->request_new_pad =
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_request_new_pad);
+  element_class->release_pad =
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_release_pad);
+
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory containing the key files", DEFAULT_KEY_DIRECTORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_PROVIDER,
+      g_param_spec_object ("key-provider", "Key provider",
+          "Provider asked for keys before the key-directory is searched",
+          GST_TYPE_CENC_KEY_PROVIDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_N_THREADS,
+      g_param_spec_uint ("n-threads", "Number of threads",
+          "Number of threads that decrypt the samples of all the tracks, "
+          "or 0 for one per processor (applied when going to READY)",
+          0, G_MAXINT, DEFAULT_N_THREADS,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  quark_iv_size = g_quark_from_static_string ("iv_size");
+  quark_encrypted = g_quark_from_static_string ("encrypted");
+  quark_subsample_count = g_quark_from_static_string ("subsample_count");
+  quark_subsamples = g_quark_from_static_string ("subsamples");
+  quark_kid = g_quark_from_static_string ("kid");
+  quark_iv = g_quark_from_static_string ("iv");
+}
+
+static void
+gst_cenc_multi_decrypt_init (GstCencMultiDecrypt * self)
+{
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->key_provider = NULL;
+  self->n_threads = DEFAULT_N_THREADS;
+  self->streams = g_ptr_array_new ();
+  g_mutex_init (&self->key_lock);
+  self->key_arena = gst_cenc_key_arena_new ();
+  self->protection_events = g_hash_table_new_full (g_bytes_hash,
+      g_bytes_equal, (GDestroyNotify) g_bytes_unref, NULL);
+  g_mutex_init (&self->work_lock);
+  self->queue = g_ptr_array_new ();
+}
+
+static void
+gst_cenc_multi_decrypt_set_property (GObject * object, guint property_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "set_property");
+
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_PROVIDER:
+      GST_OBJECT_LOCK (self);
+      if (self->key_provider)
+        g_object_unref (self->key_provider);
+      self->key_provider = g_value_dup_object (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (self);
+      self->n_threads = g_value_get_uint (value);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_cenc_multi_decrypt_get_property (GObject * object, guint property_id,
+    GValue * value, GParamSpec * pspec)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "get_property");
+
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      GST_OBJECT_LOCK (self);
+      g_value_set_string (value, self->key_directory);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_KEY_PROVIDER:
+      GST_OBJECT_LOCK (self);
+      g_value_set_object (value, self->key_provider);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    case PROP_N_THREADS:
+      GST_OBJECT_LOCK (self);
+      g_value_set_uint (value, self->n_threads);
+      GST_OBJECT_UNLOCK (self);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+}
+
+static void
+gst_cenc_multi_decrypt_stream_free (GstCencMultiStream * stream)
+{
+  if (stream->state)
+    gst_aes_ctr_decrypt_unref (stream->state);
+  g_array_unref (stream->ranges);
+  g_cond_clear (&stream->done_cond);
+  g_free (stream);
+}
+
+static void
+gst_cenc_multi_decrypt_finalize (GObject * object)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  g_free (self->key_directory);
+  g_clear_object (&self->key_provider);
+  /* the pads of streams that were never released are already gone */
+  g_ptr_array_foreach (self->streams,
+      (GFunc) gst_cenc_multi_decrypt_stream_free, NULL);
+  g_ptr_array_unref (self->streams);
+  g_mutex_clear (&self->key_lock);
+  gst_cenc_key_arena_free (self->key_arena);
+  g_hash_table_unref (self->protection_events);
+  g_mutex_clear (&self->work_lock);
+  g_ptr_array_unref (self->queue);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static GstStateChangeReturn
+gst_cenc_multi_decrypt_change_state (GstElement * element,
+    GstStateChange transition)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (element);
+  GstStateChangeReturn ret;
+  guint n_threads;
+
+  switch (transition) {
+    case GST_STATE_CHANGE_NULL_TO_READY:
+      GST_OBJECT_LOCK (self);
+      n_threads = self->n_threads;
+      GST_OBJECT_UNLOCK (self);
+      if (n_threads == 0)
+        n_threads = g_get_num_processors ();
+      /* without a pool, each streaming thread decrypts its own samples */
+      self->pool = g_thread_pool_new (gst_cenc_multi_decrypt_worker, self,
+          n_threads, FALSE, NULL);
+      GST_DEBUG_OBJECT (self, "using %u threads", self->pool ? n_threads : 0);
+      break;
+    default:
+      break;
+  }
+
+  ret = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+  switch (transition) {
+    case GST_STATE_CHANGE_PAUSED_TO_READY:
+      /* parse the protection events again if the streams are restarted */
+      g_mutex_lock (&self->key_lock);
+      g_hash_table_remove_all (self->protection_events);
+      g_mutex_unlock (&self->key_lock);
+      break;
+    case GST_STATE_CHANGE_READY_TO_NULL:
+      if (self->pool)
+        g_thread_pool_free (self->pool, FALSE, TRUE);
+      self->pool = NULL;
+      break;
+    default:
+      break;
+  }
+  return ret;
+}
+
+static void
+gst_cenc_multi_decrypt_set_context (GstElement * element,
+    GstContext * context)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (element);
+  GstCencKeyProvider *provider;
+
+  provider = gst_cenc_key_provider_from_context (context);
+  if (provider) {
+    GST_DEBUG_OBJECT (self, "using key provider %" GST_PTR_FORMAT, provider);
+    GST_OBJECT_LOCK (self);
+    if (self->key_provider)
+      g_object_unref (self->key_provider);
+    self->key_provider = provider;
+    GST_OBJECT_UNLOCK (self);
+  }
+  GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
+}
+
+/* Adds a sink pad and the src pad with the same number. A name of
+   "sink_%u" takes the next unused number. */
+static GstPad *
+gst_cenc_multi_decrypt_request_new_pad (GstElement * element,
+    GstPadTemplate * templ, const gchar * name, const GstCaps * caps)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (element);
+  GstCencMultiStream *stream;
+  gchar *pad_name;
+  guint index, i;
+
+  GST_OBJECT_LOCK (self);
+  if (name && sscanf (name, "sink_%u", &index) == 1) {
+    for (i = 0; i < self->streams->len; ++i) {
+      stream = g_ptr_array_index (self->streams, i);
+      if (stream->index == index) {
+        GST_OBJECT_UNLOCK (self);
+        GST_WARNING_OBJECT (self, "pad %s already exists", name);
+        return NULL;
+      }
+    }
+    self->next_index = MAX (self->next_index, index + 1);
+  } else {
+    index = self->next_index++;
+  }
+  stream = g_new0 (GstCencMultiStream, 1);
+  stream->self = self;
+  stream->index = index;
+  stream->slot = GST_CENC_KEY_ARENA_NO_SLOT;
+  stream->ranges = g_array_new (FALSE, FALSE, sizeof (AesCtrJob));
+  g_cond_init (&stream->done_cond);
+  g_ptr_array_add (self->streams, stream);
+  GST_OBJECT_UNLOCK (self);
+
+  pad_name = g_strdup_printf ("sink_%u", index);
+  stream->sinkpad =
+      gst_pad_new_from_static_template (&gst_cenc_multi_decrypt_sink_template,
+      pad_name);
+  g_free (pad_name);
+  gst_pad_set_element_private (stream->sinkpad, stream);
+  gst_pad_set_chain_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_chain));
+  gst_pad_set_event_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_sink_event));
+  gst_pad_set_iterate_internal_links_function (stream->sinkpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_iterate_internal_links));
+
+  pad_name = g_strdup_printf ("src_%u", index);
+  stream->srcpad =
+      gst_pad_new_from_static_template (&gst_cenc_multi_decrypt_src_template,
+      pad_name);
+  g_free (pad_name);
+  gst_pad_set_element_private (stream->srcpad, stream);
+  gst_pad_set_iterate_internal_links_function (stream->srcpad,
+      GST_DEBUG_FUNCPTR (gst_cenc_multi_decrypt_iterate_internal_links));
+
+  /* both pads are activated here if the element is already running */
+  gst_element_add_pad (element, stream->srcpad);
+  gst_element_add_pad (element, stream->sinkpad);
+  GST_DEBUG_OBJECT (self, "added stream %u", index);
+
+  return stream->sinkpad;
+}
+
+static void
+gst_cenc_multi_decrypt_release_pad (GstElement * element, GstPad * pad)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (element);
+  GstCencMultiStream *stream = gst_pad_get_element_private (pad);
+
+  if (!stream || pad != stream->sinkpad)
+    return;
+  GST_DEBUG_OBJECT (self, "releasing stream %u", stream->index);
+  GST_OBJECT_LOCK (self);
+  g_ptr_array_remove (self->streams, stream);
+  GST_OBJECT_UNLOCK (self);
+
+  /* deactivating the pads waits for the streaming thread to leave */
+  gst_pad_set_active (stream->sinkpad, FALSE);
+  gst_pad_set_active (stream->srcpad, FALSE);
+  gst_element_remove_pad (element, stream->srcpad);
+  gst_element_remove_pad (element, stream->sinkpad);
+  gst_cenc_multi_decrypt_stream_free (stream);
+}
+
+/* Events and queries are passed between the two pads of a stream only */
+static GstIterator *
+gst_cenc_multi_decrypt_iterate_internal_links (GstPad * pad,
+    GstObject * parent)
+{
+  GstCencMultiStream *stream = gst_pad_get_element_private (pad);
+  GValue value = G_VALUE_INIT;
+  GstIterator *it;
+
+  g_value_init (&value, GST_TYPE_PAD);
+  g_value_set_object (&value,
+      pad == stream->sinkpad ? stream->srcpad : stream->sinkpad);
+  it = gst_iterator_new_single (GST_TYPE_PAD, &value);
+  g_value_unset (&value);
+  return it;
+}
+
+/* Loads a key from the key provider or the key directory, trying both the
+   ClearKey and the Marlin file names */
+static GBytes *
+gst_cenc_multi_decrypt_load_key (GstCencMultiDecrypt * self,
+    const guint8 * kid, GError ** err)
+{
+  GstCencKeyProvider *provider;
+  gchar *key_directory;
+  GBytes *key = NULL;
+
+  GST_OBJECT_LOCK (self);
+  provider = self->key_provider ? g_object_ref (self->key_provider) : NULL;
+  key_directory = g_strdup (self->key_directory);
+  GST_OBJECT_UNLOCK (self);
+
+  if (provider) {
+    key = gst_cenc_key_provider_get_key (provider, kid);
+    g_object_unref (provider);
+  }
+  if (!key)
+    key = gst_cenc_key_store_load (key_directory, kid,
+        GST_CENC_KEY_NAMING_CLEARKEY, NULL);
+  if (!key)
+    key = gst_cenc_key_store_load (key_directory, kid,
+        GST_CENC_KEY_NAMING_MARLIN, err);
+  if (key && g_bytes_get_size (key) != GST_CENC_KEY_LENGTH) {
+    g_set_error (err, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+        "Key is %" G_GSIZE_FORMAT " bytes long", g_bytes_get_size (key));
+    g_bytes_unref (key);
+    key = NULL;
+  }
+  g_free (key_directory);
+  return key;
+}
+
+/* Returns the slot of the key of a KID in the key arena, loading it the
+   first time that any stream needs it. Called with the key lock held,
+   which is released while the key is loaded. */
+static gint
+gst_cenc_multi_decrypt_find_key (GstCencMultiDecrypt * self,
+    const guint8 * kid, GError ** err)
+{
+  GBytes *key;
+  gint slot;
+
+  slot = gst_cenc_key_arena_lookup (self->key_arena, kid);
+  if (slot != GST_CENC_KEY_ARENA_NO_SLOT)
+    return slot;
+
+  g_mutex_unlock (&self->key_lock);
+  key = gst_cenc_multi_decrypt_load_key (self, kid, err);
+  g_mutex_lock (&self->key_lock);
+  if (!key)
+    return GST_CENC_KEY_ARENA_NO_SLOT;
+  /* another stream may have added the same key in the meantime, in which
+     case its slot is reused */
+  slot = gst_cenc_key_arena_add (self->key_arena, kid,
+      g_bytes_get_data (key, NULL));
+  g_bytes_unref (key);
+  return slot;
+}
+
+/* Loads the keys of the KIDs of a PSSH box, so that they are in the key
+   table before the first sample of any stream needs them */
+static void
+gst_cenc_multi_decrypt_parse_pssh_box (GstCencMultiDecrypt * self,
+    const guint8 * data, gsize size)
+{
+  GstByteReader br;
+  guint8 version;
+  guint32 n_kids;
+  const guint8 *kids;
+  guint i;
+
+  gst_byte_reader_init (&br, data, size);
+  if (!gst_byte_reader_skip (&br, 8)
+      || !gst_byte_reader_get_uint8 (&br, &version)
+      || !gst_byte_reader_skip (&br, 3 + 16)) {
+    GST_WARNING_OBJECT (self, "Invalid pssh box");
+    return;
+  }
+  GST_DEBUG_OBJECT (self, "pssh version: %u", version);
+  if (version == 0)
+    return;
+  if (!gst_byte_reader_get_uint32_be (&br, &n_kids)
+      || n_kids > gst_byte_reader_get_remaining (&br) / GST_CENC_KID_LENGTH
+      || !gst_byte_reader_get_data (&br, n_kids * GST_CENC_KID_LENGTH,
+          &kids)) {
+    GST_WARNING_OBJECT (self, "Invalid KIDs in pssh box");
+    return;
+  }
+
+  g_mutex_lock (&self->key_lock);
+  for (i = 0; i < n_kids; ++i) {
+    const guint8 *kid = kids + i * GST_CENC_KID_LENGTH;
+    GError *err = NULL;
+
+    if (gst_cenc_multi_decrypt_find_key (self, kid, &err) ==
+        GST_CENC_KEY_ARENA_NO_SLOT) {
+      /* it is only an error if a sample needs it */
+      GST_DEBUG_OBJECT (self, "No key for KID %u of pssh box: %s", i,
+          err ? err->message : "unknown error");
+      g_clear_error (&err);
+    }
+  }
+  g_mutex_unlock (&self->key_lock);
+}
+
+/* qtdemux sends the same protection events to every track, so each one is
+   only parsed the first time it arrives on any sink pad */
+static void
+gst_cenc_multi_decrypt_protection_event (GstCencMultiDecrypt * self,
+    GstEvent * event)
+{
+  const gchar *system_id;
+  const gchar *origin;
+  GstBuffer *data;
+  GstMapInfo map;
+  GByteArray *bytes;
+  GBytes *id;
+  gboolean seen;
+
+  gst_event_parse_protection (event, &system_id, &data, &origin);
+  GST_DEBUG_OBJECT (self, "system_id: %s  origin: %s", system_id, origin);
+  /* the KIDs of DASH ContentProtection elements are also in the PSSH boxes
+     or the samples */
+  if (!origin || !g_str_has_prefix (origin, "isobmff/"))
+    return;
+  if (!gst_buffer_map (data, &map, GST_MAP_READ))
+    return;
+
+  bytes = g_byte_array_new ();
+  g_byte_array_append (bytes, (const guint8 *) system_id,
+      strlen (system_id) + 1);
+  g_byte_array_append (bytes, map.data, map.size);
+  id = g_byte_array_free_to_bytes (bytes);
+  g_mutex_lock (&self->key_lock);
+  seen = !g_hash_table_add (self->protection_events, id);
+  g_mutex_unlock (&self->key_lock);
+
+  if (seen) {
+    GST_DEBUG_OBJECT (self, "protection event already parsed");
+  } else {
+    gst_cenc_multi_decrypt_parse_pssh_box (self, map.data, map.size);
+  }
+  gst_buffer_unmap (data, &map);
+}
+
+/* Turns application/x-cenc caps back into the caps of the clear media */
+static GstCaps *
+gst_cenc_multi_decrypt_transform_caps (GstCaps * caps)
+{
+  GstCaps *res = gst_caps_new_empty ();
+  guint i;
+
+  for (i = 0; i < gst_caps_get_size (caps); ++i) {
+    GstStructure *in = gst_caps_get_structure (caps, i);
+    const gchar *media_type;
+    GstStructure *out;
+
+    media_type = gst_structure_get_string (in, "original-media-type");
+    if (!media_type)
+      continue;
+    out = gst_structure_copy (in);
+    gst_structure_set_name (out, media_type);
+    gst_structure_remove_fields (out, "original-media-type",
+        "protection-system", NULL);
+    gst_caps_append_structure (res, out);
+  }
+  return res;
+}
+
+static gboolean
+gst_cenc_multi_decrypt_sink_event (GstPad * pad, GstObject * parent,
+    GstEvent * event)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (parent);
+  GstCencMultiStream *stream = gst_pad_get_element_private (pad);
+
+  switch (GST_EVENT_TYPE (event)) {
+    case GST_EVENT_CAPS:{
+      GstCaps *caps, *outcaps;
+
+      gst_event_parse_caps (event, &caps);
+      outcaps = gst_cenc_multi_decrypt_transform_caps (caps);
+      gst_event_unref (event);
+      if (gst_caps_is_empty (outcaps)) {
+        GST_ERROR_OBJECT (pad, "No original-media-type in caps %"
+            GST_PTR_FORMAT, caps);
+        gst_caps_unref (outcaps);
+        return FALSE;
+      }
+      GST_DEBUG_OBJECT (pad, "output caps %" GST_PTR_FORMAT, outcaps);
+      event = gst_event_new_caps (outcaps);
+      gst_caps_unref (outcaps);
+      return gst_pad_push_event (stream->srcpad, event);
+    }
+    case GST_EVENT_PROTECTION:
+      gst_cenc_multi_decrypt_protection_event (self, event);
+      gst_event_unref (event);
+      return TRUE;
+    default:
+      break;
+  }
+  return gst_pad_event_default (pad, parent, event);
+}
+
+/* Decrypts up to CHUNK_SIZE bytes of the current sample of a stream,
+   carrying on from where the previous chunk stopped. Returns TRUE when the
+   whole sample has been decrypted. */
+static gboolean
+gst_cenc_multi_decrypt_chunk (GstCencMultiStream * stream, gsize * n_bytes)
+{
+  gsize done = 0;
+
+  while (stream->next_range < stream->ranges->len && done < CHUNK_SIZE) {
+    AesCtrJob *range =
+        &g_array_index (stream->ranges, AesCtrJob, stream->next_range);
+    gsize n = MIN (range->length - stream->range_pos, CHUNK_SIZE - done);
+
+    gst_aes_ctr_decrypt_ip (range->state, range->data + stream->range_pos, n);
+    done += n;
+    stream->range_pos += n;
+    if (stream->range_pos == range->length) {
+      stream->next_range++;
+      stream->range_pos = 0;
+    }
+  }
+  *n_bytes = done;
+  return stream->next_range == stream->ranges->len;
+}
+
+/* Decrypts a chunk of the waiting stream that has had the least data
+   decrypted so far. Returns FALSE when no waiting stream is free. */
+static gboolean
+gst_cenc_multi_decrypt_work (GstCencMultiDecrypt * self)
+{
+  GstCencMultiStream *stream = NULL;
+  gboolean finished;
+  gsize n_bytes;
+  guint i;
+
+  g_mutex_lock (&self->work_lock);
+  for (i = 0; i < self->queue->len; ++i) {
+    GstCencMultiStream *s = g_ptr_array_index (self->queue, i);
+
+    if (!s->busy && (!stream || s->vtime < stream->vtime))
+      stream = s;
+  }
+  if (!stream) {
+    g_mutex_unlock (&self->work_lock);
+    return FALSE;
+  }
+  stream->busy = TRUE;
+  self->vtime = stream->vtime;
+  g_mutex_unlock (&self->work_lock);
+
+  finished = gst_cenc_multi_decrypt_chunk (stream, &n_bytes);
+
+  g_mutex_lock (&self->work_lock);
+  stream->busy = FALSE;
+  stream->vtime += n_bytes;
+  if (finished) {
+    g_ptr_array_remove_fast (self->queue, stream);
+    stream->queued = FALSE;
+    g_cond_signal (&stream->done_cond);
+  }
+  g_mutex_unlock (&self->work_lock);
+  return TRUE;
+}
+
+/* Each sample pushed to the pool wakes one thread, which then keeps going
+   until there is nothing left that it can take, so no sample is missed
+   when a thread finds the only waiting stream busy. */
+static void
+gst_cenc_multi_decrypt_worker (gpointer data, gpointer user_data)
+{
+  GstCencMultiDecrypt *self = user_data;
+
+  while (gst_cenc_multi_decrypt_work (self));
+}
+
+/* Hands the encrypted ranges of the current sample of a stream to the
+   thread pool, and waits for them to be decrypted */
+static void
+gst_cenc_multi_decrypt_run (GstCencMultiDecrypt * self,
+    GstCencMultiStream * stream)
+{
+  gsize n_bytes;
+
+  stream->next_range = 0;
+  stream->range_pos = 0;
+  if (!self->pool) {
+    while (!gst_cenc_multi_decrypt_chunk (stream, &n_bytes));
+    return;
+  }
+
+  g_mutex_lock (&self->work_lock);
+  /* a stream that has been idle starts level with the streams that are
+     busy, rather than being owed the time that it did not use */
+  stream->vtime = MAX (stream->vtime, self->vtime);
+  stream->queued = TRUE;
+  g_ptr_array_add (self->queue, stream);
+  g_mutex_unlock (&self->work_lock);
+
+  g_thread_pool_push (self->pool, stream, NULL);
+
+  g_mutex_lock (&self->work_lock);
+  while (stream->queued)
+    g_cond_wait (&stream->done_cond, &self->work_lock);
+  g_mutex_unlock (&self->work_lock);
+}
+
+/* Sets up the cipher of a stream for a sample, from the key in the shared
+   key table. The schedule is copied into the cipher of the stream while
+   the key lock is held, since adding a key can move the arena. */
+static gboolean
+gst_cenc_multi_decrypt_cipher_setup (GstCencMultiDecrypt * self,
+    GstCencMultiStream * stream, const guint8 * kid, const guint8 * iv,
+    gsize iv_length)
+{
+  GError *err = NULL;
+  const guint8 *schedule;
+  guint32 generation;
+  gint slot;
+
+  g_mutex_lock (&self->key_lock);
+  slot = gst_cenc_multi_decrypt_find_key (self, kid, &err);
+  if (slot == GST_CENC_KEY_ARENA_NO_SLOT) {
+    g_mutex_unlock (&self->key_lock);
+    GST_ELEMENT_ERROR (self, STREAM, DECRYPT_NOKEY,
+        ("Failed to load the key of stream %u", stream->index),
+        ("%s", err ? err->message : "unknown error"));
+    g_clear_error (&err);
+    return FALSE;
+  }
+  schedule = gst_cenc_key_arena_get_schedule (self->key_arena, slot);
+  generation = gst_cenc_key_arena_get_generation (self->key_arena, slot);
+  if (!stream->state) {
+    stream->state = gst_aes_ctr_decrypt_new_from_schedule (schedule, iv,
+        iv_length);
+  } else {
+    if (slot != stream->slot || generation != stream->generation)
+      gst_aes_ctr_decrypt_set_key (stream->state, schedule);
+    if (!gst_aes_ctr_decrypt_set_iv (stream->state, iv, iv_length)) {
+      gst_aes_ctr_decrypt_unref (stream->state);
+      stream->state = NULL;
+    }
+  }
+  g_mutex_unlock (&self->key_lock);
+
+  if (!stream->state) {
+    GST_ERROR_OBJECT (stream->sinkpad, "Failed to init AES cipher");
+    stream->slot = GST_CENC_KEY_ARENA_NO_SLOT;
+    return FALSE;
+  }
+  stream->slot = slot;
+  stream->generation = generation;
+  return TRUE;
+}
+
+/* Fills in the encrypted ranges of a mapped sample from its subsample
+   table, or the whole sample when it has none */
+static gboolean
+gst_cenc_multi_decrypt_add_ranges (GstCencMultiStream * stream,
+    guint8 * data, gsize size, GstBuffer * subsamples, guint subsample_count)
+{
+  GstByteReader reader;
+  GstMapInfo map;
+  gboolean ret = TRUE;
+  gsize pos = 0;
+  AesCtrJob job;
+  guint i;
+
+  g_array_set_size (stream->ranges, 0);
+  job.state = stream->state;
+  if (!subsample_count) {
+    job.data = data;
+    job.length = size;
+    if (size)
+      g_array_append_val (stream->ranges, job);
+    return TRUE;
+  }
+
+  if (!gst_buffer_map (subsamples, &map, GST_MAP_READ))
+    return FALSE;
+  gst_byte_reader_init (&reader, map.data, map.size);
+  for (i = 0; ret && i < subsample_count; ++i) {
+    guint16 n_bytes_clear;
+    guint32 n_bytes_encrypted;
+
+    if (!gst_byte_reader_get_uint16_be (&reader, &n_bytes_clear)
+        || !gst_byte_reader_get_uint32_be (&reader, &n_bytes_encrypted)
+        || n_bytes_clear > size - pos
+        || n_bytes_encrypted > size - pos - n_bytes_clear) {
+      GST_ERROR_OBJECT (stream->sinkpad, "Subsample %u exceeds sample size",
+          i);
+      ret = FALSE;
+      break;
+    }
+    pos += n_bytes_clear;
+    if (n_bytes_encrypted) {
+      job.data = data + pos;
+      job.length = n_bytes_encrypted;
+      g_array_append_val (stream->ranges, job);
+      pos += n_bytes_encrypted;
+    }
+  }
+  gst_buffer_unmap (subsamples, &map);
+  return ret;
+}
+
+static GstFlowReturn
+gst_cenc_multi_decrypt_chain (GstPad * pad, GstObject * parent,
+    GstBuffer * buf)
+{
+  GstCencMultiDecrypt *self = GST_CENC_MULTI_DECRYPT (parent);
+  GstCencMultiStream *stream = gst_pad_get_element_private (pad);
+  GstProtectionMeta *prot_meta;
+  guint iv_size, subsample_count = 0;
+  gboolean encrypted;
+  GstBuffer *kid_buf, *iv_buf, *subsamples = NULL;
+  guint8 kid[GST_CENC_KID_LENGTH];
+  guint8 iv[16];
+  gsize iv_length;
+  GstMapInfo map;
+  const GValue *value;
+  gboolean ok;
+
+  buf = gst_buffer_make_writable (buf);
+  prot_meta = (GstProtectionMeta *) gst_buffer_get_protection_meta (buf);
+  if (!prot_meta) {
+    GST_ERROR_OBJECT (pad, "Failed to get GstProtection metadata from buffer");
+    goto not_supported;
+  }
+  if (!gst_structure_id_get (prot_meta->info,
+          quark_iv_size, G_TYPE_UINT, &iv_size,
+          quark_encrypted, G_TYPE_BOOLEAN, &encrypted, NULL)) {
+    GST_ERROR_OBJECT (pad, "failed to get iv_size or encrypted flag");
+    goto not_supported;
+  }
+  if (iv_size == 0 || !encrypted)
+    goto push;
+
+  value = gst_structure_id_get_value (prot_meta->info, quark_kid);
+  kid_buf = value ? gst_value_get_buffer (value) : NULL;
+  value = gst_structure_id_get_value (prot_meta->info, quark_iv);
+  iv_buf = value ? gst_value_get_buffer (value) : NULL;
+  if (!kid_buf || !iv_buf
+      || gst_buffer_extract (kid_buf, 0, kid, sizeof (kid)) != sizeof (kid)) {
+    GST_ERROR_OBJECT (pad, "Failed to get KID or IV for sample");
+    goto not_supported;
+  }
+  iv_length = gst_buffer_extract (iv_buf, 0, iv, sizeof (iv));
+  value = gst_structure_id_get_value (prot_meta->info, quark_subsample_count);
+  if (value)
+    subsample_count = g_value_get_uint (value);
+  if (subsample_count) {
+    value = gst_structure_id_get_value (prot_meta->info, quark_subsamples);
+    subsamples = value ? gst_value_get_buffer (value) : NULL;
+    if (!subsamples) {
+      GST_ERROR_OBJECT (pad, "Failed to get subsamples");
+      goto not_supported;
+    }
+  }
+
+  if (!gst_cenc_multi_decrypt_cipher_setup (self, stream, kid, iv, iv_length)) {
+    gst_buffer_unref (buf);
+    return GST_FLOW_ERROR;
+  }
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ERROR_OBJECT (pad, "Failed to map buffer");
+    goto not_supported;
+  }
+  ok = gst_cenc_multi_decrypt_add_ranges (stream, map.data, map.size,
+      subsamples, subsample_count);
+  if (ok)
+    gst_cenc_multi_decrypt_run (self, stream);
+  gst_buffer_unmap (buf, &map);
+  if (!ok)
+    goto not_supported;
+
+push:
+  gst_buffer_remove_meta (buf, (GstMeta *) prot_meta);
+  return gst_pad_push (stream->srcpad, buf);
+
+not_supported:
+  gst_buffer_unref (buf);
+  return GST_FLOW_NOT_SUPPORTED;
+}
@@ -0,0 +1,38 @@
+/* GStreamer ISO MPEG-DASH common encryption multi-stream decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_MULTI_DECRYPT_H_
+#define _GST_CENC_MULTI_DECRYPT_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+#define GST_TYPE_CENC_MULTI_DECRYPT   (gst_cenc_multi_decrypt_get_type())
+#define GST_CENC_MULTI_DECRYPT(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_CENC_MULTI_DECRYPT,GstCencMultiDecrypt))
+#define GST_CENC_MULTI_DECRYPT_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_CENC_MULTI_DECRYPT,GstCencMultiDecryptClass))
+#define GST_IS_CENC_MULTI_DECRYPT(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_CENC_MULTI_DECRYPT))
+#define GST_IS_CENC_MULTI_DECRYPT_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_CENC_MULTI_DECRYPT))
+typedef struct _GstCencMultiDecrypt GstCencMultiDecrypt;
+typedef struct _GstCencMultiDecryptClass GstCencMultiDecryptClass;
+
+
+GType gst_cenc_multi_decrypt_get_type (void);
+
+G_END_DECLS
+#endif
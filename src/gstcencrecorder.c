@@ -0,0 +1,72 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstcencrecorder.h"
+
+G_STATIC_ASSERT (sizeof (GstCencRecord) == 64);
+
+GstCencRecorder *
+gst_cenc_recorder_new (void)
+{
+  return g_new0 (GstCencRecorder, 1);
+}
+
+void
+gst_cenc_recorder_free (GstCencRecorder * recorder)
+{
+  g_free (recorder);
+}
+
+/* Format the records, oldest first, one line per sample. Records that are
+   being written while the dump is made may be torn. */
+gchar *
+gst_cenc_recorder_format (GstCencRecorder * recorder)
+{
+  GString *out = g_string_new (NULL);
+  guint head = (guint) g_atomic_int_get (&recorder->head);
+  guint first = head > GST_CENC_RECORDER_SIZE ?
+      head - GST_CENC_RECORDER_SIZE : 0;
+  guint n, i;
+
+  g_string_append (out, "# seq timestamp pts kid iv size encrypted "
+      "subsamples decrypt-ns result\n");
+  for (n = first; n != head; ++n) {
+    const GstCencRecord *r = &recorder->records[n &
+        (GST_CENC_RECORDER_SIZE - 1)];
+
+    g_string_append_printf (out, "%u %" G_GUINT64_FORMAT " %" GST_TIME_FORMAT,
+        n, r->timestamp, GST_TIME_ARGS (r->pts));
+    if (r->kid_index == GST_CENC_RECORDER_NO_KID)
+      g_string_append (out, " - ");
+    else
+      g_string_append_printf (out, " %u ", r->kid_index);
+    for (i = 0; i < MIN (r->iv_size, sizeof (r->iv)); ++i)
+      g_string_append_printf (out, "%02x", r->iv[i]);
+    if (!r->iv_size)
+      g_string_append_c (out, '-');
+    g_string_append_printf (out, " %u %u %u %u %s\n", r->size,
+        r->bytes_encrypted, r->subsample_count, r->decrypt_time,
+        gst_flow_get_name ((GstFlowReturn) r->result));
+  }
+  return g_string_free (out, FALSE);
+}
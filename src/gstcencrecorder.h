@@ -0,0 +1,69 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_RECORDER_H_
+#define _GST_CENC_RECORDER_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* number of records kept, must be a power of two */
+#define GST_CENC_RECORDER_SIZE 1024
+
+#define GST_CENC_RECORDER_NO_KID 0xffff
+
+/* One decrypted sample, padded to a cache line */
+typedef struct _GstCencRecord
+{
+  guint64 timestamp;            /* monotonic time when the sample finished */
+  GstClockTime pts;
+  guint32 size;
+  guint32 bytes_encrypted;
+  guint32 decrypt_time;         /* nanoseconds */
+  gint32 result;                /* GstFlowReturn */
+  guint16 kid_index;            /* index in the key table */
+  guint16 subsample_count;
+  guint8 iv_size;
+  guint8 padding[11];
+  guint8 iv[16];
+} GstCencRecord;
+
+/* Ring buffer of the most recent samples. Records are claimed with an
+   atomic increment, so recording never blocks. */
+typedef struct _GstCencRecorder
+{
+  volatile gint head;           /* number of records ever claimed */
+  GstCencRecord records[GST_CENC_RECORDER_SIZE];
+} GstCencRecorder;
+
+static inline GstCencRecord *
+gst_cenc_recorder_claim (GstCencRecorder * recorder)
+{
+  guint n = (guint) g_atomic_int_add (&recorder->head, 1);
+
+  return &recorder->records[n & (GST_CENC_RECORDER_SIZE - 1)];
+}
+
+GstCencRecorder *gst_cenc_recorder_new (void);
+void gst_cenc_recorder_free (GstCencRecorder * recorder);
+gchar *gst_cenc_recorder_format (GstCencRecorder * recorder);
+
+G_END_DECLS
+#endif
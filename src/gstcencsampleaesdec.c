@@ -0,0 +1,668 @@
+/* GStreamer HLS SAMPLE-AES decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+/**
+ * SECTION:element-gstcencsampleaesdecrypt
+ *
+ * Decrypts the elementary streams of HLS content that uses the SAMPLE-AES
+ * method, as they come out of tsdemux.
+ *
+ * SAMPLE-AES encrypts H.264 slices, ADTS AAC frames and AC-3 or E-AC-3
+ * frames with AES-128 in CBC mode, leaving enough of each one in the clear
+ * for it to be parsed. In a slice NAL unit longer than 48 bytes, the first
+ * 32 bytes are clear and then one block in every ten is encrypted. The
+ * emulation prevention bytes were added after encryption, so they are
+ * removed before the slice is decrypted, which makes the buffer shorter. In
+ * an audio frame, the first 16 bytes after the header are clear and the
+ * rest of the whole blocks are encrypted. Each NAL unit and frame starts a
+ * new CBC chain with the IV of the playlist.
+ *
+ * Each buffer must contain whole NAL units and frames, as tsdemux produces
+ * them. The key is the one of key-uri, which is looked up with the key
+ * provider and then in the key-directory (see store-key.py --uri), unless
+ * it is given directly with the key property.
+ *
+ * <refsect2>
+ * <title>Example launch line</title>
+ * |[
+ * gst-launch-1.0 souphttpsrc location=http://example.com/media_0.ts ! \
+ *     tsdemux ! hlssampleaesdec key-uri=https://example.com/key \
+ *     iv=0x00000000000000000000000000000001 ! h264parse ! avdec_h264 ! \
+ *     autovideosink
+ * ]|
+ * </refsect2>
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeyprovider.h>
+#include <gst/gstcenckeystore.h>
+
+#include <glib.h>
+
+#include "gstcencsampleaesdec.h"
+
+GST_DEBUG_CATEGORY_STATIC (gst_cenc_sample_aes_decrypt_debug_category);
+#define GST_CAT_DEFAULT gst_cenc_sample_aes_decrypt_debug_category
+
+#define AES_BLOCK_SIZE 16
+
+typedef enum
+{
+  GST_SAMPLE_AES_FORMAT_NONE,
+  GST_SAMPLE_AES_FORMAT_H264,
+  GST_SAMPLE_AES_FORMAT_ADTS,
+  GST_SAMPLE_AES_FORMAT_AC3     /* AC-3 and E-AC-3 */
+} GstSampleAesFormat;
+
+struct _GstCencSampleAesDecrypt
+{
+  GstBaseTransform parent;
+  /* properties, protected by the object lock */
+  gchar *key_directory;
+  GstCencKeyProvider *key_provider;
+  gchar *key_uri;
+  gchar *key_string;
+  gchar *iv_string;
+  gboolean key_changed;         /* the key or IV is to be set up again */
+  /* streaming state */
+  GstSampleAesFormat format;
+  AesCbcState *state;
+  guint8 iv[AES_BLOCK_SIZE];
+};
+
+struct _GstCencSampleAesDecryptClass
+{
+  GstBaseTransformClass parent_class;
+};
+
+enum
+{
+  PROP_0,
+  PROP_KEY_DIRECTORY,
+  PROP_KEY_PROVIDER,
+  PROP_KEY_URI,
+  PROP_KEY,
+  PROP_IV
+};
+
+#define DEFAULT_KEY_DIRECTORY "/tmp"
+#define DEFAULT_KEY_URI NULL
+#define DEFAULT_KEY NULL
+#define DEFAULT_IV NULL
+
+/* SAMPLE-AES layout */
+#define NAL_CLEAR_LEADER 32
+#define NAL_MIN_ENCRYPTED_SIZE 48
+#define NAL_CRYPT_BLOCKS 1
+#define NAL_SKIP_BLOCKS 9
+#define AUDIO_CLEAR_LEADER 16
+
+/* prototypes */
+static void gst_cenc_sample_aes_decrypt_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_cenc_sample_aes_decrypt_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_cenc_sample_aes_decrypt_finalize (GObject * object);
+static void gst_cenc_sample_aes_decrypt_set_context (GstElement * element,
+    GstContext * context);
+static gboolean gst_cenc_sample_aes_decrypt_start (GstBaseTransform * trans);
+static gboolean gst_cenc_sample_aes_decrypt_stop (GstBaseTransform * trans);
+static gboolean gst_cenc_sample_aes_decrypt_set_caps (GstBaseTransform *
+    trans, GstCaps * incaps, GstCaps * outcaps);
+static GstFlowReturn gst_cenc_sample_aes_decrypt_transform_ip (GstBaseTransform
+    * trans, GstBuffer * buf);
+
+/* pad templates */
+
+#define GST_CENC_SAMPLE_AES_DECRYPT_CAPS \
+  "video/x-h264, stream-format=(string)byte-stream; " \
+  "audio/mpeg, mpegversion=(int){2,4}, stream-format=(string)adts; " \
+  "audio/x-ac3; audio/x-eac3"
+
+static GstStaticPadTemplate gst_cenc_sample_aes_decrypt_sink_template =
+GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_CENC_SAMPLE_AES_DECRYPT_CAPS)
+    );
+
+static GstStaticPadTemplate gst_cenc_sample_aes_decrypt_src_template =
+GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_CENC_SAMPLE_AES_DECRYPT_CAPS)
+    );
+
+/* class initialization */
+
+#define gst_cenc_sample_aes_decrypt_parent_class parent_class
+G_DEFINE_TYPE (GstCencSampleAesDecrypt, gst_cenc_sample_aes_decrypt,
+    GST_TYPE_BASE_TRANSFORM);
+
+static void
+gst_cenc_sample_aes_decrypt_class_init (GstCencSampleAesDecryptClass * klass)
+{
+  GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS (klass);
+  GstBaseTransformClass *base_transform_class =
+      GST_BASE_TRANSFORM_CLASS (klass);
+
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_sample_aes_decrypt_sink_template));
+  gst_element_class_add_pad_template (element_class,
+      gst_static_pad_template_get (&gst_cenc_sample_aes_decrypt_src_template));
+
+  gst_element_class_set_static_metadata (element_class,
+      "Decrypt HLS SAMPLE-AES elementary streams",
+      "Decryptor",
+      "Decrypts H.264, AAC and AC-3 streams from tsdemux that use the HLS "
+      "SAMPLE-AES method.",
+      "Alex Ashley <alex.ashley@youview.com>");
+
+  GST_DEBUG_CATEGORY_INIT (gst_cenc_sample_aes_decrypt_debug_category,
+      "hlssampleaesdec", 0, "HLS SAMPLE-AES decryptor");
+
+  gobject_class->set_property = gst_cenc_sample_aes_decrypt_set_property;
+  gobject_class->get_property = gst_cenc_sample_aes_decrypt_get_property;
+  gobject_class->finalize = gst_cenc_sample_aes_decrypt_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_KEY_DIRECTORY,
+      g_param_spec_string ("key-directory", "Key directory",
+          "Directory containing the key files", DEFAULT_KEY_DIRECTORY,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_PROVIDER,
+      g_param_spec_object ("key-provider", "Key provider",
+          "Provider asked for the key of key-uri before the key-directory "
+          "is searched", GST_TYPE_CENC_KEY_PROVIDER,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY_URI,
+      g_param_spec_string ("key-uri", "Key URI",
+          "URI of the EXT-X-KEY tag of the playlist", DEFAULT_KEY_URI,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_KEY,
+      g_param_spec_string ("key", "Key",
+          "Key as a string of 32 hex digits, used instead of looking up "
+          "key-uri, which cannot be read back", DEFAULT_KEY,
+          G_PARAM_WRITABLE | G_PARAM_STATIC_STRINGS));
+  g_object_class_install_property (gobject_class, PROP_IV,
+      g_param_spec_string ("iv", "IV",
+          "IV as a string of 32 hex digits, from the IV attribute of the "
+          "EXT-X-KEY tag or else the media sequence number (NULL = zero)",
+          DEFAULT_IV, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  element_class->set_context =
+      GST_DEBUG_FUNCPTR (gst_cenc_sample_aes_decrypt_set_context);
+  base_transform_class->start =
+      GST_DEBUG_FUNCPTR (gst_cenc_sample_aes_decrypt_start);
+  base_transform_class->stop =
+      GST_DEBUG_FUNCPTR (gst_cenc_sample_aes_decrypt_stop);
+  base_transform_class->set_caps =
+      GST_DEBUG_FUNCPTR (gst_cenc_sample_aes_decrypt_set_caps);
+  base_transform_class->transform_ip =
+      GST_DEBUG_FUNCPTR (gst_cenc_sample_aes_decrypt_transform_ip);
+  base_transform_class->transform_ip_on_passthrough = FALSE;
+}
+
+static void
+gst_cenc_sample_aes_decrypt_init (GstCencSampleAesDecrypt * self)
+{
+  GstBaseTransform *base = GST_BASE_TRANSFORM (self);
+
+  gst_base_transform_set_in_place (base, TRUE);
+  gst_base_transform_set_passthrough (base, FALSE);
+  gst_base_transform_set_gap_aware (base, FALSE);
+  self->key_directory = g_strdup (DEFAULT_KEY_DIRECTORY);
+  self->key_provider = NULL;
+  self->key_uri = g_strdup (DEFAULT_KEY_URI);
+  self->key_string = g_strdup (DEFAULT_KEY);
+  self->iv_string = g_strdup (DEFAULT_IV);
+  self->key_changed = TRUE;
+  self->format = GST_SAMPLE_AES_FORMAT_NONE;
+  self->state = NULL;
+}
+
+static void
+gst_cenc_sample_aes_decrypt_set_property (GObject * object,
+    guint property_id, const GValue * value, GParamSpec * pspec)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "set_property");
+
+  GST_OBJECT_LOCK (self);
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      g_free (self->key_directory);
+      self->key_directory = g_value_dup_string (value);
+      self->key_changed = TRUE;
+      break;
+    case PROP_KEY_PROVIDER:
+      if (self->key_provider)
+        g_object_unref (self->key_provider);
+      self->key_provider = g_value_dup_object (value);
+      self->key_changed = TRUE;
+      break;
+    case PROP_KEY_URI:
+      g_free (self->key_uri);
+      self->key_uri = g_value_dup_string (value);
+      self->key_changed = TRUE;
+      break;
+    case PROP_KEY:
+      g_free (self->key_string);
+      self->key_string = g_value_dup_string (value);
+      self->key_changed = TRUE;
+      break;
+    case PROP_IV:
+      g_free (self->iv_string);
+      self->iv_string = g_value_dup_string (value);
+      self->key_changed = TRUE;
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_sample_aes_decrypt_get_property (GObject * object,
+    guint property_id, GValue * value, GParamSpec * pspec)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "get_property");
+
+  GST_OBJECT_LOCK (self);
+  switch (property_id) {
+    case PROP_KEY_DIRECTORY:
+      g_value_set_string (value, self->key_directory);
+      break;
+    case PROP_KEY_PROVIDER:
+      g_value_set_object (value, self->key_provider);
+      break;
+    case PROP_KEY_URI:
+      g_value_set_string (value, self->key_uri);
+      break;
+    case PROP_IV:
+      g_value_set_string (value, self->iv_string);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+      break;
+  }
+  GST_OBJECT_UNLOCK (self);
+}
+
+static void
+gst_cenc_sample_aes_decrypt_finalize (GObject * object)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (object);
+
+  GST_DEBUG_OBJECT (self, "finalize");
+
+  g_free (self->key_directory);
+  g_clear_object (&self->key_provider);
+  g_free (self->key_uri);
+  g_free (self->key_string);
+  g_free (self->iv_string);
+
+  G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static void
+gst_cenc_sample_aes_decrypt_set_context (GstElement * element,
+    GstContext * context)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (element);
+  GstCencKeyProvider *provider;
+
+  provider = gst_cenc_key_provider_from_context (context);
+  if (provider) {
+    GST_DEBUG_OBJECT (self, "using key provider %" GST_PTR_FORMAT, provider);
+    GST_OBJECT_LOCK (self);
+    if (self->key_provider)
+      g_object_unref (self->key_provider);
+    self->key_provider = provider;
+    self->key_changed = TRUE;
+    GST_OBJECT_UNLOCK (self);
+  }
+  GST_ELEMENT_CLASS (parent_class)->set_context (element, context);
+}
+
+static gboolean
+gst_cenc_sample_aes_decrypt_start (GstBaseTransform * trans)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (trans);
+  gboolean have_provider;
+
+  GST_DEBUG_OBJECT (self, "start");
+
+  /* let the application share one key provider between elements */
+  GST_OBJECT_LOCK (self);
+  have_provider = self->key_provider != NULL;
+  self->key_changed = TRUE;
+  GST_OBJECT_UNLOCK (self);
+  if (!have_provider) {
+    gst_element_post_message (GST_ELEMENT (self),
+        gst_message_new_need_context (GST_OBJECT (self),
+            GST_CENC_KEY_PROVIDER_CONTEXT_TYPE));
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_sample_aes_decrypt_stop (GstBaseTransform * trans)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (trans);
+
+  GST_DEBUG_OBJECT (self, "stop");
+  if (self->state) {
+    gst_aes_cbc_decrypt_unref (self->state);
+    self->state = NULL;
+  }
+  return TRUE;
+}
+
+static gboolean
+gst_cenc_sample_aes_decrypt_set_caps (GstBaseTransform * trans,
+    GstCaps * incaps, GstCaps * outcaps)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (trans);
+  const gchar *name = gst_structure_get_name (gst_caps_get_structure (incaps,
+          0));
+
+  if (g_str_equal (name, "video/x-h264"))
+    self->format = GST_SAMPLE_AES_FORMAT_H264;
+  else if (g_str_equal (name, "audio/mpeg"))
+    self->format = GST_SAMPLE_AES_FORMAT_ADTS;
+  else if (g_str_equal (name, "audio/x-ac3") || g_str_equal (name,
+          "audio/x-eac3"))
+    self->format = GST_SAMPLE_AES_FORMAT_AC3;
+  else
+    return FALSE;
+  GST_DEBUG_OBJECT (self, "format %d from %" GST_PTR_FORMAT, self->format,
+      incaps);
+  return TRUE;
+}
+
+/* Set up the cipher when the key or IV has changed */
+static gboolean
+gst_cenc_sample_aes_decrypt_setup (GstCencSampleAesDecrypt * self)
+{
+  GstCencKeyProvider *provider;
+  gchar *key_directory, *key_uri, *key_string, *iv_string;
+  GBytes *key, *iv;
+  GError *err = NULL;
+  gboolean changed, valid;
+
+  GST_OBJECT_LOCK (self);
+  changed = self->key_changed;
+  self->key_changed = FALSE;
+  if (!changed) {
+    GST_OBJECT_UNLOCK (self);
+    return TRUE;
+  }
+  provider = self->key_provider ? g_object_ref (self->key_provider) : NULL;
+  key_directory = g_strdup (self->key_directory);
+  key_uri = g_strdup (self->key_uri);
+  key_string = g_strdup (self->key_string);
+  iv_string = g_strdup (self->iv_string);
+  GST_OBJECT_UNLOCK (self);
+
+  memset (self->iv, 0, sizeof (self->iv));
+  valid = !iv_string || gst_cenc_key_store_parse_hex (iv_string, self->iv,
+      sizeof (self->iv));
+  key = gst_cenc_key_store_load_uri (key_directory, key_uri, key_string,
+      provider, &err);
+
+  if (self->state) {
+    gst_aes_cbc_decrypt_unref (self->state);
+    self->state = NULL;
+  }
+  if (!valid) {
+    GST_ELEMENT_ERROR (self, LIBRARY, SETTINGS,
+        ("Invalid iv \"%s\"", iv_string), (NULL));
+  } else if (!key) {
+    GST_ELEMENT_ERROR (self, STREAM, DECRYPT_NOKEY,
+        ("No key for %s", GST_STR_NULL (key_uri)), ("%s",
+            err ? err->message : "not found"));
+  } else {
+    iv = g_bytes_new (self->iv, sizeof (self->iv));
+    self->state = gst_aes_cbc_decrypt_new (key, iv);
+    g_bytes_unref (iv);
+    if (!self->state) {
+      GST_ELEMENT_ERROR (self, LIBRARY, INIT,
+          ("Failed to init AES cipher"), (NULL));
+    }
+  }
+  if (!self->state) {
+    /* try again with the next buffer */
+    GST_OBJECT_LOCK (self);
+    self->key_changed = TRUE;
+    GST_OBJECT_UNLOCK (self);
+  }
+
+  if (key)
+    g_bytes_unref (key);
+  g_clear_error (&err);
+  if (provider)
+    g_object_unref (provider);
+  g_free (key_directory);
+  g_free (key_uri);
+  g_free (key_string);
+  g_free (iv_string);
+  return self->state != NULL;
+}
+
+/* Returns the position of the next 00 00 01 start code, or size */
+static gsize
+gst_cenc_sample_aes_find_start_code (const guint8 * data, gsize pos,
+    gsize size)
+{
+  while (pos + 3 <= size) {
+    const guint8 *one = memchr (data + pos + 2, 0x01, size - pos - 2);
+    gsize i;
+
+    if (!one)
+      break;
+    i = one - data;
+    if (data[i - 1] == 0 && data[i - 2] == 0)
+      return i - 2;
+    pos = i - 1;
+  }
+  return size;
+}
+
+/* Copy a NAL unit without its emulation prevention bytes. dest may be the
+   same as, or before, src. Returns the new size. */
+static gsize
+gst_cenc_sample_aes_unescape (guint8 * dest, const guint8 * src, gsize size)
+{
+  guint zeros = 0;
+  gsize i, n = 0;
+
+  for (i = 0; i < size; ++i) {
+    if (zeros >= 2 && src[i] == 0x03) {
+      zeros = 0;
+      continue;
+    }
+    zeros = src[i] == 0 ? zeros + 1 : 0;
+    dest[n++] = src[i];
+  }
+  return n;
+}
+
+/* Decrypt the slices of an H.264 byte stream, moving each NAL unit down
+   over the emulation prevention bytes removed from the ones before it.
+   Returns the new size of the data. */
+static gsize
+gst_cenc_sample_aes_decrypt_h264 (GstCencSampleAesDecrypt * self,
+    guint8 * data, gsize size)
+{
+  gsize pos, out;
+
+  pos = gst_cenc_sample_aes_find_start_code (data, 0, size);
+  out = pos;
+  while (pos < size) {
+    gsize nal = pos + 3;
+    gsize next = gst_cenc_sample_aes_find_start_code (data, nal, size);
+    gsize end = next;
+    guint type;
+
+    /* zero bytes before a start code belong to it */
+    while (end > nal && data[end - 1] == 0)
+      --end;
+    memmove (data + out, data + pos, nal - pos);
+    out += nal - pos;
+    type = nal < end ? data[nal] & 0x1f : 0;
+    if ((type == 1 || type == 5) && end - nal > NAL_MIN_ENCRYPTED_SIZE) {
+      gsize length = gst_cenc_sample_aes_unescape (data + out, data + nal,
+          end - nal);
+
+      /* a block is only encrypted when more than 16 bytes are left, so
+         the last byte is never part of a whole block */
+      gst_aes_cbc_decrypt_set_iv (self->state, self->iv, sizeof (self->iv));
+      gst_aes_cbc_decrypt_ip_pattern (self->state,
+          data + out + NAL_CLEAR_LEADER, length - NAL_CLEAR_LEADER - 1,
+          NAL_CRYPT_BLOCKS, NAL_SKIP_BLOCKS);
+      out += length;
+    } else {
+      memmove (data + out, data + nal, end - nal);
+      out += end - nal;
+    }
+    memmove (data + out, data + end, next - end);
+    out += next - end;
+    pos = next;
+  }
+  return out;
+}
+
+static const guint16 ac3_bitrates[] = {
+  32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448,
+  512, 576, 640
+};
+
+/* Returns the size of the AC-3 or E-AC-3 sync frame at data, or 0 */
+static gsize
+gst_cenc_sample_aes_ac3_frame_size (const guint8 * data, gsize size)
+{
+  guint fscod, frmsizecod, bitrate;
+
+  if (size < 6 || data[0] != 0x0b || data[1] != 0x77)
+    return 0;
+  /* E-AC-3 has a bsid of 11 to 16 and gives the frame size directly */
+  if ((data[5] >> 3) > 10)
+    return 2 * ((((data[2] & 0x07) << 8) | data[3]) + 1);
+  fscod = data[4] >> 6;
+  frmsizecod = data[4] & 0x3f;
+  if (fscod == 3 || frmsizecod >= 2 * G_N_ELEMENTS (ac3_bitrates))
+    return 0;
+  bitrate = ac3_bitrates[frmsizecod / 2];
+  switch (fscod) {
+    case 0:                    /* 48 kHz */
+      return 4 * bitrate;
+    case 1:                    /* 44.1 kHz, padded to a whole word */
+      return 2 * (bitrate * 320 / 147 + (frmsizecod & 1));
+    default:                   /* 32 kHz */
+      return 6 * bitrate;
+  }
+}
+
+/* Returns the size of the ADTS frame at data, or 0, and its header size */
+static gsize
+gst_cenc_sample_aes_adts_frame_size (const guint8 * data, gsize size,
+    gsize * header_size)
+{
+  gsize frame_size;
+
+  if (size < 7 || data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+    return 0;
+  *header_size = (data[1] & 0x01) ? 7 : 9;
+  frame_size = ((data[3] & 0x03) << 11) | (data[4] << 3) | (data[5] >> 5);
+  return frame_size >= *header_size ? frame_size : 0;
+}
+
+/* Decrypt each whole audio frame, skipping anything that is not one */
+static void
+gst_cenc_sample_aes_decrypt_audio (GstCencSampleAesDecrypt * self,
+    guint8 * data, gsize size)
+{
+  gsize pos = 0;
+
+  while (pos < size) {
+    gsize header_size = 0, frame_size, clear;
+
+    if (self->format == GST_SAMPLE_AES_FORMAT_ADTS)
+      frame_size = gst_cenc_sample_aes_adts_frame_size (data + pos,
+          size - pos, &header_size);
+    else
+      frame_size = gst_cenc_sample_aes_ac3_frame_size (data + pos,
+          size - pos);
+    if (!frame_size) {
+      ++pos;
+      continue;
+    }
+    if (frame_size > size - pos) {
+      GST_WARNING_OBJECT (self, "incomplete frame of %" G_GSIZE_FORMAT
+          " bytes at the end of the buffer", frame_size);
+      break;
+    }
+    clear = header_size + AUDIO_CLEAR_LEADER;
+    if (frame_size > clear) {
+      gst_aes_cbc_decrypt_set_iv (self->state, self->iv, sizeof (self->iv));
+      gst_aes_cbc_decrypt_ip_pattern (self->state, data + pos + clear,
+          frame_size - clear, 1, 0);
+    }
+    pos += frame_size;
+  }
+}
+
+static GstFlowReturn
+gst_cenc_sample_aes_decrypt_transform_ip (GstBaseTransform * trans,
+    GstBuffer * buf)
+{
+  GstCencSampleAesDecrypt *self = GST_CENC_SAMPLE_AES_DECRYPT (trans);
+  GstMapInfo map;
+  gsize size;
+
+  if (!gst_cenc_sample_aes_decrypt_setup (self))
+    return GST_FLOW_NOT_SUPPORTED;
+  if (!gst_buffer_map (buf, &map, GST_MAP_READWRITE)) {
+    GST_ELEMENT_ERROR (self, RESOURCE, READ, ("Failed to map buffer"),
+        (NULL));
+    return GST_FLOW_ERROR;
+  }
+  size = map.size;
+  if (self->format == GST_SAMPLE_AES_FORMAT_H264)
+    size = gst_cenc_sample_aes_decrypt_h264 (self, map.data, map.size);
+  else
+    gst_cenc_sample_aes_decrypt_audio (self, map.data, map.size);
+  gst_buffer_unmap (buf, &map);
+  if (size != map.size)
+    gst_buffer_set_size (buf, size);
+  return GST_FLOW_OK;
+}
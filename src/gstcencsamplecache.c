@@ -0,0 +1,155 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstcencsamplecache.h"
+
+typedef struct _GstCencSampleCacheEntry
+{
+  GstCencSampleCacheKey key;
+  GstMemory *memory;
+  GList link;                   /* in the LRU list, data is the entry */
+} GstCencSampleCacheEntry;
+
+struct _GstCencSampleCache
+{
+  GHashTable *entries;          /* key -> GstCencSampleCacheEntry */
+  GQueue lru;                   /* most recently used first */
+  gsize size;
+  gsize max_size;
+};
+
+G_STATIC_ASSERT (sizeof (GstCencSampleCacheKey) == 48);
+
+static guint
+gst_cenc_sample_cache_key_hash (gconstpointer data)
+{
+  const GstCencSampleCacheKey *key = data;
+  guint32 iv;
+
+  memcpy (&iv, key->iv, sizeof (iv));
+  return key->digest ^ iv ^ (key->size << 7);
+}
+
+static gboolean
+gst_cenc_sample_cache_key_equal (gconstpointer a, gconstpointer b)
+{
+  return memcmp (a, b, sizeof (GstCencSampleCacheKey)) == 0;
+}
+
+static void
+gst_cenc_sample_cache_entry_free (gpointer data)
+{
+  GstCencSampleCacheEntry *entry = data;
+
+  gst_memory_unlock (entry->memory, GST_LOCK_FLAG_EXCLUSIVE);
+  gst_memory_unref (entry->memory);
+  g_slice_free (GstCencSampleCacheEntry, entry);
+}
+
+GstCencSampleCache *
+gst_cenc_sample_cache_new (gsize max_size)
+{
+  GstCencSampleCache *cache = g_new0 (GstCencSampleCache, 1);
+
+  cache->entries = g_hash_table_new_full (gst_cenc_sample_cache_key_hash,
+      gst_cenc_sample_cache_key_equal, NULL,
+      gst_cenc_sample_cache_entry_free);
+  g_queue_init (&cache->lru);
+  cache->max_size = max_size;
+  return cache;
+}
+
+void
+gst_cenc_sample_cache_free (GstCencSampleCache * cache)
+{
+  if (!cache)
+    return;
+  g_hash_table_unref (cache->entries);
+  g_free (cache);
+}
+
+/* Returns a new reference to the clear data of the sample, or NULL. The
+   memory is shared with the cache, so it is never writable. */
+GstMemory *
+gst_cenc_sample_cache_lookup (GstCencSampleCache * cache,
+    const GstCencSampleCacheKey * key)
+{
+  GstCencSampleCacheEntry *entry;
+
+  entry = g_hash_table_lookup (cache->entries, key);
+  if (!entry)
+    return NULL;
+  g_queue_unlink (&cache->lru, &entry->link);
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  return gst_memory_ref (entry->memory);
+}
+
+/* Copy the clear data of a sample into the cache, dropping the least
+   recently used samples to make room. Returns FALSE if the sample is
+   larger than the whole cache. */
+gboolean
+gst_cenc_sample_cache_insert (GstCencSampleCache * cache,
+    const GstCencSampleCacheKey * key, const guint8 * data, gsize size)
+{
+  GstCencSampleCacheEntry *entry;
+  GstMemory *memory;
+
+  if (size > cache->max_size)
+    return FALSE;
+  if (g_hash_table_contains (cache->entries, key))
+    return TRUE;
+  while (cache->size + size > cache->max_size) {
+    GList *oldest = g_queue_pop_tail_link (&cache->lru);
+
+    entry = oldest->data;
+    cache->size -= gst_memory_get_sizes (entry->memory, NULL, NULL);
+    g_hash_table_remove (cache->entries, &entry->key);
+  }
+
+  memory = gst_allocator_alloc (NULL, size, NULL);
+  if (!memory)
+    return FALSE;
+  gst_memory_fill_from (memory, data, size);
+  /* an exclusive lock of the cache's own stops buffers that share the
+     memory from writing to it */
+  gst_memory_lock (memory, GST_LOCK_FLAG_EXCLUSIVE);
+
+  entry = g_slice_new (GstCencSampleCacheEntry);
+  entry->key = *key;
+  entry->memory = memory;
+  entry->link.data = entry;
+  entry->link.prev = entry->link.next = NULL;
+  g_queue_push_head_link (&cache->lru, &entry->link);
+  g_hash_table_insert (cache->entries, &entry->key, entry);
+  cache->size += size;
+  return TRUE;
+}
+
+/* number of bytes of clear data held */
+gsize
+gst_cenc_sample_cache_get_size (GstCencSampleCache * cache)
+{
+  return cache->size;
+}
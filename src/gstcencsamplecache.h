@@ -0,0 +1,53 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_SAMPLE_CACHE_H_
+#define _GST_CENC_SAMPLE_CACHE_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Identifies the encrypted form of a sample. A KID and IV pair is only
+   ever used for one sample, so the digest of the cipher text is only there
+   to catch packagers that reuse IVs. */
+typedef struct _GstCencSampleCacheKey
+{
+  guint8 kid[16];
+  guint8 iv[16];                /* zero padded 8 byte IVs */
+  guint32 size;
+  guint32 subsample_count;
+  guint32 layout;               /* CRC32C of the subsample table */
+  guint32 digest;               /* CRC32C of the encrypted sample */
+} GstCencSampleCacheKey;
+
+/* A least recently used cache of the clear data of samples, holding no
+   more than max_size bytes. It is only used by the streaming thread. */
+typedef struct _GstCencSampleCache GstCencSampleCache;
+
+GstCencSampleCache *gst_cenc_sample_cache_new (gsize max_size);
+void gst_cenc_sample_cache_free (GstCencSampleCache * cache);
+GstMemory *gst_cenc_sample_cache_lookup (GstCencSampleCache * cache,
+    const GstCencSampleCacheKey * key);
+gboolean gst_cenc_sample_cache_insert (GstCencSampleCache * cache,
+    const GstCencSampleCacheKey * key, const guint8 * data, gsize size);
+gsize gst_cenc_sample_cache_get_size (GstCencSampleCache * cache);
+
+G_END_DECLS
+#endif
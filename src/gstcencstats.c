@@ -0,0 +1,116 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include "gstcencstats.h"
+
+void
+gst_cenc_stats_reset (GstCencStats * stats)
+{
+  memset (stats, 0, sizeof (GstCencStats));
+}
+
+static guint
+gst_cenc_stats_bucket (GstClockTime duration)
+{
+  guint bits, bucket;
+
+  if (duration < 4)
+    return (guint) duration;
+  bits = g_bit_storage (duration);
+  /* the two bits below the most significant bit select the sub-bucket */
+  bucket = 4 * (bits - 2) + ((duration >> (bits - 3)) & 3);
+  return MIN (bucket, GST_CENC_STATS_HISTOGRAM_SIZE - 1);
+}
+
+/* lower bound, in nanoseconds, of the durations counted in bucket */
+static guint64
+gst_cenc_stats_bucket_value (guint bucket)
+{
+  guint bits;
+
+  if (bucket < 4)
+    return bucket;
+  bits = bucket / 4 + 2;
+  return (G_GUINT64_CONSTANT (4) | (bucket & 3)) << (bits - 3);
+}
+
+void
+gst_cenc_stats_add_decrypt_time (GstCencStats * stats, GstClockTime duration)
+{
+  gst_cenc_stats_add (stats->decrypt_histogram[gst_cenc_stats_bucket
+          (duration)], 1);
+}
+
+static guint64
+gst_cenc_stats_percentile (const guint64 * histogram, guint64 total,
+    guint percent)
+{
+  guint64 count = 0, target;
+  guint i;
+
+  if (!total)
+    return 0;
+  target = (total * percent + 99) / 100;
+  for (i = 0; i < GST_CENC_STATS_HISTOGRAM_SIZE; ++i) {
+    count += histogram[i];
+    if (count >= target)
+      return gst_cenc_stats_bucket_value (i);
+  }
+  return gst_cenc_stats_bucket_value (GST_CENC_STATS_HISTOGRAM_SIZE - 1);
+}
+
+/* take a snapshot of the counters */
+GstStructure *
+gst_cenc_stats_to_structure (GstCencStats * stats)
+{
+  guint64 histogram[GST_CENC_STATS_HISTOGRAM_SIZE];
+  guint64 total = 0;
+  guint i;
+
+  for (i = 0; i < GST_CENC_STATS_HISTOGRAM_SIZE; ++i) {
+    histogram[i] = gst_cenc_stats_get (stats->decrypt_histogram[i]);
+    total += histogram[i];
+  }
+
+#define GET(field) gst_cenc_stats_get (stats->field)
+  return gst_structure_new ("application/x-cenc-stats",
+      "bytes-decrypted", G_TYPE_UINT64, GET (bytes_decrypted),
+      "bytes-clear", G_TYPE_UINT64, GET (bytes_clear),
+      "samples-decrypted", G_TYPE_UINT64, GET (samples_decrypted),
+      "samples-clear", G_TYPE_UINT64, GET (samples_clear),
+      "samples-dropped", G_TYPE_UINT64, GET (samples_dropped),
+      "samples-invalid", G_TYPE_UINT64, GET (samples_invalid),
+      "key-cache-hits", G_TYPE_UINT64, GET (key_cache_hits),
+      "key-cache-misses", G_TYPE_UINT64, GET (key_cache_misses),
+      "sample-cache-hits", G_TYPE_UINT64, GET (sample_cache_hits),
+      "sample-cache-misses", G_TYPE_UINT64, GET (sample_cache_misses),
+      "key-load-time", G_TYPE_UINT64, GET (key_load_time),
+      "map-time", G_TYPE_UINT64, GET (map_time),
+      "decrypt-time-p50", G_TYPE_UINT64,
+      gst_cenc_stats_percentile (histogram, total, 50),
+      "decrypt-time-p99", G_TYPE_UINT64,
+      gst_cenc_stats_percentile (histogram, total, 99), NULL);
+#undef GET
+}
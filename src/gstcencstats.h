@@ -0,0 +1,63 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_STATS_H_
+#define _GST_CENC_STATS_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* The decrypt time histogram has four buckets for each power of two
+   nanoseconds, which covers up to 2^32ns (~4s) */
+#define GST_CENC_STATS_HISTOGRAM_SIZE 128
+
+/* Counters of one decryptor instance. Every counter is only ever
+   increased, using relaxed 64-bit atomic adds, so they can be read from
+   any thread while the streaming thread is updating them and do not wrap
+   on 32-bit platforms. */
+typedef struct _GstCencStats
+{
+  guint64 bytes_decrypted;
+  guint64 bytes_clear;
+  guint64 samples_decrypted;
+  guint64 samples_clear;
+  guint64 samples_dropped;
+  guint64 samples_invalid;
+  guint64 key_cache_hits;
+  guint64 key_cache_misses;
+  guint64 sample_cache_hits;
+  guint64 sample_cache_misses;
+  guint64 key_load_time;
+  guint64 map_time;
+  guint64 decrypt_histogram[GST_CENC_STATS_HISTOGRAM_SIZE];
+} GstCencStats;
+
+#define gst_cenc_stats_add(counter,value) \
+  ((void) __atomic_fetch_add (&(counter), (guint64) (value), __ATOMIC_RELAXED))
+#define gst_cenc_stats_get(counter) \
+  ((guint64) __atomic_load_n (&(counter), __ATOMIC_RELAXED))
+
+void gst_cenc_stats_reset (GstCencStats * stats);
+void gst_cenc_stats_add_decrypt_time (GstCencStats * stats,
+    GstClockTime duration);
+GstStructure *gst_cenc_stats_to_structure (GstCencStats * stats);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,142 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "gstcencvalidate.h"
+
+/* Select the checks from the caps of the decrypted stream */
+void
+gst_cenc_validator_init (GstCencValidator * validator,
+    const GstStructure * caps)
+{
+  const gchar *media_type = gst_structure_get_name (caps);
+  const gchar *stream_format = gst_structure_get_string (caps,
+      "stream-format");
+  const GValue *value;
+  gint mpegversion = 0;
+
+  validator->type = GST_CENC_VALIDATOR_NONE;
+  validator->hevc = g_str_equal (media_type, "video/x-h265");
+  validator->nal_length_size = 4;
+
+  if (validator->hevc || g_str_equal (media_type, "video/x-h264")) {
+    if (g_strcmp0 (stream_format, "byte-stream") == 0) {
+      validator->type = GST_CENC_VALIDATOR_NAL_BYTE_STREAM;
+      return;
+    }
+    validator->type = GST_CENC_VALIDATOR_NAL_LENGTH;
+    /* the NAL unit length size is found in the
+       AVCDecoderConfigurationRecord or HEVCDecoderConfigurationRecord */
+    value = gst_structure_get_value (caps, "codec_data");
+    if (value && GST_VALUE_HOLDS_BUFFER (value)) {
+      GstBuffer *codec_data = gst_value_get_buffer (value);
+      guint8 byte;
+      gsize offset = validator->hevc ? 21 : 4;
+
+      if (gst_buffer_extract (codec_data, offset, &byte, 1) == 1)
+        validator->nal_length_size = (byte & 0x03) + 1;
+    }
+  } else if (g_str_equal (media_type, "audio/mpeg")) {
+    gst_structure_get_int (caps, "mpegversion", &mpegversion);
+    if (mpegversion == 1) {
+      validator->type = GST_CENC_VALIDATOR_MPEG_AUDIO;
+    } else if (g_strcmp0 (stream_format, "adts") == 0) {
+      validator->type = GST_CENC_VALIDATOR_ADTS;
+    }
+    /* raw AAC has no sync word to check */
+  } else if (g_str_equal (media_type, "audio/x-ac3")
+      || g_str_equal (media_type, "audio/x-eac3")) {
+    validator->type = GST_CENC_VALIDATOR_AC3;
+  }
+}
+
+/* A NAL unit never ends with a zero byte, because of the RBSP stop bit, and
+   its header has the forbidden_zero_bit clear and a non-zero type (AVC) or
+   temporal ID (HEVC) */
+static inline gboolean
+gst_cenc_validator_check_nal (const GstCencValidator * validator,
+    const guint8 * nal, gsize size)
+{
+  if (validator->hevc)
+    return size >= 2 && !(nal[0] & 0x80) && (nal[1] & 0x07)
+        && nal[size - 1];
+  return size >= 1 && !(nal[0] & 0x80) && (nal[0] & 0x1f) && nal[size - 1];
+}
+
+/* Returns FALSE if the start of a decrypted sample cannot be valid. Only the
+   headers of the NAL units, or the first few bytes of an audio frame, are
+   looked at. */
+gboolean
+gst_cenc_validator_check (const GstCencValidator * validator,
+    const guint8 * data, gsize size)
+{
+  gsize pos, nal_size, frame_length;
+  guint i;
+
+  if (size == 0)
+    return TRUE;
+
+  switch (validator->type) {
+    case GST_CENC_VALIDATOR_NAL_LENGTH:
+      /* the NAL unit lengths must add up to the size of the sample */
+      for (pos = 0; pos < size; pos += nal_size) {
+        if (size - pos < validator->nal_length_size)
+          return FALSE;
+        nal_size = 0;
+        for (i = 0; i < validator->nal_length_size; ++i)
+          nal_size = (nal_size << 8) | data[pos + i];
+        pos += validator->nal_length_size;
+        if (nal_size > size - pos
+            || !gst_cenc_validator_check_nal (validator, data + pos,
+                nal_size))
+          return FALSE;
+      }
+      return TRUE;
+    case GST_CENC_VALIDATOR_NAL_BYTE_STREAM:
+      /* a start code, then the header of the first NAL unit */
+      if (size >= 4 && !data[0] && !data[1] && !data[2] && data[3] == 1) {
+        pos = 4;
+      } else if (size >= 3 && !data[0] && !data[1] && data[2] == 1) {
+        pos = 3;
+      } else {
+        return FALSE;
+      }
+      return size - pos >= (validator->hevc ? 2 : 1)
+          && !(data[pos] & 0x80)
+          && (validator->hevc ? (data[pos + 1] & 0x07) : (data[pos] & 0x1f));
+    case GST_CENC_VALIDATOR_ADTS:
+      /* 12 bit sync word and layer 0, then a frame length that fits */
+      if (size < 7 || data[0] != 0xff || (data[1] & 0xf6) != 0xf0)
+        return FALSE;
+      frame_length = ((data[3] & 0x03) << 11) | (data[4] << 3) |
+          (data[5] >> 5);
+      return frame_length >= 7 && frame_length <= size;
+    case GST_CENC_VALIDATOR_MPEG_AUDIO:
+      /* 11 bit sync word, and a valid layer and bitrate */
+      return size >= 4 && data[0] == 0xff && (data[1] & 0xe0) == 0xe0
+          && (data[1] & 0x06) && (data[2] & 0xf0) != 0xf0;
+    case GST_CENC_VALIDATOR_AC3:
+      return size >= 2 && data[0] == 0x0b && data[1] == 0x77;
+    default:
+      return TRUE;
+  }
+}
@@ -0,0 +1,52 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ */
+
+#ifndef _GST_CENC_VALIDATE_H_
+#define _GST_CENC_VALIDATE_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Cheap checks of the start of a decrypted sample, which fail with a high
+   probability when the sample was decrypted with the wrong key */
+typedef enum
+{
+  GST_CENC_VALIDATOR_NONE,
+  GST_CENC_VALIDATOR_NAL_LENGTH,        /* AVC or HEVC with length prefixes */
+  GST_CENC_VALIDATOR_NAL_BYTE_STREAM,   /* AVC or HEVC with start codes */
+  GST_CENC_VALIDATOR_ADTS,
+  GST_CENC_VALIDATOR_MPEG_AUDIO,
+  GST_CENC_VALIDATOR_AC3                /* AC-3 and E-AC-3 */
+} GstCencValidatorType;
+
+typedef struct _GstCencValidator
+{
+  GstCencValidatorType type;
+  gboolean hevc;
+  guint nal_length_size;
+} GstCencValidator;
+
+void gst_cenc_validator_init (GstCencValidator * validator,
+    const GstStructure * caps);
+gboolean gst_cenc_validator_check (const GstCencValidator * validator,
+    const guint8 * data, gsize size);
+
+G_END_DECLS
+#endif
@@ -13,12 +13,18 @@ def store_key(filename, key):
     kfile.close()
     print('Key stored: {0}'.format(filename))
 
-if len(sys.argv)<3:
+if len(sys.argv)<3 or (sys.argv[1]=='--uri' and len(sys.argv)<4):
     print('Usage: %s <KID> <key>'%(sys.argv[0]))
+    print('       %s --uri <HLS key URI> <key>'%(sys.argv[0]))
     sys.exit(1)
 
-kid_str = sys.argv[1].strip().replace('-','')
-bin_kid= binascii.unhexlify(kid_str)
+if sys.argv[1]=='--uri':
+    # HLS keys are stored under the first 16 bytes of the SHA-1 of the URI
+    bin_kid = hashlib.sha1(sys.argv[2].encode('utf-8')).digest()[:16]
+    del sys.argv[1]
+else:
+    kid_str = sys.argv[1].strip().replace('-','')
+    bin_kid= binascii.unhexlify(kid_str)
 if len(bin_kid)!=16:
     print('ERROR: KID is not 16 bytes long')
     sys.exit(2)
@@ -19,6 +19,7 @@
 #include <gst/check/gstcheck.h>
 #include <gst/gst.h>
 #include <gst/gstaesctr.h>
+#include <gst/gstcenckeyarena.h>
 
 
 static AesCtrState *
@@ -91,6 +92,188 @@ GST_START_TEST (test_nist_aes_ctr) {
 }
 GST_END_TEST;
 
+GST_START_TEST (test_multi_aes_ctr) {
+  /* the four blocks of NIST SP800-38a section F.5.2 */
+  const guint8 Ciphertext[] = {
+    0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce,
+    0x98, 0x06, 0xf6, 0x6b, 0x79, 0x70, 0xfd, 0xff, 0x86, 0x17, 0x18, 0x7b, 0xb9, 0xff, 0xfd, 0xff,
+    0x5a, 0xe4, 0xdf, 0x3e, 0xdb, 0xd5, 0xd3, 0x5e, 0x5b, 0x4f, 0x09, 0x02, 0x0d, 0xb0, 0x3e, 0xab,
+    0x1e, 0x03, 0x1d, 0xda, 0x2f, 0xbe, 0x03, 0xd1, 0x79, 0x21, 0x70, 0xa0, 0xf3, 0x00, 0x9c, 0xee };
+  const guint8 Plaintext[] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10 };
+  /* first call covers a range of job sizes, the second call decrypts the
+     rest of each job to check that partial blocks are carried over */
+  const guint split[] = { 64, 0, 1, 15, 16, 17, 31, 33, 47, 48, 50, 63, 5, 40, 24 };
+  AesCtrState *states[G_N_ELEMENTS (split)];
+  AesCtrJob jobs[G_N_ELEMENTS (split)];
+  guint8 data[G_N_ELEMENTS (split)][sizeof (Ciphertext)];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (split); ++i) {
+    states[i] = setup_aes_decrypt ();
+    memcpy (data[i], Ciphertext, sizeof (Ciphertext));
+    jobs[i].state = states[i];
+    jobs[i].data = data[i];
+    jobs[i].length = split[i];
+  }
+  gst_aes_ctr_decrypt_ip_multi (jobs, G_N_ELEMENTS (jobs));
+  for (i = 0; i < G_N_ELEMENTS (split); ++i) {
+    jobs[i].data = data[i] + split[i];
+    jobs[i].length = sizeof (Ciphertext) - split[i];
+  }
+  gst_aes_ctr_decrypt_ip_multi (jobs, G_N_ELEMENTS (jobs));
+  for (i = 0; i < G_N_ELEMENTS (split); ++i) {
+    fail_unless (memcmp (data[i], Plaintext, sizeof (Plaintext)) == 0,
+        "job %u decrypted incorrectly", i);
+    gst_aes_ctr_decrypt_unref (states[i]);
+  }
+}
+GST_END_TEST;
+
+GST_START_TEST (test_transcrypt_aes_ctr) {
+  const guint8 Key2[] = { 0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77, 0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+  const guint8 IV2[] = { 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08 };
+  GBytes *key2 = g_bytes_new_static (Key2, sizeof (Key2));
+  GBytes *iv2 = g_bytes_new_static (IV2, sizeof (IV2));
+  AesCtrState *from, *to, *check;
+  guint8 plain[3000], data[3000];
+  guint i;
+
+  for (i = 0; i < sizeof (plain); ++i)
+    plain[i] = g_random_int_range (0, 256);
+  memcpy (data, plain, sizeof (data));
+  from = setup_aes_decrypt ();
+  gst_aes_ctr_decrypt_ip (from, data, sizeof (data));
+  gst_aes_ctr_decrypt_unref (from);
+
+  /* re-encrypt in two uneven parts, then decrypt with the new key */
+  from = setup_aes_decrypt ();
+  to = gst_aes_ctr_decrypt_new (key2, iv2);
+  gst_aes_ctr_transcrypt_ip (from, to, data, 1001);
+  gst_aes_ctr_transcrypt_ip (from, to, data + 1001, sizeof (data) - 1001);
+  check = gst_aes_ctr_decrypt_new (key2, iv2);
+  gst_aes_ctr_decrypt_ip (check, data, sizeof (data));
+  fail_unless (memcmp (data, plain, sizeof (plain)) == 0);
+
+  gst_aes_ctr_decrypt_unref (from);
+  gst_aes_ctr_decrypt_unref (to);
+  gst_aes_ctr_decrypt_unref (check);
+  g_bytes_unref (key2);
+  g_bytes_unref (iv2);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_nist_aes_cbc) {
+  /* F.2.2 CBC-AES128.Decrypt from NIST SP 800-38A */
+  const guint8 Key[] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+  const guint8 IV[] = { 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f };
+  const guint8 Ciphertext[] = {
+    0x76, 0x49, 0xab, 0xac, 0x81, 0x19, 0xb2, 0x46, 0xce, 0xe9, 0x8e, 0x9b, 0x12, 0xe9, 0x19, 0x7d,
+    0x50, 0x86, 0xcb, 0x9b, 0x50, 0x72, 0x19, 0xee, 0x95, 0xdb, 0x11, 0x3a, 0x91, 0x76, 0x78, 0xb2,
+    0x73, 0xbe, 0xd6, 0xb8, 0xe3, 0xc1, 0x74, 0x3b, 0x71, 0x16, 0xe6, 0x9e, 0x22, 0x22, 0x95, 0x16,
+    0x3f, 0xf1, 0xca, 0xa1, 0x68, 0x1f, 0xac, 0x09, 0x12, 0x0e, 0xca, 0x30, 0x75, 0x86, 0xe1, 0xa7
+  };
+  const guint8 Plaintext[] = {
+    0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a,
+    0xae, 0x2d, 0x8a, 0x57, 0x1e, 0x03, 0xac, 0x9c, 0x9e, 0xb7, 0x6f, 0xac, 0x45, 0xaf, 0x8e, 0x51,
+    0x30, 0xc8, 0x1c, 0x46, 0xa3, 0x5c, 0xe4, 0x11, 0xe5, 0xfb, 0xc1, 0x19, 0x1a, 0x0a, 0x52, 0xef,
+    0xf6, 0x9f, 0x24, 0x45, 0xdf, 0x4f, 0x9b, 0x17, 0xad, 0x2b, 0x41, 0x7b, 0xe6, 0x6c, 0x37, 0x10
+  };
+  GBytes *key = g_bytes_new_static (Key, sizeof (Key));
+  GBytes *iv = g_bytes_new_static (IV, sizeof (IV));
+  AesCbcState *state;
+  guint8 data[sizeof (Ciphertext)];
+  guint8 pattern[2 * sizeof (Ciphertext) + 7];
+  guint i;
+
+  /* the chain carries on from one call to the next */
+  memcpy (data, Ciphertext, sizeof (data));
+  state = gst_aes_cbc_decrypt_new (key, iv);
+  fail_unless (state != NULL);
+  gst_aes_cbc_decrypt_ip (state, data, 32);
+  gst_aes_cbc_decrypt_ip (state, data + 32, sizeof (data) - 32);
+  fail_unless (memcmp (data, Plaintext, sizeof (Plaintext)) == 0);
+
+  /* clear blocks between the encrypted ones are not part of the chain,
+     and neither is a partial block at the end */
+  for (i = 0; i < sizeof (pattern); ++i)
+    pattern[i] = i;
+  for (i = 0; i < 4; ++i)
+    memcpy (pattern + 32 * i, Ciphertext + 16 * i, 16);
+  fail_unless (gst_aes_cbc_decrypt_set_iv (state, IV, sizeof (IV)));
+  gst_aes_cbc_decrypt_ip_pattern (state, pattern, sizeof (pattern), 1, 1);
+  for (i = 0; i < 4; ++i) {
+    fail_unless (memcmp (pattern + 32 * i, Plaintext + 16 * i, 16) == 0);
+    fail_unless_equals_int (pattern[32 * i + 16], 32 * i + 16);
+  }
+  fail_unless_equals_int (pattern[sizeof (pattern) - 1], sizeof (pattern) - 1);
+
+  gst_aes_cbc_decrypt_unref (state);
+  g_bytes_unref (key);
+  g_bytes_unref (iv);
+}
+GST_END_TEST;
+
+GST_START_TEST (test_key_arena) {
+  /* NIST SP800-38a section F.5.2, as in setup_aes_decrypt() */
+  const guint8 Key[]={ 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+  const guint8 IV[] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff };
+  const guint8 Ciphertext1[] ={ 0x87, 0x4d, 0x61, 0x91, 0xb6, 0x20, 0xe3, 0x26, 0x1b, 0xef, 0x68, 0x64, 0x99, 0x0d, 0xb6, 0xce};
+  const guint8 Plaintext1[] = { 0x6b, 0xc1, 0xbe, 0xe2, 0x2e, 0x40, 0x9f, 0x96, 0xe9, 0x3d, 0x7e, 0x11, 0x73, 0x93, 0x17, 0x2a };
+  GstCencKeyArena *arena;
+  AesCtrState *state;
+  guint8 kid[16], other[16];
+  guint32 generation;
+  gint slot, i;
+
+  arena = gst_cenc_key_arena_new ();
+  /* enough keys to make the arena grow */
+  for (i = 0; i < 40; ++i) {
+    memset (kid, i + 1, sizeof (kid));
+    memset (other, i + 100, sizeof (other));
+    fail_unless_equals_int (gst_cenc_key_arena_add (arena, kid, other), i);
+  }
+  memset (kid, 7, sizeof (kid));
+  slot = gst_cenc_key_arena_add (arena, kid, Key);
+  fail_unless_equals_int (slot, 6);
+  fail_unless_equals_int (gst_cenc_key_arena_get_size (arena), 40);
+  fail_unless_equals_int (gst_cenc_key_arena_lookup (arena, kid), slot);
+
+  state = gst_aes_ctr_decrypt_new_from_schedule (
+      gst_cenc_key_arena_get_schedule (arena, slot), IV, sizeof (IV));
+  fail_if (state == NULL);
+  decrypt_block (state, Ciphertext1, Plaintext1, sizeof (Ciphertext1));
+
+  /* re-keying a state only needs the counter to be reset afterwards */
+  gst_aes_ctr_decrypt_set_key (state,
+      gst_cenc_key_arena_get_schedule (arena, 0));
+  memset (kid, 7, sizeof (kid));
+  generation = gst_cenc_key_arena_get_generation (arena, slot);
+  gst_cenc_key_arena_add (arena, kid, Key);
+  fail_if (gst_cenc_key_arena_get_generation (arena, slot) == generation);
+  gst_aes_ctr_decrypt_set_key (state,
+      gst_cenc_key_arena_get_schedule (arena, slot));
+  fail_unless (gst_aes_ctr_decrypt_set_iv (state, IV, sizeof (IV)));
+  decrypt_block (state, Ciphertext1, Plaintext1, sizeof (Ciphertext1));
+  gst_aes_ctr_decrypt_unref (state);
+
+  /* the slot of a removed key is reused, even for an all zero KID */
+  gst_cenc_key_arena_remove (arena, slot);
+  fail_unless_equals_int (gst_cenc_key_arena_lookup (arena, kid),
+      GST_CENC_KEY_ARENA_NO_SLOT);
+  memset (other, 0, sizeof (other));
+  fail_unless_equals_int (gst_cenc_key_arena_lookup (arena, other),
+      GST_CENC_KEY_ARENA_NO_SLOT);
+  fail_unless_equals_int (gst_cenc_key_arena_add (arena, other, Key), slot);
+  fail_unless_equals_int (gst_cenc_key_arena_lookup (arena, other), slot);
+
+  gst_cenc_key_arena_free (arena);
+}
+GST_END_TEST;
+
 static Suite *
 aesctr_suite (void)
 {
@@ -99,6 +282,10 @@ aesctr_suite (void)
 
   suite_add_tcase (s, tc_chain);
   tcase_add_test (tc_chain, test_nist_aes_ctr);
+  tcase_add_test (tc_chain, test_multi_aes_ctr);
+  tcase_add_test (tc_chain, test_transcrypt_aes_ctr);
+  tcase_add_test (tc_chain, test_nist_aes_cbc);
+  tcase_add_test (tc_chain, test_key_arena);
 
   return s;
 }
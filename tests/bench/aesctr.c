@@ -0,0 +1,259 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+  Throughput benchmark of the AES-CTR engine. Each result is printed as one
+  JSON object per line, for example:
+
+  {"backend":"aesni","mode":"single","layout":"avc","size":4096,
+   "iv_size":8,"aligned":true,"samples":...,"bytes":...,"ns":...,
+   "gbps":...,"cycles_per_byte":...}
+
+  "mode" is "single" for gst_aes_ctr_decrypt_ip() on one sample at a time,
+  or "multi" for gst_aes_ctr_decrypt_ip_multi() on BENCH_LANES samples at
+  a time. "bytes" counts whole samples, including their clear parts.
+*/
+
+#include <string.h>
+
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#define BENCH_LANES 8
+#define BENCH_MIN_SIZE 16
+#define BENCH_MAX_SIZE (16 * 1024 * 1024)
+/* largest sample size used for the multi mode */
+#define BENCH_MAX_MULTI_SIZE (1024 * 1024)
+
+/* Subsample layout of a sample: header_clear bytes of clear parameter
+   sets, then n_slices equal slices, each starting with slice_clear bytes
+   of clear NAL and slice header. n_slices == 0 encrypts everything after
+   the header, as for audio. */
+typedef struct
+{
+  const gchar *name;
+  guint header_clear;
+  guint n_slices;
+  guint slice_clear;
+} BenchLayout;
+
+static const BenchLayout layouts[] = {
+  {"full", 0, 0, 0},
+  {"avc", 0, 4, 37},
+  {"hevc", 120, 2, 38},
+};
+
+typedef struct
+{
+  guint8 *data;
+  gsize length;
+} BenchRange;
+
+static gint min_time = 200;
+static gint max_size = BENCH_MAX_SIZE;
+
+static GOptionEntry options[] = {
+  {"min-time", 't', 0, G_OPTION_ARG_INT, &min_time,
+      "Minimum run time of each measurement in milliseconds", "MS"},
+  {"max-size", 's', 0, G_OPTION_ARG_INT, &max_size,
+      "Largest sample size in bytes", "BYTES"},
+  {NULL}
+};
+
+static guint64
+bench_cycles (void)
+{
+#ifdef HAVE_RDTSC
+  return __rdtsc ();
+#else
+  return 0;
+#endif
+}
+
+/* split a sample into its encrypted ranges */
+static guint
+bench_layout_ranges (const BenchLayout * layout, guint8 * data, gsize size,
+    BenchRange * ranges)
+{
+  gsize pos = MIN (layout->header_clear, size);
+  gsize slice;
+  guint i, n = 0;
+
+  if (!layout->n_slices) {
+    ranges[0].data = data + pos;
+    ranges[0].length = size - pos;
+    return ranges[0].length ? 1 : 0;
+  }
+  slice = (size - pos) / layout->n_slices;
+  for (i = 0; i < layout->n_slices; ++i) {
+    gsize length = (i + 1 == layout->n_slices) ? size - pos : slice;
+    gsize clear = MIN (layout->slice_clear, length);
+
+    if (length > clear) {
+      ranges[n].data = data + pos + clear;
+      ranges[n].length = length - clear;
+      ++n;
+    }
+    pos += length;
+  }
+  return n;
+}
+
+static void
+bench_run (GstAesCtrBackend backend, gboolean multi,
+    const BenchLayout * layout, gsize size, guint iv_size, gboolean aligned)
+{
+  static const guint8 key_data[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae,
+    0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+  };
+  static const guint8 iv[16] = { 0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6,
+    0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+  };
+  guint n_lanes = multi ? BENCH_LANES : 1;
+  AesCtrState *states[BENCH_LANES];
+  BenchRange ranges[BENCH_LANES][8];
+  guint n_ranges[BENCH_LANES];
+  guint8 *memory[BENCH_LANES];
+  GBytes *key, *iv_bytes;
+  guint64 samples = 0, cycles;
+  GstClockTime start, elapsed, limit = min_time * GST_MSECOND;
+  guint batch, i, j, r;
+
+  gst_aes_ctr_set_backend (backend);
+  key = g_bytes_new_static (key_data, sizeof (key_data));
+  iv_bytes = g_bytes_new_static (iv, iv_size);
+  for (i = 0; i < n_lanes; ++i) {
+    guint8 *data;
+
+    states[i] = gst_aes_ctr_decrypt_new (key, iv_bytes);
+    memory[i] = g_malloc (size + 64);
+    data = (guint8 *) (((guintptr) memory[i] + 63) & ~(guintptr) 63);
+    if (!aligned)
+      ++data;
+    memset (data, 0x5a, size);
+    n_ranges[i] = bench_layout_ranges (layout, data, size, ranges[i]);
+  }
+  g_bytes_unref (key);
+  g_bytes_unref (iv_bytes);
+
+  /* read the clock about every 64KB so small samples are not swamped by
+     the cost of the clock itself */
+  batch = MAX (1, 65536 / (size * n_lanes));
+  cycles = bench_cycles ();
+  start = gst_util_get_timestamp ();
+  do {
+    for (j = 0; j < batch; ++j) {
+      for (i = 0; i < n_lanes; ++i) {
+        gst_aes_ctr_decrypt_set_iv (states[i], iv, iv_size);
+      }
+      if (multi) {
+        AesCtrJob jobs[BENCH_LANES];
+
+        for (r = 0; r < n_ranges[0]; ++r) {
+          for (i = 0; i < n_lanes; ++i) {
+            jobs[i].state = states[i];
+            jobs[i].data = ranges[i][r].data;
+            jobs[i].length = ranges[i][r].length;
+          }
+          gst_aes_ctr_decrypt_ip_multi (jobs, n_lanes);
+        }
+      } else {
+        for (r = 0; r < n_ranges[0]; ++r) {
+          gst_aes_ctr_decrypt_ip (states[0], ranges[0][r].data,
+              ranges[0][r].length);
+        }
+      }
+    }
+    samples += batch * n_lanes;
+    elapsed = gst_util_get_timestamp () - start;
+  } while (elapsed < limit);
+  cycles = bench_cycles () - cycles;
+
+  g_print ("{\"backend\":\"%s\",\"mode\":\"%s\",\"layout\":\"%s\","
+      "\"size\":%" G_GSIZE_FORMAT ",\"iv_size\":%u,\"aligned\":%s,"
+      "\"samples\":%" G_GUINT64_FORMAT ",\"bytes\":%" G_GUINT64_FORMAT ","
+      "\"ns\":%" G_GUINT64_FORMAT ",\"gbps\":%.3f,\"cycles_per_byte\":",
+      gst_aes_ctr_backend_name (backend), multi ? "multi" : "single",
+      layout->name, size, iv_size, aligned ? "true" : "false", samples,
+      samples * size, elapsed, (gdouble) (samples * size) / elapsed);
+#ifdef HAVE_RDTSC
+  g_print ("%.3f}\n", (gdouble) cycles / (samples * size));
+#else
+  g_print ("null}\n");
+#endif
+
+  for (i = 0; i < n_lanes; ++i) {
+    gst_aes_ctr_decrypt_unref (states[i]);
+    g_free (memory[i]);
+  }
+}
+
+int
+main (int argc, char **argv)
+{
+  static const GstAesCtrBackend backends[] = {
+    GST_AES_CTR_BACKEND_OPENSSL, GST_AES_CTR_BACKEND_AESNI
+  };
+  static const guint iv_sizes[] = { 8, 16 };
+  GOptionContext *ctx;
+  GError *err = NULL;
+  guint b, l, v, a, m;
+  gsize size;
+
+  ctx = g_option_context_new ("- AES-CTR decryption benchmark");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  max_size = MAX (max_size, BENCH_MIN_SIZE);
+
+  for (b = 0; b < G_N_ELEMENTS (backends); ++b) {
+    if (!gst_aes_ctr_set_backend (backends[b])) {
+      g_printerr ("Skipping unsupported backend %s\n",
+          gst_aes_ctr_backend_name (backends[b]));
+      continue;
+    }
+    for (m = 0; m < 2; ++m) {
+      for (l = 0; l < G_N_ELEMENTS (layouts); ++l) {
+        for (size = BENCH_MIN_SIZE; size <= (gsize) max_size; size *= 4) {
+          if (m && size > BENCH_MAX_MULTI_SIZE)
+            break;
+          for (v = 0; v < G_N_ELEMENTS (iv_sizes); ++v) {
+            for (a = 0; a < 2; ++a) {
+              bench_run (backends[b], m, &layouts[l], size, iv_sizes[v], !a);
+            }
+          }
+        }
+      }
+    }
+  }
+  gst_aes_ctr_set_backend (GST_AES_CTR_BACKEND_AUTO);
+
+  return 0;
+}
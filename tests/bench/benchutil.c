@@ -0,0 +1,227 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Synthetic protected streams shared by the element benchmarks */
+
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <gst/gst.h>
+#include <gst/gstprotection.h>
+
+#include "benchutil.h"
+
+#define CLEARKEY_PROTECTION_ID "e2719d58-a985-b3c9-781a-b030af78d30e"
+
+const BenchProfile bench_profiles[] = {
+  /* 128 kbit/s AAC-LC, 1024 samples per frame at 48kHz */
+  {"audio", "audio/mpeg", 342, 8, 0, 0, 0, 21333333},
+  /* 8 Mbit/s AVC at 30 fps */
+  {"1080p", "video/x-h264", 33333, 8, 0, 4, 37, 33333333},
+  /* 25 Mbit/s HEVC at 50 fps */
+  {"4k", "video/x-h265", 62500, 16, 120, 8, 38, 20000000},
+};
+
+const guint bench_n_profiles = G_N_ELEMENTS (bench_profiles);
+
+const BenchProfile *
+bench_profile_find (const gchar * name)
+{
+  guint i;
+
+  for (i = 0; i < bench_n_profiles; ++i) {
+    if (g_strcmp0 (bench_profiles[i].name, name) == 0)
+      return &bench_profiles[i];
+  }
+  return NULL;
+}
+
+/* caps of the encrypted stream, as qtdemux would output them */
+gchar *
+bench_profile_caps (const BenchProfile * profile)
+{
+  return g_strdup_printf ("application/x-cenc, original-media-type=(string)%s,"
+      " protection-system=(string)" CLEARKEY_PROTECTION_ID,
+      profile->media_type);
+}
+
+static void
+bench_make_kid (guint index, guint8 * kid)
+{
+  guint i;
+
+  for (i = 0; i < BENCH_KID_LENGTH; ++i) {
+    kid[i] = 0xb0 + i;
+  }
+  kid[BENCH_KID_LENGTH - 1] = index;
+}
+
+/* Create a sample of random data with a GstProtectionMeta that uses the
+   key kid_index. The data is not real ciphertext, which does not matter
+   to the cost of decrypting it. */
+GstBuffer *
+bench_make_sample (const BenchProfile * profile, guint kid_index)
+{
+  GstStructure *info;
+  GstBuffer *buf, *kid_buf, *iv_buf;
+  guint8 kid[BENCH_KID_LENGTH];
+  guint8 iv[16];
+  GstMapInfo map;
+  guint i;
+
+  buf = gst_buffer_new_allocate (NULL, profile->sample_size, NULL);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; ++i) {
+    map.data[i] = g_random_int_range (0, 256);
+  }
+  gst_buffer_unmap (buf, &map);
+
+  bench_make_kid (kid_index, kid);
+  kid_buf = gst_buffer_new_allocate (NULL, sizeof (kid), NULL);
+  gst_buffer_fill (kid_buf, 0, kid, sizeof (kid));
+  for (i = 0; i < profile->iv_size; ++i) {
+    iv[i] = g_random_int_range (0, 256);
+  }
+  iv_buf = gst_buffer_new_allocate (NULL, profile->iv_size, NULL);
+  gst_buffer_fill (iv_buf, 0, iv, profile->iv_size);
+
+  info = gst_structure_new ("application/x-cenc",
+      "encrypted", G_TYPE_BOOLEAN, TRUE,
+      "iv_size", G_TYPE_UINT, profile->iv_size,
+      "kid", GST_TYPE_BUFFER, kid_buf,
+      "iv", GST_TYPE_BUFFER, iv_buf, NULL);
+  gst_buffer_unref (kid_buf);
+  gst_buffer_unref (iv_buf);
+
+  if (profile->header_clear || profile->n_slices) {
+    guint n_subsamples = profile->n_slices + (profile->header_clear ? 1 : 0);
+    gsize slice = (profile->sample_size - profile->header_clear)
+        / profile->n_slices;
+    gsize remaining = profile->sample_size - profile->header_clear;
+    GstBuffer *subsamples;
+
+    subsamples = gst_buffer_new_allocate (NULL, 6 * n_subsamples, NULL);
+    gst_buffer_map (subsamples, &map, GST_MAP_WRITE);
+    i = 0;
+    if (profile->header_clear) {
+      GST_WRITE_UINT16_BE (map.data, profile->header_clear);
+      GST_WRITE_UINT32_BE (map.data + 2, 0);
+      ++i;
+    }
+    for (; i < n_subsamples; ++i) {
+      gsize length = (i + 1 == n_subsamples) ? remaining : slice;
+
+      GST_WRITE_UINT16_BE (map.data + 6 * i, profile->slice_clear);
+      GST_WRITE_UINT32_BE (map.data + 6 * i + 2,
+          length - profile->slice_clear);
+      remaining -= length;
+    }
+    gst_buffer_unmap (subsamples, &map);
+    gst_structure_set (info,
+        "subsample_count", G_TYPE_UINT, n_subsamples,
+        "subsamples", GST_TYPE_BUFFER, subsamples, NULL);
+    gst_buffer_unref (subsamples);
+  } else {
+    gst_structure_set (info, "subsample_count", G_TYPE_UINT, 0, NULL);
+  }
+  gst_buffer_add_protection_meta (buf, info);
+  GST_BUFFER_DURATION (buf) = profile->duration;
+
+  return buf;
+}
+
+/* Create a temporary key directory with a random key for the first n_keys
+   KIDs, using the same file names as store-key.py */
+gchar *
+bench_keys_create (guint n_keys, GError ** error)
+{
+  gchar *dir;
+  guint i, j;
+
+  dir = g_dir_make_tmp ("cencdec-bench-XXXXXX", error);
+  if (!dir)
+    return NULL;
+  for (i = 0; i < n_keys; ++i) {
+    guint8 kid[BENCH_KID_LENGTH];
+    guint8 key[BENCH_KEY_LENGTH];
+    gchar name[2 * BENCH_KID_LENGTH + 5];
+    gchar *path;
+    gboolean ok;
+
+    bench_make_kid (i, kid);
+    for (j = 0; j < BENCH_KID_LENGTH; ++j) {
+      g_snprintf (name + (2 * j), 3, "%02x", kid[j]);
+      key[j] = g_random_int_range (0, 256);
+    }
+    g_strlcat (name, ".key", sizeof (name));
+    path = g_build_filename (dir, name, NULL);
+    ok = g_file_set_contents (path, (const gchar *) key, sizeof (key), error);
+    g_free (path);
+    if (!ok) {
+      bench_keys_remove (dir);
+      return NULL;
+    }
+  }
+  return dir;
+}
+
+/* delete a directory made by bench_keys_create() and free its name */
+void
+bench_keys_remove (gchar * dir)
+{
+  const gchar *name;
+  GDir *d;
+
+  d = g_dir_open (dir, 0, NULL);
+  if (d) {
+    while ((name = g_dir_read_name (d))) {
+      gchar *path = g_build_filename (dir, name, NULL);
+
+      g_unlink (path);
+      g_free (path);
+    }
+    g_dir_close (d);
+  }
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+static gint
+bench_compare_times (gconstpointer a, gconstpointer b)
+{
+  GstClockTime ta = *(const GstClockTime *) a;
+  GstClockTime tb = *(const GstClockTime *) b;
+
+  return ta < tb ? -1 : (ta > tb ? 1 : 0);
+}
+
+void
+bench_times_sort (GArray * times)
+{
+  g_array_sort (times, bench_compare_times);
+}
+
+/* percentile of an array of GstClockTime sorted by bench_times_sort() */
+GstClockTime
+bench_times_percentile (GArray * times, guint percent)
+{
+  if (!times->len)
+    return GST_CLOCK_TIME_NONE;
+  return g_array_index (times, GstClockTime, (times->len - 1) * percent / 100);
+}
@@ -0,0 +1,61 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+#ifndef _BENCH_UTIL_H_
+#define _BENCH_UTIL_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define BENCH_KID_LENGTH 16
+#define BENCH_KEY_LENGTH 16
+#define BENCH_MAX_KEYS 64
+
+/* A stream profile. Samples of a video profile start with header_clear
+   bytes of clear parameter sets and are split into n_slices slices, each
+   with slice_clear bytes of clear NAL and slice header. */
+typedef struct
+{
+  const gchar *name;
+  const gchar *media_type;
+  gsize sample_size;
+  guint iv_size;
+  guint header_clear;
+  guint n_slices;
+  guint slice_clear;
+  GstClockTime duration;
+} BenchProfile;
+
+extern const BenchProfile bench_profiles[];
+extern const guint bench_n_profiles;
+
+const BenchProfile * bench_profile_find (const gchar * name);
+gchar * bench_profile_caps (const BenchProfile * profile);
+GstBuffer * bench_make_sample (const BenchProfile * profile,
+    guint kid_index);
+
+gchar * bench_keys_create (guint n_keys, GError ** error);
+void bench_keys_remove (gchar * dir);
+
+void bench_times_sort (GArray * times);
+GstClockTime bench_times_percentile (GArray * times, guint percent);
+
+G_END_DECLS
+#endif
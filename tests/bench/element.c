@@ -0,0 +1,159 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+  Throughput and latency benchmark of the cencdec element. Synthetic
+  samples carrying a GstProtectionMeta are pushed through the element
+  using GstHarness, with keys written to a temporary key-directory.
+  Each profile prints one JSON object per line, for example:
+
+  {"profile":"1080p","keys":1,"samples":...,"bytes":...,"ns":...,
+   "samples_per_sec":...,"bytes_per_sec":...,"latency_p50":...,
+   "latency_p90":...,"latency_p99":...,"latency_max":...}
+
+  Latencies are the time in ns from pushing a buffer until the decrypted
+  buffer has been pulled from the harness. Creating the input buffers is
+  not timed.
+*/
+
+#include <gst/gst.h>
+#include <gst/check/gstharness.h>
+
+#include "benchutil.h"
+
+/* number of distinct input samples of each profile */
+#define BENCH_N_TEMPLATES 16
+
+static gint min_time = 2000;
+static gint n_keys = 1;
+
+static GOptionEntry options[] = {
+  {"min-time", 't', 0, G_OPTION_ARG_INT, &min_time,
+      "Minimum run time of each profile in milliseconds", "MS"},
+  {"keys", 'k', 0, G_OPTION_ARG_INT, &n_keys,
+      "Number of KIDs that the samples cycle through", "N"},
+  {NULL}
+};
+
+static gboolean
+bench_run (const BenchProfile * profile, const gchar * key_dir)
+{
+  GstBuffer *templates[BENCH_N_TEMPLATES];
+  GstClockTime elapsed = 0, limit = min_time * GST_MSECOND;
+  GArray *latencies;
+  GstHarness *h;
+  gchar *caps;
+  guint64 samples = 0;
+  guint i;
+
+  h = gst_harness_new ("cencdec");
+  g_object_set (h->element, "key-directory", key_dir, NULL);
+  caps = bench_profile_caps (profile);
+  gst_harness_set_src_caps_str (h, caps);
+  g_free (caps);
+
+  for (i = 0; i < BENCH_N_TEMPLATES; ++i) {
+    templates[i] = bench_make_sample (profile, i % n_keys);
+  }
+  latencies = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+
+  while (elapsed < limit) {
+    GstBuffer *in, *out;
+    GstClockTime start, latency;
+
+    /* the element decrypts in place, so every push needs its own copy of
+       the encrypted data */
+    in = gst_buffer_copy_deep (templates[samples % BENCH_N_TEMPLATES]);
+    GST_BUFFER_PTS (in) = samples * profile->duration;
+
+    start = gst_util_get_timestamp ();
+    if (gst_harness_push (h, in) != GST_FLOW_OK) {
+      g_printerr ("Failed to decrypt %s sample %" G_GUINT64_FORMAT "\n",
+          profile->name, samples);
+      break;
+    }
+    out = gst_harness_pull (h);
+    latency = gst_util_get_timestamp () - start;
+
+    gst_buffer_unref (out);
+    g_array_append_val (latencies, latency);
+    elapsed += latency;
+    ++samples;
+  }
+
+  if (latencies->len) {
+    bench_times_sort (latencies);
+    g_print ("{\"profile\":\"%s\",\"keys\":%d,\"samples\":%" G_GUINT64_FORMAT
+        ",\"bytes\":%" G_GUINT64_FORMAT ",\"ns\":%" G_GUINT64_FORMAT
+        ",\"samples_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+        "\"latency_p50\":%" G_GUINT64_FORMAT ",\"latency_p90\":%"
+        G_GUINT64_FORMAT ",\"latency_p99\":%" G_GUINT64_FORMAT
+        ",\"latency_max\":%" G_GUINT64_FORMAT "}\n", profile->name, n_keys,
+        samples, samples * profile->sample_size, elapsed,
+        (gdouble) samples * GST_SECOND / elapsed,
+        (gdouble) samples * profile->sample_size * GST_SECOND / elapsed,
+        bench_times_percentile (latencies, 50),
+        bench_times_percentile (latencies, 90),
+        bench_times_percentile (latencies, 99),
+        g_array_index (latencies, GstClockTime, latencies->len - 1));
+  }
+
+  g_array_free (latencies, TRUE);
+  for (i = 0; i < BENCH_N_TEMPLATES; ++i) {
+    gst_buffer_unref (templates[i]);
+  }
+  gst_harness_teardown (h);
+
+  return elapsed >= limit;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GError *err = NULL;
+  gchar *key_dir;
+  gboolean ok = TRUE;
+  guint i;
+
+  ctx = g_option_context_new ("- cencdec element benchmark");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  n_keys = CLAMP (n_keys, 1, BENCH_MAX_KEYS);
+
+  key_dir = bench_keys_create (n_keys, &err);
+  if (!key_dir) {
+    g_printerr ("Failed to create keys: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+  for (i = 0; ok && i < bench_n_profiles; ++i) {
+    ok = bench_run (&bench_profiles[i], key_dir);
+  }
+  bench_keys_remove (key_dir);
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,351 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+  Scaling benchmark of many cencdec instances in one process. For each
+  number of streams N = 1, 2, 4 ... max-streams it runs N pipelines of
+
+    appsrc ! cencdec ! fakesink
+
+  each fed with synthetic protected samples, and prints one JSON object
+  per line, for example:
+
+  {"profile":"1080p","streams":64,"keys":1,"samples":...,"bytes":...,
+   "ns":...,"samples_per_sec":...,"bytes_per_sec":...,
+   "min_stream_samples_per_sec":...,"latency_p50":...,"latency_p90":...,
+   "latency_p99":...,"latency_max":...,"rss":...}
+
+  Every pipeline has its own streaming thread. Stream i uses key
+  i % keys. Latencies are the time in ns from appsrc taking a sample until
+  fakesink receives it decrypted, sampled from the first
+  BENCH_MAX_LATENCIES samples of every stream. "rss" is the resident set
+  size of the process in bytes while all the pipelines are running, or -1
+  if it is not known.
+*/
+
+#include <string.h>
+
+#include <gst/gst.h>
+#ifdef G_OS_UNIX
+#include <unistd.h>
+#endif
+
+#include "benchutil.h"
+
+/* number of distinct input samples, shared by all streams */
+#define BENCH_N_TEMPLATES 16
+#define BENCH_MAX_LATENCIES 4096
+
+typedef struct
+{
+  GstElement *pipeline;
+  const BenchProfile *profile;
+  GstBuffer **templates;
+  guint64 pushed;
+  /* counted by the streaming thread while measuring */
+  guint64 samples;
+  guint64 bytes;
+  GArray *latencies;
+} BenchStream;
+
+static gint min_time = 2000;
+static gint max_streams = 512;
+static gint n_keys = 1;
+static gchar *profile_name = NULL;
+
+static volatile gint measuring = 0;
+
+static GOptionEntry options[] = {
+  {"min-time", 't', 0, G_OPTION_ARG_INT, &min_time,
+      "Measurement time of each step in milliseconds", "MS"},
+  {"max-streams", 'n', 0, G_OPTION_ARG_INT, &max_streams,
+      "Largest number of concurrent pipelines", "N"},
+  {"keys", 'k', 0, G_OPTION_ARG_INT, &n_keys,
+      "Number of KIDs shared between the streams", "N"},
+  {"profile", 'p', 0, G_OPTION_ARG_STRING, &profile_name,
+      "Stream profile: audio, 1080p or 4k (default 1080p)", "NAME"},
+  {NULL}
+};
+
+static gint64
+bench_rss (void)
+{
+#ifdef G_OS_UNIX
+  gchar *contents = NULL;
+  gchar **fields;
+  gint64 pages = -1;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return -1;
+  fields = g_strsplit (contents, " ", 3);
+  if (fields[0] && fields[1])
+    pages = g_ascii_strtoll (fields[1], NULL, 10);
+  g_strfreev (fields);
+  g_free (contents);
+
+  return pages < 0 ? -1 : pages * sysconf (_SC_PAGESIZE);
+#else
+  return -1;
+#endif
+}
+
+/* called by appsrc from the streaming thread when its queue is empty */
+static void
+bench_need_data (GstElement * src, guint length, BenchStream * stream)
+{
+  GstBuffer *buf;
+  GstFlowReturn ret;
+
+  /* the element decrypts in place, so every sample needs its own copy of
+     the encrypted data */
+  buf = gst_buffer_copy_deep (stream->templates[stream->pushed %
+          BENCH_N_TEMPLATES]);
+  GST_BUFFER_PTS (buf) = stream->pushed * stream->profile->duration;
+  /* appsrc streams have no use for the offset, so carry the time that the
+     sample was created in it */
+  GST_BUFFER_OFFSET (buf) = gst_util_get_timestamp ();
+  stream->pushed++;
+  g_signal_emit_by_name (src, "push-buffer", buf, &ret);
+  gst_buffer_unref (buf);
+}
+
+static void
+bench_handoff (GstElement * sink, GstBuffer * buf, GstPad * pad,
+    BenchStream * stream)
+{
+  if (g_atomic_int_get (&measuring)) {
+    if (stream->latencies->len < BENCH_MAX_LATENCIES) {
+      GstClockTime latency = gst_util_get_timestamp () -
+          GST_BUFFER_OFFSET (buf);
+
+      g_array_append_val (stream->latencies, latency);
+    }
+    stream->samples++;
+    stream->bytes += gst_buffer_get_size (buf);
+  }
+}
+
+static gboolean
+bench_stream_init (BenchStream * stream, const BenchProfile * profile,
+    GstBuffer ** templates, const gchar * key_dir)
+{
+  GstElement *src, *dec, *sink;
+  GstCaps *caps;
+  gchar *caps_str;
+
+  memset (stream, 0, sizeof (BenchStream));
+  stream->profile = profile;
+  stream->templates = templates;
+  stream->latencies = g_array_sized_new (FALSE, FALSE, sizeof (GstClockTime),
+      BENCH_MAX_LATENCIES);
+  stream->pipeline = gst_parse_launch ("appsrc name=src ! cencdec name=dec"
+      " ! fakesink name=sink", NULL);
+  if (!stream->pipeline)
+    return FALSE;
+
+  src = gst_bin_get_by_name (GST_BIN (stream->pipeline), "src");
+  dec = gst_bin_get_by_name (GST_BIN (stream->pipeline), "dec");
+  sink = gst_bin_get_by_name (GST_BIN (stream->pipeline), "sink");
+  caps_str = bench_profile_caps (profile);
+  caps = gst_caps_from_string (caps_str);
+  g_free (caps_str);
+  g_object_set (src, "caps", caps, "format", GST_FORMAT_TIME,
+      "emit-signals", TRUE, NULL);
+  gst_caps_unref (caps);
+  g_signal_connect (src, "need-data", G_CALLBACK (bench_need_data), stream);
+  g_object_set (dec, "key-directory", key_dir, NULL);
+  g_object_set (sink, "sync", FALSE, "signal-handoffs", TRUE, NULL);
+  g_signal_connect (sink, "handoff", G_CALLBACK (bench_handoff), stream);
+  gst_object_unref (src);
+  gst_object_unref (dec);
+  gst_object_unref (sink);
+
+  return TRUE;
+}
+
+/* stop a stream, returning FALSE if it posted an error */
+static gboolean
+bench_stream_clear (BenchStream * stream)
+{
+  gboolean ok = TRUE;
+
+  if (stream->pipeline) {
+    GstBus *bus = gst_element_get_bus (stream->pipeline);
+    GstMessage *msg;
+
+    gst_element_set_state (stream->pipeline, GST_STATE_NULL);
+    msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+    if (msg) {
+      GError *err = NULL;
+
+      gst_message_parse_error (msg, &err, NULL);
+      g_printerr ("Stream error: %s\n", err->message);
+      g_clear_error (&err);
+      gst_message_unref (msg);
+      ok = FALSE;
+    }
+    gst_object_unref (bus);
+    gst_object_unref (stream->pipeline);
+    stream->pipeline = NULL;
+  }
+  if (stream->latencies) {
+    g_array_free (stream->latencies, TRUE);
+    stream->latencies = NULL;
+  }
+  return ok;
+}
+
+static gboolean
+bench_run (const BenchProfile * profile, GstBuffer ** templates[],
+    guint n_streams, const gchar * key_dir)
+{
+  BenchStream *streams;
+  GArray *latencies;
+  guint64 samples = 0, bytes = 0;
+  gdouble min_rate = G_MAXDOUBLE;
+  GstClockTime start, elapsed = 0;
+  gint64 rss = -1;
+  gboolean ok = TRUE;
+  guint i;
+
+  streams = g_new0 (BenchStream, n_streams);
+  for (i = 0; ok && i < n_streams; ++i) {
+    ok = bench_stream_init (&streams[i], profile, templates[i % n_keys],
+        key_dir);
+  }
+  for (i = 0; ok && i < n_streams; ++i) {
+    if (gst_element_set_state (streams[i].pipeline,
+            GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+      ok = FALSE;
+  }
+  for (i = 0; ok && i < n_streams; ++i) {
+    if (gst_element_get_state (streams[i].pipeline, NULL, NULL,
+            10 * GST_SECOND) != GST_STATE_CHANGE_SUCCESS)
+      ok = FALSE;
+  }
+  if (!ok) {
+    g_printerr ("Failed to start %u streams\n", n_streams);
+  } else {
+    /* let the key caches and allocators warm up */
+    g_usleep (200 * G_TIME_SPAN_MILLISECOND);
+    start = gst_util_get_timestamp ();
+    g_atomic_int_set (&measuring, 1);
+    g_usleep (min_time * G_TIME_SPAN_MILLISECOND);
+    g_atomic_int_set (&measuring, 0);
+    elapsed = gst_util_get_timestamp () - start;
+    rss = bench_rss ();
+  }
+
+  latencies = g_array_new (FALSE, FALSE, sizeof (GstClockTime));
+  for (i = 0; i < n_streams; ++i) {
+    BenchStream *stream = &streams[i];
+
+    if (stream->pipeline) {
+      /* stopping the pipeline joins its streaming thread */
+      gst_element_set_state (stream->pipeline, GST_STATE_NULL);
+      samples += stream->samples;
+      bytes += stream->bytes;
+      min_rate = MIN (min_rate,
+          (gdouble) stream->samples * GST_SECOND / elapsed);
+      g_array_append_vals (latencies, stream->latencies->data,
+          stream->latencies->len);
+    }
+    ok = bench_stream_clear (stream) && ok;
+  }
+  g_free (streams);
+
+  if (ok) {
+    bench_times_sort (latencies);
+    g_print ("{\"profile\":\"%s\",\"streams\":%u,\"keys\":%d,\"samples\":%"
+        G_GUINT64_FORMAT ",\"bytes\":%" G_GUINT64_FORMAT ",\"ns\":%"
+        G_GUINT64_FORMAT ",\"samples_per_sec\":%.1f,\"bytes_per_sec\":%.1f,"
+        "\"min_stream_samples_per_sec\":%.1f,\"latency_p50\":%"
+        G_GUINT64_FORMAT ",\"latency_p90\":%" G_GUINT64_FORMAT
+        ",\"latency_p99\":%" G_GUINT64_FORMAT ",\"latency_max\":%"
+        G_GUINT64_FORMAT ",\"rss\":%" G_GINT64_FORMAT "}\n", profile->name,
+        n_streams, n_keys, samples, bytes, elapsed,
+        (gdouble) samples * GST_SECOND / elapsed,
+        (gdouble) bytes * GST_SECOND / elapsed, min_rate,
+        bench_times_percentile (latencies, 50),
+        bench_times_percentile (latencies, 90),
+        bench_times_percentile (latencies, 99),
+        bench_times_percentile (latencies, 100), rss);
+  }
+  g_array_free (latencies, TRUE);
+
+  return ok;
+}
+
+int
+main (int argc, char **argv)
+{
+  GstBuffer **templates[BENCH_MAX_KEYS];
+  const BenchProfile *profile;
+  GOptionContext *ctx;
+  GError *err = NULL;
+  gchar *key_dir;
+  gboolean ok = TRUE;
+  guint n, i, j;
+
+  ctx = g_option_context_new ("- cencdec scaling benchmark");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  n_keys = CLAMP (n_keys, 1, BENCH_MAX_KEYS);
+  max_streams = MAX (max_streams, 1);
+  profile = bench_profile_find (profile_name ? profile_name : "1080p");
+  if (!profile) {
+    g_printerr ("Unknown profile %s\n", profile_name);
+    return 1;
+  }
+
+  key_dir = bench_keys_create (n_keys, &err);
+  if (!key_dir) {
+    g_printerr ("Failed to create keys: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+  for (i = 0; i < (guint) n_keys; ++i) {
+    templates[i] = g_new (GstBuffer *, BENCH_N_TEMPLATES);
+    for (j = 0; j < BENCH_N_TEMPLATES; ++j) {
+      templates[i][j] = bench_make_sample (profile, i);
+    }
+  }
+
+  for (n = 1; ok && n <= (guint) max_streams; n *= 2) {
+    ok = bench_run (profile, templates, n, key_dir);
+  }
+
+  for (i = 0; i < (guint) n_keys; ++i) {
+    for (j = 0; j < BENCH_N_TEMPLATES; ++j) {
+      gst_buffer_unref (templates[i][j]);
+    }
+    g_free (templates[i]);
+  }
+  bench_keys_remove (key_dir);
+  g_free (profile_name);
+
+  return ok ? 0 : 1;
+}
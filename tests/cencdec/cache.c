@@ -0,0 +1,209 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+
+/* cencenc does not store the key when key-directory is empty, so it is
+   given to cencdec with add-key */
+#define TEST_ENCRYPTOR "cencenc key-directory=\"\" kid=" TEST_KID \
+  " key=" TEST_KEY
+
+/* encrypts the samples, each with its own IV, and sets up a decryptor
+   with the caps of the encrypted stream */
+static GstHarness *
+setup_decryptor (guint cache_size, GstBuffer ** samples, guint n_samples)
+{
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  gboolean added = FALSE;
+  GstHarness *enc, *h;
+  GstCaps *caps;
+  gchar *line;
+  guint i;
+
+  enc = gst_harness_new_parse (TEST_ENCRYPTOR);
+  fail_unless (enc != NULL);
+  gst_harness_set_src_caps_str (enc, "audio/mpeg, mpegversion=(int)4");
+  for (i = 0; i < n_samples; ++i) {
+    samples[i] = gst_harness_push_and_pull (enc, samples[i]);
+    fail_unless (samples[i] != NULL);
+    fail_unless (gst_buffer_get_protection_meta (samples[i]) != NULL);
+  }
+  caps = gst_pad_get_current_caps (enc->sinkpad);
+  fail_unless (caps != NULL);
+  gst_harness_teardown (enc);
+
+  /* the cache is created when the element starts, which the harness does
+     straight away */
+  line = g_strdup_printf ("cencdec key-directory=/nonexistent "
+      "sample-cache-size=%u", cache_size);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  g_signal_emit_by_name (h->element, "add-key", kid, key, &added);
+  fail_unless (added);
+  gst_harness_set_src_caps (h, caps);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  return h;
+}
+
+/* decrypts a copy of an encrypted sample and checks it against the clear
+   data */
+static GstBuffer *
+decrypt_sample (GstHarness * h, GstBuffer * encrypted, GstBuffer * clear)
+{
+  GstBuffer *out;
+  GstMapInfo map;
+
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (encrypted));
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  fail_unless (gst_buffer_map (clear, &map, GST_MAP_READ));
+  fail_unless_equals_int (gst_buffer_get_size (out), map.size);
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (clear, &map);
+  return out;
+}
+
+static void
+check_cache_stats (GstElement * dec, guint64 hits, guint64 misses)
+{
+  GstStructure *stats;
+  guint64 value = 0;
+
+  g_object_get (dec, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "sample-cache-hits", &value));
+  fail_unless_equals_uint64 (value, hits);
+  fail_unless (gst_structure_get_uint64 (stats, "sample-cache-misses",
+          &value));
+  fail_unless_equals_uint64 (value, misses);
+  gst_structure_free (stats);
+}
+
+GST_START_TEST (test_repeated_sample)
+{
+  GstBuffer *clear = test_create_sample (2000);
+  GstBuffer *encrypted = gst_buffer_copy_deep (clear);
+  GstBuffer *first, *second;
+  GstHarness *h;
+
+  h = setup_decryptor (100000, &encrypted, 1);
+  first = decrypt_sample (h, encrypted, clear);
+  check_cache_stats (h->element, 0, 1);
+  second = decrypt_sample (h, encrypted, clear);
+  check_cache_stats (h->element, 1, 1);
+
+  /* the copy shares the memory of the cache, so it cannot be written to */
+  fail_unless_equals_int (gst_buffer_n_memory (second), 1);
+  fail_if (gst_memory_is_writable (gst_buffer_peek_memory (second, 0)));
+
+  gst_buffer_unref (first);
+  gst_buffer_unref (second);
+  gst_buffer_unref (encrypted);
+  gst_buffer_unref (clear);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_eviction)
+{
+  GstBuffer *clear[2], *encrypted[2];
+  GstHarness *h;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i) {
+    clear[i] = test_create_sample (1000);
+    encrypted[i] = gst_buffer_copy_deep (clear[i]);
+  }
+  /* there is only room for one sample, so each evicts the other */
+  h = setup_decryptor (1500, encrypted, 2);
+  gst_buffer_unref (decrypt_sample (h, encrypted[0], clear[0]));
+  gst_buffer_unref (decrypt_sample (h, encrypted[1], clear[1]));
+  gst_buffer_unref (decrypt_sample (h, encrypted[0], clear[0]));
+  check_cache_stats (h->element, 0, 3);
+  gst_buffer_unref (decrypt_sample (h, encrypted[0], clear[0]));
+  check_cache_stats (h->element, 1, 3);
+
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i) {
+    gst_buffer_unref (encrypted[i]);
+    gst_buffer_unref (clear[i]);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_disabled)
+{
+  GstBuffer *clear = test_create_sample (500);
+  GstBuffer *encrypted = gst_buffer_copy_deep (clear);
+  GstHarness *h;
+
+  h = setup_decryptor (0, &encrypted, 1);
+  gst_buffer_unref (decrypt_sample (h, encrypted, clear));
+  gst_buffer_unref (decrypt_sample (h, encrypted, clear));
+  check_cache_stats (h->element, 0, 0);
+
+  gst_buffer_unref (encrypted);
+  gst_buffer_unref (clear);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_cache_suite (void)
+{
+  Suite *s = suite_create ("cencdec-cache");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_repeated_sample);
+  tcase_add_test (tc_chain, test_eviction);
+  tcase_add_test (tc_chain, test_disabled);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_cache_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
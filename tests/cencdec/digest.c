@@ -0,0 +1,172 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstcencdigest.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+
+/* cencenc does not store the key when key-directory is empty, so it is
+   given to cencdec with add-key */
+#define TEST_PIPELINE "cencenc key-directory=\"\" kid=" TEST_KID \
+  " key=" TEST_KEY " ! cencdec name=dec key-directory=/nonexistent digest="
+
+/* pushes a sample through the encryptor and decryptor and returns the
+   digest meta of the output, which must match the input */
+static GstBuffer *
+decrypt_sample (const gchar * digest, GstBuffer * in)
+{
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  gboolean added = FALSE;
+  GstElement *dec;
+  GstBuffer *out;
+  GstHarness *h;
+  GstMapInfo map;
+  gchar *launch;
+
+  launch = g_strconcat (TEST_PIPELINE, digest, NULL);
+  h = gst_harness_new_parse (launch);
+  g_free (launch);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)4");
+  dec = gst_bin_get_by_name (GST_BIN (h->element), "dec");
+  g_signal_emit_by_name (dec, "add-key", kid, key, &added);
+  fail_unless (added);
+
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (in, &map);
+
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  return out;
+}
+
+GST_START_TEST (test_crc32c)
+{
+  const guint8 check[] = "123456789";
+  GstBuffer *in, *out;
+  GstCencDigestMeta *meta;
+  GstMapInfo map;
+  guint32 crc;
+
+  /* the check value of the Castagnoli CRC, also computed in pieces */
+  fail_unless_equals_int (gst_cenc_crc32c (0, check, 9), 0xe3069283);
+  fail_unless_equals_int (gst_cenc_crc32c (gst_cenc_crc32c (0, check, 5),
+          check + 5, 4), 0xe3069283);
+
+  in = test_create_sample (1234);
+  out = decrypt_sample ("crc32c", in);
+  meta = gst_buffer_get_cenc_digest_meta (out);
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->type, GST_CENC_DIGEST_CRC32C);
+  fail_unless_equals_int (meta->length, 4);
+  gst_buffer_map (in, &map, GST_MAP_READ);
+  crc = gst_cenc_crc32c (0, map.data, map.size);
+  gst_buffer_unmap (in, &map);
+  fail_unless_equals_int (GST_READ_UINT32_BE (meta->digest), crc);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_sha256)
+{
+  GstBuffer *in, *out;
+  GstCencDigestMeta *meta;
+  GstMapInfo map;
+  gchar *expected, *digest;
+
+  in = test_create_sample (5000);
+  out = decrypt_sample ("sha256", in);
+  meta = gst_buffer_get_cenc_digest_meta (out);
+  fail_unless (meta != NULL);
+  fail_unless_equals_int (meta->type, GST_CENC_DIGEST_SHA256);
+  fail_unless_equals_int (meta->length, 32);
+  gst_buffer_map (in, &map, GST_MAP_READ);
+  expected = g_compute_checksum_for_data (G_CHECKSUM_SHA256, map.data,
+      map.size);
+  gst_buffer_unmap (in, &map);
+  digest = gst_cenc_digest_meta_to_string (meta);
+  fail_unless_equals_string (digest, expected);
+
+  g_free (digest);
+  g_free (expected);
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_no_digest)
+{
+  GstBuffer *in, *out;
+
+  in = test_create_sample (100);
+  out = decrypt_sample ("none", in);
+  fail_unless (gst_buffer_get_cenc_digest_meta (out) == NULL);
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_digest_suite (void)
+{
+  Suite *s = suite_create ("cencdec-digest");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_crc32c);
+  tcase_add_test (tc_chain, test_sha256);
+  tcase_add_test (tc_chain, test_no_digest);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_digest_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,224 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstprotection.h>
+#include <gst/gstcenckeyprovider.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+
+/* cencenc does not store the key when key-directory is empty, so cencdec
+   can only get it from memory */
+#define TEST_PIPELINE "cencenc key-directory=\"\" kid=" TEST_KID \
+  " key=" TEST_KEY " iv-size=16 ! cencdec name=dec key-directory=/nonexistent"
+
+static GstHarness *
+setup_harness (GstElement ** dec)
+{
+  GstHarness *h;
+
+  h = gst_harness_new_parse (TEST_PIPELINE);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)4");
+  *dec = gst_bin_get_by_name (GST_BIN (h->element), "dec");
+  fail_unless (*dec != NULL);
+  return h;
+}
+
+/* pushes a sample through the encryptor and decryptor and checks that it
+   comes out unchanged */
+static void
+check_roundtrip (GstHarness * h)
+{
+  GstBuffer *in, *out;
+  GstMapInfo map;
+  guint i;
+
+  in = gst_buffer_new_allocate (NULL, 333, NULL);
+  gst_buffer_map (in, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; ++i)
+    map.data[i] = g_random_int_range (0, 256);
+  gst_buffer_unmap (in, &map);
+
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (in, &map);
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+}
+
+GST_START_TEST (test_add_key)
+{
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  GstElement *dec;
+  gboolean added = FALSE;
+  GstHarness *h;
+
+  h = setup_harness (&dec);
+  g_signal_emit_by_name (dec, "add-key", kid, key, &added);
+  fail_unless (added);
+  check_roundtrip (h);
+
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_add_keys)
+{
+  GstStructure *keys;
+  GstElement *dec;
+  guint added = 0;
+  GstHarness *h;
+
+  h = setup_harness (&dec);
+  keys = gst_structure_new ("keys",
+      "00000000-0000-0000-0000-000000000001", G_TYPE_STRING, TEST_KEY,
+      TEST_KID, G_TYPE_STRING, TEST_KEY, "invalid", G_TYPE_STRING, "00",
+      NULL);
+  g_signal_emit_by_name (dec, "add-keys", keys, &added);
+  fail_unless_equals_int (added, 2);
+  check_roundtrip (h);
+
+  gst_structure_free (keys);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_context)
+{
+  GstCencMemoryKeyProvider *provider;
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  GstContext *context;
+  GstElement *dec;
+  GstHarness *h;
+
+  provider = gst_cenc_memory_key_provider_new ();
+  fail_unless (gst_cenc_memory_key_provider_add_key (provider, kid, key));
+  context = gst_cenc_key_provider_context_new (GST_CENC_KEY_PROVIDER
+      (provider));
+
+  h = setup_harness (&dec);
+  gst_element_set_context (h->element, context);
+  check_roundtrip (h);
+
+  gst_context_unref (context);
+  g_object_unref (provider);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static gpointer
+add_key_later (gpointer user_data)
+{
+  GstElement *dec = user_data;
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  gboolean added = FALSE;
+
+  g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+  g_signal_emit_by_name (dec, "add-key", kid, key, &added);
+  fail_unless (added);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  gst_object_unref (dec);
+  return NULL;
+}
+
+static void
+need_key_cb (GstElement * dec, GBytes * kid, GThread ** thread)
+{
+  GBytes *expected = test_hex_to_bytes (TEST_KID);
+
+  fail_unless (g_bytes_equal (kid, expected));
+  g_bytes_unref (expected);
+  /* answer from another thread, after need-key has returned */
+  *thread = g_thread_new ("add-key", add_key_later, gst_object_ref (dec));
+}
+
+GST_START_TEST (test_need_key_async)
+{
+  GThread *thread = NULL;
+  GstElement *dec;
+  GstHarness *h;
+
+  h = setup_harness (&dec);
+  g_object_set (dec, "key-timeout", 10000, NULL);
+  g_signal_connect (dec, "need-key", G_CALLBACK (need_key_cb), &thread);
+  check_roundtrip (h);
+  fail_unless (thread != NULL);
+  g_thread_join (thread);
+
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_keys_suite (void)
+{
+  Suite *s = suite_create ("cencdec-keys");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_add_key);
+  tcase_add_test (tc_chain, test_add_keys);
+  tcase_add_test (tc_chain, test_context);
+  tcase_add_test (tc_chain, test_need_key_async);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_keys_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
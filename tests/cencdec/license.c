@@ -0,0 +1,389 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gio/gio.h>
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstprotection.h>
+#include <gst/gstcenclicense.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+
+/* a loopback ClearKey license server, which knows the key of every KID:
+   the key is the KID with each byte inverted, except for TEST_KID */
+static GSocketService *service;
+static guint16 port;
+static gint n_requests;
+static gint n_kids;             /* in the most recent request */
+static gint n_failures;         /* requests still to answer with an error */
+
+static gchar *
+base64url_encode (const guint8 * data, gsize size)
+{
+  gchar *string = g_base64_encode (data, size);
+
+  g_strdelimit (string, "+", '-');
+  g_strdelimit (string, "/", '_');
+  if (strchr (string, '='))
+    *strchr (string, '=') = '\0';
+  return string;
+}
+
+static guint8 *
+base64url_decode (const gchar * string, gsize * size)
+{
+  GString *padded = g_string_new (string);
+  guint8 *data;
+
+  g_strdelimit (padded->str, "-", '+');
+  g_strdelimit (padded->str, "_", '/');
+  while (padded->len % 4)
+    g_string_append_c (padded, '=');
+  data = g_base64_decode (padded->str, size);
+  g_string_free (padded, TRUE);
+  return data;
+}
+
+/* the response to a {"kids":[...],"type":"temporary"} request */
+static gchar *
+create_license (const gchar * request)
+{
+  GBytes *test_kid = test_hex_to_bytes (TEST_KID);
+  GBytes *test_key = test_hex_to_bytes (TEST_KEY);
+  GString *response = g_string_new ("{\"keys\":[");
+  const gchar *start, *end;
+  gchar **kids;
+  guint i;
+
+  start = strchr (request, '[');
+  end = strchr (request, ']');
+  fail_unless (start != NULL && end != NULL);
+  start = g_strndup (start + 1, end - start - 1);
+  kids = g_strsplit (start, ",", -1);
+  g_free ((gchar *) start);
+  g_atomic_int_set (&n_kids, g_strv_length (kids));
+  for (i = 0; kids[i]; ++i) {
+    gchar *kid_string = g_strndup (kids[i] + 1, strlen (kids[i]) - 2);
+    guint8 *kid, key[16];
+    gchar *key_string;
+    gsize size, j;
+
+    kid = base64url_decode (kid_string, &size);
+    fail_unless_equals_int (size, 16);
+    if (memcmp (kid, g_bytes_get_data (test_kid, NULL), size) == 0) {
+      memcpy (key, g_bytes_get_data (test_key, NULL), sizeof (key));
+    } else {
+      for (j = 0; j < sizeof (key); ++j)
+        key[j] = ~kid[j];
+    }
+    key_string = base64url_encode (key, sizeof (key));
+    g_string_append_printf (response,
+        "%s{\"kty\":\"oct\",\"kid\":\"%s\",\"k\":\"%s\"}", i ? "," : "",
+        kid_string, key_string);
+    g_free (key_string);
+    g_free (kid_string);
+    g_free (kid);
+  }
+  g_string_append (response, "],\"type\":\"temporary\"}");
+  g_strfreev (kids);
+  g_bytes_unref (test_kid);
+  g_bytes_unref (test_key);
+  return g_string_free (response, FALSE);
+}
+
+static gboolean
+handle_request (GThreadedSocketService * service,
+    GSocketConnection * connection, GObject * source, gpointer user_data)
+{
+  GDataInputStream *input;
+  GOutputStream *output;
+  gsize content_length = 0;
+  gchar *line, *body, *response, *reply;
+
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM
+          (connection)));
+  g_data_input_stream_set_newline_type (input,
+      G_DATA_STREAM_NEWLINE_TYPE_CR_LF);
+  while ((line = g_data_input_stream_read_line (input, NULL, NULL, NULL))
+      && *line) {
+    if (g_ascii_strncasecmp (line, "Content-Length:", 15) == 0)
+      content_length = g_ascii_strtoull (line + 15, NULL, 10);
+    g_free (line);
+  }
+  g_free (line);
+  body = g_malloc0 (content_length + 1);
+  fail_unless (g_input_stream_read_all (G_INPUT_STREAM (input), body,
+          content_length, NULL, NULL, NULL));
+  g_atomic_int_inc (&n_requests);
+
+  if (g_atomic_int_get (&n_failures) > 0) {
+    g_atomic_int_add (&n_failures, -1);
+    reply = g_strdup ("HTTP/1.0 503 Service Unavailable\r\n\r\n");
+  } else {
+    response = create_license (body);
+    reply = g_strdup_printf ("HTTP/1.0 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %" G_GSIZE_FORMAT "\r\n\r\n%s",
+        strlen (response), response);
+    g_free (response);
+  }
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  g_output_stream_write_all (output, reply, strlen (reply), NULL, NULL, NULL);
+  g_free (reply);
+  g_free (body);
+  g_object_unref (input);
+  return TRUE;
+}
+
+static void
+setup_server (void)
+{
+  GInetAddress *loopback;
+  GSocketAddress *address, *effective = NULL;
+
+  service = g_threaded_socket_service_new (4);
+  loopback = g_inet_address_new_loopback (G_SOCKET_FAMILY_IPV4);
+  address = g_inet_socket_address_new (loopback, 0);
+  fail_unless (g_socket_listener_add_address (G_SOCKET_LISTENER (service),
+          address, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, NULL,
+          &effective, NULL));
+  port = g_inet_socket_address_get_port (G_INET_SOCKET_ADDRESS (effective));
+  g_signal_connect (service, "run", G_CALLBACK (handle_request), NULL);
+  g_socket_service_start (service);
+  g_object_unref (effective);
+  g_object_unref (address);
+  g_object_unref (loopback);
+  n_requests = 0;
+  n_failures = 0;
+}
+
+static void
+teardown_server (void)
+{
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+  g_object_unref (service);
+  service = NULL;
+}
+
+/* Clients are shared per URL for the life of the process, so each test
+   uses its own path */
+static GstCencLicenseClient *
+get_client (const gchar * path)
+{
+  GstCencLicenseClient *client;
+  gchar *url;
+
+  url = g_strdup_printf ("http://127.0.0.1:%u/%s", port, path);
+  client = gst_cenc_license_client_get (url);
+  g_free (url);
+  return client;
+}
+
+static GBytes *
+make_kid (guint8 value)
+{
+  guint8 kid[16];
+
+  memset (kid, value, sizeof (kid));
+  return g_bytes_new (kid, sizeof (kid));
+}
+
+static void
+check_key (GstCencLicenseClient * client, GBytes * kid)
+{
+  const guint8 *kid_data = g_bytes_get_data (kid, NULL);
+  const guint8 *key_data;
+  GBytes *key;
+  guint i;
+
+  key = gst_cenc_key_provider_get_key (GST_CENC_KEY_PROVIDER (client),
+      kid_data);
+  fail_unless (key != NULL);
+  fail_unless_equals_int (g_bytes_get_size (key), 16);
+  key_data = g_bytes_get_data (key, NULL);
+  for (i = 0; i < 16; ++i)
+    fail_unless_equals_int (key_data[i], (guint8) ~ kid_data[i]);
+  g_bytes_unref (key);
+}
+
+GST_START_TEST (test_batch)
+{
+  GstCencLicenseClient *client = get_client ("batch");
+  GBytes *kids[3];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (kids); ++i)
+    kids[i] = make_kid (i + 1);
+  gst_cenc_license_client_request (client, kids, G_N_ELEMENTS (kids));
+  for (i = 0; i < G_N_ELEMENTS (kids); ++i)
+    check_key (client, kids[i]);
+  fail_unless_equals_int (g_atomic_int_get (&n_requests), 1);
+  fail_unless_equals_int (g_atomic_int_get (&n_kids), 3);
+
+  /* already known keys are not requested again */
+  gst_cenc_license_client_request (client, kids, G_N_ELEMENTS (kids));
+  check_key (client, kids[0]);
+  fail_unless_equals_int (g_atomic_int_get (&n_requests), 1);
+
+  for (i = 0; i < G_N_ELEMENTS (kids); ++i)
+    g_bytes_unref (kids[i]);
+  g_object_unref (client);
+}
+
+GST_END_TEST;
+
+static gpointer
+get_key_thread (gpointer data)
+{
+  GstCencLicenseClient *client = get_client ("coalesce");
+  GBytes *kid = make_kid (0x42);
+
+  check_key (client, kid);
+  g_bytes_unref (kid);
+  g_object_unref (client);
+  return NULL;
+}
+
+GST_START_TEST (test_coalesce)
+{
+  GThread *threads[8];
+  guint i;
+
+  /* delay the response so that all the threads wait for the same one */
+  g_atomic_int_set (&n_failures, 1);
+  for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+    threads[i] = g_thread_new ("get-key", get_key_thread, NULL);
+  for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+    g_thread_join (threads[i]);
+  /* one failure and one retry */
+  fail_unless_equals_int (g_atomic_int_get (&n_requests), 2);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_retry)
+{
+  GstCencLicenseClient *client = get_client ("retry");
+  GBytes *kid = make_kid (0x99);
+
+  g_atomic_int_set (&n_failures, GST_CENC_LICENSE_MAX_RETRIES);
+  check_key (client, kid);
+  fail_unless_equals_int (g_atomic_int_get (&n_requests),
+      GST_CENC_LICENSE_MAX_RETRIES + 1);
+
+  g_bytes_unref (kid);
+  g_object_unref (client);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_give_up)
+{
+  GstCencLicenseClient *client = get_client ("give-up");
+  GBytes *kid = make_kid (0x77);
+
+  g_atomic_int_set (&n_failures, GST_CENC_LICENSE_MAX_RETRIES + 1);
+  fail_unless (gst_cenc_key_provider_get_key (GST_CENC_KEY_PROVIDER (client),
+          g_bytes_get_data (kid, NULL)) == NULL);
+  /* a later lookup asks again */
+  check_key (client, kid);
+  fail_unless_equals_int (g_atomic_int_get (&n_requests),
+      GST_CENC_LICENSE_MAX_RETRIES + 2);
+
+  g_bytes_unref (kid);
+  g_object_unref (client);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_element)
+{
+  GstBuffer *in, *out;
+  GstHarness *h;
+  GstMapInfo map;
+  gchar *launch;
+  guint i;
+
+  /* cencenc does not store the key when key-directory is empty */
+  launch = g_strdup_printf ("cencenc key-directory=\"\" kid=" TEST_KID
+      " key=" TEST_KEY " ! cencdec key-directory=/nonexistent "
+      "license-url=http://127.0.0.1:%u/element", port);
+  h = gst_harness_new_parse (launch);
+  g_free (launch);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)4");
+
+  in = gst_buffer_new_allocate (NULL, 417, NULL);
+  gst_buffer_map (in, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; ++i)
+    map.data[i] = g_random_int_range (0, 256);
+  gst_buffer_unmap (in, &map);
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (in, &map);
+  fail_unless_equals_int (g_atomic_int_get (&n_requests), 1);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_license_suite (void)
+{
+  Suite *s = suite_create ("cencdec-license");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup_server, teardown_server);
+  tcase_add_test (tc_chain, test_batch);
+  tcase_add_test (tc_chain, test_coalesce);
+  tcase_add_test (tc_chain, test_retry);
+  tcase_add_test (tc_chain, test_give_up);
+  tcase_add_test (tc_chain, test_element);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_license_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
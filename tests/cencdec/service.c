@@ -0,0 +1,327 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+/* for memfd_create and file sealing */
+#define _GNU_SOURCE
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gst.h>
+#include <gst/gstcencservice.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+/* a key that is not in the key directory of the service */
+#define MISSING_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc2bbc"
+#define MISSING_KEY "abcdef0123456789abcdef0123456789"
+
+/* the hello message that a client sends when it connects, as defined in
+   gstcencservice.c */
+typedef struct
+{
+  guint32 magic;
+  guint32 version;
+  guint32 n_slots;
+  guint32 slot_size;
+} ServiceHello;
+
+#define SERVICE_MAGIC 0x43454e43
+#define SERVICE_VERSION 1
+
+#define AVC_CAPS \
+  "video/x-h264, stream-format=(string)avc, alignment=(string)au"
+
+static gchar *key_dir;
+static gchar *socket_path;
+static GstCencService *service;
+
+static void
+setup_service (void)
+{
+  GError *err = NULL;
+
+  key_dir = test_key_dir_create ("cencdec-service-test-XXXXXX");
+  socket_path = g_build_filename (key_dir, "decryptd.sock", NULL);
+  service = gst_cenc_service_new (socket_path, key_dir, &err);
+  fail_unless (service != NULL, "%s", err ? err->message : "");
+}
+
+static void
+teardown_service (void)
+{
+  gst_cenc_service_free (service);
+  service = NULL;
+  test_key_dir_remove (key_dir);
+  g_free (socket_path);
+  key_dir = NULL;
+  socket_path = NULL;
+}
+
+static void
+append_nal (GstByteWriter * writer, guint8 header, guint size)
+{
+  guint i;
+
+  gst_byte_writer_put_uint32_be (writer, size);
+  gst_byte_writer_put_uint8 (writer, header);
+  for (i = 1; i < size; ++i) {
+    gst_byte_writer_put_uint8 (writer, g_random_int_range (0, 256));
+  }
+}
+
+/* An access unit of an SPS and two slices, so that cencenc gives it more
+   than one subsample */
+static GstBuffer *
+create_avc_sample (guint slice_size)
+{
+  GstByteWriter writer;
+
+  gst_byte_writer_init (&writer);
+  append_nal (&writer, 0x67, 20);
+  append_nal (&writer, 0x65, slice_size);
+  append_nal (&writer, 0x41, 37);
+  return gst_byte_writer_reset_and_get_buffer (&writer);
+}
+
+/* Encrypts the samples with the given cencenc launch line and returns a
+   cencdec that uses the service, with the caps of the encrypted stream */
+static GstHarness *
+setup_decryptor (const gchar * encryptor, GstBuffer ** clear,
+    GstBuffer ** encrypted, guint n_samples)
+{
+  GstHarness *enc, *h;
+  GstCaps *caps;
+  gchar *line;
+  guint i;
+
+  enc = gst_harness_new_parse (encryptor);
+  fail_unless (enc != NULL);
+  gst_harness_set_src_caps_str (enc, AVC_CAPS);
+  for (i = 0; i < n_samples; ++i) {
+    encrypted[i] = gst_harness_push_and_pull (enc,
+        gst_buffer_copy_deep (clear[i]));
+    fail_unless (encrypted[i] != NULL);
+    fail_unless (gst_buffer_get_protection_meta (encrypted[i]) != NULL);
+  }
+  caps = gst_pad_get_current_caps (enc->sinkpad);
+  fail_unless (caps != NULL);
+  gst_harness_teardown (enc);
+
+  /* the service has the only copy of the key */
+  line = g_strdup_printf ("cencdec key-directory=/nonexistent "
+      "decrypt-service=%s", socket_path);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps (h, caps);
+  return h;
+}
+
+static void
+check_sample (GstBuffer * out, GstBuffer * clear)
+{
+  GstMapInfo map;
+
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  fail_unless (gst_buffer_map (clear, &map, GST_MAP_READ));
+  fail_unless_equals_int (gst_buffer_get_size (out), map.size);
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (clear, &map);
+  gst_buffer_unref (out);
+}
+
+GST_START_TEST (test_decrypt)
+{
+  GstBuffer *clear[3], *encrypted[3];
+  GstHarness *h;
+  gchar *line;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i)
+    clear[i] = create_avc_sample (100 + 1000 * i);
+  line = g_strdup_printf ("cencenc key-directory=%s kid=" TEST_KID, key_dir);
+  h = setup_decryptor (line, clear, encrypted, G_N_ELEMENTS (clear));
+  g_free (line);
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i) {
+    check_sample (gst_harness_push_and_pull (h, encrypted[i]), clear[i]);
+    gst_buffer_unref (clear[i]);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_list)
+{
+  /* more samples than fit in one batch */
+  GstBuffer *clear[40], *encrypted[40];
+  GstBufferList *list;
+  GstHarness *h;
+  gchar *line;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i)
+    clear[i] = create_avc_sample (g_random_int_range (10, 5000));
+  line = g_strdup_printf ("cencenc key-directory=%s kid=" TEST_KID, key_dir);
+  h = setup_decryptor (line, clear, encrypted, G_N_ELEMENTS (clear));
+  g_free (line);
+  /* the first buffer sets up the caps of the source pad */
+  check_sample (gst_harness_push_and_pull (h, encrypted[0]), clear[0]);
+  list = gst_buffer_list_new ();
+  for (i = 1; i < G_N_ELEMENTS (clear); ++i)
+    gst_buffer_list_add (list, encrypted[i]);
+  fail_unless_equals_int (gst_pad_push_list (h->srcpad, list), GST_FLOW_OK);
+  for (i = 0; i < G_N_ELEMENTS (clear); ++i) {
+    if (i > 0)
+      check_sample (gst_harness_pull (h), clear[i]);
+    gst_buffer_unref (clear[i]);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_missing_key)
+{
+  GstBuffer *clear, *encrypted;
+  GstHarness *h;
+
+  /* cencenc does not store the key when key-directory is empty */
+  clear = create_avc_sample (500);
+  h = setup_decryptor ("cencenc key-directory=\"\" kid=" MISSING_KID
+      " key=" MISSING_KEY, &clear, &encrypted, 1);
+  fail_if (gst_harness_push (h, encrypted) == GST_FLOW_OK);
+  gst_buffer_unref (clear);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+/* Connects to the service without the client library, offering one 64 KiB
+   slot in a memfd that is optionally sealed against shrinking, and returns
+   the reply of the service, which is 0 when it accepts the connection */
+static guint32
+connect_with_memory (gboolean sealed)
+{
+  ServiceHello hello = { SERVICE_MAGIC, SERVICE_VERSION, 1, 64 * 1024 };
+  union
+  {
+    struct cmsghdr header;
+    guint8 buf[CMSG_SPACE (3 * sizeof (gint))];
+  } control;
+  struct sockaddr_un address;
+  struct iovec iov = { &hello, sizeof (hello) };
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+  guint32 reply = G_MAXUINT32;
+  gint fds[3], sock;
+
+  sock = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  fail_unless (sock >= 0);
+  memset (&address, 0, sizeof (address));
+  address.sun_family = AF_UNIX;
+  g_strlcpy (address.sun_path, socket_path, sizeof (address.sun_path));
+  fail_unless (connect (sock, (struct sockaddr *) &address,
+          sizeof (address)) == 0);
+
+  /* much larger than the region of one slot */
+  fds[0] = memfd_create ("service-test", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  fail_unless (fds[0] >= 0);
+  fail_unless (ftruncate (fds[0], 1024 * 1024) == 0);
+  if (sealed)
+    fail_unless (fcntl (fds[0], F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL) ==
+        0);
+  fds[1] = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  fds[2] = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  fail_unless (fds[1] >= 0 && fds[2] >= 0);
+
+  memset (&msg, 0, sizeof (msg));
+  memset (&control, 0, sizeof (control));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof (control.buf);
+  cmsg = CMSG_FIRSTHDR (&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN (sizeof (fds));
+  memcpy (CMSG_DATA (cmsg), fds, sizeof (fds));
+  fail_unless (sendmsg (sock, &msg, MSG_NOSIGNAL) == sizeof (hello));
+  fail_unless (recv (sock, &reply, sizeof (reply), MSG_WAITALL) ==
+      sizeof (reply));
+
+  close (fds[0]);
+  close (fds[1]);
+  close (fds[2]);
+  close (sock);
+  return reply;
+}
+
+GST_START_TEST (test_unsealed_memory)
+{
+  /* a client that could shrink the memory after connecting would crash
+     the service with SIGBUS */
+  fail_if (connect_with_memory (FALSE) == 0);
+  /* the same hello with sealed memory is accepted */
+  fail_unless_equals_int (connect_with_memory (TRUE), 0);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_service_suite (void)
+{
+  Suite *s = suite_create ("cencdec-service");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup_service, teardown_service);
+  tcase_add_test (tc_chain, test_decrypt);
+  tcase_add_test (tc_chain, test_decrypt_list);
+  tcase_add_test (tc_chain, test_missing_key);
+  tcase_add_test (tc_chain, test_unsealed_memory);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_service_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
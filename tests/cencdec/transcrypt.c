@@ -0,0 +1,177 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstprotection.h>
+#include <gst/gstaesctr.h>
+
+#include "testutil.h"
+
+#define OLD_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define OLD_KEY "abcdef0123456789abcdef0123456789"
+#define NEW_KID "11223344556677881122334455667788"
+#define NEW_KEY "00112233445566778899aabbccddeeff"
+
+/* cencenc does not store the key when key-directory is empty, so the keys
+   are given to cencdec with add-key */
+#define TRANSCRYPT_PIPELINE "cencenc key-directory=\"\" kid=" OLD_KID \
+  " key=" OLD_KEY " ! cencdec name=trans key-directory=/nonexistent" \
+  " transcrypt-kid=" NEW_KID " transcrypt-key=" NEW_KEY
+
+static void
+add_key (GstHarness * h, const gchar * name, const gchar * kid_string,
+    const gchar * key_string)
+{
+  GBytes *kid = test_hex_to_bytes (kid_string);
+  GBytes *key = test_hex_to_bytes (key_string);
+  gboolean added = FALSE;
+  GstElement *dec;
+
+  dec = gst_bin_get_by_name (GST_BIN (h->element), name);
+  fail_unless (dec != NULL);
+  g_signal_emit_by_name (dec, "add-key", kid, key, &added);
+  fail_unless (added);
+  gst_object_unref (dec);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+}
+
+GST_START_TEST (test_protection_meta)
+{
+  GBytes *new_kid = test_hex_to_bytes (NEW_KID);
+  GBytes *new_key = test_hex_to_bytes (NEW_KEY);
+  guint8 last_iv[8];
+  GstHarness *h;
+  guint n;
+
+  h = gst_harness_new_parse (TRANSCRYPT_PIPELINE);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)4");
+  add_key (h, "trans", OLD_KID, OLD_KEY);
+
+  for (n = 0; n < 3; ++n) {
+    GstBuffer *in, *out, *kid_buf, *iv_buf;
+    GstProtectionMeta *meta;
+    AesCtrState *state;
+    GBytes *iv;
+    guint iv_size = 0;
+    GstMapInfo map;
+    guint8 iv_data[8];
+
+    in = test_create_sample (1000 + n);
+    out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+    fail_unless (out != NULL);
+    meta = gst_buffer_get_protection_meta (out);
+    fail_unless (meta != NULL);
+    fail_unless (gst_structure_get_uint (meta->info, "iv_size", &iv_size));
+    fail_unless_equals_int (iv_size, 8);
+    kid_buf = gst_value_get_buffer (gst_structure_get_value (meta->info,
+            "kid"));
+    fail_unless (gst_buffer_memcmp (kid_buf, 0, g_bytes_get_data (new_kid,
+                NULL), 16) == 0);
+    iv_buf = gst_value_get_buffer (gst_structure_get_value (meta->info,
+            "iv"));
+    fail_unless_equals_int (gst_buffer_extract (iv_buf, 0, iv_data, 8), 8);
+    if (n > 0)
+      fail_unless (memcmp (iv_data, last_iv, sizeof (iv_data)) != 0);
+    memcpy (last_iv, iv_data, sizeof (iv_data));
+
+    /* the output is the input encrypted with the new key */
+    iv = g_bytes_new (iv_data, sizeof (iv_data));
+    state = gst_aes_ctr_decrypt_new (new_key, iv);
+    fail_unless (gst_buffer_map (out, &map, GST_MAP_READWRITE));
+    gst_aes_ctr_decrypt_ip (state, map.data, map.size);
+    gst_buffer_unmap (out, &map);
+    fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+    fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+    gst_buffer_unmap (in, &map);
+
+    gst_aes_ctr_decrypt_unref (state);
+    g_bytes_unref (iv);
+    gst_buffer_unref (out);
+    gst_buffer_unref (in);
+  }
+
+  g_bytes_unref (new_kid);
+  g_bytes_unref (new_key);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_transcrypted)
+{
+  GstBuffer *in, *out;
+  GstHarness *h;
+  GstMapInfo map;
+
+  h = gst_harness_new_parse (TRANSCRYPT_PIPELINE
+      " ! cencdec name=dec key-directory=/nonexistent");
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)4");
+  add_key (h, "trans", OLD_KID, OLD_KEY);
+  add_key (h, "dec", NEW_KID, NEW_KEY);
+
+  in = test_create_sample (4321);
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (in, &map);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_transcrypt_suite (void)
+{
+  Suite *s = suite_create ("cencdec-transcrypt");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_protection_meta);
+  tcase_add_test (tc_chain, test_decrypt_transcrypted);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_transcrypt_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,210 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+#define WRONG_KEY "abcdef0123456789abcdef0123456788"
+
+/* cencenc does not store the key when key-directory is empty, so it is
+   given to cencdec with add-key */
+#define TEST_PIPELINE "cencenc key-directory=\"\" kid=" TEST_KID \
+  " key=" TEST_KEY " ! cencdec name=dec key-directory=/nonexistent" \
+  " validate=true"
+
+static GstHarness *
+setup_harness (const gchar * caps, const gchar * key_string,
+    GstElement ** dec)
+{
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  GBytes *key = test_hex_to_bytes (key_string);
+  gboolean added = FALSE;
+  GstHarness *h;
+
+  h = gst_harness_new_parse (TEST_PIPELINE);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, caps);
+  *dec = gst_bin_get_by_name (GST_BIN (h->element), "dec");
+  fail_unless (*dec != NULL);
+  g_signal_emit_by_name (*dec, "add-key", kid, key, &added);
+  fail_unless (added);
+  g_bytes_unref (kid);
+  g_bytes_unref (key);
+  return h;
+}
+
+/* an ADTS frame with a random payload */
+static GstBuffer *
+create_adts_frame (gsize size)
+{
+  GstBuffer *buf = gst_buffer_new_allocate (NULL, size, NULL);
+  GstMapInfo map;
+  guint i;
+
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; ++i)
+    map.data[i] = g_random_int_range (0, 256);
+  map.data[0] = 0xff;
+  map.data[1] = 0xf1;
+  map.data[3] = (map.data[3] & 0xfc) | ((size >> 11) & 0x03);
+  map.data[4] = (size >> 3) & 0xff;
+  map.data[5] = ((size & 0x07) << 5) | (map.data[5] & 0x1f);
+  gst_buffer_unmap (buf, &map);
+  return buf;
+}
+
+/* an AVC access unit of NAL units with 4 byte length prefixes */
+static GstBuffer *
+create_avc_sample (void)
+{
+  const guint8 types[] = { 0x09, 0x06, 0x65, 0x65 };
+  GstBuffer *buf = gst_buffer_new_allocate (NULL, 4 * 104, NULL);
+  GstMapInfo map;
+  guint i, j;
+
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < G_N_ELEMENTS (types); ++i) {
+    guint8 *nal = map.data + 104 * i;
+
+    GST_WRITE_UINT32_BE (nal, 100);
+    nal[4] = types[i];
+    for (j = 5; j < 103; ++j)
+      nal[j] = g_random_int_range (0, 256);
+    nal[103] = 0x80;            /* rbsp_stop_one_bit */
+  }
+  gst_buffer_unmap (buf, &map);
+  return buf;
+}
+
+static guint64
+get_invalid_samples (GstElement * dec)
+{
+  GstStructure *stats;
+  guint64 invalid = 0;
+
+  g_object_get (dec, "stats", &stats, NULL);
+  fail_unless (gst_structure_get_uint64 (stats, "samples-invalid", &invalid));
+  gst_structure_free (stats);
+  return invalid;
+}
+
+GST_START_TEST (test_valid_samples)
+{
+  GstElement *dec;
+  GstHarness *h;
+  guint i;
+
+  h = setup_harness ("audio/mpeg, mpegversion=(int)4, "
+      "stream-format=(string)adts", TEST_KEY, &dec);
+  for (i = 0; i < 10; ++i) {
+    fail_unless_equals_int (gst_harness_push (h, create_adts_frame (200 +
+                i)), GST_FLOW_OK);
+    gst_buffer_unref (gst_harness_pull (h));
+  }
+  fail_unless_equals_int (get_invalid_samples (dec), 0);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+
+  h = setup_harness ("video/x-h264, stream-format=(string)avc, "
+      "alignment=(string)au", TEST_KEY, &dec);
+  for (i = 0; i < 10; ++i) {
+    fail_unless_equals_int (gst_harness_push (h, create_avc_sample ()),
+        GST_FLOW_OK);
+    gst_buffer_unref (gst_harness_pull (h));
+  }
+  fail_unless_equals_int (get_invalid_samples (dec), 0);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_wrong_key)
+{
+  GBytes *key = test_hex_to_bytes (TEST_KEY);
+  GBytes *kid = test_hex_to_bytes (TEST_KID);
+  gboolean added = FALSE;
+  GstSegment segment;
+  GstElement *dec;
+  GstHarness *h;
+
+  h = setup_harness ("audio/mpeg, mpegversion=(int)4, "
+      "stream-format=(string)adts", WRONG_KEY, &dec);
+  /* the sync word does not survive decryption with the wrong key */
+  fail_unless_equals_int (gst_harness_push (h, create_adts_frame (300)),
+      GST_FLOW_NOT_SUPPORTED);
+  fail_unless_equals_int (gst_harness_buffers_in_queue (h), 0);
+  fail_unless_equals_int (get_invalid_samples (dec), 1);
+
+  /* the key is looked for again after a failure, so that a corrected key
+     is used when the stream restarts */
+  g_signal_emit_by_name (dec, "add-key", kid, key, &added);
+  fail_unless (added);
+  fail_unless (gst_harness_push_event (h, gst_event_new_flush_start ()));
+  fail_unless (gst_harness_push_event (h, gst_event_new_flush_stop (TRUE)));
+  gst_segment_init (&segment, GST_FORMAT_TIME);
+  fail_unless (gst_harness_push_event (h, gst_event_new_segment (&segment)));
+  fail_unless_equals_int (gst_harness_push (h, create_adts_frame (300)),
+      GST_FLOW_OK);
+  gst_buffer_unref (gst_harness_pull (h));
+  fail_unless_equals_int (get_invalid_samples (dec), 1);
+
+  g_bytes_unref (key);
+  g_bytes_unref (kid);
+  gst_object_unref (dec);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencdec_validate_suite (void)
+{
+  Suite *s = suite_create ("cencdec-validate");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_valid_samples);
+  tcase_add_test (tc_chain, test_wrong_key);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencdec_validate_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,239 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gst.h>
+#include <gst/gstprotection.h>
+
+#include "testutil.h"
+
+#define TEST_KID "0bbc0bbc0bbc0bbc0bbc0bbc0bbc1bbc"
+
+static gchar *key_dir;
+
+static void
+setup_key_dir (void)
+{
+  key_dir = test_key_dir_create ("cencenc-test-XXXXXX");
+}
+
+static void
+teardown_key_dir (void)
+{
+  test_key_dir_remove (key_dir);
+  key_dir = NULL;
+}
+
+static void
+append_nal (GstByteWriter * writer, guint8 header, guint size)
+{
+  guint i;
+
+  gst_byte_writer_put_uint32_be (writer, size);
+  gst_byte_writer_put_uint8 (writer, header);
+  for (i = 1; i < size; ++i) {
+    gst_byte_writer_put_uint8 (writer, g_random_int_range (0, 256));
+  }
+}
+
+/* An access unit of an SPS, an IDR slice and a non-IDR slice, with 4 byte
+   NAL unit lengths */
+static GstBuffer *
+create_avc_sample (void)
+{
+  GstByteWriter writer;
+
+  gst_byte_writer_init (&writer);
+  append_nal (&writer, 0x67, 20);
+  append_nal (&writer, 0x65, 1000);
+  append_nal (&writer, 0x41, 37);
+  return gst_byte_writer_reset_and_get_buffer (&writer);
+}
+
+static GstBuffer *
+create_audio_sample (guint size)
+{
+  GstBuffer *buf = gst_buffer_new_allocate (NULL, size, NULL);
+  GstMapInfo map;
+  guint i;
+
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < size; ++i) {
+    map.data[i] = g_random_int_range (0, 256);
+  }
+  gst_buffer_unmap (buf, &map);
+  return buf;
+}
+
+/* compare size bytes of two buffers, starting at offset */
+static gint
+compare_buffers (GstBuffer * a, GstBuffer * b, gsize offset, gsize size)
+{
+  GstMapInfo map;
+  gint ret;
+
+  fail_unless (gst_buffer_map (b, &map, GST_MAP_READ));
+  ret = gst_buffer_memcmp (a, offset, map.data + offset, size);
+  gst_buffer_unmap (b, &map);
+  return ret;
+}
+
+static GstHarness *
+setup_harness (const gchar * launch, const gchar * caps)
+{
+  GstHarness *h;
+  gchar *line;
+
+  line = g_strdup_printf (launch, key_dir, key_dir);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, caps);
+  return h;
+}
+
+static void
+check_roundtrip (GstHarness * h, GstBuffer * in)
+{
+  GstBuffer *out;
+
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+  fail_unless_equals_int (gst_buffer_get_size (out), gst_buffer_get_size (in));
+  fail_unless (compare_buffers (out, in, 0, gst_buffer_get_size (in)) == 0);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  gst_buffer_unref (out);
+}
+
+GST_START_TEST (test_encrypt_avc_subsamples)
+{
+  const guint8 expected[] = { 0x00, 36, 0x00, 0x00, 0x03, 0xe0,
+    0x00, 9, 0x00, 0x00, 0x00, 32
+  };
+  GstProtectionMeta *meta;
+  GstBuffer *in, *out, *subsamples;
+  const GValue *value;
+  guint iv_size, count;
+  gboolean encrypted;
+  GstHarness *h;
+
+  h = setup_harness ("cencenc key-directory=%s kid=" TEST_KID,
+      "video/x-h264, stream-format=(string)avc, alignment=(string)au");
+  in = create_avc_sample ();
+  out = gst_harness_push_and_pull (h, gst_buffer_copy_deep (in));
+  fail_unless (out != NULL);
+
+  meta = (GstProtectionMeta *) gst_buffer_get_protection_meta (out);
+  fail_unless (meta != NULL);
+  fail_unless (gst_structure_get (meta->info,
+          "iv_size", G_TYPE_UINT, &iv_size,
+          "encrypted", G_TYPE_BOOLEAN, &encrypted,
+          "subsample_count", G_TYPE_UINT, &count, NULL));
+  fail_unless_equals_int (iv_size, 8);
+  fail_unless (encrypted);
+  fail_unless_equals_int (count, 2);
+  value = gst_structure_get_value (meta->info, "subsamples");
+  fail_unless (value != NULL);
+  subsamples = gst_value_get_buffer (value);
+  fail_unless_equals_int (gst_buffer_get_size (subsamples), sizeof (expected));
+  fail_unless (gst_buffer_memcmp (subsamples, 0, expected,
+          sizeof (expected)) == 0);
+
+  /* the SPS and NAL unit headers are clear, the slice data is not */
+  fail_unless (compare_buffers (out, in, 0, 36) == 0);
+  fail_if (compare_buffers (out, in, 36, 992) == 0);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roundtrip_avc)
+{
+  GstHarness *h;
+  GstBuffer *in;
+  guint i;
+
+  h = setup_harness ("cencenc key-directory=%s kid=" TEST_KID
+      " ! cencdec key-directory=%s",
+      "video/x-h264, stream-format=(string)avc, alignment=(string)au");
+  for (i = 0; i < 3; ++i) {
+    in = create_avc_sample ();
+    check_roundtrip (h, in);
+    gst_buffer_unref (in);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_roundtrip_audio)
+{
+  GstHarness *h;
+  GstBuffer *in;
+  guint i;
+
+  h = setup_harness ("cencenc key-directory=%s kid=" TEST_KID " iv-size=16"
+      " ! cencdec key-directory=%s", "audio/mpeg, mpegversion=(int)4");
+  for (i = 0; i < 3; ++i) {
+    in = create_audio_sample (371 + i);
+    check_roundtrip (h, in);
+    gst_buffer_unref (in);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencenc_suite (void)
+{
+  Suite *s = suite_create ("cencenc");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup_key_dir, teardown_key_dir);
+  tcase_add_test (tc_chain, test_encrypt_avc_subsamples);
+  tcase_add_test (tc_chain, test_roundtrip_avc);
+  tcase_add_test (tc_chain, test_roundtrip_audio);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencenc_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,505 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+#include <gst/gstcencmp4.h>
+
+#include "testutil.h"
+
+static const guint8 test_kid[GST_CENC_KID_LENGTH] = {
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc,
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x1b, 0xbc
+};
+
+static const guint8 test_key[GST_CENC_KEY_LENGTH] = {
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89,
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89
+};
+
+/* bytes of each sample before and after its encrypted part */
+#define CLEAR_BYTES 10
+
+static gchar *key_dir;
+
+static void
+setup_key_dir (void)
+{
+  GBytes *key;
+
+  key_dir = test_key_dir_create ("cencfragdec-test-XXXXXX");
+  key = g_bytes_new_static (test_key, sizeof (test_key));
+  fail_unless (gst_cenc_key_store_save (key_dir, test_kid, key, NULL));
+  g_bytes_unref (key);
+}
+
+static void
+teardown_key_dir (void)
+{
+  test_key_dir_remove (key_dir);
+  key_dir = NULL;
+}
+
+static guint
+start_box (GstByteWriter * writer, const gchar * type)
+{
+  guint pos = gst_byte_writer_get_pos (writer);
+
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_data (writer, (const guint8 *) type, 4);
+  return pos;
+}
+
+static guint
+start_full_box (GstByteWriter * writer, const gchar * type, guint32 flags)
+{
+  guint pos = start_box (writer, type);
+
+  gst_byte_writer_put_uint32_be (writer, flags);
+  return pos;
+}
+
+static void
+end_box (GstByteWriter * writer, guint pos)
+{
+  guint end = gst_byte_writer_get_pos (writer);
+
+  gst_byte_writer_set_pos (writer, pos);
+  gst_byte_writer_put_uint32_be (writer, end - pos);
+  gst_byte_writer_set_pos (writer, end);
+}
+
+/* Appends a moov box with one video track, encrypted unless protected is
+   FALSE */
+static void
+append_movie (GstByteWriter * writer, gboolean protected)
+{
+  guint moov, trak, mdia, minf, stbl, stsd, encv, sinf, schi, tenc, mvex, box;
+
+  moov = start_box (writer, "moov");
+  trak = start_box (writer, "trak");
+  box = start_full_box (writer, "tkhd", 3);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_uint32_be (writer, 1);    /* track ID */
+  gst_byte_writer_fill (writer, 0, 68);
+  end_box (writer, box);
+  mdia = start_box (writer, "mdia");
+  minf = start_box (writer, "minf");
+  stbl = start_box (writer, "stbl");
+  stsd = start_full_box (writer, "stsd", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);
+  encv = start_box (writer, protected ? "encv" : "avc1");
+  gst_byte_writer_fill (writer, 0, 6);
+  gst_byte_writer_put_uint16_be (writer, 1);    /* data reference index */
+  gst_byte_writer_fill (writer, 0, 70);
+  box = start_box (writer, "avcC");
+  gst_byte_writer_put_uint16_be (writer, 0x0102);
+  end_box (writer, box);
+  if (protected) {
+    sinf = start_box (writer, "sinf");
+    box = start_box (writer, "frma");
+    gst_byte_writer_put_data (writer, (const guint8 *) "avc1", 4);
+    end_box (writer, box);
+    box = start_full_box (writer, "schm", 0);
+    gst_byte_writer_put_data (writer, (const guint8 *) "cenc", 4);
+    gst_byte_writer_put_uint32_be (writer, 0x10000);
+    end_box (writer, box);
+    schi = start_box (writer, "schi");
+    tenc = start_full_box (writer, "tenc", 0);
+    gst_byte_writer_put_uint16_be (writer, 0);
+    gst_byte_writer_put_uint8 (writer, 1);      /* is protected */
+    gst_byte_writer_put_uint8 (writer, 8);      /* IV size */
+    gst_byte_writer_put_data (writer, test_kid, sizeof (test_kid));
+    end_box (writer, tenc);
+    end_box (writer, schi);
+    end_box (writer, sinf);
+  }
+  end_box (writer, encv);
+  end_box (writer, stsd);
+  end_box (writer, stbl);
+  end_box (writer, minf);
+  end_box (writer, mdia);
+  end_box (writer, trak);
+  mvex = start_box (writer, "mvex");
+  box = start_full_box (writer, "trex", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);    /* track ID */
+  gst_byte_writer_put_uint32_be (writer, 1);
+  gst_byte_writer_fill (writer, 0, 12);
+  end_box (writer, box);
+  end_box (writer, mvex);
+  end_box (writer, moov);
+}
+
+/* Appends a fragment of n_samples encrypted samples of the given sizes
+   and returns the offset of its mdat payload. The clear sample data is
+   stored in plain. With base_data_offset, the tfhd box gives the position
+   of the moof box instead of using default-base-is-moof. */
+static guint
+append_fragment (GstByteWriter * writer, guint n_samples,
+    const guint * sample_sizes, guint8 * plain, gboolean base_data_offset)
+{
+  guint8 *ivs = g_malloc (n_samples * 8);
+  guint moof, traf, box, data_offset, mdat, i;
+  gsize payload_size = 0, offset;
+  GBytes *key;
+
+  for (i = 0; i < n_samples; ++i)
+    payload_size += sample_sizes[i];
+  for (i = 0; i < n_samples * 8; ++i)
+    ivs[i] = g_random_int_range (0, 256);
+  for (offset = 0; offset < payload_size; ++offset)
+    plain[offset] = g_random_int_range (0, 256);
+
+  moof = start_box (writer, "moof");
+  box = start_full_box (writer, "mfhd", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);
+  end_box (writer, box);
+  traf = start_box (writer, "traf");
+  /* base-data-offset present, or default-base-is-moof */
+  box = start_full_box (writer, "tfhd", base_data_offset ? 0x1 : 0x020000);
+  gst_byte_writer_put_uint32_be (writer, 1);
+  if (base_data_offset)
+    gst_byte_writer_put_uint64_be (writer, moof);
+  end_box (writer, box);
+  /* data-offset and sample-size present */
+  box = start_full_box (writer, "trun", 0x201);
+  gst_byte_writer_put_uint32_be (writer, n_samples);
+  data_offset = gst_byte_writer_get_pos (writer);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  for (i = 0; i < n_samples; ++i)
+    gst_byte_writer_put_uint32_be (writer, sample_sizes[i]);
+  end_box (writer, box);
+  /* subsample information present */
+  box = start_full_box (writer, "senc", 2);
+  gst_byte_writer_put_uint32_be (writer, n_samples);
+  for (i = 0; i < n_samples; ++i) {
+    gst_byte_writer_put_data (writer, ivs + i * 8, 8);
+    gst_byte_writer_put_uint16_be (writer, 2);
+    gst_byte_writer_put_uint16_be (writer, CLEAR_BYTES);
+    gst_byte_writer_put_uint32_be (writer,
+        sample_sizes[i] - 2 * CLEAR_BYTES);
+    gst_byte_writer_put_uint16_be (writer, CLEAR_BYTES);
+    gst_byte_writer_put_uint32_be (writer, 0);
+  }
+  end_box (writer, box);
+  end_box (writer, traf);
+  end_box (writer, moof);
+
+  mdat = start_box (writer, "mdat");
+  gst_byte_writer_set_pos (writer, data_offset);
+  gst_byte_writer_put_uint32_be (writer, mdat + 8 - moof);
+  gst_byte_writer_set_pos (writer, mdat + 8);
+  gst_byte_writer_put_data (writer, plain, payload_size);
+  end_box (writer, mdat);
+
+  key = g_bytes_new_static (test_key, sizeof (test_key));
+  offset = mdat + 8;
+  for (i = 0; i < n_samples; ++i) {
+    guint8 *sample = (guint8 *) gst_byte_writer_get_data (writer) + offset;
+    GBytes *iv = g_bytes_new (ivs + i * 8, 8);
+    AesCtrState *state = gst_aes_ctr_decrypt_new (key, iv);
+
+    fail_unless (state != NULL);
+    /* CTR mode encryption is the same operation as decryption */
+    gst_aes_ctr_decrypt_ip (state, sample + CLEAR_BYTES,
+        sample_sizes[i] - 2 * CLEAR_BYTES);
+    gst_aes_ctr_decrypt_unref (state);
+    g_bytes_unref (iv);
+    offset += sample_sizes[i];
+  }
+  g_bytes_unref (key);
+  g_free (ivs);
+  return mdat + 8;
+}
+
+static gboolean
+has_fourcc (const guint8 * data, gsize size, const gchar * type)
+{
+  gsize i;
+
+  for (i = 0; i + 4 <= size; ++i) {
+    if (memcmp (data + i, type, 4) == 0)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Pushes an encrypted stream through cencfragdec in chunk byte buffers
+   and checks that the output is the clear stream. In low-latency mode, each
+   part of the mdat payload must be output as soon as it is pushed. */
+static void
+check_stream_sizes (guint n_samples, const guint * sample_sizes, gsize chunk,
+    guint n_threads, gboolean low_latency)
+{
+  GstByteWriter writer;
+  GstBuffer *in, *out, *buf;
+  guint8 *plain;
+  GstMapInfo map;
+  GstHarness *h;
+  gchar *line;
+  guint payload, i;
+  gsize offset, size, end, payload_size = 0;
+
+  for (i = 0; i < n_samples; ++i)
+    payload_size += sample_sizes[i];
+  plain = g_malloc (payload_size);
+  gst_byte_writer_init (&writer);
+  gst_byte_writer_put_uint32_be (&writer, 16);
+  gst_byte_writer_put_data (&writer, (const guint8 *) "ftypiso6mp41", 12);
+  append_movie (&writer, TRUE);
+  payload = append_fragment (&writer, n_samples, sample_sizes, plain, FALSE);
+  in = gst_byte_writer_reset_and_get_buffer (&writer);
+  size = gst_buffer_get_size (in);
+
+  line = g_strdup_printf ("cencfragdec key-directory=%s n-threads=%u "
+      "low-latency=%d", key_dir, n_threads, low_latency);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "video/quicktime");
+  out = gst_buffer_new ();
+  for (offset = 0; offset < size; offset += chunk) {
+    end = offset + MIN (chunk, size - offset);
+    buf = gst_buffer_copy_region (in, GST_BUFFER_COPY_ALL, offset,
+        end - offset);
+    fail_unless_equals_int (gst_harness_push (h, buf), GST_FLOW_OK);
+    while ((buf = gst_harness_try_pull (h)))
+      out = gst_buffer_append (out, buf);
+    if (low_latency && end > payload)
+      fail_unless_equals_uint64 (gst_buffer_get_size (out), end);
+  }
+
+  fail_unless_equals_int (gst_buffer_get_size (out), size);
+  fail_unless (gst_buffer_map (out, &map, GST_MAP_READ));
+  fail_unless (memcmp (map.data + payload, plain, payload_size) == 0);
+  fail_unless (has_fourcc (map.data, payload, "avc1"));
+  fail_if (has_fourcc (map.data, payload, "encv"));
+  fail_if (has_fourcc (map.data, payload, "sinf"));
+  fail_if (has_fourcc (map.data, payload, "senc"));
+  gst_buffer_unmap (out, &map);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  g_free (plain);
+  gst_harness_teardown (h);
+}
+
+static void
+check_stream (guint n_samples, guint sample_size, gsize chunk,
+    guint n_threads, gboolean low_latency)
+{
+  guint *sample_sizes = g_new (guint, n_samples);
+  guint i;
+
+  for (i = 0; i < n_samples; ++i)
+    sample_sizes[i] = sample_size;
+  check_stream_sizes (n_samples, sample_sizes, chunk, n_threads, low_latency);
+  g_free (sample_sizes);
+}
+
+GST_START_TEST (test_decrypt_small_chunks)
+{
+  check_stream (5, 1000, 97, 1, FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_single_buffer)
+{
+  check_stream (13, 333, G_MAXSIZE, 1, FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_threads)
+{
+  /* large enough for the fragment to be split between the threads */
+  check_stream (100, 20000, 65536, 4, FALSE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_low_latency)
+{
+  check_stream (5, 1000, 97, 1, TRUE);
+  /* chunks that end part way through the encrypted part of a sample */
+  check_stream (7, 3000, 4001, 1, TRUE);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_threads_uneven)
+{
+  guint sample_sizes[2 * GST_CENC_MP4_MAX_LANES];
+  guint i, half = GST_CENC_MP4_MAX_LANES;
+
+  /* With two threads, the streaming thread decrypts the first half of the
+     samples and the pool thread the second half. Making one half tiny and
+     the other several MiB fixes which of them finishes first, so both
+     orders are covered: the buffer must only be pushed once both halves
+     are done. */
+  for (i = 0; i < 2 * half; ++i)
+    sample_sizes[i] = i < half ? 64 : 1024 * 1024;
+  check_stream_sizes (2 * half, sample_sizes, G_MAXSIZE, 2, FALSE);
+  for (i = 0; i < 2 * half; ++i)
+    sample_sizes[i] = i < half ? 1024 * 1024 : 64;
+  check_stream_sizes (2 * half, sample_sizes, G_MAXSIZE, 2, FALSE);
+}
+
+GST_END_TEST;
+
+/* Builds a stream with one fragment of 3 samples of 500 bytes */
+static GstBuffer *
+create_stream (gboolean protected, gboolean base_data_offset)
+{
+  static const guint sample_sizes[] = { 500, 500, 500 };
+  GstByteWriter writer;
+  guint8 plain[3 * 500];
+
+  gst_byte_writer_init (&writer);
+  gst_byte_writer_put_uint32_be (&writer, 16);
+  gst_byte_writer_put_data (&writer, (const guint8 *) "ftypiso6mp41", 12);
+  append_movie (&writer, protected);
+  append_fragment (&writer, 3, sample_sizes, plain, base_data_offset);
+  return gst_byte_writer_reset_and_get_buffer (&writer);
+}
+
+GST_START_TEST (test_clear_stream)
+{
+  GstBuffer *in, *out, *buf;
+  GstMapInfo map;
+  GstHarness *h;
+  gchar *line;
+
+  /* with no protected track, the whole stream is left as it is */
+  in = create_stream (FALSE, FALSE);
+  line = g_strdup_printf ("cencfragdec key-directory=%s", key_dir);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "video/quicktime");
+  fail_unless_equals_int (gst_harness_push (h, gst_buffer_ref (in)),
+      GST_FLOW_OK);
+  out = gst_buffer_new ();
+  while ((buf = gst_harness_try_pull (h)))
+    out = gst_buffer_append (out, buf);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READ));
+  fail_unless_equals_int (gst_buffer_get_size (out), map.size);
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (in, &map);
+
+  gst_buffer_unref (out);
+  gst_buffer_unref (in);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_missing_tenc)
+{
+  GstBuffer *in;
+  GstMapInfo map;
+  GstHarness *h;
+  gchar *line;
+  gsize i;
+
+  /* an encv sample entry whose tenc box is missing is not clear content */
+  in = create_stream (TRUE, FALSE);
+  fail_unless (gst_buffer_map (in, &map, GST_MAP_READWRITE));
+  for (i = 0; i + 4 <= map.size; ++i) {
+    if (memcmp (map.data + i, "tenc", 4) == 0)
+      memcpy (map.data + i, "free", 4);
+  }
+  gst_buffer_unmap (in, &map);
+
+  line = g_strdup_printf ("cencfragdec key-directory=%s", key_dir);
+  h = gst_harness_new_parse (line);
+  g_free (line);
+  fail_unless (h != NULL);
+  gst_harness_set_src_caps_str (h, "video/quicktime");
+  fail_unless_equals_int (gst_harness_push (h, in), GST_FLOW_ERROR);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_base_data_offset)
+{
+  GstHarness *h;
+  gchar *line;
+  gint low_latency;
+
+  /* the element does not know where the moof box is in the file */
+  for (low_latency = 0; low_latency < 2; ++low_latency) {
+    line = g_strdup_printf ("cencfragdec key-directory=%s low-latency=%d",
+        key_dir, low_latency);
+    h = gst_harness_new_parse (line);
+    g_free (line);
+    fail_unless (h != NULL);
+    gst_harness_set_src_caps_str (h, "video/quicktime");
+    fail_unless_equals_int (gst_harness_push (h, create_stream (TRUE, TRUE)),
+        GST_FLOW_ERROR);
+    gst_harness_teardown (h);
+  }
+}
+
+GST_END_TEST;
+
+static Suite *
+cencfragdec_suite (void)
+{
+  Suite *s = suite_create ("cencfragdec");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup_key_dir, teardown_key_dir);
+  tcase_add_test (tc_chain, test_decrypt_small_chunks);
+  tcase_add_test (tc_chain, test_decrypt_single_buffer);
+  tcase_add_test (tc_chain, test_decrypt_threads);
+  tcase_add_test (tc_chain, test_decrypt_threads_uneven);
+  tcase_add_test (tc_chain, test_decrypt_low_latency);
+  tcase_add_test (tc_chain, test_clear_stream);
+  tcase_add_test (tc_chain, test_missing_tenc);
+  tcase_add_test (tc_chain, test_base_data_offset);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencfragdec_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,581 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcencmp4.h>
+
+static const guint8 test_kid[GST_CENC_KID_LENGTH] = {
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc,
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x1b, 0xbc
+};
+
+static const guint8 test_key[GST_CENC_KEY_LENGTH] = {
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89,
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89
+};
+
+static const guint8 piff_senc_uuid[16] = {
+  0xa2, 0x39, 0x4f, 0x52, 0x5a, 0x9b, 0x4f, 0x14,
+  0xa2, 0x44, 0x6c, 0x42, 0x7c, 0x64, 0x8d, 0xf4
+};
+
+#define N_SAMPLES 7
+#define MAX_SUBSAMPLES 2
+
+/* where the IVs and subsamples of the samples are stored */
+typedef enum
+{
+  AUX_SENC,
+  AUX_SAIZ_SAIO,                /* at the start of the mdat payload */
+  AUX_PIFF
+} AuxInfo;
+
+/* what the trun data offset is relative to */
+typedef enum
+{
+  BASE_IS_MOOF,
+  BASE_IS_MOOF_MDAT_FIRST,      /* so the data offset is negative */
+  BASE_DATA_OFFSET              /* given in the tfhd box */
+} DataBase;
+
+typedef struct
+{
+  gsize offset;
+  guint32 size;
+  guint8 iv[16];
+  guint subsample_count;
+  GstCencMp4Subsample subsamples[MAX_SUBSAMPLES];
+} ExpectedSample;
+
+static guint
+start_box (GstByteWriter * writer, const gchar * type)
+{
+  guint pos = gst_byte_writer_get_pos (writer);
+
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_data (writer, (const guint8 *) type, 4);
+  return pos;
+}
+
+static guint
+start_full_box (GstByteWriter * writer, const gchar * type, guint32 flags)
+{
+  guint pos = start_box (writer, type);
+
+  gst_byte_writer_put_uint32_be (writer, flags);
+  return pos;
+}
+
+static void
+end_box (GstByteWriter * writer, guint pos)
+{
+  guint end = gst_byte_writer_get_pos (writer);
+
+  gst_byte_writer_set_pos (writer, pos);
+  gst_byte_writer_put_uint32_be (writer, end - pos);
+  gst_byte_writer_set_pos (writer, end);
+}
+
+/* Overwrites the placeholder at pos */
+static void
+patch_uint32 (GstByteWriter * writer, guint pos, guint32 value)
+{
+  guint end = gst_byte_writer_get_pos (writer);
+
+  gst_byte_writer_set_pos (writer, pos);
+  gst_byte_writer_put_uint32_be (writer, value);
+  gst_byte_writer_set_pos (writer, end);
+}
+
+/* Appends a moov box with one protected track and returns its offset */
+static guint
+append_movie (GstByteWriter * writer, guint iv_size)
+{
+  guint moov, trak, mdia, minf, stbl, stsd, encv, sinf, schi, tenc, mvex, box;
+
+  moov = start_box (writer, "moov");
+  trak = start_box (writer, "trak");
+  box = start_full_box (writer, "tkhd", 3);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  gst_byte_writer_put_uint32_be (writer, 1);    /* track ID */
+  gst_byte_writer_fill (writer, 0, 68);
+  end_box (writer, box);
+  mdia = start_box (writer, "mdia");
+  minf = start_box (writer, "minf");
+  stbl = start_box (writer, "stbl");
+  stsd = start_full_box (writer, "stsd", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);
+  encv = start_box (writer, "encv");
+  gst_byte_writer_fill (writer, 0, 6);
+  gst_byte_writer_put_uint16_be (writer, 1);    /* data reference index */
+  gst_byte_writer_fill (writer, 0, 70);
+  sinf = start_box (writer, "sinf");
+  box = start_box (writer, "frma");
+  gst_byte_writer_put_data (writer, (const guint8 *) "avc1", 4);
+  end_box (writer, box);
+  box = start_full_box (writer, "schm", 0);
+  gst_byte_writer_put_data (writer, (const guint8 *) "cenc", 4);
+  gst_byte_writer_put_uint32_be (writer, 0x10000);
+  end_box (writer, box);
+  schi = start_box (writer, "schi");
+  tenc = start_full_box (writer, "tenc", 0);
+  gst_byte_writer_put_uint16_be (writer, 0);
+  gst_byte_writer_put_uint8 (writer, 1);        /* is protected */
+  gst_byte_writer_put_uint8 (writer, iv_size);
+  gst_byte_writer_put_data (writer, test_kid, sizeof (test_kid));
+  end_box (writer, tenc);
+  end_box (writer, schi);
+  end_box (writer, sinf);
+  end_box (writer, encv);
+  end_box (writer, stsd);
+  end_box (writer, stbl);
+  end_box (writer, minf);
+  end_box (writer, mdia);
+  end_box (writer, trak);
+  mvex = start_box (writer, "mvex");
+  box = start_full_box (writer, "trex", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);    /* track ID */
+  gst_byte_writer_put_uint32_be (writer, 1);
+  gst_byte_writer_fill (writer, 0, 12);
+  end_box (writer, box);
+  end_box (writer, mvex);
+  end_box (writer, moov);
+  return moov;
+}
+
+/* Chooses the sizes, IVs and subsamples of the samples. The first sample
+   is encrypted as a whole, the others have one or two subsamples. */
+static void
+make_samples (ExpectedSample * samples, guint iv_size)
+{
+  guint i, j;
+
+  memset (samples, 0, N_SAMPLES * sizeof (ExpectedSample));
+  for (i = 0; i < N_SAMPLES; ++i) {
+    ExpectedSample *sample = &samples[i];
+
+    sample->size = 100 + 37 * i;
+    for (j = 0; j < iv_size; ++j)
+      sample->iv[j] = g_random_int_range (0, 256);
+    sample->subsample_count = i % 3;
+    if (sample->subsample_count == 1) {
+      sample->subsamples[0].bytes_clear = 10;
+      sample->subsamples[0].bytes_encrypted = sample->size - 10;
+    } else if (sample->subsample_count == 2) {
+      sample->subsamples[0].bytes_clear = 10;
+      sample->subsamples[0].bytes_encrypted = 40;
+      sample->subsamples[1].bytes_clear = 7;
+      sample->subsamples[1].bytes_encrypted = sample->size - 57;
+    }
+  }
+}
+
+static void
+put_aux_info (GstByteWriter * writer, const ExpectedSample * sample,
+    guint iv_size, gboolean use_subsamples)
+{
+  guint j;
+
+  gst_byte_writer_put_data (writer, sample->iv, iv_size);
+  if (!use_subsamples)
+    return;
+  gst_byte_writer_put_uint16_be (writer, sample->subsample_count);
+  for (j = 0; j < sample->subsample_count; ++j) {
+    gst_byte_writer_put_uint16_be (writer, sample->subsamples[j].bytes_clear);
+    gst_byte_writer_put_uint32_be (writer,
+        sample->subsamples[j].bytes_encrypted);
+  }
+}
+
+/* size of the auxiliary information of a sample in a saiz box */
+static guint
+aux_info_size (const ExpectedSample * sample, guint iv_size)
+{
+  if (!sample->subsample_count)
+    return iv_size;
+  return iv_size + 2 + 6 * sample->subsample_count;
+}
+
+/* Appends a moof box, leaving its offsets as placeholders, and returns its
+   offset */
+static guint
+append_moof (GstByteWriter * writer, const ExpectedSample * samples,
+    guint iv_size, AuxInfo aux, DataBase base, guint * base_pos,
+    guint * data_offset_pos, guint * saio_pos)
+{
+  guint moof, traf, box, i;
+
+  moof = start_box (writer, "moof");
+  box = start_full_box (writer, "mfhd", 0);
+  gst_byte_writer_put_uint32_be (writer, 1);
+  end_box (writer, box);
+  traf = start_box (writer, "traf");
+  if (base == BASE_DATA_OFFSET) {
+    box = start_full_box (writer, "tfhd", 0x000001);
+    gst_byte_writer_put_uint32_be (writer, 1);
+    *base_pos = gst_byte_writer_get_pos (writer);
+    gst_byte_writer_put_uint64_be (writer, 0);
+  } else {
+    /* default-base-is-moof */
+    box = start_full_box (writer, "tfhd", 0x020000);
+    gst_byte_writer_put_uint32_be (writer, 1);
+  }
+  end_box (writer, box);
+  /* data-offset and sample-size present */
+  box = start_full_box (writer, "trun", 0x201);
+  gst_byte_writer_put_uint32_be (writer, N_SAMPLES);
+  *data_offset_pos = gst_byte_writer_get_pos (writer);
+  gst_byte_writer_put_uint32_be (writer, 0);
+  for (i = 0; i < N_SAMPLES; ++i)
+    gst_byte_writer_put_uint32_be (writer, samples[i].size);
+  end_box (writer, box);
+
+  if (aux == AUX_SAIZ_SAIO) {
+    box = start_full_box (writer, "saiz", 0);
+    gst_byte_writer_put_uint8 (writer, 0);      /* sizes follow */
+    gst_byte_writer_put_uint32_be (writer, N_SAMPLES);
+    for (i = 0; i < N_SAMPLES; ++i)
+      gst_byte_writer_put_uint8 (writer, aux_info_size (&samples[i],
+              iv_size));
+    end_box (writer, box);
+    box = start_full_box (writer, "saio", 0);
+    gst_byte_writer_put_uint32_be (writer, 1);
+    *saio_pos = gst_byte_writer_get_pos (writer);
+    gst_byte_writer_put_uint32_be (writer, 0);
+    end_box (writer, box);
+  } else {
+    if (aux == AUX_PIFF) {
+      box = start_box (writer, "uuid");
+      gst_byte_writer_put_data (writer, piff_senc_uuid,
+          sizeof (piff_senc_uuid));
+      /* subsample information present */
+      gst_byte_writer_put_uint32_be (writer, 2);
+    } else {
+      box = start_full_box (writer, "senc", 2);
+    }
+    gst_byte_writer_put_uint32_be (writer, N_SAMPLES);
+    for (i = 0; i < N_SAMPLES; ++i)
+      put_aux_info (writer, &samples[i], iv_size, TRUE);
+    end_box (writer, box);
+  }
+  end_box (writer, traf);
+  end_box (writer, moof);
+  return moof;
+}
+
+/* Appends an mdat box with the clear sample data in plain, preceded by the
+   auxiliary information for saio, and records the sample offsets. Returns
+   the offset of the mdat payload. */
+static guint
+append_mdat (GstByteWriter * writer, ExpectedSample * samples,
+    const guint8 * plain, guint iv_size, AuxInfo aux)
+{
+  guint mdat, payload, i;
+  gsize pos = 0;
+
+  mdat = start_box (writer, "mdat");
+  payload = gst_byte_writer_get_pos (writer);
+  if (aux == AUX_SAIZ_SAIO) {
+    for (i = 0; i < N_SAMPLES; ++i)
+      put_aux_info (writer, &samples[i], iv_size,
+          samples[i].subsample_count > 0);
+  }
+  for (i = 0; i < N_SAMPLES; ++i) {
+    samples[i].offset = gst_byte_writer_get_pos (writer);
+    gst_byte_writer_put_data (writer, plain + pos, samples[i].size);
+    pos += samples[i].size;
+  }
+  end_box (writer, mdat);
+  return payload;
+}
+
+/* Encrypts the samples in place, with one counter running across all the
+   encrypted ranges of a sample */
+static void
+encrypt_samples (guint8 * data, const ExpectedSample * samples,
+    guint iv_size)
+{
+  GBytes *key = g_bytes_new_static (test_key, sizeof (test_key));
+  guint i, j;
+
+  for (i = 0; i < N_SAMPLES; ++i) {
+    const ExpectedSample *sample = &samples[i];
+    GBytes *iv = g_bytes_new (sample->iv, iv_size);
+    AesCtrState *state = gst_aes_ctr_decrypt_new (key, iv);
+    guint8 *pos = data + sample->offset;
+
+    fail_unless (state != NULL);
+    /* CTR mode encryption is the same operation as decryption */
+    if (!sample->subsample_count)
+      gst_aes_ctr_decrypt_ip (state, pos, sample->size);
+    for (j = 0; j < sample->subsample_count; ++j) {
+      pos += sample->subsamples[j].bytes_clear;
+      gst_aes_ctr_decrypt_ip (state, pos,
+          sample->subsamples[j].bytes_encrypted);
+      pos += sample->subsamples[j].bytes_encrypted;
+    }
+    gst_aes_ctr_decrypt_unref (state);
+    g_bytes_unref (iv);
+  }
+  g_bytes_unref (key);
+}
+
+/* Builds a file with one encrypted fragment, checks that the parser finds
+   each sample with its IV and subsamples, and that the samples it finds
+   decrypt to the clear data */
+static void
+check_fragment (AuxInfo aux, DataBase base, guint iv_size)
+{
+  ExpectedSample expected[N_SAMPLES];
+  GstCencMp4Movie movie;
+  GstCencMp4Fragment fragment;
+  GstByteWriter writer;
+  GBytes *key, *iv;
+  AesCtrState *state;
+  guint8 *data, *plain;
+  guint moov, moof, payload, base_pos = 0, data_offset_pos, saio_pos = 0;
+  gsize size, base_offset, plain_size = 0, pos;
+  guint i, j;
+
+  make_samples (expected, iv_size);
+  for (i = 0; i < N_SAMPLES; ++i)
+    plain_size += expected[i].size;
+  plain = g_malloc (plain_size);
+  for (pos = 0; pos < plain_size; ++pos)
+    plain[pos] = g_random_int_range (0, 256);
+
+  gst_byte_writer_init (&writer);
+  gst_byte_writer_put_uint32_be (&writer, 16);
+  gst_byte_writer_put_data (&writer, (const guint8 *) "ftypiso6mp41", 12);
+  moov = append_movie (&writer, iv_size);
+  if (base == BASE_IS_MOOF_MDAT_FIRST) {
+    payload = append_mdat (&writer, expected, plain, iv_size, aux);
+    moof = append_moof (&writer, expected, iv_size, aux, base, &base_pos,
+        &data_offset_pos, &saio_pos);
+  } else {
+    moof = append_moof (&writer, expected, iv_size, aux, base, &base_pos,
+        &data_offset_pos, &saio_pos);
+    payload = append_mdat (&writer, expected, plain, iv_size, aux);
+  }
+
+  base_offset = moof;
+  if (base == BASE_DATA_OFFSET) {
+    base_offset = payload;
+    patch_uint32 (&writer, base_pos + 4, base_offset);
+  }
+  patch_uint32 (&writer, data_offset_pos,
+      (gint32) (expected[0].offset - base_offset));
+  if (aux == AUX_SAIZ_SAIO)
+    patch_uint32 (&writer, saio_pos, payload - base_offset);
+
+  size = gst_byte_writer_get_size (&writer);
+  data = gst_byte_writer_reset_and_get_data (&writer);
+  encrypt_samples (data, expected, iv_size);
+
+  gst_cenc_mp4_movie_init (&movie);
+  fail_unless (gst_cenc_mp4_movie_parse (&movie, data + moov + 8,
+          GST_READ_UINT32_BE (data + moov) - 8));
+  fail_unless (movie.has_protected_entries);
+  gst_cenc_mp4_fragment_init (&fragment);
+  fail_unless (gst_cenc_mp4_fragment_parse (&fragment, &movie, data, size,
+          moof));
+  fail_unless_equals_uint64 (fragment.offset, moof);
+  fail_unless_equals_int (fragment.has_base_data_offset,
+      base == BASE_DATA_OFFSET);
+  fail_unless_equals_int (fragment.samples->len, N_SAMPLES);
+
+  for (i = 0; i < N_SAMPLES; ++i) {
+    const GstCencMp4Sample *sample = &g_array_index (fragment.samples,
+        GstCencMp4Sample, i);
+
+    fail_unless_equals_uint64 (sample->offset, expected[i].offset);
+    fail_unless_equals_int (sample->size, expected[i].size);
+    fail_unless (memcmp (sample->iv, expected[i].iv, iv_size) == 0,
+        "sample %u has the wrong IV", i);
+    fail_unless_equals_int (sample->subsample_count,
+        expected[i].subsample_count);
+    for (j = 0; j < sample->subsample_count; ++j) {
+      const GstCencMp4Subsample *subsample =
+          &g_array_index (fragment.subsamples, GstCencMp4Subsample,
+          sample->first_subsample + j);
+
+      fail_unless_equals_int (subsample->bytes_clear,
+          expected[i].subsamples[j].bytes_clear);
+      fail_unless_equals_int (subsample->bytes_encrypted,
+          expected[i].subsamples[j].bytes_encrypted);
+    }
+  }
+
+  key = g_bytes_new_static (test_key, sizeof (test_key));
+  iv = g_bytes_new_static (expected[0].iv, iv_size);
+  state = gst_aes_ctr_decrypt_new (key, iv);
+  fail_unless (state != NULL);
+  for (i = 0; i < N_SAMPLES; ++i)
+    fail_unless (gst_cenc_mp4_sample_decrypt (state, data, &fragment,
+            &g_array_index (fragment.samples, GstCencMp4Sample, i)));
+  fail_unless (memcmp (data + expected[0].offset, plain, plain_size) == 0);
+  gst_aes_ctr_decrypt_unref (state);
+  g_bytes_unref (iv);
+  g_bytes_unref (key);
+
+  /* a file cut short in the data of the last sample */
+  fail_if (gst_cenc_mp4_fragment_parse (&fragment, &movie, data,
+          expected[N_SAMPLES - 1].offset + 1, moof));
+
+  gst_cenc_mp4_fragment_clear (&fragment);
+  gst_cenc_mp4_movie_clear (&movie);
+  g_free (data);
+  g_free (plain);
+}
+
+GST_START_TEST (test_senc)
+{
+  check_fragment (AUX_SENC, BASE_IS_MOOF, 8);
+  check_fragment (AUX_SENC, BASE_IS_MOOF, 16);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_saiz_saio)
+{
+  check_fragment (AUX_SAIZ_SAIO, BASE_IS_MOOF, 8);
+  check_fragment (AUX_SAIZ_SAIO, BASE_IS_MOOF, 16);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_piff_senc)
+{
+  check_fragment (AUX_PIFF, BASE_IS_MOOF, 8);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_negative_data_offset)
+{
+  check_fragment (AUX_SENC, BASE_IS_MOOF_MDAT_FIRST, 8);
+  check_fragment (AUX_PIFF, BASE_IS_MOOF_MDAT_FIRST, 16);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_base_data_offset)
+{
+  check_fragment (AUX_SENC, BASE_DATA_OFFSET, 8);
+  check_fragment (AUX_SAIZ_SAIO, BASE_DATA_OFFSET, 16);
+}
+
+GST_END_TEST;
+
+/* Builds a file with two fragments, as cenc-decrypt maps it, and checks
+   that each moof box is parsed with the samples of its own mdat box */
+GST_START_TEST (test_two_fragments)
+{
+  ExpectedSample expected[2][N_SAMPLES];
+  GstCencMp4Movie movie;
+  GstCencMp4Fragment fragment;
+  GstByteWriter writer;
+  guint8 *data, *plain;
+  guint moov, moof[2], data_offset_pos, unused;
+  gsize size, plain_size;
+  guint f, i;
+
+  gst_byte_writer_init (&writer);
+  gst_byte_writer_put_uint32_be (&writer, 16);
+  gst_byte_writer_put_data (&writer, (const guint8 *) "ftypiso6mp41", 12);
+  moov = append_movie (&writer, 8);
+  for (f = 0; f < 2; ++f) {
+    make_samples (expected[f], 8);
+    plain_size = 0;
+    for (i = 0; i < N_SAMPLES; ++i)
+      plain_size += expected[f][i].size;
+    plain = g_malloc0 (plain_size);
+    moof[f] = append_moof (&writer, expected[f], 8, AUX_SENC, BASE_IS_MOOF,
+        &unused, &data_offset_pos, &unused);
+    append_mdat (&writer, expected[f], plain, 8, AUX_SENC);
+    patch_uint32 (&writer, data_offset_pos, expected[f][0].offset - moof[f]);
+    g_free (plain);
+  }
+  size = gst_byte_writer_get_size (&writer);
+  data = gst_byte_writer_reset_and_get_data (&writer);
+
+  gst_cenc_mp4_movie_init (&movie);
+  fail_unless (gst_cenc_mp4_movie_parse (&movie, data + moov + 8,
+          GST_READ_UINT32_BE (data + moov) - 8));
+  gst_cenc_mp4_fragment_init (&fragment);
+  for (f = 0; f < 2; ++f) {
+    fail_unless (gst_cenc_mp4_fragment_parse (&fragment, &movie, data, size,
+            moof[f]));
+    fail_unless_equals_uint64 (fragment.offset, moof[f]);
+    fail_unless_equals_int (fragment.samples->len, N_SAMPLES);
+    for (i = 0; i < N_SAMPLES; ++i) {
+      const GstCencMp4Sample *sample = &g_array_index (fragment.samples,
+          GstCencMp4Sample, i);
+
+      fail_unless_equals_uint64 (sample->offset, expected[f][i].offset);
+      fail_unless (memcmp (sample->iv, expected[f][i].iv, 8) == 0,
+          "sample %u of fragment %u has the wrong IV", i, f);
+    }
+  }
+
+  gst_cenc_mp4_fragment_clear (&fragment);
+  gst_cenc_mp4_movie_clear (&movie);
+  g_free (data);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencmp4_suite (void)
+{
+  Suite *s = suite_create ("cencmp4");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_senc);
+  tcase_add_test (tc_chain, test_saiz_saio);
+  tcase_add_test (tc_chain, test_piff_senc);
+  tcase_add_test (tc_chain, test_negative_data_offset);
+  tcase_add_test (tc_chain, test_base_data_offset);
+  tcase_add_test (tc_chain, test_two_fragments);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencmp4_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
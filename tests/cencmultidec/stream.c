@@ -0,0 +1,547 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/base/gstbytewriter.h>
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+#include <glib/gstdio.h>
+
+#include "testutil.h"
+
+static const guint8 video_kid[GST_CENC_KID_LENGTH] = {
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc,
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x1b, 0xbc
+};
+
+static const guint8 audio_kid[GST_CENC_KID_LENGTH] = {
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc,
+  0x0b, 0xbc, 0x0b, 0xbc, 0x0b, 0xbc, 0x2b, 0xbc
+};
+
+static const guint8 video_key[GST_CENC_KEY_LENGTH] = {
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89,
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89
+};
+
+static const guint8 audio_key[GST_CENC_KEY_LENGTH] = {
+  0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef,
+  0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef
+};
+
+#define CLEARKEY_PROTECTION_ID "e2719d58-a985-b3c9-781a-b030af78d30e"
+/* system ID of the W3C common PSSH box */
+#define COMMON_PSSH_SYSTEM_ID \
+  "\x10\x77\xef\xec\xc0\xb2\x4d\x02\xac\xe3\x3c\x1e\x52\xe2\xfb\x4b"
+
+#define VIDEO_CAPS "application/x-cenc, " \
+  "original-media-type=(string)video/x-h264, " \
+  "stream-format=(string)avc, alignment=(string)au, " \
+  "protection-system=(string)" CLEARKEY_PROTECTION_ID
+#define AUDIO_CAPS "application/x-cenc, " \
+  "original-media-type=(string)audio/mpeg, mpegversion=(int)4, " \
+  "protection-system=(string)" CLEARKEY_PROTECTION_ID
+
+/* bytes at the start of each video subsample that are left in the clear */
+#define CLEAR_BYTES 10
+
+static gchar *key_dir;
+
+static void
+save_key (const guint8 * kid, const guint8 * key_data)
+{
+  GBytes *key;
+
+  key = g_bytes_new_static (key_data, GST_CENC_KEY_LENGTH);
+  fail_unless (gst_cenc_key_store_save (key_dir, kid, key, NULL));
+  g_bytes_unref (key);
+}
+
+static void
+remove_keys (void)
+{
+  const gchar *name;
+  GDir *d;
+
+  d = g_dir_open (key_dir, 0, NULL);
+  fail_unless (d != NULL);
+  while ((name = g_dir_read_name (d))) {
+    gchar *path = g_build_filename (key_dir, name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_dir_close (d);
+}
+
+static void
+setup_key_dir (void)
+{
+  key_dir = test_key_dir_create ("cencmultidec-test-XXXXXX");
+  save_key (video_kid, video_key);
+  save_key (audio_kid, audio_key);
+}
+
+static void
+teardown_key_dir (void)
+{
+  test_key_dir_remove (key_dir);
+  key_dir = NULL;
+}
+
+/* Returns an encrypted sample of size bytes with its protection meta, and
+   the clear data in clear. Video samples have two subsamples that each
+   start with CLEAR_BYTES clear bytes, audio samples are encrypted whole
+   with a 16 byte IV. */
+static GstBuffer *
+create_sample (gboolean video, gsize size, GstBuffer ** clear)
+{
+  const guint8 *kid = video ? video_kid : audio_kid;
+  GstBuffer *buf, *kid_buf, *iv_buf;
+  guint8 iv[16];
+  GBytes *key, *iv_bytes;
+  AesCtrState *state;
+  GstStructure *info;
+  GstMapInfo map;
+  guint iv_size = video ? 8 : 16;
+  gsize i;
+
+  buf = gst_buffer_new_allocate (NULL, size, NULL);
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < size; ++i)
+    map.data[i] = g_random_int_range (0, 256);
+  *clear = gst_buffer_new_wrapped (g_memdup (map.data, size), size);
+  for (i = 0; i < iv_size; ++i)
+    iv[i] = g_random_int_range (0, 256);
+
+  key = g_bytes_new_static (video ? video_key : audio_key,
+      GST_CENC_KEY_LENGTH);
+  iv_bytes = g_bytes_new (iv, iv_size);
+  state = gst_aes_ctr_decrypt_new (key, iv_bytes);
+  fail_unless (state != NULL);
+  kid_buf = gst_buffer_new_allocate (NULL, GST_CENC_KID_LENGTH, NULL);
+  gst_buffer_fill (kid_buf, 0, kid, GST_CENC_KID_LENGTH);
+  iv_buf = gst_buffer_new_allocate (NULL, iv_size, NULL);
+  gst_buffer_fill (iv_buf, 0, iv, iv_size);
+  info = gst_structure_new ("application/x-cenc",
+      "iv_size", G_TYPE_UINT, iv_size,
+      "encrypted", G_TYPE_BOOLEAN, TRUE,
+      "kid", GST_TYPE_BUFFER, kid_buf,
+      "iv", GST_TYPE_BUFFER, iv_buf, NULL);
+
+  if (video) {
+    gsize first = (size - 2 * CLEAR_BYTES) / 3;
+    gsize second = size - 2 * CLEAR_BYTES - first;
+    GstByteWriter writer;
+    GstBuffer *subsamples;
+
+    /* the counter carries on from one subsample to the next */
+    gst_aes_ctr_decrypt_ip (state, map.data + CLEAR_BYTES, first);
+    gst_aes_ctr_decrypt_ip (state, map.data + 2 * CLEAR_BYTES + first,
+        second);
+    gst_byte_writer_init (&writer);
+    gst_byte_writer_put_uint16_be (&writer, CLEAR_BYTES);
+    gst_byte_writer_put_uint32_be (&writer, first);
+    gst_byte_writer_put_uint16_be (&writer, CLEAR_BYTES);
+    gst_byte_writer_put_uint32_be (&writer, second);
+    subsamples = gst_byte_writer_reset_and_get_buffer (&writer);
+    gst_structure_set (info, "subsample_count", G_TYPE_UINT, 2,
+        "subsamples", GST_TYPE_BUFFER, subsamples, NULL);
+    gst_buffer_unref (subsamples);
+  } else {
+    gst_aes_ctr_decrypt_ip (state, map.data, size);
+    gst_structure_set (info, "subsample_count", G_TYPE_UINT, 0, NULL);
+  }
+  gst_buffer_unmap (buf, &map);
+  gst_buffer_add_protection_meta (buf, info);
+
+  gst_aes_ctr_decrypt_unref (state);
+  gst_buffer_unref (kid_buf);
+  gst_buffer_unref (iv_buf);
+  g_bytes_unref (iv_bytes);
+  g_bytes_unref (key);
+  return buf;
+}
+
+static void
+check_sample (GstBuffer * out, GstBuffer * clear)
+{
+  GstMapInfo map;
+
+  fail_unless (out != NULL);
+  fail_unless (gst_buffer_get_protection_meta (out) == NULL);
+  fail_unless (gst_buffer_map (clear, &map, GST_MAP_READ));
+  fail_unless_equals_int (gst_buffer_get_size (out), map.size);
+  fail_unless (gst_buffer_memcmp (out, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (clear, &map);
+  gst_buffer_unref (out);
+  gst_buffer_unref (clear);
+}
+
+static void
+push_and_check (GstHarness * h, gboolean video, gsize size)
+{
+  GstBuffer *clear, *buf;
+
+  buf = create_sample (video, size, &clear);
+  check_sample (gst_harness_push_and_pull (h, buf), clear);
+}
+
+/* Returns harnesses for a video stream on sink_0 and an audio stream on
+   sink_1 of the same decryptor */
+static GstElement *
+setup_decryptor (guint n_threads, GstHarness ** video, GstHarness ** audio)
+{
+  GstElement *dec;
+
+  dec = gst_element_factory_make ("cencmultidec", NULL);
+  fail_unless (dec != NULL);
+  g_object_set (dec, "key-directory", key_dir, "n-threads", n_threads, NULL);
+  *video = gst_harness_new_with_element (dec, "sink_0", "src_0");
+  gst_harness_set_src_caps_str (*video, VIDEO_CAPS);
+  *audio = gst_harness_new_with_element (dec, "sink_1", "src_1");
+  gst_harness_set_src_caps_str (*audio, AUDIO_CAPS);
+  return dec;
+}
+
+static void
+teardown_decryptor (GstElement * dec, GstHarness * video, GstHarness * audio)
+{
+  gst_harness_teardown (audio);
+  gst_harness_teardown (video);
+  gst_object_unref (dec);
+}
+
+GST_START_TEST (test_request_pads)
+{
+  GstElement *dec;
+  GstPad *sink0, *sink1, *src;
+
+  dec = gst_element_factory_make ("cencmultidec", NULL);
+  fail_unless (dec != NULL);
+  sink0 = gst_element_get_request_pad (dec, "sink_%u");
+  sink1 = gst_element_get_request_pad (dec, "sink_%u");
+  fail_unless (sink0 != NULL && sink1 != NULL);
+  fail_unless_equals_string (GST_PAD_NAME (sink0), "sink_0");
+  fail_unless_equals_string (GST_PAD_NAME (sink1), "sink_1");
+  /* each sink pad comes with its own src pad */
+  src = gst_element_get_static_pad (dec, "src_1");
+  fail_unless (src != NULL);
+  gst_object_unref (src);
+  fail_unless (gst_element_get_request_pad (dec, "sink_1") == NULL);
+
+  gst_element_release_request_pad (dec, sink1);
+  gst_object_unref (sink1);
+  src = gst_element_get_static_pad (dec, "src_1");
+  fail_unless (src == NULL);
+  fail_unless_equals_int (dec->numpads, 2);
+
+  gst_element_release_request_pad (dec, sink0);
+  gst_object_unref (sink0);
+  gst_object_unref (dec);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_decrypt_streams)
+{
+  GstHarness *video, *audio;
+  GstElement *dec;
+  GstCaps *caps;
+  guint i;
+
+  dec = setup_decryptor (2, &video, &audio);
+  for (i = 0; i < 10; ++i) {
+    push_and_check (video, TRUE, g_random_int_range (2 * CLEAR_BYTES, 300000));
+    push_and_check (audio, FALSE, g_random_int_range (1, 2000));
+  }
+  caps = gst_pad_get_current_caps (video->sinkpad);
+  fail_unless (caps != NULL);
+  fail_unless (gst_structure_has_name (gst_caps_get_structure (caps, 0),
+          "video/x-h264"));
+  fail_if (gst_structure_has_field (gst_caps_get_structure (caps, 0),
+          "protection-system"));
+  gst_caps_unref (caps);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_shared_key_table)
+{
+  GstHarness *video, *audio, *audio2;
+  GstElement *dec;
+
+  dec = setup_decryptor (1, &video, &audio);
+  push_and_check (video, TRUE, 1000);
+  push_and_check (audio, FALSE, 100);
+  /* the keys loaded for the first two streams serve a third */
+  remove_keys ();
+  audio2 = gst_harness_new_with_element (dec, "sink_2", "src_2");
+  gst_harness_set_src_caps_str (audio2, AUDIO_CAPS);
+  push_and_check (audio2, FALSE, 100);
+  push_and_check (video, TRUE, 1000);
+  gst_harness_teardown (audio2);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+static GstEvent *
+create_pssh_event (void)
+{
+  GstByteWriter writer;
+  GstBuffer *pssh;
+  GstEvent *event;
+
+  gst_byte_writer_init (&writer);
+  gst_byte_writer_put_uint32_be (&writer, 8 + 4 + 16 + 4 + 2 * 16 + 4);
+  gst_byte_writer_put_data (&writer, (const guint8 *) "pssh", 4);
+  gst_byte_writer_put_uint32_be (&writer, 0x01000000);  /* version 1 */
+  gst_byte_writer_put_data (&writer, (const guint8 *) COMMON_PSSH_SYSTEM_ID,
+      16);
+  gst_byte_writer_put_uint32_be (&writer, 2);
+  gst_byte_writer_put_data (&writer, video_kid, GST_CENC_KID_LENGTH);
+  gst_byte_writer_put_data (&writer, audio_kid, GST_CENC_KID_LENGTH);
+  gst_byte_writer_put_uint32_be (&writer, 0);
+  pssh = gst_byte_writer_reset_and_get_buffer (&writer);
+  event = gst_event_new_protection ("1077efec-c0b2-4d02-ace3-3c1e52e2fb4b",
+      pssh, "isobmff/moov");
+  gst_buffer_unref (pssh);
+  return event;
+}
+
+GST_START_TEST (test_protection_event)
+{
+  GstHarness *video, *audio;
+  GstElement *dec;
+
+  dec = setup_decryptor (1, &video, &audio);
+  /* the keys of every KID in the pssh box are loaded from the first copy
+     of the event */
+  fail_unless (gst_harness_push_event (video, create_pssh_event ()));
+  remove_keys ();
+  fail_unless (gst_harness_push_event (audio, create_pssh_event ()));
+  push_and_check (audio, FALSE, 500);
+  push_and_check (video, TRUE, 5000);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_missing_key)
+{
+  GstHarness *video, *audio;
+  GstElement *dec;
+  GstBuffer *clear, *buf;
+
+  dec = setup_decryptor (1, &video, &audio);
+  remove_keys ();
+  buf = create_sample (FALSE, 100, &clear);
+  fail_unless_equals_int (gst_harness_push (audio, buf), GST_FLOW_ERROR);
+  gst_buffer_unref (clear);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+#define N_VIDEO_SAMPLES 20
+#define N_AUDIO_SAMPLES 200
+
+typedef struct
+{
+  GstHarness *h;
+  gboolean video;
+  guint n_samples;
+  GstBuffer **clear;
+} PushThreadData;
+
+static gpointer
+push_samples (gpointer user_data)
+{
+  PushThreadData *data = user_data;
+  guint i;
+
+  for (i = 0; i < data->n_samples; ++i) {
+    gsize size = data->video ? 500000 : g_random_int_range (100, 1000);
+    GstBuffer *buf = create_sample (data->video, size, &data->clear[i]);
+
+    fail_unless_equals_int (gst_harness_push (data->h, buf), GST_FLOW_OK);
+  }
+  return NULL;
+}
+
+GST_START_TEST (test_decrypt_concurrent)
+{
+  GstBuffer *video_clear[N_VIDEO_SAMPLES], *audio_clear[N_AUDIO_SAMPLES];
+  PushThreadData video_data, audio_data;
+  GThread *video_thread, *audio_thread;
+  GstHarness *video, *audio;
+  GstElement *dec;
+  guint i;
+
+  /* one thread for both streams, so that they take turns */
+  dec = setup_decryptor (1, &video, &audio);
+  video_data.h = video;
+  video_data.video = TRUE;
+  video_data.n_samples = N_VIDEO_SAMPLES;
+  video_data.clear = video_clear;
+  audio_data.h = audio;
+  audio_data.video = FALSE;
+  audio_data.n_samples = N_AUDIO_SAMPLES;
+  audio_data.clear = audio_clear;
+  video_thread = g_thread_new ("video", push_samples, &video_data);
+  audio_thread = g_thread_new ("audio", push_samples, &audio_data);
+  g_thread_join (video_thread);
+  g_thread_join (audio_thread);
+
+  for (i = 0; i < N_VIDEO_SAMPLES; ++i)
+    check_sample (gst_harness_pull (video), video_clear[i]);
+  for (i = 0; i < N_AUDIO_SAMPLES; ++i)
+    check_sample (gst_harness_pull (audio), audio_clear[i]);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+/* a video sample of this many decrypt chunks takes much longer to decrypt
+   than the audio samples pushed while it is in the pool */
+#define LARGE_VIDEO_SIZE (256 * 64 * 1024)
+#define N_STARVE_AUDIO_SAMPLES 10
+
+typedef struct
+{
+  GMutex lock;
+  GCond cond;
+  gboolean video_started;
+  gint video_done;
+  GstHarness *h;
+  GstBuffer *buf;
+} StarveData;
+
+static GstPadProbeReturn
+video_started_probe (GstPad * pad, GstPadProbeInfo * info,
+    gpointer user_data)
+{
+  StarveData *data = user_data;
+
+  g_mutex_lock (&data->lock);
+  data->video_started = TRUE;
+  g_cond_signal (&data->cond);
+  g_mutex_unlock (&data->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+static gpointer
+push_large_video (gpointer user_data)
+{
+  StarveData *data = user_data;
+
+  fail_unless_equals_int (gst_harness_push (data->h, data->buf), GST_FLOW_OK);
+  g_atomic_int_set (&data->video_done, TRUE);
+  return NULL;
+}
+
+GST_START_TEST (test_audio_not_starved)
+{
+  GstBuffer *video_clear, *clear, *buf;
+  GstHarness *video, *audio;
+  GThread *video_thread;
+  StarveData data;
+  GstElement *dec;
+  GstPad *sinkpad;
+  guint i;
+
+  /* with a single thread, a large video sample is decrypted a chunk at a
+     time, and the audio samples queued meanwhile are decrypted between
+     its chunks rather than after the whole sample */
+  dec = setup_decryptor (1, &video, &audio);
+  g_mutex_init (&data.lock);
+  g_cond_init (&data.cond);
+  data.video_started = FALSE;
+  data.video_done = FALSE;
+  data.h = video;
+  data.buf = create_sample (TRUE, LARGE_VIDEO_SIZE, &video_clear);
+  sinkpad = gst_element_get_static_pad (dec, "sink_0");
+  fail_unless (sinkpad != NULL);
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, video_started_probe,
+      &data, NULL);
+  gst_object_unref (sinkpad);
+
+  video_thread = g_thread_new ("video", push_large_video, &data);
+  g_mutex_lock (&data.lock);
+  while (!data.video_started)
+    g_cond_wait (&data.cond, &data.lock);
+  g_mutex_unlock (&data.lock);
+
+  for (i = 0; i < N_STARVE_AUDIO_SAMPLES; ++i) {
+    buf = create_sample (FALSE, 1000, &clear);
+    fail_unless_equals_int (gst_harness_push (audio, buf), GST_FLOW_OK);
+    /* the audio sample has been decrypted and pushed downstream before
+       the video sample that was queued ahead of it */
+    fail_if (g_atomic_int_get (&data.video_done));
+    check_sample (gst_harness_pull (audio), clear);
+  }
+
+  g_thread_join (video_thread);
+  check_sample (gst_harness_pull (video), video_clear);
+  g_cond_clear (&data.cond);
+  g_mutex_clear (&data.lock);
+  teardown_decryptor (dec, video, audio);
+}
+
+GST_END_TEST;
+
+static Suite *
+cencmultidec_suite (void)
+{
+  Suite *s = suite_create ("cencmultidec");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_checked_fixture (tc_chain, setup_key_dir, teardown_key_dir);
+  tcase_add_test (tc_chain, test_request_pads);
+  tcase_add_test (tc_chain, test_decrypt_streams);
+  tcase_add_test (tc_chain, test_shared_key_table);
+  tcase_add_test (tc_chain, test_protection_event);
+  tcase_add_test (tc_chain, test_missing_key);
+  tcase_add_test (tc_chain, test_decrypt_concurrent);
+  tcase_add_test (tc_chain, test_audio_not_starved);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = cencmultidec_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
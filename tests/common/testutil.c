@@ -0,0 +1,84 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/* Helpers shared by the element tests */
+
+#include <gst/check/gstcheck.h>
+#include <glib/gstdio.h>
+
+#include "testutil.h"
+
+/* a KID or key given as 32 hex digits */
+GBytes *
+test_hex_to_bytes (const gchar * hex)
+{
+  guint8 bytes[16];
+  guint i;
+
+  for (i = 0; i < sizeof (bytes); ++i) {
+    bytes[i] = (g_ascii_xdigit_value (hex[2 * i]) << 4) |
+        g_ascii_xdigit_value (hex[2 * i + 1]);
+  }
+  return g_bytes_new (bytes, sizeof (bytes));
+}
+
+/* a buffer of size random bytes */
+GstBuffer *
+test_create_sample (gsize size)
+{
+  GstBuffer *buf = gst_buffer_new_allocate (NULL, size, NULL);
+  GstMapInfo map;
+  guint i;
+
+  gst_buffer_map (buf, &map, GST_MAP_WRITE);
+  for (i = 0; i < map.size; ++i)
+    map.data[i] = g_random_int_range (0, 256);
+  gst_buffer_unmap (buf, &map);
+  return buf;
+}
+
+/* make an empty temporary directory for a test to store keys in, named
+   after tmpl as for g_dir_make_tmp() */
+gchar *
+test_key_dir_create (const gchar * tmpl)
+{
+  gchar *dir = g_dir_make_tmp (tmpl, NULL);
+
+  fail_unless (dir != NULL);
+  return dir;
+}
+
+/* delete a directory made by test_key_dir_create() and free its name */
+void
+test_key_dir_remove (gchar * dir)
+{
+  const gchar *name;
+  GDir *d;
+
+  d = g_dir_open (dir, 0, NULL);
+  fail_unless (d != NULL);
+  while ((name = g_dir_read_name (d))) {
+    gchar *path = g_build_filename (dir, name, NULL);
+    g_unlink (path);
+    g_free (path);
+  }
+  g_dir_close (d);
+  g_rmdir (dir);
+  g_free (dir);
+}
@@ -0,0 +1,33 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#ifndef _TEST_UTIL_H_
+#define _TEST_UTIL_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+GBytes * test_hex_to_bytes (const gchar * hex);
+GstBuffer * test_create_sample (gsize size);
+
+gchar * test_key_dir_create (const gchar * tmpl);
+void test_key_dir_remove (gchar * dir);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,255 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <openssl/aes.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstcenckeystore.h>
+
+#include "testutil.h"
+
+#define TEST_KEY_URI "https://example.com/keys/1"
+
+static const guint8 test_key[GST_CENC_KEY_LENGTH] = {
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89,
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89
+};
+
+static gchar *key_dir;
+
+/* store the key under the name used for TEST_KEY_URI */
+static void
+setup_key_dir (void)
+{
+  guint8 kid[GST_CENC_KID_LENGTH];
+  GBytes *key;
+
+  key_dir = test_key_dir_create ("hlsaesdec-test-XXXXXX");
+  gst_cenc_key_store_kid_from_uri (TEST_KEY_URI, kid);
+  key = g_bytes_new_static (test_key, sizeof (test_key));
+  fail_unless (gst_cenc_key_store_save (key_dir, kid, key, NULL));
+  g_bytes_unref (key);
+}
+
+static void
+teardown_key_dir (void)
+{
+  test_key_dir_remove (key_dir);
+  key_dir = NULL;
+}
+
+/* a segment of random data, and the same data padded and encrypted with
+   the IV of media sequence number sequence */
+static void
+create_segment (gsize size, guint64 sequence, guint8 ** clear,
+    guint8 ** encrypted, gsize * encrypted_size)
+{
+  gsize padded = (size / 16 + 1) * 16;
+  AES_KEY aes_key;
+  guint8 iv[16];
+  guint8 *data;
+  gsize i;
+
+  *clear = g_malloc (size);
+  for (i = 0; i < size; ++i)
+    (*clear)[i] = g_random_int_range (0, 256);
+  data = g_malloc (padded);
+  memcpy (data, *clear, size);
+  memset (data + size, padded - size, padded - size);
+  memset (iv, 0, 8);
+  GST_WRITE_UINT64_BE (iv + 8, sequence);
+  AES_set_encrypt_key (test_key, 128, &aes_key);
+  AES_cbc_encrypt (data, data, padded, &aes_key, iv, AES_ENCRYPT);
+  *encrypted = data;
+  *encrypted_size = padded;
+}
+
+/* push a segment in buffers of random sizes, the first of which starts a
+   new segment */
+static void
+push_segment (GstHarness * h, const guint8 * data, gsize size)
+{
+  gsize pos = 0;
+
+  while (pos < size) {
+    gsize n = MIN (size - pos, g_random_int_range (1, 700));
+    GstBuffer *buf = gst_buffer_new_wrapped (g_memdup (data + pos, n), n);
+
+    if (pos == 0)
+      GST_BUFFER_FLAG_SET (buf, GST_BUFFER_FLAG_DISCONT);
+    fail_unless_equals_int (gst_harness_push (h, buf), GST_FLOW_OK);
+    pos += n;
+  }
+}
+
+/* pull everything that has been output and compare it with clear */
+static void
+check_output (GstHarness * h, const guint8 * clear, gsize size)
+{
+  GstBuffer *buf;
+  gsize pos = 0;
+
+  while ((buf = gst_harness_try_pull (h))) {
+    gsize n = gst_buffer_get_size (buf);
+
+    fail_unless (pos + n <= size);
+    fail_unless (gst_buffer_memcmp (buf, 0, clear + pos, n) == 0);
+    pos += n;
+    gst_buffer_unref (buf);
+  }
+  fail_unless_equals_int (pos, size);
+}
+
+GST_START_TEST (test_segments)
+{
+  const gsize sizes[] = { 18800, 4096, 1, 0, 777 };
+  GByteArray *expected = g_byte_array_new ();
+  guint8 *clear, *encrypted;
+  gsize encrypted_size;
+  guint64 sequence;
+  GstHarness *h;
+  guint i;
+
+  setup_key_dir ();
+  h = gst_harness_new ("hlsaesdec");
+  g_object_set (h->element, "key-directory", key_dir, "key-uri",
+      TEST_KEY_URI, "media-sequence", G_GUINT64_CONSTANT (41), NULL);
+  gst_harness_set_src_caps_str (h, "video/mpegts");
+
+  /* each segment ends at the DISCONT buffer of the next one, or at EOS,
+     and the media sequence number goes up by one each time */
+  for (i = 0; i < G_N_ELEMENTS (sizes); ++i) {
+    create_segment (sizes[i], 41 + i, &clear, &encrypted, &encrypted_size);
+    push_segment (h, encrypted, encrypted_size);
+    g_byte_array_append (expected, clear, sizes[i]);
+    g_free (encrypted);
+    g_free (clear);
+  }
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  check_output (h, expected->data, expected->len);
+  g_object_get (h->element, "media-sequence", &sequence, NULL);
+  fail_unless_equals_int (sequence, 41 + G_N_ELEMENTS (sizes));
+
+  g_byte_array_unref (expected);
+  gst_harness_teardown (h);
+  teardown_key_dir ();
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_iv_and_key)
+{
+  guint8 *clear, *encrypted;
+  gsize encrypted_size;
+  GstHarness *h;
+
+  /* an IV attribute of 7 is the same as media sequence number 7 */
+  h = gst_harness_new ("hlsaesdec");
+  g_object_set (h->element, "key", "abcdef0123456789abcdef0123456789",
+      "iv", "0x00000000000000000000000000000007", NULL);
+  gst_harness_set_src_caps_str (h, "video/mpegts");
+  create_segment (1000, 7, &clear, &encrypted, &encrypted_size);
+  push_segment (h, encrypted, encrypted_size);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  check_output (h, clear, 1000);
+  g_free (encrypted);
+  g_free (clear);
+  gst_harness_teardown (h);
+
+  /* there is no key for this URI */
+  h = gst_harness_new ("hlsaesdec");
+  g_object_set (h->element, "key-directory", "/nonexistent", "key-uri",
+      TEST_KEY_URI, NULL);
+  gst_harness_set_src_caps_str (h, "video/mpegts");
+  create_segment (100, 0, &clear, &encrypted, &encrypted_size);
+  fail_unless_equals_int (gst_harness_push (h,
+          gst_buffer_new_wrapped (encrypted, encrypted_size)),
+      GST_FLOW_NOT_SUPPORTED);
+  g_free (clear);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_invalid_padding)
+{
+  guint8 *clear, *encrypted;
+  gsize encrypted_size;
+  GstMessage *msg;
+  GstHarness *h;
+  GstBus *bus;
+
+  h = gst_harness_new ("hlsaesdec");
+  bus = gst_bus_new ();
+  gst_element_set_bus (h->element, bus);
+  g_object_set (h->element, "key", "abcdef0123456789abcdef0123456789",
+      NULL);
+  gst_harness_set_src_caps_str (h, "video/mpegts");
+  /* 8 bytes of padding, and in CBC mode changing the block before the last
+     changes the same byte of the last one, so the last byte becomes 0 */
+  create_segment (1000, 0, &clear, &encrypted, &encrypted_size);
+  encrypted[encrypted_size - 16 - 1] ^= 8;
+  push_segment (h, encrypted, encrypted_size);
+  fail_unless (gst_harness_push_event (h, gst_event_new_eos ()));
+  msg = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  fail_unless (msg != NULL);
+  gst_message_unref (msg);
+
+  g_free (encrypted);
+  g_free (clear);
+  gst_element_set_bus (h->element, NULL);
+  gst_object_unref (bus);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+static Suite *
+hlsaesdec_suite (void)
+{
+  Suite *s = suite_create ("hlsaesdec");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_segments);
+  tcase_add_test (tc_chain, test_invalid_padding);
+  tcase_add_test (tc_chain, test_iv_and_key);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = hlsaesdec_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
@@ -0,0 +1,347 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+#include <string.h>
+
+#include <openssl/aes.h>
+
+#include <gst/check/gstcheck.h>
+#include <gst/check/gstharness.h>
+#include <gst/gst.h>
+#include <gst/gstcenckeystore.h>
+
+#include "testutil.h"
+
+#define TEST_KEY "abcdef0123456789abcdef0123456789"
+#define TEST_IV "0x000102030405060708090a0b0c0d0e0f"
+#define TEST_KEY_URI "skd://example.com/key?id=1"
+
+static const guint8 test_key[GST_CENC_KEY_LENGTH] = {
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89,
+  0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89
+};
+
+static const guint8 test_iv[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static gchar *key_dir;
+
+/* store the key under the name used for TEST_KEY_URI */
+static void
+setup_key_dir (void)
+{
+  guint8 kid[GST_CENC_KID_LENGTH];
+  GBytes *key;
+
+  key_dir = test_key_dir_create ("hlssampleaesdec-test-XXXXXX");
+  gst_cenc_key_store_kid_from_uri (TEST_KEY_URI, kid);
+  key = g_bytes_new_static (test_key, sizeof (test_key));
+  fail_unless (gst_cenc_key_store_save (key_dir, kid, key, NULL));
+  g_bytes_unref (key);
+}
+
+static void
+teardown_key_dir (void)
+{
+  test_key_dir_remove (key_dir);
+  key_dir = NULL;
+}
+
+/* CBC encrypt the whole blocks of a range, restarting from test_iv */
+static void
+encrypt_cbc (const AES_KEY * aes_key, guint8 * data, gsize size)
+{
+  guint8 chain[16];
+  gsize pos;
+  guint i;
+
+  memcpy (chain, test_iv, sizeof (chain));
+  for (pos = 0; pos + 16 <= size; pos += 16) {
+    for (i = 0; i < 16; ++i)
+      data[pos + i] ^= chain[i];
+    AES_encrypt (data + pos, data + pos, aes_key);
+    memcpy (chain, data + pos, sizeof (chain));
+  }
+}
+
+/* Encrypt a slice NAL unit as SAMPLE-AES does: 32 clear bytes, then one
+   encrypted block in every ten while more than 16 bytes are left, then
+   emulation prevention bytes inserted. Returns the size written to out. */
+static gsize
+encrypt_nal (const AES_KEY * aes_key, const guint8 * nal, gsize size,
+    guint8 * out)
+{
+  guint8 *tmp = g_memdup (nal, size);
+  guint8 chain[16];
+  gsize pos, n = 0;
+  guint zeros = 0, i;
+
+  memcpy (chain, test_iv, sizeof (chain));
+  pos = 32;
+  while (pos < size) {
+    if (size - pos > 16) {
+      for (i = 0; i < 16; ++i)
+        tmp[pos + i] ^= chain[i];
+      AES_encrypt (tmp + pos, tmp + pos, aes_key);
+      memcpy (chain, tmp + pos, sizeof (chain));
+      pos += 16;
+    }
+    pos += MIN (144, size - pos);
+  }
+  for (pos = 0; pos < size; ++pos) {
+    if (zeros >= 2 && tmp[pos] <= 3) {
+      out[n++] = 0x03;
+      zeros = 0;
+    }
+    zeros = tmp[pos] == 0 ? zeros + 1 : 0;
+    out[n++] = tmp[pos];
+  }
+  g_free (tmp);
+  return n;
+}
+
+/* An access unit with an access unit delimiter, an SPS, a short slice that
+   stays clear and two slices that are encrypted, as clear and encrypted
+   byte streams */
+static void
+create_h264_access_unit (GstBuffer ** clear, GstBuffer ** encrypted)
+{
+  const guint8 types[] = { 0x09, 0x67, 0x41, 0x65, 0x41 };
+  const gsize sizes[] = { 2, 20, 40, 1500, 333 };
+  const guint8 start_code[] = { 0x00, 0x00, 0x00, 0x01 };
+  guint8 *clear_data = g_malloc (4096), *enc_data = g_malloc (8192);
+  gsize clear_size = 0, enc_size = 0;
+  AES_KEY aes_key;
+  guint i, j;
+
+  AES_set_encrypt_key (test_key, 128, &aes_key);
+  for (i = 0; i < G_N_ELEMENTS (types); ++i) {
+    guint8 nal[2048];
+
+    nal[0] = types[i];
+    for (j = 1; j < sizes[i]; ++j)
+      nal[j] = g_random_int_range (1, 256);
+    /* an emulation prevention byte of the clear stream, which must be
+       kept */
+    if (sizes[i] > 20) {
+      nal[8] = nal[9] = 0x00;
+      nal[10] = 0x03;
+      nal[11] = 0x01;
+    }
+    nal[sizes[i] - 1] = 0x80;
+    memcpy (clear_data + clear_size, start_code + (i & 1), 4 - (i & 1));
+    clear_size += 4 - (i & 1);
+    memcpy (clear_data + clear_size, nal, sizes[i]);
+    clear_size += sizes[i];
+    memcpy (enc_data + enc_size, start_code + (i & 1), 4 - (i & 1));
+    enc_size += 4 - (i & 1);
+    if ((types[i] & 0x1f) == 1 || (types[i] & 0x1f) == 5) {
+      if (sizes[i] > 48) {
+        enc_size += encrypt_nal (&aes_key, nal, sizes[i], enc_data + enc_size);
+        continue;
+      }
+    }
+    memcpy (enc_data + enc_size, nal, sizes[i]);
+    enc_size += sizes[i];
+  }
+  *clear = gst_buffer_new_wrapped (clear_data, clear_size);
+  *encrypted = gst_buffer_new_wrapped (enc_data, enc_size);
+}
+
+/* three ADTS frames, as clear and encrypted buffers */
+static void
+create_adts_frames (GstBuffer ** clear, GstBuffer ** encrypted)
+{
+  const gsize sizes[] = { 7 + 16 + 5, 200, 371 };
+  guint8 *data = g_malloc (1024), *enc_data;
+  gsize size = 0, pos = 0;
+  AES_KEY aes_key;
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (sizes); ++i) {
+    guint8 *frame = data + size;
+
+    for (j = 0; j < sizes[i]; ++j)
+      frame[j] = g_random_int_range (0, 256);
+    frame[0] = 0xff;
+    frame[1] = 0xf1;
+    frame[3] = (frame[3] & 0xfc) | ((sizes[i] >> 11) & 0x03);
+    frame[4] = (sizes[i] >> 3) & 0xff;
+    frame[5] = ((sizes[i] & 0x07) << 5) | (frame[5] & 0x1f);
+    size += sizes[i];
+  }
+  enc_data = g_memdup (data, size);
+  AES_set_encrypt_key (test_key, 128, &aes_key);
+  for (i = 0; i < G_N_ELEMENTS (sizes); ++i) {
+    /* 7 byte header and 16 clear bytes */
+    encrypt_cbc (&aes_key, enc_data + pos + 23, sizes[i] - 23);
+    pos += sizes[i];
+  }
+  *clear = gst_buffer_new_wrapped (data, size);
+  *encrypted = gst_buffer_new_wrapped (enc_data, size);
+}
+
+/* an AC-3 frame of 128 kbit/s at 44.1 kHz, which is 558 bytes long */
+static void
+create_ac3_frame (GstBuffer ** clear, GstBuffer ** encrypted)
+{
+  const gsize size = 558;
+  guint8 *data = g_malloc (size), *enc_data;
+  AES_KEY aes_key;
+  guint i;
+
+  for (i = 0; i < size; ++i)
+    data[i] = g_random_int_range (0, 256);
+  data[0] = 0x0b;
+  data[1] = 0x77;
+  data[4] = (1 << 6) | 17;      /* fscod and frmsizecod */
+  data[5] = (8 << 3) | (data[5] & 0x07);        /* bsid */
+  enc_data = g_memdup (data, size);
+  AES_set_encrypt_key (test_key, 128, &aes_key);
+  encrypt_cbc (&aes_key, enc_data + 16, size - 16);
+  *clear = gst_buffer_new_wrapped (data, size);
+  *encrypted = gst_buffer_new_wrapped (enc_data, size);
+}
+
+static GstHarness *
+setup_harness (const gchar * caps)
+{
+  GstHarness *h;
+
+  h = gst_harness_new ("hlssampleaesdec");
+  fail_unless (h != NULL);
+  g_object_set (h->element, "key", TEST_KEY, "iv", TEST_IV, NULL);
+  gst_harness_set_src_caps_str (h, caps);
+  return h;
+}
+
+static void
+check_decrypted (GstHarness * h, GstBuffer * clear, GstBuffer * encrypted)
+{
+  GstBuffer *out;
+  GstMapInfo map;
+
+  fail_unless_equals_int (gst_harness_push (h, encrypted), GST_FLOW_OK);
+  out = gst_harness_pull (h);
+  fail_unless (out != NULL);
+  fail_unless_equals_int (gst_buffer_get_size (out),
+      gst_buffer_get_size (clear));
+  gst_buffer_map (out, &map, GST_MAP_READ);
+  fail_unless (gst_buffer_memcmp (clear, 0, map.data, map.size) == 0);
+  gst_buffer_unmap (out, &map);
+  gst_buffer_unref (out);
+  gst_buffer_unref (clear);
+}
+
+GST_START_TEST (test_h264)
+{
+  GstBuffer *clear, *encrypted;
+  GstHarness *h;
+  guint i;
+
+  h = setup_harness ("video/x-h264, stream-format=(string)byte-stream, "
+      "alignment=(string)au");
+  for (i = 0; i < 10; ++i) {
+    create_h264_access_unit (&clear, &encrypted);
+    /* emulation prevention bytes are only added to encrypted slices */
+    fail_unless (gst_buffer_get_size (encrypted) >=
+        gst_buffer_get_size (clear));
+    check_decrypted (h, clear, encrypted);
+  }
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_audio)
+{
+  GstBuffer *clear, *encrypted;
+  GstHarness *h;
+
+  h = setup_harness ("audio/mpeg, mpegversion=(int)4, "
+      "stream-format=(string)adts");
+  create_adts_frames (&clear, &encrypted);
+  check_decrypted (h, clear, encrypted);
+  gst_harness_teardown (h);
+
+  h = setup_harness ("audio/x-ac3");
+  create_ac3_frame (&clear, &encrypted);
+  check_decrypted (h, clear, encrypted);
+  gst_harness_teardown (h);
+}
+
+GST_END_TEST;
+
+GST_START_TEST (test_key_uri)
+{
+  GstBuffer *clear, *encrypted;
+  GstHarness *h;
+
+  setup_key_dir ();
+  h = gst_harness_new ("hlssampleaesdec");
+  g_object_set (h->element, "key-directory", key_dir, "key-uri",
+      TEST_KEY_URI, "iv", TEST_IV, NULL);
+  gst_harness_set_src_caps_str (h, "audio/mpeg, mpegversion=(int)2, "
+      "stream-format=(string)adts");
+  create_adts_frames (&clear, &encrypted);
+  check_decrypted (h, clear, encrypted);
+
+  /* a key URI that is not in the key store stops the stream */
+  g_object_set (h->element, "key-uri", "skd://example.com/key?id=2", NULL);
+  create_adts_frames (&clear, &encrypted);
+  gst_buffer_unref (clear);
+  fail_unless_equals_int (gst_harness_push (h, encrypted),
+      GST_FLOW_NOT_SUPPORTED);
+  gst_harness_teardown (h);
+  teardown_key_dir ();
+}
+
+GST_END_TEST;
+
+static Suite *
+hlssampleaesdec_suite (void)
+{
+  Suite *s = suite_create ("hlssampleaesdec");
+  TCase *tc_chain = tcase_create ("general");
+
+  suite_add_tcase (s, tc_chain);
+  tcase_add_test (tc_chain, test_h264);
+  tcase_add_test (tc_chain, test_audio);
+  tcase_add_test (tc_chain, test_key_uri);
+
+  return s;
+}
+
+int
+main (int argc, char **argv)
+{
+  int nf;
+
+  Suite *s = hlssampleaesdec_suite ();
+  SRunner *sr = srunner_create (s);
+
+  gst_check_init (&argc, &argv);
+
+  srunner_run_all (sr, CK_NORMAL);
+  nf = srunner_ntests_failed (sr);
+  srunner_free (sr);
+
+  return nf;
+}
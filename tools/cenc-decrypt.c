@@ -0,0 +1,403 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+  cenc-decrypt: decrypt fragmented MP4 files that use the 'cenc' Common
+  Encryption scheme, without a GStreamer pipeline.
+
+  Each file is memory mapped and its mdat boxes are decrypted in place,
+  after copying it to the output directory unless --in-place is given.
+  The fragments of all the files are decrypted in parallel by a pool of
+  worker threads. Keys are read from the same key store as cencdec uses.
+
+  The protection boxes are replaced with free boxes and the sample entries
+  get back their original format, so the output is a normal unencrypted
+  fragmented MP4 file. A fragment is only marked as clear once all of its
+  samples have been decrypted, and the moov box once every fragment of the
+  file has been, so a file that fails is never left marked as clear while
+  it still holds ciphertext. Every key that the moov box refers to is
+  loaded before any fragment is touched.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <gst/gst.h>
+#include <gst/gstaesctr.h>
+#include <gst/gstcenckeystore.h>
+#include <gst/gstcencmp4.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+
+/* a memory mapped file, shared by the jobs that decrypt its fragments */
+typedef struct
+{
+  gchar *path;
+  guint8 *data;
+  gsize size;
+  GstCencMp4Movie movie;
+  gsize moov_offset;            /* of the moov payload */
+  gsize moov_size;
+  volatile gint refcount;
+  volatile gint failed;
+} CencFile;
+
+typedef struct
+{
+  CencFile *file;
+  GstCencMp4Fragment fragment;
+} CencJob;
+
+static gchar *key_directory = NULL;
+static gchar *output_directory = NULL;
+static gboolean in_place = FALSE;
+static gboolean marlin = FALSE;
+static gint n_threads = 0;
+static gboolean verbose = FALSE;
+
+/* keys that have been loaded from the key store, by hex KID */
+static GHashTable *keys;
+static GMutex keys_lock;
+
+static volatile gint n_failed = 0;
+
+static GOptionEntry options[] = {
+  {"key-directory", 'k', 0, G_OPTION_ARG_FILENAME, &key_directory,
+      "Directory that contains the key files (default /tmp)", "DIR"},
+  {"output-directory", 'o', 0, G_OPTION_ARG_FILENAME, &output_directory,
+      "Directory to write the decrypted files to", "DIR"},
+  {"in-place", 'i', 0, G_OPTION_ARG_NONE, &in_place,
+      "Decrypt the input files in place", NULL},
+  {"marlin", 'm', 0, G_OPTION_ARG_NONE, &marlin,
+      "Use Marlin key file names", NULL},
+  {"threads", 'j', 0, G_OPTION_ARG_INT, &n_threads,
+      "Number of worker threads (default: number of processors)", "N"},
+  {"verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose,
+      "Print the progress of every file", NULL},
+  {NULL}
+};
+
+static void
+cenc_file_unref (CencFile * file)
+{
+  if (!g_atomic_int_dec_and_test (&file->refcount))
+    return;
+  /* every fragment has been decrypted */
+  if (file->moov_size && !g_atomic_int_get (&file->failed))
+    gst_cenc_mp4_movie_clear_protection (file->data + file->moov_offset,
+        file->moov_size);
+  if (file->data)
+    munmap (file->data, file->size);
+  gst_cenc_mp4_movie_clear (&file->movie);
+  if (g_atomic_int_get (&file->failed)) {
+    g_printerr ("%s: decryption failed\n", file->path);
+    g_atomic_int_inc (&n_failed);
+  } else if (verbose) {
+    g_print ("%s: decrypted\n", file->path);
+  }
+  g_free (file->path);
+  g_free (file);
+}
+
+static GBytes *
+cenc_get_key (const guint8 * kid)
+{
+  GError *err = NULL;
+  GBytes *key;
+  gchar *name;
+  guint i;
+
+  name = g_malloc (2 * GST_CENC_KID_LENGTH + 1);
+  for (i = 0; i < GST_CENC_KID_LENGTH; ++i) {
+    g_snprintf (name + (2 * i), 3, "%02x", kid[i]);
+  }
+  g_mutex_lock (&keys_lock);
+  key = g_hash_table_lookup (keys, name);
+  if (!key) {
+    key = gst_cenc_key_store_load (key_directory, kid,
+        marlin ? GST_CENC_KEY_NAMING_MARLIN : GST_CENC_KEY_NAMING_CLEARKEY,
+        &err);
+    if (key) {
+      g_hash_table_insert (keys, name, key);
+      name = NULL;
+    } else {
+      g_printerr ("Failed to load key for KID %s: %s\n", name, err->message);
+      g_clear_error (&err);
+    }
+  }
+  if (key)
+    g_bytes_ref (key);
+  g_mutex_unlock (&keys_lock);
+  g_free (name);
+
+  return key;
+}
+
+/* Loads the key of every protected track of a movie into the cache, so
+   that a missing key is found before any fragment is decrypted */
+static gboolean
+cenc_load_keys (const GstCencMp4Movie * movie)
+{
+  guint i;
+
+  for (i = 0; i < movie->tracks->len; ++i) {
+    const GstCencMp4Track *track = &g_array_index (movie->tracks,
+        GstCencMp4Track, i);
+    GBytes *key;
+
+    if (!track->is_protected)
+      continue;
+    key = cenc_get_key (track->kid);
+    if (!key)
+      return FALSE;
+    g_bytes_unref (key);
+  }
+  return TRUE;
+}
+
+/* worker thread function that decrypts one fragment */
+static void
+cenc_job_run (gpointer data, gpointer user_data)
+{
+  CencJob *job = data;
+  GstCencMp4Fragment *fragment = &job->fragment;
+  const GstCencMp4Track *track = NULL;
+  AesCtrState *state = NULL;
+  gboolean ok;
+  guint i;
+
+  /* the fragments of a file that has already failed are left encrypted,
+     but one that has started is not stopped part way by another failing */
+  ok = !g_atomic_int_get (&job->file->failed);
+  for (i = 0; ok && i < fragment->samples->len; ++i) {
+    const GstCencMp4Sample *sample = &g_array_index (fragment->samples,
+        GstCencMp4Sample, i);
+
+    /* usually every sample of a fragment uses the same key */
+    if (sample->track != track) {
+      GBytes *key, *iv;
+
+      if (state)
+        gst_aes_ctr_decrypt_unref (state);
+      state = NULL;
+      track = sample->track;
+      key = cenc_get_key (track->kid);
+      if (key) {
+        iv = g_bytes_new (sample->iv, track->iv_size);
+        state = gst_aes_ctr_decrypt_new (key, iv);
+        g_bytes_unref (iv);
+        g_bytes_unref (key);
+      }
+      ok = state != NULL;
+    }
+    if (ok && !gst_cenc_mp4_sample_decrypt (state, job->file->data,
+            fragment, sample)) {
+      g_printerr ("%s: invalid subsamples in fragment at offset %"
+          G_GSIZE_FORMAT "\n", job->file->path, fragment->offset);
+      ok = FALSE;
+    }
+  }
+  if (state)
+    gst_aes_ctr_decrypt_unref (state);
+  if (ok)
+    gst_cenc_mp4_fragment_clear_protection (job->file->data, fragment);
+  else
+    g_atomic_int_set (&job->file->failed, TRUE);
+
+  gst_cenc_mp4_fragment_clear (fragment);
+  cenc_file_unref (job->file);
+  g_free (job);
+}
+
+static gboolean
+cenc_copy_file (const gchar * from, const gchar * to)
+{
+  GMappedFile *mapped;
+  GError *err = NULL;
+  gboolean ret;
+
+  mapped = g_mapped_file_new (from, FALSE, &err);
+  if (!mapped) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+  ret = g_file_set_contents (to, g_mapped_file_get_contents (mapped),
+      g_mapped_file_get_length (mapped), &err);
+  if (!ret) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+  }
+  g_mapped_file_unref (mapped);
+  return ret;
+}
+
+/* Map a file and queue the decryption of each of its fragments */
+static void
+cenc_process_file (GThreadPool * pool, const gchar * input)
+{
+  CencFile *file;
+  gsize offset = 0, header_size, box_size;
+  guint32 type;
+  gboolean have_movie = FALSE;
+  struct stat st;
+  gint fd;
+
+  file = g_new0 (CencFile, 1);
+  file->refcount = 1;
+  gst_cenc_mp4_movie_init (&file->movie);
+  if (in_place) {
+    file->path = g_strdup (input);
+  } else {
+    gchar *basename = g_path_get_basename (input);
+
+    file->path = g_build_filename (output_directory, basename, NULL);
+    g_free (basename);
+    if (!cenc_copy_file (input, file->path)) {
+      g_atomic_int_set (&file->failed, TRUE);
+      cenc_file_unref (file);
+      return;
+    }
+  }
+
+  fd = g_open (file->path, O_RDWR, 0);
+  if (fd < 0 || fstat (fd, &st) < 0) {
+    g_printerr ("%s: %s\n", file->path, g_strerror (errno));
+    if (fd >= 0)
+      close (fd);
+    g_atomic_int_set (&file->failed, TRUE);
+    cenc_file_unref (file);
+    return;
+  }
+  file->size = st.st_size;
+  file->data = mmap (NULL, file->size, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+  close (fd);
+  if (file->data == MAP_FAILED) {
+    g_printerr ("%s: %s\n", file->path, g_strerror (errno));
+    file->data = NULL;
+    g_atomic_int_set (&file->failed, TRUE);
+    cenc_file_unref (file);
+    return;
+  }
+
+  while (!g_atomic_int_get (&file->failed)
+      && gst_cenc_mp4_next_box (file->data, file->size, offset, &type,
+          &header_size, &box_size)) {
+    if (type == GST_CENC_MP4_FOURCC ('m', 'o', 'o', 'v')) {
+      have_movie = gst_cenc_mp4_movie_parse (&file->movie,
+          file->data + offset + header_size, box_size - header_size);
+      if (!have_movie) {
+        g_printerr ("%s: no supported protected tracks\n", file->path);
+        g_atomic_int_set (&file->failed, TRUE);
+        break;
+      }
+      if (!cenc_load_keys (&file->movie)) {
+        g_atomic_int_set (&file->failed, TRUE);
+        break;
+      }
+      file->moov_offset = offset + header_size;
+      file->moov_size = box_size - header_size;
+    } else if (type == GST_CENC_MP4_FOURCC ('m', 'o', 'o', 'f')) {
+      CencJob *job = g_new0 (CencJob, 1);
+
+      gst_cenc_mp4_fragment_init (&job->fragment);
+      if (!have_movie || !gst_cenc_mp4_fragment_parse (&job->fragment,
+              &file->movie, file->data, file->size, offset)) {
+        g_printerr ("%s: failed to parse fragment at offset %" G_GSIZE_FORMAT
+            "\n", file->path, offset);
+        g_atomic_int_set (&file->failed, TRUE);
+        gst_cenc_mp4_fragment_clear (&job->fragment);
+        g_free (job);
+        break;
+      }
+      g_atomic_int_inc (&file->refcount);
+      job->file = file;
+      g_thread_pool_push (pool, job, NULL);
+    }
+    offset += box_size;
+  }
+  if (!have_movie && !g_atomic_int_get (&file->failed)) {
+    g_printerr ("%s: no moov box\n", file->path);
+    g_atomic_int_set (&file->failed, TRUE);
+  }
+
+  /* the moov box is cleared by the last reference, once all the jobs of
+     the file have finished */
+  cenc_file_unref (file);
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GThreadPool *pool;
+  GError *err = NULL;
+  gint i;
+
+  ctx = g_option_context_new ("FILE... - decrypt CENC fragmented MP4 files");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  if (argc < 2 || in_place == (output_directory != NULL)) {
+    g_printerr ("Usage: %s (--in-place | --output-directory DIR) FILE...\n",
+        argv[0]);
+    return 1;
+  }
+  if (!key_directory)
+    key_directory = g_strdup ("/tmp");
+  if (n_threads <= 0)
+    n_threads = g_get_num_processors ();
+
+  keys = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+      (GDestroyNotify) g_bytes_unref);
+  pool = g_thread_pool_new (cenc_job_run, NULL, n_threads, TRUE, &err);
+  if (!pool) {
+    g_printerr ("Failed to start threads: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+
+  for (i = 1; i < argc; ++i) {
+    cenc_process_file (pool, argv[i]);
+  }
+  /* wait for all the fragments to be decrypted */
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  g_hash_table_unref (keys);
+  g_free (key_directory);
+  g_free (output_directory);
+
+  return g_atomic_int_get (&n_failed) ? 1 : 0;
+}
@@ -0,0 +1,137 @@
+/* GStreamer ISO MPEG DASH common encryption decryptor
+ * Copyright (C) 2013 YouView TV Ltd. <alex.ashley@youview.com>
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+ * Boston, MA 02110-1335, USA.
+ */
+
+/*
+  cenc-decryptd: a local decryption service for cencdec.
+
+  The service holds all the keys and AES state of the host, so that the
+  pipelines that use cencdec with decrypt-service set never see a key.
+  Each pipeline connects over the local socket and hands over a shared
+  memory ring, and the service decrypts the samples of each batch in place
+  in that memory. Keys are read from the key directory the first time that
+  a KID is asked for, using the ClearKey or Marlin file names written by
+  store-key.py.
+
+  The service can be pinned to one CPU, to keep the AES work of every
+  pipeline off the CPUs that they run on.
+
+  Only pipelines that run as the user or the group of the service can
+  connect to it, and the socket is made in the private runtime directory
+  of the user unless --socket is given.
+*/
+
+#define _GNU_SOURCE
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/prctl.h>
+
+#include <gst/gst.h>
+#include <gst/gstcencservice.h>
+
+#include <glib.h>
+#include <glib-unix.h>
+
+static gchar *socket_path = NULL;
+static gchar *key_directory = NULL;
+static gint cpu = -1;
+
+static GOptionEntry options[] = {
+  {"socket", 's', 0, G_OPTION_ARG_FILENAME, &socket_path,
+      "Path of the socket to listen on "
+        "(default $XDG_RUNTIME_DIR/cenc-decryptd.sock)", "PATH"},
+  {"key-directory", 'k', 0, G_OPTION_ARG_FILENAME, &key_directory,
+      "Directory that contains the key files (default /tmp)", "DIR"},
+  {"cpu", 'c', 0, G_OPTION_ARG_INT, &cpu,
+      "CPU to run on (default: any)", "N"},
+  {NULL}
+};
+
+static gboolean
+cenc_decryptd_quit (gpointer user_data)
+{
+  g_main_loop_quit ((GMainLoop *) user_data);
+  return G_SOURCE_REMOVE;
+}
+
+int
+main (int argc, char **argv)
+{
+  GOptionContext *ctx;
+  GstCencService *service;
+  GMainLoop *loop;
+  GError *err = NULL;
+
+  ctx = g_option_context_new ("- decrypt samples for cencdec elements");
+  g_option_context_add_main_entries (ctx, options, NULL);
+  g_option_context_add_group (ctx, gst_init_get_option_group ());
+  if (!g_option_context_parse (ctx, &argc, &argv, &err)) {
+    g_printerr ("Error initializing: %s\n", err->message);
+    g_clear_error (&err);
+    g_option_context_free (ctx);
+    return 1;
+  }
+  g_option_context_free (ctx);
+  /* the runtime directory is private to the user */
+  if (!socket_path)
+    socket_path = g_build_filename (g_get_user_runtime_dir (),
+        "cenc-decryptd.sock", NULL);
+  if (!key_directory)
+    key_directory = g_strdup ("/tmp");
+
+  /* the threads of the service inherit the affinity */
+  if (cpu >= 0) {
+    cpu_set_t set;
+
+    CPU_ZERO (&set);
+    CPU_SET (cpu, &set);
+    if (sched_setaffinity (0, sizeof (set), &set) < 0) {
+      g_printerr ("Failed to pin to CPU %d: %s\n", cpu, g_strerror (errno));
+      return 1;
+    }
+  }
+  /* keep the keys out of core dumps, and away from debuggers that are not
+     root */
+  prctl (PR_SET_DUMPABLE, 0, 0, 0, 0);
+
+  service = gst_cenc_service_new (socket_path, key_directory, &err);
+  if (!service) {
+    g_printerr ("Failed to start the service: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+  g_print ("Listening on %s\n", socket_path);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  g_unix_signal_add (SIGINT, cenc_decryptd_quit, loop);
+  g_unix_signal_add (SIGTERM, cenc_decryptd_quit, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+
+  gst_cenc_service_free (service);
+  g_free (socket_path);
+  g_free (key_directory);
+
+  return 0;
+}